@@ -1,7 +1,11 @@
 #include "ast.h"
 #include "lex.h"
+#include "symbols.h"
 #include "debug.h"
 #include <stdlib.h>
+#include <string.h> // memmove
+#include <atomic>
+#include <thread>
 
 // STAGE 5 grammar from: https://norasandler.com/2018/01/08/Write-a-Compiler-5.html
 // Updates from other stages including: https://norasandler.com/2018/03/14/Write-a-Compiler-7.html
@@ -36,48 +40,127 @@
 // GENERAL RULE FOR FUNCTIONS BELOW: update io_tokens only if succesfully parsed
 //    - This makes it easier to move the instruction pointer during debugging and it should allow for simpler function call structure
 // GENERAL RULE FOR FUNCTIONS BELOW: assume there's at least one item in the token stream
+// GENERAL RULE FOR FUNCTIONS BELOW: pick the production from the next token (or the few after it), never by trying
+//    one and falling back to another. Every token is advanced over exactly once, see ASTOut::tokens_visited.
 
 
-struct TokenStream
+// how tightly each operator from (16) to (5) above holds on to its operands, 0 for tokens that aren't one. Higher
+// numbers bind tighter, see parse_binary_expression.
+struct binding_powers
 {
-    const Token* next;
-    const Token* end;
+    uint8_t of[256]; // indexed by eToken
 };
 
+static constexpr binding_powers make_binding_powers()
+{
+    binding_powers p = {};
+    p.of[eToken::question_mark] = 1;         // (16) right associative
+    p.of[eToken::logical_or] = 2;            // (15)
+    p.of[eToken::logical_and] = 3;           // (14)
+    p.of[eToken::logical_equal] = 4;         // (10)
+    p.of[eToken::logical_not_equal] = 4;
+    p.of[eToken::less_than] = 5;             // ( 9)
+    p.of[eToken::greater_than] = 5;
+    p.of[eToken::less_than_or_equal] = 5;
+    p.of[eToken::greater_than_or_equal] = 5;
+    p.of[eToken::plus] = 6;                  // ( 6)
+    p.of[eToken::dash] = 6;
+    p.of[eToken::star] = 7;                  // ( 5)
+    p.of[eToken::forward_slash] = 7;
+    p.of[eToken::mod] = 7;
+    return p;
+}
+
+static constexpr binding_powers BINDING_POWER = make_binding_powers();
+static constexpr uint8_t BINDING_POWER_LOWEST = 1; // a whole <conditional-exp>
+static_assert(BINDING_POWER.of[eToken::star] > BINDING_POWER.of[eToken::plus], "binding powers out of order");
+
 struct ast_context
 {
     bool failure;
     eToken func_return_type; // used to verify return value of funcs
-    ASTNodeArray var_decl_stack; // fixup references
+    ASTArena* arena; // where the nodes go, see ASTOut
+    SymbolTable symbols; // names in scope at the current token, file scope is globals
+    uint32_t num_slots; // slots handed out in the current function
+    uint32_t num_temps; // and binop temporaries
+    uint32_t num_globals;
+    uint64_t* item_ends; // see ASTOut
+    uint64_t tokens_visited; // see ASTOut
+    const char* failure_location; // first error, see ASTOut
+    const char* failure_reason;
+    struct ASTLazy* lazy; // set by ast_lazy, function bodies are stepped over and recorded here
+    struct parse_frame* frames; // the parse stack for statements and expressions, see parse()
+    uint32_t num_frames;
+    uint32_t frames_capacity;
+    uint32_t deepest; // see ASTOut
+    bool quiet; // append_error doesn't debug_break, ast_parallel breaks once for the error it reports
+    bool quiet_break; // append_error would have, for the first error
+};
+
+static void free_context(ast_context* ctx)
+{
+    symbols_free(&ctx->symbols);
+    free(ctx->frames);
+}
+
+// where a pending body's function starts, and how much of the file it can see
+struct ast_lazy_body
+{
+    uint64_t start; // first token of the function
+    uint64_t open; // its {, the signature before it was parsed already
+    uint32_t num_globals; // of ASTLazy::globals declared before it
+};
+
+struct ASTLazy
+{
+    TokenStream tokens;
+    ast_lazy_body* bodies; // indexed by a pending fdef's lazy_body
+    uint32_t num_bodies;
+    ASTNode** globals; // every global declaration, in source order
+    uint32_t num_globals;
+    SymbolTable functions; // name -> the first fdef with that name, for ast_materialize_reachable
 };
 
+// a[count - 1] = value, growing a whenever count reaches a power of two
+template<typename T>
+static void push_lazy(T** a, uint32_t* count, const T& value)
+{
+    if ((*count & (*count - 1)) == 0)
+    {
+        *a = (T*)realloc(*a, sizeof(T) * (*count ? *count * 2 : 1));
+        assert(*a);
+    }
+    (*a)[(*count)++] = value;
+}
+
 static ASTNode* parse_program(TokenStream& io_tokens, ast_context* ctx);
+static ASTNode* parse_top_level_item(TokenStream& io_tokens, ast_context* ctx);
 static ASTNode* parse_function(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_function_call(TokenStream& io_tokens, ast_context* ctx);
 static ASTNode* parse_block_item(TokenStream& io_tokens, ast_context* ctx);
 static ASTNode* parse_declaration(TokenStream& io_tokens, ast_context* ctx);
 static ASTNode* parse_declaration_with_semicolon(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_statement(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_expression(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_conditional_exp(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_logical_or_expression(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_logical_and_expression(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_equality_expression(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_relational_expression(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_additive_expression(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_term(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_factor(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_for_loop(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_while_loop(TokenStream& io_tokens, ast_context* ctx);
-static ASTNode* parse_do_while_loop(TokenStream& io_tokens, ast_context* ctx);
 
 static bool expect_and_advance(TokenStream& io_tokens, eToken expected_token, ast_context* ctx);
-static void append_error(ast_context* ctx, const Token* token, const char* reason);
+static void advance(TokenStream& io_tokens, ast_context* ctx, uint64_t n = 1);
+static void append_error(ast_context* ctx, str_slice location, const char* reason);
+static void resolve_declaration(ast_context* ctx, ASTNode* decl);
+static void resolve_usage(ast_context* ctx, ASTNode* n);
+
+// item_ends[num_items - 1] = end, growing it whenever num_items reaches a power of two
+static void push_item_end(ast_context* ctx, uint32_t num_items, uint64_t end)
+{
+    if ((num_items & (num_items - 1)) == 0)
+    {
+        ctx->item_ends = (uint64_t*)realloc(ctx->item_ends, sizeof(uint64_t) * num_items * 2);
+        assert(ctx->item_ends);
+    }
+    ctx->item_ends[num_items - 1] = end;
+}
 
 ASTNode* parse_program(TokenStream& io_tokens, ast_context* ctx)
 {
     // <program> ::= { <function> | <declaration> }
-    if (io_tokens.next == io_tokens.end)
+    if (io_tokens.at_end())
     {
         debug_break();
         return NULL;
@@ -87,35 +170,52 @@ ASTNode* parse_program(TokenStream& io_tokens, ast_context* ctx)
     ASTNode n = {};
     n.type = AST_program;
 
-    while (tokens.next != tokens.end)
+    while (!tokens.at_end())
     {
-        if (ASTNode* f = parse_function(tokens, ctx))
-        {
-            astn_push(&n.program, f);
-            continue;
-        }
-        if (ASTNode* d = parse_declaration_with_semicolon(tokens, ctx))
-        {
-            astn_push(&n.program, d);
-            continue;
-        }
-        break;
+        ASTNode* item = parse_top_level_item(tokens, ctx);
+        if (!item)
+            break;
+        astn_push(ctx->arena, &n.program, item);
+        push_item_end(ctx, n.program.size, tokens.pos);
     }
 
     // success if we parsed all tokens
-    if (tokens.next == tokens.end)
+    if (tokens.at_end())
     {
         io_tokens = tokens;
-        return new ASTNode(n);
+        return ast_new(ctx->arena, n);
     }
 
+    // nothing more specific was reported, point at the item that didn't parse
+    if (!ctx->failure_reason)
+    {
+        ctx->failure_location = tokens.peek().location.start;
+        ctx->failure_reason = "couldn't parse function or declaration";
+    }
     return NULL;
 }
 
+ASTNode* parse_top_level_item(TokenStream& io_tokens, ast_context* ctx)
+{
+    // every item numbers its slots from 0, a global's initializer temporaries too
+    ctx->num_slots = 0;
+    ctx->num_temps = 0;
+
+    // both start with a type and a name, a ( after them makes it a function
+    if (io_tokens.type(2) == eToken::open_parens)
+    {
+        symbols_push_scope(&ctx->symbols); // params and locals
+        ASTNode* n = parse_function(io_tokens, ctx);
+        symbols_pop_scope(&ctx->symbols); // only globals are visible to the next function
+        return n;
+    }
+    return parse_declaration_with_semicolon(io_tokens, ctx);
+}
+
 ASTNode* parse_function(TokenStream& io_tokens, ast_context* ctx)
 {
     // <function> :: = "int" <id> "("["int" <id> { "," "int" <id> }] ")" ("{" { <block - item> } "}" | ";")
-    assert(io_tokens.next != io_tokens.end);
+    assert(!io_tokens.at_end());
     TokenStream tokens = io_tokens;
 
     str func_name;
@@ -123,31 +223,31 @@ ASTNode* parse_function(TokenStream& io_tokens, ast_context* ctx)
 
     // int or void
     eToken func_return_type = eToken::UNKNOWN;
-    if (tokens.next->type != eToken::keyword_int && tokens.next->type != eToken::keyword_void)
+    if (tokens.type() != eToken::keyword_int && tokens.type() != eToken::keyword_void)
     {
-        append_error(ctx, tokens.next, "expected int or void at start of function");
+        append_error(ctx, tokens.peek().location, "expected int or void at start of function");
         return NULL;
     }
-    ctx->func_return_type = func_return_type = tokens.next->type;
-    ++tokens.next;
-    if (tokens.next == tokens.end)
+    ctx->func_return_type = func_return_type = tokens.type();
+    advance(tokens, ctx);
+    if (tokens.at_end())
         return NULL;
 
     // identifier
-    func_name = tokens.next->identifier;
-    if (tokens.next->type != eToken::identifier)
+    func_name = tokens.peek().identifier;
+    if (tokens.type() != eToken::identifier)
         return NULL;
-    ++tokens.next;
-    if (tokens.next == tokens.end)
+    advance(tokens, ctx);
+    if (tokens.at_end())
         return NULL;
 
     // (
-    if (tokens.next->type != eToken::open_parens)
+    if (tokens.type() != eToken::open_parens)
         return NULL;
     if (!expect_and_advance(tokens, eToken::open_parens, ctx)) return NULL;
 
     // params
-    while (tokens.next != tokens.end)
+    while (!tokens.at_end())
     {
         ASTNode* decl = parse_declaration(tokens, ctx);
         if (!decl) break;
@@ -156,41 +256,70 @@ ASTNode* parse_function(TokenStream& io_tokens, ast_context* ctx)
             debug_break();
             return NULL;
         }
-        astn_push(&func_params, decl);
+        astn_push(ctx->arena, &func_params, decl);
 
         // TODO SUPPORT MORE
         if (func_params.size >= 4)
         {
-            append_error(ctx, tokens.next, "we only support 4 params when calling functions. TODO.");
+            append_error(ctx, tokens.peek().location, "we only support 4 params when calling functions. TODO.");
             return NULL;
         }
 
-        if (tokens.next == tokens.end)
+        if (tokens.at_end())
         {
-            append_error(ctx, tokens.next, "out of tokens while parsing params");
+            append_error(ctx, tokens.peek().location, "out of tokens while parsing params");
             return NULL;
         }
 
-        if (tokens.next->type == eToken::comma)
-            ++tokens.next;
+        if (tokens.type() == eToken::comma)
+            advance(tokens, ctx);
     }
 
     // )
     if (!expect_and_advance(tokens, eToken::closed_parens, ctx)) return NULL;
 
     // either end with ; or we get a func body
-    if (tokens.next == tokens.end)
+    if (tokens.at_end())
         return NULL;
-    if (tokens.next->type == eToken::semicolon)
+    if (tokens.type() == eToken::semicolon)
     {
-        ++tokens.next;
+        advance(tokens, ctx);
+
+        // a declaration's params don't name any storage
+        for (uint32_t i = 0; i < func_params.size; ++i)
+        {
+            func_params.nodes[i]->var.var_decl = NULL;
+            func_params.nodes[i]->var.slot = 0;
+        }
 
         io_tokens = tokens;
-        ASTNode* n = new ASTNode;
-        n->type = AST_fdecl;
-        n->fdecl.name = func_name;
-        n->fdecl.params = func_params;
-        return n;
+        ASTNode n = {};
+        n.type = AST_fdecl;
+        n.fdecl.name = func_name;
+        n.fdecl.params = func_params;
+        return ast_new(ctx->arena, n);
+    }
+
+    // ast_lazy: step over the body, ast_materialize parses the whole function again when it's needed
+    if (ctx->lazy && tokens.matches && tokens.type() == eToken::open_curly)
+    {
+        ASTLazy* lazy = ctx->lazy;
+        ast_lazy_body body = { io_tokens.pos, tokens.pos, lazy->num_globals };
+        tokens.skip_group(); // not visited, ast_materialize counts them
+        io_tokens = tokens;
+
+        ASTNode n = {};
+        n.type = AST_fdef;
+        n.fdef.name = func_name;
+        n.fdef.return_type = func_return_type;
+        n.fdef.params = func_params;
+        n.fdef.body_pending = true;
+        n.fdef.lazy_body = lazy->num_bodies;
+        push_lazy(&lazy->bodies, &lazy->num_bodies, body);
+        ASTNode* fdef = ast_new(ctx->arena, n);
+        if (!symbols_find(&lazy->functions, func_name))
+            symbols_bind(&lazy->functions, func_name, fdef);
+        return fdef;
     }
 
     // func body! {
@@ -198,7 +327,7 @@ ASTNode* parse_function(TokenStream& io_tokens, ast_context* ctx)
 
     // body
     ASTNodeArray func_body = {};
-    while (tokens.next != tokens.end)
+    while (!tokens.at_end())
     {
         ASTNode* bi = parse_block_item(tokens, ctx);
         if (!bi)
@@ -209,145 +338,274 @@ ASTNode* parse_function(TokenStream& io_tokens, ast_context* ctx)
             break;
         }
 
-        astn_push(&func_body, bi);
+        astn_push(ctx->arena, &func_body, bi);
     }
 
     // }
     if (!expect_and_advance(tokens, eToken::closed_curly, ctx)) return NULL;
 
     io_tokens = tokens;
-    ASTNode* n = new ASTNode;
-    n->type = AST_fdef;
-    n->fdef.name = func_name;
-    n->fdef.return_type = func_return_type;
-    n->fdef.params = func_params;
-    n->fdef.body = func_body;
-    return n;
+    ASTNode n = {};
+    n.type = AST_fdef;
+    n.fdef.name = func_name;
+    n.fdef.return_type = func_return_type;
+    n.fdef.params = func_params;
+    n.fdef.body = func_body;
+    n.fdef.num_slots = ctx->num_slots;
+    n.fdef.num_temps = ctx->num_temps;
+    return ast_new(ctx->arena, n);
 }
 
-ASTNode* parse_function_call(TokenStream& io_tokens, ast_context* ctx)
+// Everything under <function> runs on one loop over a heap stack of parse_frames (ast_context::frames) instead of
+// functions calling each other, so nesting costs heap rather than C stack, and at most ast_max_depth() frames of it.
+// A frame is one production. It either finishes, popping itself and handing its node (NULL if it failed) to the
+// frame under it as result, or starts a child and sets step to where it picks up once the child is done. A frame
+// that fails puts the tokens back where it started. Some callers take a NULL without an error as "not one of
+// these" and carry on, so which failures report an error is exactly what it was with recursive functions.
+
+enum parse_kind : uint8_t
 {
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
+    PARSE_declaration, // arg is 1 if a ; ends it
+    PARSE_statement,
+    PARSE_for_loop, // the statement around it holds the scope for the init's declaration
+    PARSE_while_loop,
+    PARSE_do_while_loop,
+    PARSE_expression,
+    PARSE_binary_expression, // arg is min_power
+    PARSE_factor,
+    PARSE_function_call,
+};
 
-    if (tokens.next + 3 >= tokens.end) // id()
-        return NULL;
+// parse_frame::step, by kind
+enum : uint8_t
+{
+    STEP_enter = 0,
 
-    if (tokens.next[0].type != eToken::identifier ||
-        tokens.next[1].type != eToken::open_parens)
-        return NULL;
+    DECL_initializer = 1,
 
-    ASTNode n = {};
-    n.type = AST_fcall;
-    n.fcall.name = tokens.next->identifier;
-    
-    tokens.next += 2; // skip id and (
+    STMT_return = 1,
+    STMT_if_condition,
+    STMT_if_true,
+    STMT_if_false,
+    STMT_block_item,
+    STMT_for,
+    STMT_expression,
 
-    while (tokens.next != tokens.end)
-    {
-        ASTNode* arg = parse_expression(tokens, ctx);
-        if (!arg) break;
-        astn_push(&n.fcall.args, arg);
+    FOR_init_declaration = 1,
+    FOR_init_expression,
+    FOR_condition,
+    FOR_update,
+    FOR_body,
 
-        if (tokens.next != tokens.end &&
-            tokens.next->type == eToken::comma)
-            ++tokens.next;
-    }
+    LOOP_condition = 1,
+    LOOP_body,
 
-    if (!expect_and_advance(tokens, eToken::closed_parens, ctx)) return NULL;
+    EXP_assignment = 1,
 
-    io_tokens = tokens;
-    return new ASTNode(n);
+    BIN_left = 1,
+    BIN_right,
+    BIN_if_true,
+    BIN_if_false,
+
+    FACTOR_parens = 1,
+    FACTOR_unary,
+
+    CALL_argument = 1,
+};
+
+struct parse_frame
+{
+    parse_kind kind;
+    uint8_t step; // where to pick up when the child it started is done
+    uint8_t arg;
+    uint64_t start; // tokens.pos on entry, put back if the frame fails
+    ASTNode n; // being built
+};
+
+static uint32_t max_parse_depth = AST_DEFAULT_MAX_DEPTH;
+
+uint32_t ast_max_depth()
+{
+    return max_parse_depth;
 }
 
-ASTNode* parse_block_item(TokenStream& io_tokens, ast_context* ctx)
+void ast_set_max_depth(uint32_t max_frames)
 {
-    // <block-item> ::= <statement> | <declaration>
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
+    max_parse_depth = max_frames ? max_frames : AST_DEFAULT_MAX_DEPTH;
+}
 
-    ASTNode* n = parse_statement(tokens, ctx);
-    if (n)
-    {
-        io_tokens = tokens;
-        return n;
-    }
+static parse_frame& top_frame(ast_context* ctx)
+{
+    return ctx->frames[ctx->num_frames - 1];
+}
 
-    n = parse_declaration_with_semicolon(tokens, ctx);
-    if (n)
-    {
-        io_tokens = tokens;
-        return n;
-    }
+// the top frame is done, node goes to the frame under it
+static void finish_frame(ast_context* ctx, ASTNode* node, ASTNode** result)
+{
+    --ctx->num_frames;
+    *result = node;
+}
 
-    return NULL;
+static void fail_frame(ast_context* ctx, TokenStream& tokens, ASTNode** result)
+{
+    tokens.pos = top_frame(ctx).start;
+    --ctx->num_frames;
+    *result = NULL;
 }
 
-ASTNode* parse_declaration(TokenStream& io_tokens, ast_context* ctx)
+// <int> | <id>, the factors that don't nest
+static bool is_leaf(const TokenStream& tokens)
 {
-    // <declaration> ::= "int" <id> [ = <exp> ]
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
+    return tokens.type() == eToken::constant_number
+        || (tokens.type() == eToken::identifier && tokens.type(1) != eToken::open_parens);
+}
 
-    if (tokens.next->type == eToken::keyword_int)
+static ASTNode* parse_leaf(TokenStream& tokens, ast_context* ctx)
+{
+    ASTNode n = {};
+    if (tokens.type() == eToken::constant_number)
+    {
+        n.type = AST_num;
+        n.num.value = tokens.peek().number;
+    }
+    else
     {
-        ASTNode n = {};
         n.type = AST_var;
         n.var.var_decl = NULL;
-        n.var.is_variable_declaration = true;
+        n.var.is_variable_usage = true;
+        n.var.debug_location = tokens.peek().location;
+        n.var.name = tokens.peek().identifier;
+        resolve_usage(ctx, &n);
+    }
+    advance(tokens, ctx);
+    return ast_new(ctx->arena, n);
+}
 
-        ++tokens.next;
-        if (tokens.next == tokens.end)
-            return NULL;
+// Start kind at the current token. True if that pushed a frame: the caller returns and is picked up at the step it
+// set once the frame is done. False if result is already in: an operand that's a lone number or variable is
+// parsed right here (most of them are), and nothing starts at the end of the tokens or past ast_max_depth().
+static bool parse_call(ast_context* ctx, TokenStream& tokens, ASTNode** result, parse_kind kind, uint8_t arg = 0)
+{
+    if (tokens.at_end())
+    {
+        *result = NULL;
+        return false;
+    }
 
-        if (tokens.next->type != eToken::identifier)
+    // a lone operand is one that the next token can't take as its left side
+    if (kind >= PARSE_expression && kind <= PARSE_factor && is_leaf(tokens))
+    {
+        const eToken next = tokens.type(1);
+        const uint8_t min_power = kind == PARSE_expression ? BINDING_POWER_LOWEST : arg;
+        if (kind == PARSE_factor || (BINDING_POWER.of[next] < min_power && next != eToken::assignment))
         {
-            append_error(ctx, tokens.next, "expected identifier after variable type");
-            return NULL;
+            *result = parse_leaf(tokens, ctx);
+            return false;
         }
+    }
 
-        n.var.debug_token = tokens.next;
-        n.var.name = tokens.next->identifier;
-        ++tokens.next;
-
-        if (tokens.next == tokens.end)
-            return NULL;
-
-        if (tokens.next->type == eToken::assignment)
+    if (ctx->num_frames >= max_parse_depth)
+    {
+        // the input's fault rather than the parser's, so no debug_break like append_error
+        if (!ctx->failure_reason)
         {
-            n.var.is_variable_assignment = true;
-            ++tokens.next;
-
-            n.var.assign_expression = parse_expression(tokens, ctx);
-            if (!n.var.assign_expression)
-            {
-                append_error(ctx, tokens.next, "expected expression after =");
-                return NULL;
-            }
+            ctx->failure_location = tokens.peek().location.start;
+            ctx->failure_reason = "nested too deeply, see ast_set_max_depth";
         }
+        ctx->failure = true;
+        *result = NULL;
+        return false;
+    }
 
-        io_tokens = tokens;
-        return new ASTNode(n);
+    if (ctx->num_frames == ctx->frames_capacity)
+    {
+        ctx->frames_capacity = ctx->frames_capacity ? ctx->frames_capacity * 2 : 64;
+        ctx->frames = (parse_frame*)realloc(ctx->frames, sizeof(parse_frame) * ctx->frames_capacity);
+        assert(ctx->frames);
     }
+    parse_frame& f = ctx->frames[ctx->num_frames++];
+    f.kind = kind;
+    f.step = STEP_enter;
+    f.arg = arg;
+    f.start = tokens.pos;
+    f.n = {};
+    if (ctx->num_frames > ctx->deepest)
+        ctx->deepest = ctx->num_frames;
+    return true;
+}
 
-    return NULL;
+// <block-item> ::= <statement> | <declaration> ";"
+static bool parse_call_block_item(ast_context* ctx, TokenStream& tokens, ASTNode** result)
+{
+    // no statement starts with a type
+    if (tokens.type() == eToken::keyword_int)
+        return parse_call(ctx, tokens, result, PARSE_declaration, 1);
+    return parse_call(ctx, tokens, result, PARSE_statement);
 }
 
-ASTNode* parse_declaration_with_semicolon(TokenStream& io_tokens, ast_context* ctx)
+static void step_declaration(ast_context* ctx, TokenStream& tokens, ASTNode** result)
 {
-    // <declaration_with_semicolon> ::= <declaration> ";"
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
+    // <declaration> ::= "int" <id> [ = <exp> ]
+    parse_frame& f = top_frame(ctx);
+    if (f.step == STEP_enter)
+    {
+        if (tokens.type() != eToken::keyword_int)
+            return fail_frame(ctx, tokens, result);
 
-    ASTNode* decl = parse_declaration(tokens, ctx);
-    if (!decl) return NULL;
-    if (!expect_and_advance(tokens, eToken::semicolon, ctx)) return NULL;
+        f.n.type = AST_var;
+        f.n.var.var_decl = NULL;
+        f.n.var.is_variable_declaration = true;
 
-    io_tokens = tokens;
-    return decl;
+        advance(tokens, ctx);
+        if (tokens.at_end())
+            return fail_frame(ctx, tokens, result);
+
+        if (tokens.type() != eToken::identifier)
+        {
+            append_error(ctx, tokens.peek().location, "expected identifier after variable type");
+            return fail_frame(ctx, tokens, result);
+        }
+
+        f.n.var.debug_location = tokens.peek().location;
+        f.n.var.name = tokens.peek().identifier;
+        advance(tokens, ctx);
+
+        if (tokens.at_end())
+            return fail_frame(ctx, tokens, result);
+
+        // in scope from here on, its own initializer included
+        f.n.var.is_variable_assignment = tokens.type() == eToken::assignment;
+        ASTNode* decl = ast_new(ctx->arena, f.n);
+        resolve_declaration(ctx, decl);
+        f.n.var.var_decl = decl;
+
+        if (decl->var.is_variable_assignment)
+        {
+            advance(tokens, ctx);
+
+            f.step = DECL_initializer;
+            if (parse_call(ctx, tokens, result, PARSE_expression))
+                return;
+        }
+    }
+
+    ASTNode* decl = f.n.var.var_decl;
+    if (f.step == DECL_initializer)
+    {
+        decl->var.assign_expression = *result;
+        if (!decl->var.assign_expression)
+        {
+            append_error(ctx, tokens.peek().location, "expected expression after =");
+            return fail_frame(ctx, tokens, result);
+        }
+    }
+
+    if (f.arg && !expect_and_advance(tokens, eToken::semicolon, ctx))
+        return fail_frame(ctx, tokens, result);
+    finish_frame(ctx, decl, result);
 }
 
-ASTNode* parse_statement(TokenStream& io_tokens, ast_context* ctx)
+static void step_statement(ast_context* ctx, TokenStream& tokens, ASTNode** result)
 {
     // <statement> ::= "return" <exp> ";"
     //               | <exp> ";"
@@ -360,1114 +618,731 @@ ASTNode* parse_statement(TokenStream& io_tokens, ast_context* ctx)
     //               | "break" ";"
     //               | "continue" ";"
     //               | ";"
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream& tokens = io_tokens;
-
-    // return
-    if (tokens.next->type == eToken::keyword_return)
+    parse_frame& f = top_frame(ctx);
+    switch (f.step)
     {
-        ASTNode n = {};
-        n.type = AST_ret;
-
-        ++tokens.next;
-        if (tokens.next == tokens.end)
-            return NULL;
+    case STEP_enter:
+        break;
 
-        n.ret.expression = parse_expression(tokens, ctx);
+    case STMT_return:
+        f.n.ret.expression = *result;
         assert(ctx->func_return_type != eToken::UNKNOWN);
-        if (!n.ret.expression && ctx->func_return_type != eToken::keyword_void)
+        if (!f.n.ret.expression && ctx->func_return_type != eToken::keyword_void)
         {
-            append_error(ctx, tokens.next, "expected expression after return");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected expression after return");
+            return fail_frame(ctx, tokens, result);
         }
 
-        if (!expect_and_advance(tokens, eToken::semicolon, ctx)) return NULL;
-
-        io_tokens = tokens;
-        return new ASTNode(n);
-    }
+        if (!expect_and_advance(tokens, eToken::semicolon, ctx))
+            return fail_frame(ctx, tokens, result);
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
 
-    // expression
-    {
-        ASTNode* expr = parse_expression(tokens, ctx);
-        if (expr && tokens.next->type == eToken::semicolon)
+    case STMT_if_condition:
+        f.n.ifdef.condition = *result;
+        if (!f.n.ifdef.condition)
         {
-            ++tokens.next;
-
-            io_tokens = tokens;
-            return expr;
+            append_error(ctx, tokens.peek().location, "expected expression ater if");
+            return fail_frame(ctx, tokens, result);
         }
-    }
 
-    // if statement
-    if (tokens.next->type == eToken::keyword_if)
-    {
-        ASTNode n = {};
-        n.type = AST_if;
-
-        ++tokens.next;
+        // )
+        if (!expect_and_advance(tokens, eToken::closed_parens, ctx) || tokens.at_end())
+            return fail_frame(ctx, tokens, result);
 
-        // (
-        if (!expect_and_advance(tokens, eToken::open_parens, ctx)) return NULL;
-        if (tokens.next == tokens.end) return NULL;
+        f.step = STMT_if_true;
+        parse_call(ctx, tokens, result, PARSE_statement);
+        return;
 
-        n.ifdef.condition = parse_expression(tokens, ctx);
-        if (!n.ifdef.condition)
+    case STMT_if_true:
+        f.n.ifdef.if_true = *result;
+        if (!f.n.ifdef.if_true)
         {
-            append_error(ctx, tokens.next, "expected expression ater if");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected statement after if");
+            return fail_frame(ctx, tokens, result);
         }
 
-        // )
-        if (!expect_and_advance(tokens, eToken::closed_parens, ctx)) return NULL;
-        if (tokens.next == tokens.end) return NULL;
-
-        n.ifdef.if_true = parse_statement(tokens, ctx);
-        if (!n.ifdef.if_true)
+        if (!tokens.at_end() && tokens.type() == eToken::keyword_else)
         {
-            append_error(ctx, tokens.next, "expected statement after if");
-            return NULL;
+            advance(tokens, ctx);
+            if (tokens.at_end())
+                return fail_frame(ctx, tokens, result);
+
+            f.step = STMT_if_false;
+            parse_call(ctx, tokens, result, PARSE_statement);
+            return;
         }
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
 
-        if (tokens.next != tokens.end && tokens.next->type == eToken::keyword_else)
+    case STMT_if_false:
+        f.n.ifdef.if_false = *result;
+        if (!f.n.ifdef.if_false)
         {
-            ++tokens.next;
-            if (tokens.next == tokens.end) return NULL;
-
-            n.ifdef.if_false = parse_statement(tokens, ctx);
-            if (!n.ifdef.if_false)
-            {
-                append_error(ctx, tokens.next, "expected statement after else");
-                return NULL;
-            }
+            append_error(ctx, tokens.peek().location, "expected statement after else");
+            return fail_frame(ctx, tokens, result);
         }
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
 
-        io_tokens = tokens;
-        return new ASTNode(n);
-    }
-
-    // block list
-    if (tokens.next->type == eToken::open_curly)
-    {
-        ASTNode n = {};
-        n.type = AST_blocklist;
-        ++tokens.next;
-
-        while (tokens.next != tokens.end)
+    case STMT_block_item:
+        // NULL ends the block, whether it's the } or an error
+        if (*result)
         {
-            ASTNode* bi = parse_block_item(tokens, ctx);
-            if (!bi)
+            astn_push(ctx->arena, &f.n.blocklist, *result);
+            if (!tokens.at_end())
             {
-                //if (ctx->num_errors != 0)
-                if(ctx->failure)
-                    return NULL;
-                break;
+                parse_call_block_item(ctx, tokens, result);
+                return;
             }
-            astn_push(&n.blocklist, bi);
         }
+        symbols_pop_scope(&ctx->symbols); // its decls are out of scope now
 
+        if (ctx->failure)
+            return fail_frame(ctx, tokens, result);
         if (!expect_and_advance(tokens, eToken::closed_curly, ctx))
-            return NULL;
-
-        io_tokens = tokens;
-        return new ASTNode(n);
+            return fail_frame(ctx, tokens, result);
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
+
+    case STMT_for:
+        symbols_pop_scope(&ctx->symbols);
+        if (!*result)
+            return fail_frame(ctx, tokens, result);
+        return finish_frame(ctx, *result, result);
+
+    case STMT_expression:
+        if (!*result)
+            return fail_frame(ctx, tokens, result);
+        if (!expect_and_advance(tokens, eToken::semicolon, ctx))
+            return fail_frame(ctx, tokens, result);
+        return finish_frame(ctx, *result, result);
     }
 
-    // for
-    if (tokens.next->type == eToken::keyword_for)
+    switch (tokens.type())
     {
-        ASTNode* n = parse_for_loop(tokens, ctx);
-        if (!n)
-            return NULL;
-        io_tokens = tokens;
-        return n;
-    }
+    case eToken::keyword_return:
+        f.n.type = AST_ret;
+        advance(tokens, ctx);
+        if (tokens.at_end())
+            return fail_frame(ctx, tokens, result);
 
-    // while
-    if (tokens.next->type == eToken::keyword_while)
-    {
-        ASTNode* n = parse_while_loop(tokens, ctx);
-        if (!n)
-            return NULL;
-        io_tokens = tokens;
-        return n;
-    }
+        f.step = STMT_return;
+        parse_call(ctx, tokens, result, PARSE_expression);
+        return;
 
-    // do-while
-    if (tokens.next->type == eToken::keyword_do)
-    {
-        ASTNode* n = parse_do_while_loop(tokens, ctx);
-        if (!n)
-            return NULL;
-        io_tokens = tokens;
-        return n;
-    }
+    case eToken::keyword_if:
+        f.n.type = AST_if;
+        advance(tokens, ctx);
 
-    // break;
-    if (tokens.next->type == eToken::keyword_break)
-    {
-        ASTNode n = {};
-        n.type = AST_break;
-        ++tokens.next;
+        // (
+        if (!expect_and_advance(tokens, eToken::open_parens, ctx) || tokens.at_end())
+            return fail_frame(ctx, tokens, result);
 
-        if (tokens.next == tokens.end)
-            return NULL;
-        if (tokens.next->type != eToken::semicolon)
-        {
-            append_error(ctx, tokens.next, "expected ; after break/continue");
-            return NULL;
-        }
+        f.step = STMT_if_condition;
+        parse_call(ctx, tokens, result, PARSE_expression);
+        return;
 
-        ++tokens.next;
-        io_tokens = tokens;
-        return new ASTNode(n);
-    }
+    case eToken::open_curly:
+        f.n.type = AST_blocklist;
+        advance(tokens, ctx);
+        symbols_push_scope(&ctx->symbols);
 
-    // continue;
-    if (tokens.next->type == eToken::keyword_continue)
-    {
-        ASTNode n = {};
-        n.type = AST_continue;
-        ++tokens.next;
+        f.step = STMT_block_item;
+        if (!tokens.at_end())
+            parse_call_block_item(ctx, tokens, result);
+        else
+            *result = NULL;
+        return;
 
-        if (tokens.next == tokens.end)
-            return NULL;
-        if (tokens.next->type != eToken::semicolon)
+    case eToken::keyword_for:
+        symbols_push_scope(&ctx->symbols); // the init's decl
+        f.step = STMT_for;
+        parse_call(ctx, tokens, result, PARSE_for_loop);
+        return;
+
+    // the frame becomes the loop, it starts at the same token and returns the same node
+    case eToken::keyword_while:
+        f.kind = PARSE_while_loop;
+        return;
+    case eToken::keyword_do:
+        f.kind = PARSE_do_while_loop;
+        return;
+
+    case eToken::keyword_break:
+    case eToken::keyword_continue:
+        f.n.type = tokens.type() == eToken::keyword_break ? AST_break : AST_continue;
+        advance(tokens, ctx);
+
+        if (tokens.at_end())
+            return fail_frame(ctx, tokens, result);
+        if (tokens.type() != eToken::semicolon)
         {
-            append_error(ctx, tokens.next, "expected ; after break/continue");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected ; after break/continue");
+            return fail_frame(ctx, tokens, result);
         }
 
-        ++tokens.next;
-        io_tokens = tokens;
-        return new ASTNode(n);
-    }
+        advance(tokens, ctx);
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
 
     // empty statement
-    if (tokens.next->type == eToken::semicolon)
-    {
-        ASTNode n = {};
-        n.type = AST_empty;
-        ++tokens.next;
-
-        io_tokens = tokens;
-        return new ASTNode(n);
+    case eToken::semicolon:
+        f.n.type = AST_empty;
+        advance(tokens, ctx);
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
+
+    // none of the keywords above, so it's an expression. NULL without an error if it isn't one either, that's
+    // how a block finds its }
+    default:
+        f.step = STMT_expression;
+        parse_call(ctx, tokens, result, PARSE_expression);
+        return;
     }
-
-    return NULL;
 }
 
-ASTNode* parse_expression(TokenStream& io_tokens, ast_context* ctx)
+static void step_for_loop(ast_context* ctx, TokenStream& tokens, ASTNode** result)
 {
-    // <exp> ::= <id> "=" <exp> | <conditional-exp>
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
-
-    if (tokens.next + 2 < tokens.end
-        && tokens.next[0].type == eToken::identifier
-        && tokens.next[1].type == eToken::assignment)
+    // init, condition and update each either start a child or are empty, then the body. Each section starts once
+    // step is past the one before it.
+    parse_frame& f = top_frame(ctx);
+    switch (f.step)
     {
-        ASTNode n = {};
-        n.type = AST_var;
-        n.var.var_decl = NULL;
-        n.var.is_variable_assignment = true;
-        n.var.debug_token = tokens.next;
-        n.var.name = tokens.next->identifier;
+    case STEP_enter:
+        if (!tokens.has(7)) // 5 = "for(;;);" (min required tokens for for loop)
+            return fail_frame(ctx, tokens, result);
+
+        assert(tokens.type() == eToken::keyword_for);
+        advance(tokens, ctx);
+        f.n.type = AST_for;
 
-        tokens.next += 2; //skip id and assignment
+        if (!expect_and_advance(tokens, eToken::open_parens, ctx))
+            return fail_frame(ctx, tokens, result);
 
-        n.var.assign_expression = parse_expression(tokens, ctx);
-        if (!n.var.assign_expression)
+        // parse init
+        if (tokens.type() == eToken::semicolon)
         {
-            append_error(ctx, tokens.next, "expected expression after =");
-            return NULL;
+            advance(tokens, ctx);
         }
+        else if (tokens.type() == eToken::keyword_int)
+        {
+            f.step = FOR_init_declaration;
+            parse_call(ctx, tokens, result, PARSE_declaration, 1);
+            return;
+        }
+        else
+        {
+            f.step = FOR_init_expression;
+            parse_call(ctx, tokens, result, PARSE_expression);
+            return;
+        }
+        break;
 
-        io_tokens = tokens;
-        return new ASTNode(n);
-    }
-
-    ASTNode* n = parse_conditional_exp(tokens, ctx);
-    if (n)
-    {
-        io_tokens = tokens;
-        return n;
-    }
-
-    return NULL;
-}
-
-ASTNode* parse_conditional_exp(TokenStream& io_tokens, ast_context* ctx)
-{
-    // <conditional-exp> ::= <logical-or-exp> [ "?" <exp> ":" <conditional-exp> ]
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
+    case FOR_init_declaration:
+    case FOR_init_expression:
+        f.n.forloop.init = *result;
+        if (!f.n.forloop.init)
+        {
+            append_error(ctx, tokens.peek().location, "failed parsing init section of for loop");
+            return fail_frame(ctx, tokens, result);
+        }
+        if (f.step == FOR_init_expression && !expect_and_advance(tokens, eToken::semicolon, ctx))
+            return fail_frame(ctx, tokens, result);
+        break;
 
-    ASTNode* expr = parse_logical_or_expression(tokens, ctx);
-    if (!expr)
-        return NULL;
+    case FOR_condition:
+        f.n.forloop.condition = *result;
+        if (!f.n.forloop.condition)
+        {
+            append_error(ctx, tokens.peek().location, "failed parsing condition section of for loop");
+            return fail_frame(ctx, tokens, result);
+        }
+        if (!expect_and_advance(tokens, eToken::semicolon, ctx))
+            return fail_frame(ctx, tokens, result);
+        break;
 
-    if (tokens.next == tokens.end)
-        return NULL;
+    case FOR_update:
+        f.n.forloop.update = *result;
+        if (!f.n.forloop.update)
+        {
+            append_error(ctx, tokens.peek().location, "failed parsing update section of for loop");
+            return fail_frame(ctx, tokens, result);
+        }
+        if (!expect_and_advance(tokens, eToken::closed_parens, ctx))
+            return fail_frame(ctx, tokens, result);
+        break;
 
-    if (tokens.next->type != eToken::question_mark)
-    {
-        io_tokens = tokens;
-        return expr;
+    case FOR_body:
+        f.n.forloop.body = *result;
+        if (!f.n.forloop.body)
+        {
+            append_error(ctx, tokens.peek().location, "expected loop body after for loop");
+            return fail_frame(ctx, tokens, result);
+        }
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
     }
 
-    ASTNode n = {};
-    n.type = AST_terop;
-    n.terop.condition = expr;
-
-    if (!expect_and_advance(tokens, eToken::question_mark, ctx)) return NULL;
-
-    n.terop.if_true = parse_expression(tokens, ctx);
-    if (!n.terop.if_true)
+    // parse condition
+    if (f.step < FOR_condition)
     {
-        append_error(ctx, tokens.next, "expected expression after ?");
-        return NULL;
+        if (tokens.type() != eToken::semicolon)
+        {
+            f.step = FOR_condition;
+            parse_call(ctx, tokens, result, PARSE_expression);
+            return;
+        }
+        advance(tokens, ctx);
     }
 
-    if (!expect_and_advance(tokens, eToken::colon, ctx)) return NULL;
-
-    n.terop.if_false = parse_conditional_exp(tokens, ctx);
-    if (!n.terop.if_false)
+    // parse update
+    if (f.step < FOR_update)
     {
-        append_error(ctx, tokens.next, "expected conditional expression after :");
-        return NULL;
+        if (tokens.type() != eToken::closed_parens)
+        {
+            f.step = FOR_update;
+            parse_call(ctx, tokens, result, PARSE_expression);
+            return;
+        }
+        advance(tokens, ctx);
     }
 
-    io_tokens = tokens;
-    return new ASTNode(n);
+    // for loop body
+    f.step = FOR_body;
+    parse_call(ctx, tokens, result, PARSE_statement);
 }
 
-ASTNode* parse_logical_or_expression(TokenStream& io_tokens, ast_context* ctx)
+static void step_while_loop(ast_context* ctx, TokenStream& tokens, ASTNode** result)
 {
-    // <logical-or-exp> ::= <logical-and-exp> { "||" <logical-and-exp> }
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
-
-    ASTNode* left_node = parse_logical_and_expression(tokens, ctx);
-    if (!left_node)
-        return NULL;
-
-    if (tokens.next->type != eToken::logical_or)
+    parse_frame& f = top_frame(ctx);
+    switch (f.step)
     {
-        io_tokens = tokens;
-        return left_node;
-    }
+    case STEP_enter:
+        if (!tokens.has(5)) //X = while(...);
+            return fail_frame(ctx, tokens, result);
 
-    ASTNode op = {};
-    op.type = AST_binop;
+        assert(tokens.type() == eToken::keyword_while);
+        advance(tokens, ctx);
+        f.n.type = AST_while;
 
-    for (;;)
-    {
-        op.binop.op = tokens.next->type;
+        if (!expect_and_advance(tokens, eToken::open_parens, ctx))
+            return fail_frame(ctx, tokens, result);
 
-        ++tokens.next;
-        if (tokens.next == tokens.end)
-        {
-            append_error(ctx, tokens.next, "expected term after || but no more tokens");
-            return NULL;
-        }
+        f.step = LOOP_condition;
+        parse_call(ctx, tokens, result, PARSE_expression);
+        return;
 
-        ASTNode* right_node = parse_logical_and_expression(tokens, ctx);
-        if (!right_node)
+    case LOOP_condition:
+        f.n.whileloop.condition = *result;
+        if (!f.n.whileloop.condition)
         {
-            append_error(ctx, tokens.next, "expected term after ||");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected conditional expression inside while()");
+            return fail_frame(ctx, tokens, result);
         }
 
-        op.binop.left = left_node;
-        op.binop.right = right_node;
+        if (!expect_and_advance(tokens, eToken::closed_parens, ctx))
+            return fail_frame(ctx, tokens, result);
 
-        // Gross, but it works. We will wrap around, set our binary_op to next token type and
-        // use previous binop as term for next binop
-        if (tokens.next != tokens.end && (tokens.next->type == eToken::logical_or))
+        f.step = LOOP_body;
+        parse_call(ctx, tokens, result, PARSE_statement);
+        return;
+
+    case LOOP_body:
+        f.n.whileloop.body = *result;
+        if (!f.n.whileloop.body)
         {
-            left_node = new ASTNode(op);
-            continue;
+            append_error(ctx, tokens.peek().location, "expected body after while(...)");
+            return fail_frame(ctx, tokens, result);
         }
-
-        break;
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
     }
-
-    io_tokens = tokens;
-    return new ASTNode(op);
 }
 
-ASTNode* parse_logical_and_expression(TokenStream& io_tokens, ast_context* ctx)
+static void step_do_while_loop(ast_context* ctx, TokenStream& tokens, ASTNode** result)
 {
-    // <logical-and-exp> ::= <equality-exp> { "&&" <equality-exp> }
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
-
-    ASTNode* left_node = parse_equality_expression(tokens, ctx);
-    if (!left_node)
-        return NULL;
-
-    if (tokens.next->type != eToken::logical_and)
+    parse_frame& f = top_frame(ctx);
+    switch (f.step)
     {
-        io_tokens = tokens;
-        return left_node;
-    }
+    case STEP_enter:
+        if (!tokens.has(8)) //X = do{...}while(...);
+            return fail_frame(ctx, tokens, result);
 
-    ASTNode op = {};
-    op.type = AST_binop;
+        assert(tokens.type() == eToken::keyword_do);
+        advance(tokens, ctx);
+        f.n.type = AST_dowhile;
 
-    for (;;)
-    {
-        op.binop.op = tokens.next->type;
+        f.step = LOOP_body;
+        parse_call(ctx, tokens, result, PARSE_statement);
+        return;
 
-        ++tokens.next;
-        if (tokens.next == tokens.end)
+    case LOOP_body:
+        f.n.whileloop.body = *result;
+        if (!f.n.whileloop.body)
         {
-            append_error(ctx, tokens.next, "expected additive expression after && but no more tokens");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected loop body after do");
+            return fail_frame(ctx, tokens, result);
         }
 
-        ASTNode* right_node = parse_equality_expression(tokens, ctx);
-        if (!right_node)
-        {
-            append_error(ctx, tokens.next, "expected additive expression after &&");
-            return NULL;
-        }
+        if (!expect_and_advance(tokens, eToken::keyword_while, ctx))
+            return fail_frame(ctx, tokens, result);
+        if (!expect_and_advance(tokens, eToken::open_parens, ctx))
+            return fail_frame(ctx, tokens, result);
 
-        op.binop.left = left_node;
-        op.binop.right = right_node;
+        f.step = LOOP_condition;
+        parse_call(ctx, tokens, result, PARSE_expression);
+        return;
 
-        if (tokens.next != tokens.end &&
-            (tokens.next->type == eToken::logical_and))
+    case LOOP_condition:
+        f.n.whileloop.condition = *result;
+        if (!f.n.whileloop.condition)
         {
-            left_node = new ASTNode(op);
-            continue;
+            append_error(ctx, tokens.peek().location, "expected condition inside while()");
+            return fail_frame(ctx, tokens, result);
         }
 
-        break;
+        if (!expect_and_advance(tokens, eToken::closed_parens, ctx))
+            return fail_frame(ctx, tokens, result);
+        if (!expect_and_advance(tokens, eToken::semicolon, ctx))
+            return fail_frame(ctx, tokens, result);
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
     }
-
-    io_tokens = tokens;
-    return new ASTNode(op);
 }
 
-ASTNode* parse_equality_expression(TokenStream& io_tokens, ast_context* ctx)
+static void step_expression(ast_context* ctx, TokenStream& tokens, ASTNode** result)
 {
-    // <equality-exp> ::= <relational-exp> { ("!=" | "==") <relational-exp> }
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
-
-    ASTNode* left_node = parse_relational_expression(tokens, ctx);
-    if (!left_node)
-        return NULL;
-
-    if (tokens.next->type != eToken::logical_not_equal &&
-        tokens.next->type != eToken::logical_equal)
-    {
-        io_tokens = tokens;
-        return left_node;
-    }
-
-    ASTNode op = {};
-    op.type = AST_binop;
-
-    for (;;)
+    // <exp> ::= <id> "=" <exp> | <conditional-exp>
+    parse_frame& f = top_frame(ctx);
+    if (f.step == EXP_assignment)
     {
-        op.binop.op = tokens.next->type;
-
-        ++tokens.next;
-        if (tokens.next == tokens.end)
-        {
-            append_error(ctx, tokens.next, "expected additive expression after != or == but no more tokens");
-            return NULL;
-        }
-
-        ASTNode* right_node = parse_relational_expression(tokens, ctx);
-        if (!right_node)
+        f.n.var.assign_expression = *result;
+        if (!f.n.var.assign_expression)
         {
-            append_error(ctx, tokens.next, "expected additive expression after != or ==");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected expression after =");
+            return fail_frame(ctx, tokens, result);
         }
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
+    }
 
-        op.binop.left = left_node;
-        op.binop.right = right_node;
+    if (tokens.has(3)
+        && tokens.type(0) == eToken::identifier
+        && tokens.type(1) == eToken::assignment)
+    {
+        f.n.type = AST_var;
+        f.n.var.var_decl = NULL;
+        f.n.var.is_variable_assignment = true;
+        f.n.var.debug_location = tokens.peek().location;
+        f.n.var.name = tokens.peek().identifier;
+        resolve_usage(ctx, &f.n);
 
-        // Gross, but it works. We will wrap around, set our binary_op to next token type and
-        // use previous binop as term for next binop
-        if (tokens.next != tokens.end &&
-            (tokens.next->type == eToken::logical_not_equal ||
-                tokens.next->type == eToken::logical_equal))
-        {
-            left_node = new ASTNode(op);
-            continue;
-        }
+        advance(tokens, ctx, 2); //skip id and assignment
 
-        break;
+        f.step = EXP_assignment;
+        parse_call(ctx, tokens, result, PARSE_expression);
+        return;
     }
 
-    io_tokens = tokens;
-    return new ASTNode(op);
+    // the frame becomes the <conditional-exp>, same start and same node
+    f.kind = PARSE_binary_expression;
+    f.arg = BINDING_POWER_LOWEST;
 }
 
-ASTNode* parse_relational_expression(TokenStream& io_tokens, ast_context* ctx)
+static void step_binary_expression(ast_context* ctx, TokenStream& tokens, ASTNode** result)
 {
-    // <relational-exp> ::= <additive-exp> { ("<" | ">" | "<=" | ">=") <additive-exp> }
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
-
-    ASTNode* left_node = parse_additive_expression(tokens, ctx);
-    if (!left_node)
-        return NULL;
-
-    if (tokens.next->type != '<' &&
-        tokens.next->type != '>' &&
-        tokens.next->type != eToken::less_than_or_equal &&
-        tokens.next->type != eToken::greater_than_or_equal)
-    {
-        io_tokens = tokens;
-        return left_node;
-    }
-
-    ASTNode op = {};
-    op.type = AST_binop;
-
-    for (;;)
-    {
-        op.binop.op = tokens.next->type;
-
-        ++tokens.next;
-        if (tokens.next == tokens.end)
-        {
-            append_error(ctx, tokens.next, "expected additive expression after <, >, <=, or >= but no more tokens");
-            return NULL;
-        }
-
-        ASTNode* right_node = parse_additive_expression(tokens, ctx);
-        if (!right_node)
-        {
-            append_error(ctx, tokens.next, "expected additive expression after <, >, <=, or >=");
-            return NULL;
-        }
-
-        op.binop.left = left_node;
-        op.binop.right = right_node;
-
-        // Gross, but it works. We will wrap around, set our binary_op to next token type and
-        // use previous binop as term for next binop
-        if (tokens.next != tokens.end &&
-            (tokens.next->type == '<' ||
-                tokens.next->type == '>' ||
-                tokens.next->type == eToken::less_than_or_equal ||
-                tokens.next->type == eToken::greater_than_or_equal))
+    // <conditional-exp> down to <term>: a factor, then as long as the next operator binds at least as tightly as
+    // min_power (arg), fold it into the left side, kept in n.binop.left. The right side of a left associative
+    // operator is parsed with its power + 1, so the next operator at the same level comes back to this loop and
+    // takes the result as its left.
+    parse_frame& f = top_frame(ctx);
+    switch (f.step)
+    {
+    case STEP_enter:
+        if (is_leaf(tokens))
         {
-            left_node = new ASTNode(op);
-            continue;
+            f.n.binop.left = parse_leaf(tokens, ctx);
+            break;
         }
+        f.step = BIN_left;
+        parse_call(ctx, tokens, result, PARSE_factor);
+        return;
 
+    case BIN_left:
+        if (!*result)
+            return fail_frame(ctx, tokens, result);
+        f.n.binop.left = *result;
         break;
-    }
 
-    io_tokens = tokens;
-    return new ASTNode(op);
-}
-
-ASTNode* parse_additive_expression(TokenStream& io_tokens, ast_context* ctx)
-{
-    // <additive-exp> ::= <term> { ("+" | "-") <term> }
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
-
-    ASTNode* left_node = parse_term(tokens, ctx);
-    if (!left_node)
-        return NULL;
-
-    if (tokens.next->type != '+' &&
-        tokens.next->type != '-')
-    {
-        io_tokens = tokens;
-        return left_node;
-    }
-
-    ASTNode op = {};
-    op.type = AST_binop;
-
-    for (;;)
-    {
-        op.binop.op = tokens.next->type;
-
-        ++tokens.next;
-        if (tokens.next == tokens.end)
+    case BIN_if_true:
+        f.n.terop.if_true = *result;
+        if (!f.n.terop.if_true)
         {
-            append_error(ctx, tokens.next, "expected term after + or - but no more tokens");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected expression after ?");
+            return fail_frame(ctx, tokens, result);
         }
 
-        ASTNode* right_node = parse_term(tokens, ctx);
-        if (!right_node)
+        if (!expect_and_advance(tokens, eToken::colon, ctx))
+            return fail_frame(ctx, tokens, result);
+        if (tokens.at_end())
         {
-            append_error(ctx, tokens.next, "expected term after + or -");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected conditional expression after : but no more tokens");
+            return fail_frame(ctx, tokens, result);
         }
 
-        op.binop.left = left_node;
-        op.binop.right = right_node;
+        // right associative, so the else side is parsed at ?'s own power
+        f.step = BIN_if_false;
+        parse_call(ctx, tokens, result, PARSE_binary_expression, BINDING_POWER.of[eToken::question_mark]);
+        return;
 
-        // Gross, but it works. We will wrap around, set our binary_op to next token type and
-        // use previous binop as term for next binop
-        if (tokens.next != tokens.end && (tokens.next->type == '-' || tokens.next->type == '+'))
+    case BIN_if_false:
+    {
+        f.n.terop.if_false = *result;
+        if (!f.n.terop.if_false)
         {
-            left_node = new ASTNode(op);
-            continue;
+            append_error(ctx, tokens.peek().location, "expected conditional expression after :");
+            return fail_frame(ctx, tokens, result);
         }
 
+        ASTNode* terop = ast_new(ctx->arena, f.n);
+        f.n = {};
+        f.n.binop.left = terop;
         break;
     }
-
-    io_tokens = tokens;
-    return new ASTNode(op);
-}
-
-ASTNode* parse_term(TokenStream& io_tokens, ast_context* ctx)
-{
-    // <term> :: = <factor> { ("*" | "/" | "%") <factor> }
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
-
-    ASTNode* left_node = parse_factor(tokens, ctx);
-    if (!left_node)
-        return NULL;
-
-    if (tokens.next->type != '*' &&
-        tokens.next->type != '/' &&
-        tokens.next->type != '%')
-    {
-        io_tokens = tokens;
-        return left_node;
     }
 
-    ASTNode op = {};
-    op.type = AST_binop;
-
     for (;;)
     {
-        op.binop.op = tokens.next->type;
-
-        ++tokens.next;
-        if (tokens.next == tokens.end)
+        if (f.step == BIN_right)
         {
-            append_error(ctx, tokens.next, "expected factor after *, /, or % but no more tokens");
-            return NULL;
+            f.n.binop.right = *result;
+            if (!f.n.binop.right)
+            {
+                append_error(ctx, tokens.peek().location, "expected expression after operator");
+                return fail_frame(ctx, tokens, result);
+            }
+            f.n.type = AST_binop;
+            f.n.binop.slot = ctx->num_temps++; // holds the left side while the right is evaluated
+            f.n.binop.left = ast_new(ctx->arena, f.n);
         }
 
-        ASTNode* right_node = parse_factor(tokens, ctx);
-        if (!right_node)
+        const eToken op = tokens.type();
+        const uint8_t power = BINDING_POWER.of[op];
+        if (power == 0 || power < f.arg)
+            return finish_frame(ctx, f.n.binop.left, result);
+        advance(tokens, ctx);
+        if (tokens.at_end())
         {
-            append_error(ctx, tokens.next, "expected factor after *, /, or %");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected expression after operator but no more tokens");
+            return fail_frame(ctx, tokens, result);
         }
 
-        op.binop.left = left_node;
-        op.binop.right = right_node;
-
-        // Gross, but it works. We will wrap around, set our binary_op to next token type and
-        // use previous binop as term for next binop
-        if (tokens.next != tokens.end &&
-            (tokens.next->type == '*' || tokens.next->type == '/' || tokens.next->type == '%'))
+        // "?" <exp> ":" <conditional-exp>
+        if (op == eToken::question_mark)
         {
-            left_node = new ASTNode(op);
-            continue;
+            ASTNode* condition = f.n.binop.left;
+            f.n = {};
+            f.n.type = AST_terop;
+            f.n.terop.condition = condition;
+
+            f.step = BIN_if_true;
+            parse_call(ctx, tokens, result, PARSE_expression);
+            return;
         }
 
-        break;
+        // a lone operand comes straight back, anything else is picked up at the top of the loop once it's done
+        f.n.binop.op = op;
+        f.step = BIN_right;
+        if (parse_call(ctx, tokens, result, PARSE_binary_expression, power + 1))
+            return;
     }
-
-    io_tokens = tokens;
-    return new ASTNode(op);
 }
 
-ASTNode* parse_factor(TokenStream& io_tokens, ast_context* ctx)
+static void step_factor(ast_context* ctx, TokenStream& tokens, ASTNode** result)
 {
     // <factor> ::= <function-call> | "(" <exp> ")" | <unary_op> <factor> | <int> | <id>
-    assert(io_tokens.next != io_tokens.end);
-    TokenStream tokens = io_tokens;
-
-    ASTNode* f = parse_function_call(tokens, ctx);
-    if (f)
+    parse_frame& f = top_frame(ctx);
+    switch (f.step)
     {
-        io_tokens = tokens;
-        return f;
-    }
-
+    case STEP_enter:
+        break;
 
-    if (tokens.next->type == eToken::open_parens)
+    case FACTOR_parens:
     {
-        ++tokens.next;
-        if (tokens.next == tokens.end)
-            return NULL;
-
-        ASTNode* expression = parse_expression(tokens, ctx);
+        ASTNode* expression = *result;
         if (!expression)
         {
-            append_error(ctx, tokens.next, "expected expression after (");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected expression after (");
+            return fail_frame(ctx, tokens, result);
         }
 
-        if (tokens.next->type != eToken::closed_parens)
+        if (tokens.type() != eToken::closed_parens)
         {
-            append_error(ctx, tokens.next, "expected ) after expression");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected ) after expression");
+            return fail_frame(ctx, tokens, result);
         }
 
-        ++tokens.next;
-
-        io_tokens = tokens;
-        return expression;
+        advance(tokens, ctx);
+        return finish_frame(ctx, expression, result);
     }
 
-    if (tokens.next->type == '!' ||
-        tokens.next->type == '-' ||
-        tokens.next->type == '~')
+    case FACTOR_unary:
     {
-        // unary operator, expects factor
-        ASTNode n = {};
-        n.type = AST_unop;
-        n.unop.op = io_tokens.next->type;
-
-        ++tokens.next;
-
-        if (tokens.next == tokens.end)
-            return NULL;
-
-        ASTNode* factor = parse_factor(tokens, ctx);
+        ASTNode* factor = *result;
         if (!factor)
         {
-            append_error(ctx, tokens.next, "expected factor after unary operator");
-            return NULL;
+            append_error(ctx, tokens.peek().location, "expected factor after unary operator");
+            return fail_frame(ctx, tokens, result);
         }
-        n.unop.on = factor;
+        f.n.unop.on = factor;
 
         // "optimization" attempt to combine unary op with number
         if (factor->type == AST_num)
         {
-            switch (n.unop.op)
+            switch (f.n.unop.op)
             {
             case '!':
                 factor->num.value = !factor->num.value;
-                io_tokens = tokens;
-                return factor;
+                return finish_frame(ctx, factor, result);
             case '-':
                 factor->num.value = -factor->num.value;
-                io_tokens = tokens;
-                return factor;
+                return finish_frame(ctx, factor, result);
             case '~':
                 factor->num.value = ~factor->num.value;
-                io_tokens = tokens;
-                return factor;
+                return finish_frame(ctx, factor, result);
             }
 
             debug_break(); // not handling all unary ops, fall through to normal route
         }
 
-        io_tokens = tokens;
-        return new ASTNode(n);
-    }
-
-    if (tokens.next->type == eToken::constant_number)
-    {
-        ASTNode n = {};
-        n.type = AST_num;
-        n.num.value = tokens.next->number;
-        ++tokens.next;
-
-        io_tokens = tokens;
-        return new ASTNode(n);
+        return finish_frame(ctx, ast_new(ctx->arena, f.n), result);
     }
-
-    if (tokens.next->type == eToken::identifier)
-    {
-        ASTNode n = {};
-        n.type = AST_var;
-        n.var.var_decl = NULL;
-        n.var.is_variable_usage = true;
-        n.var.debug_token = tokens.next;
-        n.var.name = tokens.next->identifier;
-        ++tokens.next;
-
-        io_tokens = tokens;
-        return new ASTNode(n);
     }
 
-    return NULL;
-}
-
-ASTNode* parse_for_loop(TokenStream& io_tokens, ast_context* ctx)
-{
-    assert(io_tokens.next != io_tokens.end);
-    if (io_tokens.next + 6 >= io_tokens.end) // 5 = "for(;;);" (min required tokens for for loop)
-        return NULL;
-    TokenStream tokens = io_tokens;
-
-    if (tokens.next->type != eToken::keyword_for)
-    {
-        debug_break(); // this function expects that you've checked for 'for'
-        return NULL;
-    }
-    ++tokens.next;
-
-    ASTNode n = {};
-    n.type = AST_for;
-
-    if (!expect_and_advance(tokens, eToken::open_parens, ctx))
-        return NULL;
-
-    // parse init
-    if (tokens.next->type == eToken::semicolon)
-    {
-        ++tokens.next;
-        assert(n.forloop.init == NULL);
-    }
-    else
-    {
-        n.forloop.init = parse_declaration_with_semicolon(tokens, ctx);
-        if (!n.forloop.init)
-        {
-            n.forloop.init = parse_expression(tokens, ctx);
-            if (!n.forloop.init)
-            {
-                append_error(ctx, tokens.next, "failed parsing init section of for loop");
-                return NULL;
-            }
-
-            if (!expect_and_advance(tokens, eToken::semicolon, ctx))
-                return NULL;
-        }
-        assert(n.forloop.init);
-    }
-
-    // parse condition
-    if (tokens.next->type == eToken::semicolon)
-    {
-        ++tokens.next;
-        assert(n.forloop.condition == NULL);
-    }
-    else
-    {
-        n.forloop.condition = parse_expression(tokens, ctx);
-        if (!n.forloop.condition)
-        {
-            append_error(ctx, tokens.next, "failed parsing condition section of for loop");
-            return NULL;
-        }
-
-        if (!expect_and_advance(tokens, eToken::semicolon, ctx))
-            return NULL;
-
-        assert(n.forloop.condition);
-    }
-
-    // parse update
-    if (tokens.next->type == eToken::closed_parens)
-    {
-        ++tokens.next;
-        assert(n.forloop.update == NULL);
-    }
-    else
-    {
-        n.forloop.update = parse_expression(tokens, ctx);
-        if (!n.forloop.update)
-        {
-            append_error(ctx, tokens.next, "failed parsing update section of for loop");
-            return NULL;
-        }
-
-        if (!expect_and_advance(tokens, eToken::closed_parens, ctx))
-            return NULL;
-
-        assert(n.forloop.update);
-    }
-
-    // for loop body
-    n.forloop.body = parse_statement(tokens, ctx);
-    if (n.forloop.body)
-    {
-        io_tokens = tokens;
-        return new ASTNode(n);
-    }
-
-    append_error(ctx, tokens.next, "expected loop body after for loop");
-    return NULL;
-}
-
-ASTNode* parse_while_loop(TokenStream& io_tokens, ast_context* ctx)
-{
-    assert(io_tokens.next != io_tokens.end);
-    if (io_tokens.next + 4 >= io_tokens.end) //X = while(...);
-        return NULL;
-    TokenStream tokens = io_tokens;
-
-    if (tokens.next->type != eToken::keyword_while)
-    {
-        debug_break(); // this function expects that you've checked for 'while'
-        return NULL;
-    }
-    ++tokens.next;
-
-    ASTNode n = {};
-    n.type = AST_while;
-
-    if (!expect_and_advance(tokens, eToken::open_parens, ctx))
-        return NULL;
-
-    n.whileloop.condition = parse_expression(tokens, ctx);
-    if(!n.whileloop.condition)
-    {
-        append_error(ctx, tokens.next, "expected conditional expression inside while()");
-        return NULL;
-    }
-
-    if (!expect_and_advance(tokens, eToken::closed_parens, ctx))
-        return NULL;
-
-    n.whileloop.body = parse_statement(tokens, ctx);
-    if(!n.whileloop.body)
-    {
-        append_error(ctx, tokens.next, "expected body after while(...)");
-        return NULL;
-    }
-
-    io_tokens = tokens;
-    return new ASTNode(n);
-}
-
-ASTNode* parse_do_while_loop(TokenStream& io_tokens, ast_context* ctx)
-{
-    assert(io_tokens.next != io_tokens.end);
-    if (io_tokens.next + 7 >= io_tokens.end) //X = do{...}while(...);
-        return NULL;
-    TokenStream tokens = io_tokens;
-
-    if (tokens.next->type != eToken::keyword_do)
-    {
-        debug_break(); // this function expects that you've checked for 'do'
-        return NULL;
-    }
-    ++tokens.next;
-
-    ASTNode n = {};
-    n.type = AST_dowhile;
-
-    n.whileloop.body = parse_statement(tokens, ctx);
-    if(!n.whileloop.body)
+    // the frame becomes the call, same start and same node
+    if (tokens.type() == eToken::identifier && tokens.type(1) == eToken::open_parens)
     {
-        append_error(ctx, tokens.next, "expected loop body after do");
-        return NULL;
+        f.kind = PARSE_function_call;
+        return;
     }
 
-    if (!expect_and_advance(tokens, eToken::keyword_while, ctx))
-        return NULL;
+    if (tokens.type() == eToken::open_parens)
+    {
+        advance(tokens, ctx);
+        if (tokens.at_end())
+            return fail_frame(ctx, tokens, result);
 
-    if (!expect_and_advance(tokens, eToken::open_parens, ctx))
-        return NULL;
+        f.step = FACTOR_parens;
+        parse_call(ctx, tokens, result, PARSE_expression);
+        return;
+    }
 
-    n.whileloop.condition = parse_expression(tokens, ctx);
-    if(!n.whileloop.condition)
+    if (tokens.type() == '!' ||
+        tokens.type() == '-' ||
+        tokens.type() == '~')
     {
-        append_error(ctx, tokens.next, "expected condition inside while()");
-        return NULL;
-    }
+        // unary operator, expects factor
+        f.n.type = AST_unop;
+        f.n.unop.op = tokens.type();
 
-    if (!expect_and_advance(tokens, eToken::closed_parens, ctx))
-        return NULL;
+        advance(tokens, ctx);
+        if (tokens.at_end())
+            return fail_frame(ctx, tokens, result);
 
-    if (!expect_and_advance(tokens, eToken::semicolon, ctx))
-        return NULL;
+        f.step = FACTOR_unary;
+        parse_call(ctx, tokens, result, PARSE_factor);
+        return;
+    }
 
-    io_tokens = tokens;
-    return new ASTNode(n);
+    if (tokens.type() == eToken::constant_number || tokens.type() == eToken::identifier)
+        return finish_frame(ctx, parse_leaf(tokens, ctx), result);
+
+    fail_frame(ctx, tokens, result);
 }
 
-void fixup_var_references(ast_context* ctx, ASTNode* n)
+static void step_function_call(ast_context* ctx, TokenStream& tokens, ASTNode** result)
 {
-    if (!n) return;
+    parse_frame& f = top_frame(ctx);
+    if (f.step == STEP_enter)
+    {
+        if (!tokens.has(4)) // id()
+            return fail_frame(ctx, tokens, result);
 
-    // (1) touch every AST_var
-    // (2) if decl, set var_decl to self
-    // (3) if not decl, find decl it refers to
-    // all of this might be easier if every node had a parent node...
-    switch (n->type)
+        if (tokens.type(0) != eToken::identifier ||
+            tokens.type(1) != eToken::open_parens)
+            return fail_frame(ctx, tokens, result);
+
+        f.n.type = AST_fcall;
+        f.n.fcall.name = tokens.peek().identifier;
+        advance(tokens, ctx, 2); // skip id and (
+    }
+
+    // the arguments until one doesn't parse, lone operands don't leave the loop
+    for (;;)
     {
-    case AST_fdef: {
-        for (uint32_t i = 0; i < n->fdef.params.size; ++i)
-        {
-            fixup_var_references(ctx, n->fdef.params.nodes[i]);
-        }
-        for (uint32_t i = 0; i < n->fdef.body.size; ++i)
+        if (f.step == CALL_argument)
         {
-            fixup_var_references(ctx, n->fdef.body.nodes[i]);
+            if (!*result)
+                break;
+            astn_push(ctx->arena, &f.n.fcall.args, *result);
+
+            if (!tokens.at_end() &&
+                tokens.type() == eToken::comma)
+                advance(tokens, ctx);
         }
-    } return;
 
-    case AST_var: {
-        assert(n->var.var_decl == NULL); // should've been set to NULL when building AST. should only be touched once during iteration
+        if (tokens.at_end())
+            break;
+        f.step = CALL_argument;
+        if (parse_call(ctx, tokens, result, PARSE_expression))
+            return;
+    }
 
-        if (n->var.assign_expression)
-            fixup_var_references(ctx, n->var.assign_expression);
+    if (!expect_and_advance(tokens, eToken::closed_parens, ctx))
+        return fail_frame(ctx, tokens, result);
+    finish_frame(ctx, ast_new(ctx->arena, f.n), result);
+}
 
-        ASTNodeArray* decls = &ctx->var_decl_stack;
-        if (n->var.is_variable_declaration)
-        {
-            astn_push(decls, n);
-            n->var.var_decl = n; // var_decl is self
-            return;
-        }
-        else
+// runs the frames until the one for kind is done, see parse_frame
+static ASTNode* parse(TokenStream& io_tokens, ast_context* ctx, parse_kind kind, uint8_t arg = 0)
+{
+    assert(ctx->num_frames == 0); // only <function> and <program> start a parse, and nothing under them does
+    TokenStream tokens = io_tokens;
+    ASTNode* result = NULL;
+    parse_call(ctx, tokens, &result, kind, arg);
+    while (ctx->num_frames > 0)
+    {
+        switch (top_frame(ctx).kind)
         {
-            for (int64_t i = int64_t(decls->size) - 1; i >= 0; --i)
-            {
-                ASTNode* test = decls->nodes[i];
-                assert(test->type == AST_var);
-                if (test->var.name.nts == n->var.name.nts)
-                {
-                    n->var.var_decl = test;
-                    return;
-                }
-            }
+        case PARSE_declaration:       step_declaration(ctx, tokens, &result); break;
+        case PARSE_statement:         step_statement(ctx, tokens, &result); break;
+        case PARSE_for_loop:          step_for_loop(ctx, tokens, &result); break;
+        case PARSE_while_loop:        step_while_loop(ctx, tokens, &result); break;
+        case PARSE_do_while_loop:     step_do_while_loop(ctx, tokens, &result); break;
+        case PARSE_expression:        step_expression(ctx, tokens, &result); break;
+        case PARSE_binary_expression: step_binary_expression(ctx, tokens, &result); break;
+        case PARSE_factor:            step_factor(ctx, tokens, &result); break;
+        case PARSE_function_call:     step_function_call(ctx, tokens, &result); break;
         }
-
-        append_error(ctx, n->var.debug_token, "unable to find declaration for variable");
-    } return;
-
-    case AST_blocklist: {
-        ASTNodeArray* decls = &ctx->var_decl_stack;
-        uint32_t start_decls = decls->size; // save num decls before block
-        for (uint32_t i = 0; i < n->blocklist.size; ++i)
-        {
-            fixup_var_references(ctx, n->blocklist.nodes[i]);
-        }
-        decls->size = start_decls; // pop all decls (they are out of scope now)
-    } return;
-    case AST_ret: {
-        fixup_var_references(ctx, n->ret.expression);
-    } return;
-    
-    case AST_program: { debug_break(); }return;
-    case AST_num: {} return;
-    case AST_fdecl: {} return;
-    case AST_fcall: {
-        ASTNodeArray* decls = &ctx->var_decl_stack;
-        uint32_t start_decls = decls->size;
-        for (uint32_t i = 0; i < n->fcall.args.size; ++i)
-        {
-            fixup_var_references(ctx, n->fcall.args.nodes[i]);
-        }
-        assert(decls->size == start_decls);
-    } return;
-    case AST_if: {
-        ASTNodeArray* decls = &ctx->var_decl_stack;
-        uint32_t start_decls = decls->size;
-        fixup_var_references(ctx, n->ifdef.condition);
-        assert(decls->size == start_decls);
-        fixup_var_references(ctx, n->ifdef.if_true);
-        assert(decls->size == start_decls);
-        fixup_var_references(ctx, n->ifdef.if_false);
-        assert(decls->size == start_decls);
-    } return;
-    case AST_for: {
-        ASTNodeArray* decls = &ctx->var_decl_stack;
-        uint32_t start_decls = decls->size; // save num decls before block
-        fixup_var_references(ctx, n->forloop.init);
-        fixup_var_references(ctx, n->forloop.condition);
-        fixup_var_references(ctx, n->forloop.update);
-        fixup_var_references(ctx, n->forloop.body);
-        decls->size = start_decls; // pop all decls (they are out of scope now)
-    } return;
-    case AST_while: // fall-through
-    case AST_dowhile: {
-        ASTNodeArray* decls = &ctx->var_decl_stack;
-        uint32_t start_decls = decls->size; // save num decls before block
-        fixup_var_references(ctx, n->whileloop.condition);
-        fixup_var_references(ctx, n->whileloop.body);
-        decls->size = start_decls; // pop all decls (they are out of scope now)
-    } return;
-    case AST_unop: {
-        fixup_var_references(ctx, n->unop.on);
-    } return;
-    case AST_binop: {
-        fixup_var_references(ctx, n->binop.left);
-        fixup_var_references(ctx, n->binop.right);
-    } return;
-    case AST_terop: {
-        fixup_var_references(ctx, n->terop.condition);
-        fixup_var_references(ctx, n->terop.if_true);
-        fixup_var_references(ctx, n->terop.if_false);
-    } return;
-    case AST_break: {} return;
-    case AST_continue: {} return;
-    case AST_empty: {} return;
     }
 
-    debug_break();
+    if (result)
+        io_tokens = tokens;
+    return result;
 }
 
-void debug_assert_vars_have_decls(ASTNode* n);
-void debug_assert_vars_have_decls_ASTNodeArray(ASTNodeArray* na)
+ASTNode* parse_block_item(TokenStream& io_tokens, ast_context* ctx)
 {
-    for (uint32_t i = 0; i < na->size; ++i)
-        debug_assert_vars_have_decls(na->nodes[i]);
+    // <block-item> ::= <statement> | <declaration>
+    assert(!io_tokens.at_end());
+
+    // no statement starts with a type
+    if (io_tokens.type() == eToken::keyword_int)
+        return parse_declaration_with_semicolon(io_tokens, ctx);
+    return parse(io_tokens, ctx, PARSE_statement);
 }
 
-void debug_assert_vars_have_decls(ASTNode* n)
+ASTNode* parse_declaration(TokenStream& io_tokens, ast_context* ctx)
 {
-    if (!n) return;
-
-    switch (n->type)
-    {
-    case AST_program: { debug_assert_vars_have_decls_ASTNodeArray(&n->program); } return;
-    case AST_blocklist: { debug_assert_vars_have_decls_ASTNodeArray(&n->blocklist); } return;
-    case AST_ret: { debug_assert_vars_have_decls(n->ret.expression); } return;
-    case AST_var: { 
-        assert(n->var.var_decl); 
-        debug_assert_vars_have_decls(n->var.assign_expression); 
-    } return;
-    case AST_num: {} return;
-    case AST_fdecl: {} return;
-    case AST_fdef: { 
-        debug_assert_vars_have_decls_ASTNodeArray(&n->fdef.params);
-        debug_assert_vars_have_decls_ASTNodeArray(&n->fdef.body);
-    } return;
-    case AST_fcall: { debug_assert_vars_have_decls_ASTNodeArray(&n->fcall.args); } return;
-    case AST_if: { 
-        debug_assert_vars_have_decls(n->ifdef.condition);
-        debug_assert_vars_have_decls(n->ifdef.if_true);
-        debug_assert_vars_have_decls(n->ifdef.if_false);
-    } return;
-    case AST_for: {
-        debug_assert_vars_have_decls(n->forloop.init);
-        debug_assert_vars_have_decls(n->forloop.condition);
-        debug_assert_vars_have_decls(n->forloop.update);
-        debug_assert_vars_have_decls(n->forloop.body);
-    } return;
-    case AST_while: // fall-through
-    case AST_dowhile: {
-        debug_assert_vars_have_decls(n->whileloop.condition);
-        debug_assert_vars_have_decls(n->whileloop.body);
-    } return;
-    case AST_unop: { debug_assert_vars_have_decls(n->unop.on); } return;
-    case AST_binop: {
-        debug_assert_vars_have_decls(n->binop.left);
-        debug_assert_vars_have_decls(n->binop.right);
-    } return;
-    case AST_terop: {
-        debug_assert_vars_have_decls(n->terop.condition);
-        debug_assert_vars_have_decls(n->terop.if_true);
-        debug_assert_vars_have_decls(n->terop.if_false);
-    } return;
-    case AST_break: {} return;
-    case AST_continue: {} return;
-    case AST_empty: {} return;
-    }
+    // <declaration> ::= "int" <id> [ = <exp> ]
+    return parse(io_tokens, ctx, PARSE_declaration, 0);
+}
 
-    debug_break();
+ASTNode* parse_declaration_with_semicolon(TokenStream& io_tokens, ast_context* ctx)
+{
+    // <declaration_with_semicolon> ::= <declaration> ";"
+    return parse(io_tokens, ctx, PARSE_declaration, 1);
 }
 
 void dump_ast(FILE* file, const ASTNode* root, int spaces_indent)
@@ -1551,9 +1426,10 @@ void dump_ast(FILE* file, const ASTNode* root, int spaces_indent)
     else if (self.type == AST_for)
     {
         fprintf(file, "%*cFOR(\n", spaces_indent, ' ');
-        dump_ast(file, self.forloop.init, spaces_indent + 2);
-        dump_ast(file, self.forloop.condition, spaces_indent + 2);
-        dump_ast(file, self.forloop.update, spaces_indent + 2);
+        // empty clauses are NULL
+        if (self.forloop.init) dump_ast(file, self.forloop.init, spaces_indent + 2);
+        if (self.forloop.condition) dump_ast(file, self.forloop.condition, spaces_indent + 2);
+        if (self.forloop.update) dump_ast(file, self.forloop.update, spaces_indent + 2);
         fprintf(file, "%*c)\n", spaces_indent, ' ');
         dump_ast(file, self.forloop.body, spaces_indent + 2);
         return;
@@ -1679,112 +1555,741 @@ void dump_ast(FILE* file, const ASTNode* root, int spaces_indent)
 
 bool expect_and_advance(TokenStream& tokens, eToken expected_token, ast_context* ctx)
 {
-    if (tokens.next == tokens.end)
+    if (tokens.at_end())
     {
-        append_error(ctx, tokens.next, "out of tokens");
+        append_error(ctx, tokens.peek().location, "out of tokens");
         return false;
     }
 
-    if (tokens.next->type != expected_token)
+    if (tokens.type() != expected_token)
     {
         switch (expected_token)
         {
-        case '!': append_error(ctx, tokens.next, "expected '!'"); break;
-        case '%': append_error(ctx, tokens.next, "expected '%'"); break;
-        case '&': append_error(ctx, tokens.next, "expected '&'"); break;
-        case '(': append_error(ctx, tokens.next, "expected '('"); break;
-        case ')': append_error(ctx, tokens.next, "expected ')'"); break;
-        case '*': append_error(ctx, tokens.next, "expected '*'"); break;
-        case '+': append_error(ctx, tokens.next, "expected '+'"); break;
-        case ',': append_error(ctx, tokens.next, "expected ','"); break;
-        case '-': append_error(ctx, tokens.next, "expected '-'"); break;
-        case '/': append_error(ctx, tokens.next, "expected '/'"); break;
-        case ':': append_error(ctx, tokens.next, "expected ':'"); break;
-        case ';': append_error(ctx, tokens.next, "expected ';'"); break;
-        case '<': append_error(ctx, tokens.next, "expected '<'"); break;
-        case '=': append_error(ctx, tokens.next, "expected '='"); break;
-        case '>': append_error(ctx, tokens.next, "expected '>'"); break;
-        case '?': append_error(ctx, tokens.next, "expected '?'"); break;
-        case '{': append_error(ctx, tokens.next, "expected '{'"); break;
-        case '}': append_error(ctx, tokens.next, "expected '}'"); break;
-        case '~': append_error(ctx, tokens.next, "expected '~'"); break;
-        case eToken::logical_and:           append_error(ctx, tokens.next, "expected '&&'"); break;
-        case eToken::logical_or:            append_error(ctx, tokens.next, "expected '||'"); break;
-        case eToken::logical_equal:         append_error(ctx, tokens.next, "expected '=='"); break;
-        case eToken::logical_not_equal:     append_error(ctx, tokens.next, "expected '!='"); break;
-        case eToken::less_than_or_equal:    append_error(ctx, tokens.next, "expected '<='"); break;
-        case eToken::greater_than_or_equal: append_error(ctx, tokens.next, "expected '>='"); break;
-        case eToken::keyword_int:           append_error(ctx, tokens.next, "expected 'int'"); break;
-        case eToken::keyword_return:        append_error(ctx, tokens.next, "expected 'return'"); break;
-        case eToken::keyword_if:            append_error(ctx, tokens.next, "expected 'if'"); break;
-        case eToken::keyword_else:          append_error(ctx, tokens.next, "expected 'else'"); break;
-        case eToken::keyword_for:           append_error(ctx, tokens.next, "expected 'for'"); break;
-        case eToken::keyword_while:         append_error(ctx, tokens.next, "expected 'while'"); break;
-        case eToken::keyword_do:            append_error(ctx, tokens.next, "expected 'do'"); break;
-        case eToken::keyword_break:         append_error(ctx, tokens.next, "expected 'break'"); break;
-        case eToken::keyword_continue:      append_error(ctx, tokens.next, "expected 'continue'"); break;
+        case '!': append_error(ctx, tokens.peek().location, "expected '!'"); break;
+        case '%': append_error(ctx, tokens.peek().location, "expected '%'"); break;
+        case '&': append_error(ctx, tokens.peek().location, "expected '&'"); break;
+        case '(': append_error(ctx, tokens.peek().location, "expected '('"); break;
+        case ')': append_error(ctx, tokens.peek().location, "expected ')'"); break;
+        case '*': append_error(ctx, tokens.peek().location, "expected '*'"); break;
+        case '+': append_error(ctx, tokens.peek().location, "expected '+'"); break;
+        case ',': append_error(ctx, tokens.peek().location, "expected ','"); break;
+        case '-': append_error(ctx, tokens.peek().location, "expected '-'"); break;
+        case '/': append_error(ctx, tokens.peek().location, "expected '/'"); break;
+        case ':': append_error(ctx, tokens.peek().location, "expected ':'"); break;
+        case ';': append_error(ctx, tokens.peek().location, "expected ';'"); break;
+        case '<': append_error(ctx, tokens.peek().location, "expected '<'"); break;
+        case '=': append_error(ctx, tokens.peek().location, "expected '='"); break;
+        case '>': append_error(ctx, tokens.peek().location, "expected '>'"); break;
+        case '?': append_error(ctx, tokens.peek().location, "expected '?'"); break;
+        case '{': append_error(ctx, tokens.peek().location, "expected '{'"); break;
+        case '}': append_error(ctx, tokens.peek().location, "expected '}'"); break;
+        case '~': append_error(ctx, tokens.peek().location, "expected '~'"); break;
+        case eToken::logical_and:           append_error(ctx, tokens.peek().location, "expected '&&'"); break;
+        case eToken::logical_or:            append_error(ctx, tokens.peek().location, "expected '||'"); break;
+        case eToken::logical_equal:         append_error(ctx, tokens.peek().location, "expected '=='"); break;
+        case eToken::logical_not_equal:     append_error(ctx, tokens.peek().location, "expected '!='"); break;
+        case eToken::less_than_or_equal:    append_error(ctx, tokens.peek().location, "expected '<='"); break;
+        case eToken::greater_than_or_equal: append_error(ctx, tokens.peek().location, "expected '>='"); break;
+        case eToken::keyword_int:           append_error(ctx, tokens.peek().location, "expected 'int'"); break;
+        case eToken::keyword_return:        append_error(ctx, tokens.peek().location, "expected 'return'"); break;
+        case eToken::keyword_if:            append_error(ctx, tokens.peek().location, "expected 'if'"); break;
+        case eToken::keyword_else:          append_error(ctx, tokens.peek().location, "expected 'else'"); break;
+        case eToken::keyword_for:           append_error(ctx, tokens.peek().location, "expected 'for'"); break;
+        case eToken::keyword_while:         append_error(ctx, tokens.peek().location, "expected 'while'"); break;
+        case eToken::keyword_do:            append_error(ctx, tokens.peek().location, "expected 'do'"); break;
+        case eToken::keyword_break:         append_error(ctx, tokens.peek().location, "expected 'break'"); break;
+        case eToken::keyword_continue:      append_error(ctx, tokens.peek().location, "expected 'continue'"); break;
         default:
             debug_break();
-            append_error(ctx, tokens.next, "<UNKNOWN> token");
+            append_error(ctx, tokens.peek().location, "<UNKNOWN> token");
         }
         return false;
     }
 
-    ++tokens.next;
+    advance(tokens, ctx);
     return true;
 }
 
-void append_error(ast_context* ctx, const Token* token, const char* reason)
+void advance(TokenStream& tokens, ast_context* ctx, uint64_t n)
 {
-    token; reason;
-    //++ctx->num_errors;
-    //ctx->errors = (ASTError*)realloc(ctx->errors, ctx->num_errors * sizeof(ASTError));
-
-    //ASTError* e = ctx->errors + ctx->num_errors - 1;
-    //e->token = token;
-    //e->reason = reason;
+    tokens.advance(n);
+    ctx->tokens_visited += n;
+}
 
+void append_error(ast_context* ctx, str_slice location, const char* reason)
+{
+    // later errors are usually fallout from the first, only that one is worth stopping for
     ctx->failure = true;
-    debug_break();
+    if (ctx->failure_reason)
+        return;
+
+    ctx->failure_location = location.start;
+    ctx->failure_reason = reason;
+    if (ctx->quiet)
+        ctx->quiet_break = true;
+    else
+        debug_break();
 }
 
-bool ast(const Token* tokens, uint64_t num_tokens, ASTOut* out)
+void resolve_declaration(ast_context* ctx, ASTNode* decl)
+{
+    // var_decl is self, the slot is the next one of its function (or of the globals)
+    SymbolTable* symbols = &ctx->symbols;
+    decl->var.var_decl = decl;
+    decl->var.is_global = symbols->num_scopes == 0;
+    if (!decl->var.is_global)
+    {
+        decl->var.slot = ctx->num_slots++;
+    }
+    else
+    {
+        // a global can be declared any number of times, they're all the same variable
+        const SymbolBinding* prior = symbols_find(symbols, decl->var.name);
+        decl->var.slot = prior ? prior->decl->var.slot : ctx->num_globals++;
+        if (ctx->lazy)
+            push_lazy(&ctx->lazy->globals, &ctx->lazy->num_globals, decl);
+    }
+    symbols_bind(symbols, decl->var.name, decl);
+}
+
+void resolve_usage(ast_context* ctx, ASTNode* n)
 {
-    TokenStream io_tokens;
-    io_tokens.next = tokens;
-    io_tokens.end = tokens + num_tokens;
+    // whatever declaration of the name is visible right here, later ones in the same scope don't count
+    if (const SymbolBinding* b = symbols_find(&ctx->symbols, n->var.name))
+    {
+        n->var.var_decl = b->decl;
+        n->var.is_global = b->decl->var.is_global;
+        n->var.slot = b->decl->var.slot;
+        return;
+    }
 
+    append_error(ctx, n->var.debug_location, "unable to find declaration for variable");
+}
+
+static bool ast(TokenStream io_tokens, ASTOut* out, ASTLazy* lazy = NULL)
+{
     ast_context ctx = {};
+    ctx.arena = &out->arena;
+    ctx.lazy = lazy;
 
     ASTNode* root = parse_program(io_tokens, &ctx);
 
     out->root = root;
     out->failure = ctx.failure;
+    out->item_ends = ctx.item_ends;
+    out->tokens_visited = ctx.tokens_visited;
+    out->deepest = ctx.deepest;
+    out->failure_location = ctx.failure_location;
+    out->failure_reason = ctx.failure_reason;
 
+    free_context(&ctx);
     if (!root)
         return false;
     if (ctx.failure)
         return false;
 
-    // fixup var references
+    return true;
+}
+
+bool ast(const Token* tokens, uint64_t num_tokens, ASTOut* out)
+{
+    return ast(token_stream(tokens, num_tokens), out);
+}
+
+bool ast(const TokenBuffer* tokens, ASTOut* out)
+{
+    return ast(token_stream(tokens), out);
+}
+
+bool ast(LexStream* tokens, ASTOut* out)
+{
+    // a lex failure (or reaching back past the window) looks like end of input to the parser, so the parse
+    // may have "succeeded" on a prefix. A parse error found before the overrun is the real one though.
+    bool ok = ast(token_stream(tokens), out);
+    if (ok && tokens->overrun)
     {
-        assert(root->type == AST_program);
+        out->failure = true;
+        out->failure_location = tokens->cursor;
+        out->failure_reason = "parser reached back past the token window";
+    }
+    return ok && !tokens->failure_reason && !tokens->overrun;
+}
 
+// a top-level item of ast_parallel, by shape only
+struct ast_item
+{
+    uint64_t start;
+    uint64_t end; // one past its last token
+    bool is_function;
+};
 
-        for (uint32_t i = 0; i < root->program.size; ++i)
+// functions are handed out this many items at a time
+static const uint32_t AST_PARALLEL_BATCH = 32;
+
+// The items of <program> without parsing them: a ( two tokens in is a function, its ( ... ) and { ... } are
+// stepped over. Anything else runs to the next ; outside of brackets. False if an item has neither shape, the
+// serial parser is left to say what's wrong with it.
+static bool split_items(TokenStream tokens, ast_item** o_items, uint32_t* o_num_items, uint32_t* o_num_functions)
+{
+    ast_item* items = NULL;
+    uint32_t num_items = 0;
+    uint32_t num_functions = 0;
+    bool ok = true;
+    while (ok && !tokens.at_end())
+    {
+        ast_item item = {};
+        item.start = tokens.pos;
+        item.is_function = tokens.type(2) == eToken::open_parens;
+        if (item.is_function)
         {
-            ASTNode* n = root->program.nodes[i];
-            //if (n->type == AST_fdef)
+            tokens.advance(2);
+            tokens.skip_group();
+            if (tokens.type() == eToken::open_curly)
+                tokens.skip_group();
+            else if (tokens.type() == eToken::semicolon)
+                tokens.advance();
+            else
+                ok = false;
+            ++num_functions;
+        }
+        else
+        {
+            for (;;)
             {
-                fixup_var_references(&ctx, n);
+                const eToken t = tokens.type();
+                if (t == eToken::semicolon || t == eToken::UNKNOWN)
+                {
+                    ok = t == eToken::semicolon;
+                    tokens.advance();
+                    break;
+                }
+                if (t == eToken::open_parens || t == eToken::open_curly)
+                    tokens.skip_group();
+                else
+                    tokens.advance();
             }
         }
+        item.end = tokens.pos;
 
-        debug_assert_vars_have_decls(root);
+        // grows whenever num_items reaches a power of two, same as item_ends
+        if ((num_items & (num_items - 1)) == 0)
+        {
+            items = (ast_item*)realloc(items, sizeof(ast_item) * (num_items ? num_items * 2 : 1));
+            assert(items);
+        }
+        items[num_items++] = item;
     }
 
-    if (ctx.failure)
+    *o_items = items;
+    *o_num_items = num_items;
+    *o_num_functions = num_functions;
+    return ok;
+}
+
+// an item that didn't parse, see ast_worker::errors
+struct ast_item_error
+{
+    uint32_t item;
+    const char* location;
+    const char* reason;
+    bool breaks; // the serial parse would have stopped in the debugger here, see append_error
+};
+
+// what every thread of an ast_parallel shares. nodes[i] is only written by whoever parses item i.
+struct ast_parallel_job
+{
+    TokenStream tokens;
+    const ast_item* items;
+    uint32_t num_items;
+    ASTNode** nodes; // globals are already in from the serial pass
+    std::atomic<uint32_t> next_item;
+};
+
+struct ast_worker
+{
+    ASTArena arena;
+    uint64_t tokens_visited;
+    uint32_t deepest;
+    ast_item_error* errors; // in the order this thread met them
+    uint32_t num_errors;
+};
+
+static void ast_worker_run(ast_parallel_job* job, ast_worker* w)
+{
+    ast_context ctx = {};
+    ctx.arena = &w->arena;
+    ctx.quiet = true; // only the first error in source order is reported, once every thread is done
+    uint32_t bound = 0; // items before this have their globals in ctx.symbols. Batches come in increasing order.
+    for (;;)
+    {
+        const uint32_t first = job->next_item.fetch_add(AST_PARALLEL_BATCH);
+        if (first >= job->num_items)
+            break;
+        const uint32_t last = first + AST_PARALLEL_BATCH < job->num_items ? first + AST_PARALLEL_BATCH : job->num_items;
+        for (uint32_t i = first; i < last; ++i)
+        {
+            const ast_item& item = job->items[i];
+            if (!item.is_function)
+                continue;
+            for (; bound < i; ++bound)
+            {
+                ASTNode* global = job->nodes[bound];
+                if (!job->items[bound].is_function && global->type == AST_var)
+                    symbols_bind(&ctx.symbols, global->var.name, global);
+            }
+
+            ctx.failure = false;
+            ctx.failure_location = NULL;
+            ctx.failure_reason = NULL;
+            ctx.quiet_break = false;
+            TokenStream ts = job->tokens;
+            ts.pos = item.start;
+            ASTNode* n = parse_top_level_item(ts, &ctx);
+            assert(!n || ts.pos == item.end); // a parsed body always ends at its closing }
+            job->nodes[i] = n;
+            if (n && !ctx.failure)
+                continue;
+
+            // grows whenever num_errors reaches a power of two, same as item_ends
+            if ((w->num_errors & (w->num_errors - 1)) == 0)
+            {
+                w->errors = (ast_item_error*)realloc(w->errors, sizeof(ast_item_error) * (w->num_errors ? w->num_errors * 2 : 1));
+                assert(w->errors);
+            }
+            ast_item_error& e = w->errors[w->num_errors++];
+            e.item = i;
+            e.location = ctx.failure_reason ? ctx.failure_location : job->tokens.at(item.start).location.start;
+            e.reason = ctx.failure_reason ? ctx.failure_reason : "couldn't parse function or declaration";
+            e.breaks = ctx.quiet_break;
+        }
+    }
+    w->tokens_visited = ctx.tokens_visited;
+    w->deepest = ctx.deepest;
+    free_context(&ctx);
+}
+
+static bool ast_parallel(TokenStream tokens, uint32_t num_threads, ASTOut* out)
+{
+    ast_item* items = NULL;
+    uint32_t num_items = 0;
+    uint32_t num_functions = 0;
+    bool split = tokens.matches && !tokens.at_end() && split_items(tokens, &items, &num_items, &num_functions);
+    if (num_threads == 0)
+    {
+        uint32_t by_count = num_functions / AST_PARALLEL_MIN_FUNCTIONS;
+        uint32_t threads = std::thread::hardware_concurrency();
+        num_threads = by_count < threads ? by_count : threads;
+    }
+    if (!split || num_threads <= 1)
+    {
+        free(items);
+        return ast(tokens, out);
+    }
+
+    // globals first, in order, exactly like the serial parse. The first that fails ends the program as far as
+    // the functions are concerned, nothing after it could be reported.
+    ast_context ctx = {};
+    ctx.arena = &out->arena;
+    ctx.quiet = true; // a function before the failed global may have failed first
+    ast_parallel_job job;
+    job.tokens = tokens;
+    job.items = items;
+    job.num_items = num_items;
+    job.nodes = (ASTNode**)calloc(num_items, sizeof(ASTNode*));
+    job.next_item = 0;
+    assert(job.nodes);
+    ast_item_error first_error = { num_items, NULL, NULL, false };
+    for (uint32_t i = 0; i < num_items; ++i)
+    {
+        if (items[i].is_function)
+            continue;
+        TokenStream ts = tokens;
+        ts.pos = items[i].start;
+        job.nodes[i] = parse_top_level_item(ts, &ctx);
+        if (job.nodes[i] && !ctx.failure)
+            continue;
+        first_error.item = i;
+        first_error.location = ctx.failure_reason ? ctx.failure_location : tokens.at(items[i].start).location.start;
+        first_error.reason = ctx.failure_reason ? ctx.failure_reason : "couldn't parse function or declaration";
+        first_error.breaks = ctx.quiet_break;
+        job.num_items = i;
+        break;
+    }
+
+    ast_worker* workers = (ast_worker*)calloc(num_threads, sizeof(ast_worker));
+    assert(workers);
+    std::thread* threads = new std::thread[num_threads - 1];
+    for (uint32_t i = 1; i < num_threads; ++i)
+        threads[i - 1] = std::thread(ast_worker_run, &job, &workers[i]);
+    ast_worker_run(&job, &workers[0]);
+    for (uint32_t i = 1; i < num_threads; ++i)
+        threads[i - 1].join();
+    delete[] threads;
+
+    // every thread's errors, the serial parse would have stopped at the first one in source order
+    uint64_t tokens_visited = ctx.tokens_visited;
+    for (uint32_t t = 0; t < num_threads; ++t)
+    {
+        ast_worker& w = workers[t];
+        for (uint32_t i = 0; i < w.num_errors; ++i)
+        {
+            if (w.errors[i].item < first_error.item)
+                first_error = w.errors[i];
+        }
+        tokens_visited += w.tokens_visited;
+        if (w.deepest > ctx.deepest)
+            ctx.deepest = w.deepest;
+        ast_arena_adopt(&out->arena, &w.arena);
+        free(w.errors);
+    }
+    free(workers);
+    if (first_error.breaks)
+        debug_break();
+
+    ASTNode* root = NULL;
+    if (!first_error.reason)
+    {
+        ASTNode n = {};
+        n.type = AST_program;
+        for (uint32_t i = 0; i < num_items; ++i)
+        {
+            astn_push(ctx.arena, &n.program, job.nodes[i]);
+            push_item_end(&ctx, n.program.size, items[i].end);
+        }
+        root = ast_new(ctx.arena, n);
+    }
+
+    out->root = root;
+    out->failure = first_error.reason != NULL;
+    out->item_ends = ctx.item_ends;
+    out->tokens_visited = tokens_visited;
+    out->deepest = ctx.deepest;
+    out->failure_location = first_error.location;
+    out->failure_reason = first_error.reason;
+
+    free_context(&ctx);
+    free(job.nodes);
+    free(items);
+    return root != NULL;
+}
+
+bool ast_parallel(const Token* tokens, uint64_t num_tokens, const uint32_t* matches, uint32_t num_threads, ASTOut* out)
+{
+    return ast_parallel(token_stream(tokens, num_tokens, matches), num_threads, out);
+}
+
+bool ast_parallel(const TokenBuffer* tokens, uint32_t num_threads, ASTOut* out)
+{
+    return ast_parallel(token_stream(tokens), num_threads, out);
+}
+
+static bool ast_lazy(TokenStream tokens, ASTOut* out)
+{
+    ASTLazy* lazy = (ASTLazy*)calloc(1, sizeof(ASTLazy));
+    assert(lazy);
+    lazy->tokens = tokens;
+    bool ok = ast(tokens, out, lazy);
+    out->lazy = lazy;
+    out->bodies_skipped = lazy->num_bodies;
+    for (uint32_t i = 0; ok && i < out->root->program.size; ++i)
+    {
+        // without matches there was nothing to step over with
+        const ASTNode* n = out->root->program.nodes[i];
+        if (n->type == AST_fdef && !n->fdef.body_pending)
+            ++out->bodies_parsed;
+    }
+    return ok;
+}
+
+bool ast_lazy(const Token* tokens, uint64_t num_tokens, const uint32_t* matches, ASTOut* out)
+{
+    return ast_lazy(token_stream(tokens, num_tokens, matches), out);
+}
+
+bool ast_lazy(const TokenBuffer* tokens, ASTOut* out)
+{
+    return ast_lazy(token_stream(tokens), out);
+}
+
+bool ast_materialize(ASTOut* out, ASTNode* fdef)
+{
+    assert(fdef->type == AST_fdef);
+    if (!fdef->fdef.body_pending)
+        return true;
+    ASTLazy* lazy = out->lazy;
+    assert(lazy && fdef->fdef.lazy_body < lazy->num_bodies);
+    const ast_lazy_body& body = lazy->bodies[fdef->fdef.lazy_body];
+
+    // the whole function again, seeing the globals ast() would have seen at this point
+    ast_context ctx = {};
+    ctx.arena = &out->arena;
+    for (uint32_t i = 0; i < body.num_globals; ++i)
+        symbols_bind(&ctx.symbols, lazy->globals[i]->var.name, lazy->globals[i]);
+    TokenStream tokens = lazy->tokens;
+    tokens.pos = body.start;
+    ASTNode* n = parse_top_level_item(tokens, &ctx);
+    free_context(&ctx);
+
+    if (!n || ctx.failure)
+    {
+        if (!out->failure_reason)
+        {
+            out->failure_location = ctx.failure_reason ? ctx.failure_location : lazy->tokens.at(body.open).location.start;
+            out->failure_reason = ctx.failure_reason ? ctx.failure_reason : "couldn't parse function body";
+        }
+        out->failure = true;
         return false;
+    }
+
+    assert(n->type == AST_fdef && tokens.pos == uint64_t(lazy->tokens.matches[body.open]) + 1);
+    *fdef = *n; // the node already in the tree becomes the whole function, n is left unreferenced in the arena
+    out->tokens_visited += ctx.tokens_visited - (body.open - body.start); // ast_lazy visited the signature
+    if (ctx.deepest > out->deepest)
+        out->deepest = ctx.deepest;
+    ++out->bodies_parsed;
+    --out->bodies_skipped;
+    return true;
+}
+
+// n's children onto stack, for walking a tree without recursion
+static void push_children(ASTNodeArray* stack, const ASTNode* n)
+{
+    const ASTNode* kids[4] = {};
+    const ASTNodeArray* list = NULL;
+    switch (n->type)
+    {
+    case AST_program: list = &n->program; break;
+    case AST_blocklist: list = &n->blocklist; break;
+    case AST_fdef: list = &n->fdef.body; break;
+    case AST_fcall: list = &n->fcall.args; break;
+    case AST_ret: kids[0] = n->ret.expression; break;
+    case AST_var: kids[0] = n->var.assign_expression; break;
+    case AST_if: kids[0] = n->ifdef.condition; kids[1] = n->ifdef.if_true; kids[2] = n->ifdef.if_false; break;
+    case AST_for:
+        kids[0] = n->forloop.init;
+        kids[1] = n->forloop.condition;
+        kids[2] = n->forloop.update;
+        kids[3] = n->forloop.body;
+        break;
+    case AST_while:
+    case AST_dowhile: kids[0] = n->whileloop.condition; kids[1] = n->whileloop.body; break;
+    case AST_unop: kids[0] = n->unop.on; break;
+    case AST_binop: kids[0] = n->binop.left; kids[1] = n->binop.right; break;
+    case AST_terop: kids[0] = n->terop.condition; kids[1] = n->terop.if_true; kids[2] = n->terop.if_false; break;
+    default: break;
+    }
+    if (list)
+    {
+        for (uint32_t i = 0; i < list->size; ++i)
+            astn_push(stack, list->nodes[i]);
+    }
+    for (const ASTNode* kid : kids)
+    {
+        if (kid)
+            astn_push(stack, (ASTNode*)kid);
+    }
+}
+
+bool ast_materialize_reachable(ASTOut* out)
+{
+    ASTLazy* lazy = out->lazy;
+    if (!lazy)
+        return true; // nothing is pending
+
+    // functions to materialize and walk, each queued once. Calls to a name without a definition are left for
+    // whoever runs the program to report.
+    SymbolTable queued = {};
+    ASTNodeArray functions = {};
+    ASTNodeArray walk = {};
+    str main = strings_insert_nts("main");
+    if (const SymbolBinding* b = symbols_find(&lazy->functions, main))
+    {
+        symbols_bind(&queued, main, b->decl);
+        astn_push(&functions, b->decl);
+    }
+
+    bool ok = true;
+    while (ok && functions.size > 0)
+    {
+        ASTNode* fdef = functions.nodes[--functions.size];
+        ok = ast_materialize(out, fdef);
+        if (!ok)
+            break;
+        push_children(&walk, fdef);
+        while (walk.size > 0)
+        {
+            const ASTNode* n = walk.nodes[--walk.size];
+            push_children(&walk, n);
+            if (n->type != AST_fcall || symbols_find(&queued, n->fcall.name))
+                continue;
+            if (const SymbolBinding* b = symbols_find(&lazy->functions, n->fcall.name))
+            {
+                symbols_bind(&queued, n->fcall.name, b->decl);
+                astn_push(&functions, b->decl);
+            }
+        }
+    }
+
+    astn_free(&walk);
+    astn_free(&functions);
+    symbols_free(&queued);
+    return ok;
+}
+
+static void ast_lazy_free(ASTLazy* lazy)
+{
+    if (!lazy)
+        return;
+    free(lazy->bodies);
+    free(lazy->globals);
+    symbols_free(&lazy->functions);
+    free(lazy);
+}
+
+static bool is_function_item(const ASTNode* n)
+{
+    return n->type == AST_fdef || n->type == AST_fdecl;
+}
+
+static bool ast_full(const Token* tokens, uint64_t num_tokens, ASTOut* io_ast)
+{
+    ast_free(io_ast);
+    return ast(tokens, num_tokens, io_ast);
+}
+
+void ast_free(ASTOut* out)
+{
+    ast_arena_free(&out->arena);
+    free(out->item_ends);
+    ast_lazy_free(out->lazy);
+    *out = ASTOut();
+}
+
+// move the source locations in items [first, end) along with their tokens, see TokenEdit
+static void rebase_locations(ASTNode** items, uint32_t first, uint32_t end, int64_t delta, ASTNodeArray* stack)
+{
+    if (delta == 0)
+        return;
+    for (uint32_t i = first; i < end; ++i)
+    {
+        astn_push(stack, items[i]);
+        while (stack->size > 0)
+        {
+            ASTNode* n = stack->nodes[--stack->size];
+            push_children(stack, n);
+            const ASTNodeArray* params = n->type == AST_fdef ? &n->fdef.params : n->type == AST_fdecl ? &n->fdecl.params : NULL;
+            for (uint32_t p = 0; params && p < params->size; ++p)
+                astn_push(stack, params->nodes[p]);
+            if (n->type == AST_var && n->var.debug_location.start)
+            {
+                n->var.debug_location.start += delta;
+                n->var.debug_location.end += delta;
+            }
+        }
+    }
+}
+
+bool ast_incremental(const Token* tokens, uint64_t num_tokens, const TokenEdit* changed, ASTOut* io_ast)
+{
+    ASTNode* root = io_ast->root;
+    if (!root || io_ast->failure || io_ast->lazy || root->program.size == 0)
+        return ast_full(tokens, num_tokens, io_ast);
+
+    // old items that hold a replaced token (or sit right after an insertion)
+    const uint32_t num_items = root->program.size;
+    const uint64_t* item_ends = io_ast->item_ends;
+    uint32_t first_item = 0;
+    while (first_item + 1 < num_items && item_ends[first_item] <= changed->first)
+        ++first_item;
+    uint32_t last_item = first_item;
+    while (last_item + 1 < num_items && item_ends[last_item] < changed->old_end)
+        ++last_item;
+
+    // a global's node is referenced by every function after it, only functions can be swapped out on their own
+    for (uint32_t i = first_item; i <= last_item; ++i)
+    {
+        if (!is_function_item(root->program.nodes[i]))
+            return ast_full(tokens, num_tokens, io_ast);
+    }
+
+    const int64_t token_shift = int64_t(changed->new_end) - int64_t(changed->old_end);
+    const uint64_t start = first_item ? item_ends[first_item - 1] : 0;
+    const uint64_t stop = uint64_t(int64_t(item_ends[last_item]) + token_shift);
+
+    // the new functions go in the same arena, the ones they replace stay there until the tree is freed
+    // the new functions see the globals declared before them, same as in ast(). Their slots were handed out by
+    // that parse already.
+    ast_context ctx = {};
+    ctx.arena = &io_ast->arena;
+    for (uint32_t i = 0; i < first_item; ++i)
+    {
+        ASTNode* global = root->program.nodes[i];
+        if (global->type == AST_var)
+            symbols_bind(&ctx.symbols, global->var.name, global);
+    }
+
+    TokenStream ts = token_stream(tokens, num_tokens);
+    ts.pos = start;
+    ASTNodeArray parsed = {};
+    while (ts.pos < stop)
+    {
+        ASTNode* item = parse_top_level_item(ts, &ctx);
+        if (!item || ctx.failure || !is_function_item(item))
+        {
+            astn_free(&parsed);
+            free(ctx.item_ends);
+            free_context(&ctx);
+            return ast_full(tokens, num_tokens, io_ast);
+        }
+        astn_push(&parsed, item);
+        push_item_end(&ctx, parsed.size, ts.pos);
+    }
+
+    // the edit merged or split items across the boundary, let the full parse sort it out
+    free_context(&ctx);
+    if (ts.pos != stop)
+    {
+        astn_free(&parsed);
+        free(ctx.item_ends);
+        return ast_full(tokens, num_tokens, io_ast);
+    }
+
+    // splice the new items over [first_item, last_item]
+    const uint32_t removed = last_item - first_item + 1;
+    const uint32_t new_size = num_items - removed + parsed.size;
+    const uint32_t tail = num_items - last_item - 1;
+    ASTNode** nodes = root->program.nodes;
+    uint64_t* ends = io_ast->item_ends;
+    if (new_size > root->program.capacity)
+    {
+        root->program.capacity = new_size * 2;
+        nodes = (ASTNode**)ast_arena_alloc(&io_ast->arena, sizeof(ASTNode*) * root->program.capacity);
+        memcpy(nodes, root->program.nodes, sizeof(ASTNode*) * first_item);
+        memcpy(nodes + first_item + parsed.size, root->program.nodes + last_item + 1, sizeof(ASTNode*) * tail);
+    }
+    else
+    {
+        memmove(nodes + first_item + parsed.size, nodes + last_item + 1, sizeof(ASTNode*) * tail);
+    }
+    if (new_size > num_items)
+        ends = (uint64_t*)realloc(ends, sizeof(uint64_t) * new_size);
+    memmove(ends + first_item + parsed.size, ends + last_item + 1, sizeof(uint64_t) * tail);
+    memcpy(nodes + first_item, parsed.nodes, sizeof(ASTNode*) * parsed.size);
+    memcpy(ends + first_item, ctx.item_ends, sizeof(uint64_t) * parsed.size);
+    for (uint32_t i = first_item + parsed.size; i < new_size; ++i)
+        ends[i] = uint64_t(int64_t(ends[i]) + token_shift);
+
+    root->program.nodes = nodes;
+    root->program.size = new_size;
+    io_ast->item_ends = ends;
+
+    astn_free(&parsed);
 
+    // the items that were kept still point into the old text
+    ASTNodeArray walk = {};
+    rebase_locations(nodes, 0, first_item, changed->rebase, &walk);
+    rebase_locations(nodes, new_size - tail, new_size, changed->rebase_tail, &walk);
+    astn_free(&walk);
+    free(ctx.item_ends);
     return true;
 }
@@ -3,7 +3,9 @@
 #include "ast_alloc.h"
 
 // Below is an attempt at a simple AST generator. It's meant to be simple.
-// note: ASTNodes are dynamically allocated and never freed.
+// note: ASTNodes live in the ASTOut's arena and are only released all at once, by ast_free.
+// note: names are resolved while parsing. Every var points at its declaration and every fdef knows how many stack
+//       slots it needs, there's no fixup pass over the tree afterwards.
 
 enum ASTType
 {
@@ -44,10 +46,12 @@ struct ASTNode
             bool is_variable_declaration;
             bool is_variable_assignment;
             bool is_variable_usage;
+            bool is_global; // declared at file scope. Set on every var while parsing, same as var_decl
+            uint32_t slot; // of the declaration: its stack slot in the function (see fdef) or its index among the globals
             str name;
             ASTNode* assign_expression;
             ASTNode* var_decl; // Which node the var was declared with. A var decl points to itself. Helpful info for gen phase.
-            const Token* debug_token;
+            str_slice debug_location; // source of the name, for error reporting
         } var;
 
         struct {
@@ -58,6 +62,10 @@ struct ASTNode
         struct {
             str name;
             eToken return_type;
+            bool body_pending; // ast_lazy stepped over the body, see ast_materialize. Until then body is empty.
+            uint32_t num_slots; // stack slots for params and locals, numbered as they were declared. 0 while body_pending
+            uint32_t num_temps; // binop temporaries, numbered on their own. gen puts them after the locals, interp has no use for them
+            uint32_t lazy_body; // while body_pending, which of ASTOut::lazy's bodies is this function's
             ASTNodeArray params;
             ASTNodeArray body;
         } fdef;
@@ -92,6 +100,7 @@ struct ASTNode
 
         struct {
             eToken op;
+            uint32_t slot; // temporary for left while right is evaluated, see fdef.num_temps
             ASTNode* left;
             ASTNode* right;
         } binop;
@@ -112,7 +121,49 @@ struct ASTOut
 {
     bool failure;
     ASTNode* root;
+    ASTArena arena; // every node and child array under root
+    uint64_t* item_ends; // token index just past each of root->program's nodes, for ast_incremental
+    uint64_t tokens_visited; // advances over a token, from ast(). The parser never backtracks, so this is the token count on success
+    uint32_t deepest; // most parse frames in use at once, see ast_set_max_depth
+    const char* failure_location; // first error, NULL on success
+    const char* failure_reason;
+    struct ASTLazy* lazy; // from ast_lazy: where each pending body is and what it can see
+    uint64_t bodies_parsed; // by ast_lazy and ast_materialize
+    uint64_t bodies_skipped; // still pending
 };
 
+// Statements and expressions are parsed on a heap stack of frames rather than by recursion: about one frame per
+// nested statement and two per level of parentheses. A parse that needs more than ast_max_depth() of them fails
+// with an error instead. The limit applies to every parse started after it's set, 0 puts back the default.
+static const uint32_t AST_DEFAULT_MAX_DEPTH = 1 << 16;
+uint32_t ast_max_depth();
+void ast_set_max_depth(uint32_t max_frames);
+
 bool ast(const Token* tokens, uint64_t num_tokens, ASTOut* out); // returns true on success
+bool ast(const TokenBuffer* tokens, ASTOut* out); // tokens from lex(input, buffer, true)
+bool ast(LexStream* tokens, ASTOut* out); // pulls tokens as it goes, check tokens->failure_reason for lex errors
+// Same tree as ast(), with top-level functions parsed on num_threads threads. 0 picks one per hardware thread, at most
+// one per AST_PARALLEL_MIN_FUNCTIONS functions. Items are found up front by stepping over brackets (matches from
+// lex_match_brackets). Globals are parsed first, in order, so each function still sees the ones declared before it.
+// Each thread parses into its own arena, handed to out->arena after, and keeps its own errors. The first error in
+// source order is the one reported, and root is NULL on any failure. Falls back to ast() for a single thread or
+// items that don't split.
+static const uint32_t AST_PARALLEL_MIN_FUNCTIONS = 256;
+bool ast_parallel(const Token* tokens, uint64_t num_tokens, const uint32_t* matches, uint32_t num_threads, ASTOut* out);
+bool ast_parallel(const TokenBuffer* tokens, uint32_t num_threads, ASTOut* out);
+// Same tree as ast(), except function bodies are stepped over (matches from lex_match_brackets) and left pending:
+// only each fdef's signature is parsed. A body is parsed in place by ast_materialize the first time something needs
+// it, so a pending body costs its signature and nothing else. tokens must outlive out.
+bool ast_lazy(const Token* tokens, uint64_t num_tokens, const uint32_t* matches, ASTOut* out);
+bool ast_lazy(const TokenBuffer* tokens, ASTOut* out);
+// Parse a pending fdef's body into the same node, pointers to it stay valid. True if there was nothing to do.
+// Errors land in out->failure* like they would have from ast().
+bool ast_materialize(ASTOut* out, ASTNode* fdef);
+// Materialize main and every function it can call, transitively. The rest stay pending. True without a main.
+bool ast_materialize_reachable(ASTOut* out);
+// After lex_incremental: re-parse only the top-level functions the replaced tokens fall in and splice them into
+// io_ast->root. Falls back to a full parse if the edit touches a global declaration or the functions no longer
+// line up with the old ones, or the tree is from ast_lazy. tokens are all of the new tokens.
+bool ast_incremental(const Token* tokens, uint64_t num_tokens, const TokenEdit* changed, ASTOut* io_ast);
+void ast_free(ASTOut* out); // the whole tree, item_ends and lazy, out can be reused after
 void dump_ast(FILE* file, const ASTNode* root, int spaces_indent);
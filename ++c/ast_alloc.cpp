@@ -1,11 +1,105 @@
 #include "ast_alloc.h"
+#include "ast.h"
+#include "debug.h"
 #include "stdlib.h" // realloc
+#include <string.h> // memcpy
+
+static const size_t AST_ARENA_BLOCK_SIZE = 64 * 1024;
+
+struct ast_arena_block
+{
+    ast_arena_block* prev;
+    uint64_t size; // bytes after the header
+};
+
+void* ast_arena_alloc(ASTArena* arena, size_t bytes)
+{
+    bytes = (bytes + 7) & ~size_t(7);
+    if (size_t(arena->end - arena->at) < bytes)
+    {
+        // anything too big for a block gets one of its own
+        size_t size = bytes > AST_ARENA_BLOCK_SIZE ? bytes : AST_ARENA_BLOCK_SIZE;
+        ast_arena_block* block = (ast_arena_block*)malloc(sizeof(ast_arena_block) + size);
+        assert(block);
+        block->prev = arena->blocks;
+        block->size = size;
+        arena->blocks = block;
+        arena->at = (char*)(block + 1);
+        arena->end = arena->at + size;
+        ++arena->num_blocks;
+    }
+
+    void* p = arena->at;
+    arena->at += bytes;
+    arena->bytes_used += bytes;
+    return p;
+}
+
+void ast_arena_free(ASTArena* arena)
+{
+    ast_arena_block* block = arena->blocks;
+    while (block)
+    {
+        ast_arena_block* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+    *arena = ASTArena();
+}
+
+void ast_arena_adopt(ASTArena* arena, ASTArena* from)
+{
+    if (!from->blocks)
+        return;
+    if (!arena->blocks)
+    {
+        *arena = *from;
+        *from = ASTArena();
+        return;
+    }
+
+    // from's blocks go in behind arena's newest one, which keeps bumping where it was
+    ast_arena_block* oldest = from->blocks;
+    while (oldest->prev)
+        oldest = oldest->prev;
+    oldest->prev = arena->blocks->prev;
+    arena->blocks->prev = from->blocks;
+    arena->num_blocks += from->num_blocks;
+    arena->num_nodes += from->num_nodes;
+    arena->bytes_used += from->bytes_used;
+    *from = ASTArena();
+}
+
+ASTNode* ast_new(ASTArena* arena, const ASTNode& n)
+{
+    ASTNode* node = (ASTNode*)ast_arena_alloc(arena, sizeof(ASTNode));
+    *node = n;
+    ++arena->num_nodes;
+    return node;
+}
+
+void astn_push(ASTArena* arena, ASTNodeArray* a, struct ASTNode* n)
+{
+    if (a->size == a->capacity)
+    {
+        uint32_t capacity = a->capacity ? a->capacity * 2 : 4;
+        ASTNode** nodes = (ASTNode**)ast_arena_alloc(arena, sizeof(ASTNode*) * capacity);
+        memcpy(nodes, a->nodes, sizeof(ASTNode*) * a->size);
+        a->nodes = nodes;
+        a->capacity = capacity;
+    }
+    a->nodes[a->size++] = n;
+}
 
 void astn_push(ASTNodeArray* a, struct ASTNode* n)
 {
-    a->size += 1;
-    a->nodes = (ASTNode**)realloc(a->nodes, sizeof(ASTNode*) * a->size);
-    a->nodes[a->size - 1] = n;
+    if (a->size == a->capacity)
+    {
+        a->capacity = a->capacity ? a->capacity * 2 : 16;
+        a->nodes = (ASTNode**)realloc(a->nodes, sizeof(ASTNode*) * a->capacity);
+        assert(a->nodes);
+    }
+    a->nodes[a->size++] = n;
 }
 
 void astn_free(ASTNodeArray* a)
@@ -13,4 +107,5 @@ void astn_free(ASTNodeArray* a)
     free(a->nodes);
     a->nodes = NULL;
     a->size = 0;
-}
\ No newline at end of file
+    a->capacity = 0;
+}
@@ -1,11 +1,36 @@
 #pragma once
 #include "stdint.h"
+#include <stddef.h>
+
+// Every node of a tree, and every child array, comes out of one ASTArena (see ASTOut) so a whole translation
+// unit's tree goes away with one ast_arena_free no matter how many nodes it has. Memory is handed out by bumping
+// a pointer through 64KB blocks, nothing is freed on its own, so a parse that backtracks or fails just leaves
+// some garbage behind until the arena goes.
+
+struct ASTArena
+{
+    struct ast_arena_block* blocks; // newest first
+    char* at;
+    char* end;
+    uint64_t num_blocks; // calls to malloc
+    uint64_t num_nodes;
+    uint64_t bytes_used;
+};
+
+void* ast_arena_alloc(ASTArena* arena, size_t bytes); // 8 byte aligned, never NULL
+void ast_arena_free(ASTArena* arena);
+void ast_arena_adopt(ASTArena* arena, ASTArena* from); // moves all of from's blocks (and counts) into arena, from is left empty
+struct ASTNode* ast_new(ASTArena* arena, const struct ASTNode& n); // copy of n
 
 struct ASTNodeArray
 {
     uint32_t size;
+    uint32_t capacity;
     struct ASTNode** nodes;
 };
 
+// capacity doubles, the old nodes array is left in the arena. Children of tree nodes use this one.
+void astn_push(ASTArena* arena, ASTNodeArray* a, struct ASTNode* n);
+// capacity doubles with realloc, for scratch arrays that don't outlive a pass. Free with astn_free.
 void astn_push(ASTNodeArray* a, struct ASTNode* n);
 void astn_free(ASTNodeArray* a);
@@ -0,0 +1,426 @@
+#include "ast_flat.h"
+#include "debug.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+static void* grow_table(void* table, uint32_t* io_capacity, uint32_t needed, size_t element_size)
+{
+    if (needed <= *io_capacity)
+        return table;
+    uint32_t capacity = *io_capacity ? *io_capacity : 64;
+    while (capacity < needed)
+        capacity *= 2;
+    table = realloc(table, capacity * element_size);
+    assert(table);
+    *io_capacity = capacity;
+    return table;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FLATTEN
+// declaring AST_var -> its node index. A decl always comes before its uses in pre-order (the parser
+// only resolves a name against decls it has already read), so uses can be resolved as they're reached.
+struct decl_slot
+{
+    const ASTNode* node;
+    uint32_t index;
+};
+
+struct flat_builder
+{
+    FlatAST* flat;
+    decl_slot* decls;
+    uint32_t decls_mask;
+    uint32_t num_decls;
+    bool ok;
+};
+
+static uint32_t decl_hash(const ASTNode* node, uint32_t mask)
+{
+    return uint32_t(((uint64_t(uintptr_t(node)) >> 3) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+static void add_decl(flat_builder* b, const ASTNode* node, uint32_t index)
+{
+    if (!b->decls || (b->num_decls + 1) * 2 > b->decls_mask + 1)
+    {
+        const uint32_t old_size = b->decls ? b->decls_mask + 1 : 0;
+        const uint32_t new_size = old_size ? old_size * 2 : 64;
+        decl_slot* decls = (decl_slot*)calloc(new_size, sizeof(decl_slot));
+        assert(decls);
+        for (uint32_t i = 0; i < old_size; ++i)
+        {
+            if (!b->decls[i].node)
+                continue;
+            uint32_t slot = decl_hash(b->decls[i].node, new_size - 1);
+            while (decls[slot].node)
+                slot = (slot + 1) & (new_size - 1);
+            decls[slot] = b->decls[i];
+        }
+        free(b->decls);
+        b->decls = decls;
+        b->decls_mask = new_size - 1;
+    }
+
+    uint32_t slot = decl_hash(node, b->decls_mask);
+    while (b->decls[slot].node)
+        slot = (slot + 1) & b->decls_mask;
+    b->decls[slot].node = node;
+    b->decls[slot].index = index;
+    ++b->num_decls;
+}
+
+static uint32_t find_decl(const flat_builder* b, const ASTNode* node)
+{
+    if (!b->decls)
+        return FLAT_NONE;
+    uint32_t slot = decl_hash(node, b->decls_mask);
+    while (b->decls[slot].node)
+    {
+        if (b->decls[slot].node == node)
+            return b->decls[slot].index;
+        slot = (slot + 1) & b->decls_mask;
+    }
+    return FLAT_NONE;
+}
+
+static uint32_t push_node(flat_builder* b, const ASTNode* n, ASTType type)
+{
+    FlatAST* flat = b->flat;
+    const uint32_t index = flat->num_nodes++;
+    uint32_t capacity = flat->nodes_capacity; // nodes and origin always grow together
+    flat->nodes = (FlatNode*)grow_table(flat->nodes, &capacity, flat->num_nodes, sizeof(FlatNode));
+    flat->origin = (const ASTNode**)grow_table(flat->origin, &flat->nodes_capacity, flat->num_nodes, sizeof(ASTNode*));
+
+    FlatNode* node = &flat->nodes[index];
+    *node = FlatNode();
+    node->type = uint8_t(type);
+    node->next = index + 1;
+    node->aux = FLAT_NONE;
+    flat->origin[index] = n;
+    return index;
+}
+
+static void push_name(flat_builder* b, uint32_t index, str name, str_slice debug_location, uint32_t decl, uint32_t slot)
+{
+    FlatAST* flat = b->flat;
+    flat->names = (FlatName*)grow_table(flat->names, &flat->names_capacity, flat->num_names + 1, sizeof(FlatName));
+    FlatName* fn = &flat->names[flat->num_names];
+    fn->name = name;
+    fn->debug_location = debug_location;
+    fn->decl = decl;
+    fn->slot = slot;
+    flat->nodes[index].aux = flat->num_names++;
+}
+
+static void flatten(flat_builder* b, const ASTNode* n);
+
+// FlatNode::flags holds the count
+static void set_num_params(flat_builder* b, uint32_t index, uint32_t num_params)
+{
+    if (num_params > UINT8_MAX)
+    {
+        debug_break(); // need room
+        b->ok = false;
+        return;
+    }
+    b->flat->nodes[index].flags = uint8_t(num_params);
+}
+
+static void flatten_optional(flat_builder* b, const ASTNode* n)
+{
+    if (n)
+        flatten(b, n);
+    else
+        push_node(b, NULL, AST_UNKNOWN);
+}
+
+static void flatten_array(flat_builder* b, const ASTNodeArray* a)
+{
+    for (uint32_t i = 0; i < a->size; ++i)
+        flatten(b, a->nodes[i]);
+}
+
+static void flatten(flat_builder* b, const ASTNode* n)
+{
+    const uint32_t index = push_node(b, n, n->type);
+    switch (n->type)
+    {
+    case AST_program: flatten_array(b, &n->program); break;
+    case AST_blocklist: flatten_array(b, &n->blocklist); break;
+    case AST_ret: flatten_optional(b, n->ret.expression); break;
+    case AST_var:
+    {
+        uint8_t flags = 0;
+        flags |= n->var.is_variable_declaration ? FLAT_declaration : 0;
+        flags |= n->var.is_variable_assignment ? FLAT_assignment : 0;
+        flags |= n->var.is_variable_usage ? FLAT_usage : 0;
+        flags |= n->var.is_global ? FLAT_global : 0;
+        b->flat->nodes[index].flags = flags;
+
+        // (params of an fdecl are never resolved, they stay FLAT_NONE)
+        uint32_t decl = FLAT_NONE;
+        if (n->var.var_decl == n)
+        {
+            decl = index;
+            add_decl(b, n, index); // before the initializer, which can see it
+        }
+        else if (n->var.var_decl)
+        {
+            decl = find_decl(b, n->var.var_decl);
+            b->ok = b->ok && decl != FLAT_NONE;
+        }
+        push_name(b, index, n->var.name, n->var.debug_location, decl, n->var.slot);
+
+        if (n->var.assign_expression)
+            flatten(b, n->var.assign_expression);
+    } break;
+    case AST_num:
+    {
+        FlatAST* flat = b->flat;
+        flat->values = (int64_t*)grow_table(flat->values, &flat->values_capacity, flat->num_values + 1, sizeof(int64_t));
+        flat->values[flat->num_values] = n->num.value;
+        flat->nodes[index].aux = flat->num_values++;
+    } break;
+    case AST_fdecl:
+        set_num_params(b, index, n->fdecl.params.size);
+        push_name(b, index, n->fdecl.name, str_slice(), FLAT_NONE, 0);
+        flatten_array(b, &n->fdecl.params);
+        break;
+    case AST_fdef:
+        set_num_params(b, index, n->fdef.params.size);
+        b->flat->nodes[index].op = n->fdef.return_type;
+        push_name(b, index, n->fdef.name, str_slice(), FLAT_NONE, n->fdef.num_slots);
+        flatten_array(b, &n->fdef.params);
+        flatten_array(b, &n->fdef.body);
+        break;
+    case AST_fcall:
+        push_name(b, index, n->fcall.name, str_slice(), FLAT_NONE, 0);
+        flatten_array(b, &n->fcall.args);
+        break;
+    case AST_if:
+        flatten(b, n->ifdef.condition);
+        flatten(b, n->ifdef.if_true);
+        flatten_optional(b, n->ifdef.if_false);
+        break;
+    case AST_for:
+        flatten_optional(b, n->forloop.init);
+        flatten_optional(b, n->forloop.condition);
+        flatten_optional(b, n->forloop.update);
+        flatten(b, n->forloop.body);
+        break;
+    case AST_while: // fall-through
+    case AST_dowhile:
+        flatten(b, n->whileloop.condition);
+        flatten(b, n->whileloop.body);
+        break;
+    case AST_unop:
+        b->flat->nodes[index].op = n->unop.op;
+        flatten(b, n->unop.on);
+        break;
+    case AST_binop:
+        b->flat->nodes[index].op = n->binop.op;
+        b->flat->nodes[index].aux = n->binop.slot;
+        flatten(b, n->binop.left);
+        flatten(b, n->binop.right);
+        break;
+    case AST_terop:
+        flatten(b, n->terop.condition);
+        flatten(b, n->terop.if_true);
+        flatten(b, n->terop.if_false);
+        break;
+    case AST_break:
+    case AST_continue:
+    case AST_empty:
+        break;
+    default:
+        debug_break(); // new AST type?
+        b->ok = false;
+    }
+    b->flat->nodes[index].next = b->flat->num_nodes; // the table may have moved, index again
+}
+
+bool ast_flatten(const ASTNode* root, FlatAST* out)
+{
+    assert(out->nodes == NULL); // caller must init to 0 FlatAST
+    flat_builder b = {};
+    b.flat = out;
+    b.ok = true;
+    flatten(&b, root);
+    free(b.decls);
+    return b.ok;
+}
+
+void flat_free(FlatAST* flat)
+{
+    free(flat->nodes);
+    free(flat->origin);
+    free(flat->names);
+    free(flat->values);
+    *flat = FlatAST();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ACCESS
+uint32_t flat_child(const FlatAST* flat, uint32_t n, uint32_t k)
+{
+    uint32_t child = n + 1;
+    for (uint32_t i = 0; i < k; ++i)
+        child = flat->nodes[child].next;
+    assert(child < flat->nodes[n].next);
+    return flat->nodes[child].type == AST_UNKNOWN ? FLAT_NONE : child;
+}
+
+uint32_t flat_num_children(const FlatAST* flat, uint32_t n)
+{
+    uint32_t count = 0;
+    for (uint32_t child = n + 1; child < flat->nodes[n].next; child = flat->nodes[child].next)
+        ++count;
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// INFLATE
+struct inflater
+{
+    const FlatAST* flat;
+    ASTArena* arena;
+    ASTNode** built; // index -> new node, so uses can point at the new decls
+};
+
+static ASTNode* inflate(inflater* in, uint32_t n);
+
+static ASTNode* inflate_optional(inflater* in, uint32_t n)
+{
+    return in->flat->nodes[n].type == AST_UNKNOWN ? NULL : inflate(in, n);
+}
+
+// children of n from first up to the end of n, into an array
+static void inflate_array(inflater* in, uint32_t first, uint32_t end, ASTNodeArray* a)
+{
+    for (uint32_t child = first; child < end; child = in->flat->nodes[child].next)
+        astn_push(in->arena, a, inflate(in, child));
+}
+
+static ASTNode* inflate(inflater* in, uint32_t n)
+{
+    const FlatAST* flat = in->flat;
+    const FlatNode& fn = flat->nodes[n];
+    const uint32_t first = n + 1;
+    ASTNode node = {};
+    node.type = ASTType(fn.type);
+    switch (node.type)
+    {
+    case AST_program: inflate_array(in, first, fn.next, &node.program); break;
+    case AST_blocklist: inflate_array(in, first, fn.next, &node.blocklist); break;
+    case AST_ret: node.ret.expression = inflate_optional(in, first); break;
+    case AST_var:
+    {
+        const FlatName* name = flat_name(flat, n);
+        node.var.is_variable_declaration = (fn.flags & FLAT_declaration) != 0;
+        node.var.is_variable_assignment = (fn.flags & FLAT_assignment) != 0;
+        node.var.is_variable_usage = (fn.flags & FLAT_usage) != 0;
+        node.var.is_global = (fn.flags & FLAT_global) != 0;
+        node.var.slot = name->slot;
+        node.var.name = name->name;
+        node.var.debug_location = name->debug_location;
+        if (name->decl != FLAT_NONE && name->decl != n)
+            node.var.var_decl = in->built[name->decl];
+        if (!node.var.is_variable_declaration)
+        {
+            if (first < fn.next)
+                node.var.assign_expression = inflate(in, first);
+            break;
+        }
+
+        // a declaration is built before its initializer, which can see it
+        ASTNode* decl = ast_new(in->arena, node);
+        decl->var.var_decl = decl;
+        in->built[n] = decl;
+        if (first < fn.next)
+            decl->var.assign_expression = inflate(in, first);
+        return decl;
+    }
+    case AST_num: node.num.value = flat_value(flat, n); break;
+    case AST_fdecl:
+        node.fdecl.name = flat_name(flat, n)->name;
+        inflate_array(in, first, fn.next, &node.fdecl.params);
+        break;
+    case AST_fdef:
+    {
+        node.fdef.name = flat_name(flat, n)->name;
+        node.fdef.return_type = fn.op;
+        node.fdef.num_slots = flat_name(flat, n)->slot;
+        for (uint32_t i = first; i < fn.next; ++i) // temporaries are numbered in order, the count is one past the last
+            if (flat_type(flat, i) == AST_binop && flat->nodes[i].aux >= node.fdef.num_temps)
+                node.fdef.num_temps = flat->nodes[i].aux + 1;
+        uint32_t body = first;
+        for (uint32_t i = 0; i < fn.flags; ++i)
+            body = flat->nodes[body].next;
+        inflate_array(in, first, body, &node.fdef.params);
+        inflate_array(in, body, fn.next, &node.fdef.body);
+    } break;
+    case AST_fcall:
+        node.fcall.name = flat_name(flat, n)->name;
+        inflate_array(in, first, fn.next, &node.fcall.args);
+        break;
+    case AST_if:
+    {
+        const uint32_t if_true = flat->nodes[first].next;
+        node.ifdef.condition = inflate(in, first);
+        node.ifdef.if_true = inflate(in, if_true);
+        node.ifdef.if_false = inflate_optional(in, flat->nodes[if_true].next);
+    } break;
+    case AST_for:
+    {
+        const uint32_t condition = flat->nodes[first].next;
+        const uint32_t update = flat->nodes[condition].next;
+        node.forloop.init = inflate_optional(in, first);
+        node.forloop.condition = inflate_optional(in, condition);
+        node.forloop.update = inflate_optional(in, update);
+        node.forloop.body = inflate(in, flat->nodes[update].next);
+    } break;
+    case AST_while: // fall-through
+    case AST_dowhile:
+        node.whileloop.condition = inflate(in, first);
+        node.whileloop.body = inflate(in, flat->nodes[first].next);
+        break;
+    case AST_unop:
+        node.unop.op = fn.op;
+        node.unop.on = inflate(in, first);
+        break;
+    case AST_binop:
+        node.binop.op = fn.op;
+        node.binop.slot = fn.aux;
+        node.binop.left = inflate(in, first);
+        node.binop.right = inflate(in, flat->nodes[first].next);
+        break;
+    case AST_terop:
+    {
+        const uint32_t if_true = flat->nodes[first].next;
+        node.terop.condition = inflate(in, first);
+        node.terop.if_true = inflate(in, if_true);
+        node.terop.if_false = inflate(in, flat->nodes[if_true].next);
+    } break;
+    default:
+        break;
+    }
+
+    ASTNode* result = ast_new(in->arena, node);
+    in->built[n] = result;
+    return result;
+}
+
+ASTNode* ast_inflate(const FlatAST* flat, ASTArena* arena)
+{
+    if (flat->num_nodes == 0)
+        return NULL;
+    inflater in = {};
+    in.flat = flat;
+    in.arena = arena;
+    in.built = (ASTNode**)calloc(flat->num_nodes, sizeof(ASTNode*));
+    assert(in.built);
+    ASTNode* root = inflate(&in, 0);
+    free(in.built);
+    return root;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "ast.h"
+
+// Flat copy of an ASTNode tree: nodes in one array, in pre-order, addressed by 32-bit index. A node's children
+// follow it directly and `next` is the index just past its subtree, so the first child of n is n + 1, a child's
+// next is its sibling, and a pass that doesn't care about shape (counting a function's locals, checking every
+// var has a decl) is a plain loop from n + 1 to nodes[n].next.
+//
+// FlatNode is the hot part, 12 bytes whatever the type. Names, numbers and the ASTNode each index came from are
+// cold side tables so walking the tree doesn't drag them through the cache.
+//
+// Children by type, in order (absent optional children are kept as an AST_UNKNOWN placeholder so positions don't
+// shift):
+//   program, blocklist, fcall     every item / argument
+//   fdecl, fdef                   flags params, then (fdef) every body item
+//   ret                           expression or placeholder
+//   var                           assign expression, only if FLAT_assignment
+//   if, terop                     condition, if_true, if_false (placeholder when an if has no else)
+//   for                           init, condition, update, body (any of the first three may be placeholders)
+//   while, dowhile                condition, body
+//   unop                          on
+//   binop                         left, right
+//
+// Passes move over one at a time (interp runs on it): flat_origin gives back the ASTNode for anything still working
+// on the tree, and ast_inflate builds a whole ASTNode tree from a flat one.
+
+static const uint32_t FLAT_NONE = 0xFFFFFFFF;
+
+enum eFlatFlags : uint8_t
+{
+    FLAT_declaration = 1,
+    FLAT_assignment = 2,
+    FLAT_usage = 4,
+    FLAT_global = 8,
+};
+
+struct FlatNode
+{
+    uint8_t type; // ASTType
+    uint8_t flags; // eFlatFlags for AST_var, number of params for AST_fdecl/AST_fdef (ast_flatten fails past 255)
+    eToken op; // unop/binop operator, fdef return type
+    uint32_t next; // one past the last node of this subtree
+    uint32_t aux; // index into names (var, fdecl, fdef, fcall) or values (num), binop.slot for binops, FLAT_NONE otherwise
+};
+
+struct FlatName
+{
+    str name;
+    str_slice debug_location; // vars only
+    uint32_t decl; // vars only: node index of the declaring AST_var (itself for a declaration), FLAT_NONE if unresolved
+    uint32_t slot; // ASTNode::var.slot for vars, fdef.num_slots for fdefs
+};
+
+struct FlatAST
+{
+    FlatNode* nodes;
+    const ASTNode** origin; // the node each index was made from
+    uint32_t num_nodes;
+    uint32_t nodes_capacity;
+
+    FlatName* names;
+    uint32_t num_names;
+    uint32_t names_capacity;
+
+    int64_t* values;
+    uint32_t num_values;
+    uint32_t values_capacity;
+};
+
+bool ast_flatten(const ASTNode* root, FlatAST* out); // root goes at index 0, false if a var_decl is outside the tree or a function has too many params
+void flat_free(FlatAST* flat);
+ASTNode* ast_inflate(const FlatAST* flat, ASTArena* arena); // the tree again, var_decl pointers included
+
+inline ASTType flat_type(const FlatAST* flat, uint32_t n) { return ASTType(flat->nodes[n].type); }
+inline bool flat_has_children(const FlatAST* flat, uint32_t n) { return flat->nodes[n].next != n + 1; }
+inline uint32_t flat_next(const FlatAST* flat, uint32_t n) { return flat->nodes[n].next; }
+uint32_t flat_child(const FlatAST* flat, uint32_t n, uint32_t k); // k-th child by walking siblings, FLAT_NONE if a placeholder
+uint32_t flat_num_children(const FlatAST* flat, uint32_t n);
+inline const FlatName* flat_name(const FlatAST* flat, uint32_t n) { return &flat->names[flat->nodes[n].aux]; }
+inline int64_t flat_value(const FlatAST* flat, uint32_t n) { return flat->values[flat->nodes[n].aux]; }
+inline const ASTNode* flat_origin(const FlatAST* flat, uint32_t n) { return flat->origin[n]; }
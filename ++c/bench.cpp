@@ -0,0 +1,1072 @@
+#include "bench.h"
+#include "lex.h"
+#include "ast.h"
+#include "interp.h"
+#include "preprocess.h"
+#include "scan.h"
+#include "strings.h"
+#include "timer.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+
+static void print_bench(const char* name, float ms, size_t bytes)
+{
+    double mb = bytes / (1024.0 * 1024.0);
+    printf("  %-40s %10.2fms %10.2fMB/s\n", name, ms, ms > 0.0f ? mb / (ms / 1000.0) : 0.0);
+}
+
+static bool bench_lex_unique_identifiers(uint32_t count)
+{
+    // "int v0;\nint v1;\n..." - every identifier is new, so every one of them goes down the insert path of the interner.
+    std::string src;
+    src.reserve(size_t(count) * 14);
+    char line[32];
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        int len = sprintf_s(line, "int v%u;\n", i);
+        src.append(line, len);
+    }
+
+    uint32_t strings_before = strings_count();
+
+    LexInput lexin = init_lex("bench_unique_identifiers", src.data(), src.size());
+    LexOutput lexout = {};
+    Timer timer;
+    timer.start();
+    bool ok = lex(&lexin, &lexout);
+    timer.end();
+    if (!ok)
+    {
+        printf("  lex failed: %s\n", lexout.failure_reason);
+        debug_break();
+        return false;
+    }
+
+    char name[64];
+    sprintf_s(name, "lex %u unique identifiers", count);
+    print_bench(name, timer.milliseconds(), src.size());
+    printf("  %-40s %10" PRIu64 " tokens, %u new strings\n", "", lexout.num_tokens, strings_count() - strings_before);
+
+    free(lexout.tokens);
+    return true;
+}
+
+// code-shaped input: comments, indentation, long identifiers and long numbers. Parses, so it works for
+// the ast benchmarks too.
+static std::string make_function_source(uint32_t copies)
+{
+    static const char kFunction[] =
+        "// line comment for function %u with a few words in it\n"
+        "int function_number_%u(int first_argument, int second_argument)\n"
+        "{\n"
+        "    /* block comment\n"
+        "       spanning a couple of lines */\n"
+        "    int local_value = 1234567890123 * first_argument;\n"
+        "    if (local_value >= 42 && second_argument != 7)\n"
+        "    {\n"
+        "        return local_value + 'c';\n"
+        "    }\n"
+        "    return second_argument - 987654321;\n"
+        "}\n"
+        "\n";
+
+    std::string src;
+    src.reserve(size_t(copies) * sizeof(kFunction));
+    char chunk[sizeof(kFunction) + 32];
+    for (uint32_t i = 0; i < copies; ++i)
+    {
+        int len = sprintf_s(chunk, kFunction, i, i);
+        src.append(chunk, len);
+    }
+    return src;
+}
+
+static bool bench_lex_scan_levels(uint32_t copies)
+{
+    std::string src = make_function_source(copies);
+
+    const eScanLevel original = scan_level();
+    LexInput lexin = init_lex("bench_scan_levels", src.data(), src.size());
+    LexOutput reference = {};
+    bool ok = true;
+    for (int level = SCAN_SCALAR; level <= scan_best_level(); ++level)
+    {
+        scan_set_level(eScanLevel(level));
+
+        // best of a few runs, the first one also pays for faulting in the token array
+        LexOutput lexout = {};
+        float best_ms = 0.0f;
+        for (int run = 0; run < 3 && ok; ++run)
+        {
+            free(lexout.tokens);
+            lexout = LexOutput();
+            Timer timer;
+            timer.start();
+            bool lexed = lex(&lexin, &lexout);
+            timer.end();
+            if (!lexed)
+            {
+                printf("  lex failed: %s\n", lexout.failure_reason);
+                debug_break();
+                ok = false;
+            }
+            if (run == 0 || timer.milliseconds() < best_ms)
+                best_ms = timer.milliseconds();
+        }
+        if (!ok)
+            break;
+
+        char name[64];
+        sprintf_s(name, "lex %u functions [%s]", copies, scan_level_name(eScanLevel(level)));
+        print_bench(name, best_ms, src.size());
+
+        // scalar is the reference, every other level must match it exactly
+        if (level == SCAN_SCALAR)
+        {
+            reference = lexout;
+            continue;
+        }
+        bool same = lexout.num_tokens == reference.num_tokens;
+        for (uint64_t i = 0; same && i < lexout.num_tokens; ++i)
+            same = token_equal(lexout.tokens[i], reference.tokens[i]);
+        if (!same)
+        {
+            printf("  %s tokens differ from scalar!\n", scan_level_name(eScanLevel(level)));
+            debug_break();
+            ok = false;
+        }
+        free(lexout.tokens);
+    }
+    free(reference.tokens);
+    scan_set_level(original);
+    return ok;
+}
+
+static bool bench_ast_array_vs_stream(uint32_t copies)
+{
+    std::string src = make_function_source(copies);
+    LexInput lexin = init_lex("bench_ast_array_vs_stream", src.data(), src.size());
+    char name[64];
+
+    // lex() everything, strip comments into a second array, then parse
+    {
+        Timer timer;
+        timer.start();
+        LexOutput raw = {};
+        LexOutput stripped = {};
+        ASTOut out = {};
+        bool ok = lex(&lexin, &raw);
+        if (ok)
+        {
+            lex_strip_comments(&raw, &stripped);
+            ok = ast(stripped.tokens, stripped.num_tokens, &out);
+        }
+        timer.end();
+        if (!ok)
+        {
+            printf("  array parse failed\n");
+            debug_break();
+            return false;
+        }
+
+        sprintf_s(name, "ast %u functions [token array]", copies);
+        print_bench(name, timer.milliseconds(), src.size());
+        printf("  %-40s %10" PRIu64 " bytes of tokens\n", "", (raw.num_tokens + stripped.num_tokens) * sizeof(Token));
+        free(raw.tokens);
+        free(stripped.tokens);
+        ast_free(&out);
+    }
+
+    // pull tokens through a LexStream as the parser goes
+    {
+        LexStream* stream = (LexStream*)malloc(sizeof(LexStream));
+        lex_stream_init(stream, &lexin, true);
+        ASTOut out = {};
+        Timer timer;
+        timer.start();
+        bool ok = ast(stream, &out);
+        timer.end();
+        lex_stream_close(stream);
+        free(stream);
+        if (!ok)
+        {
+            printf("  stream parse failed\n");
+            debug_break();
+            return false;
+        }
+
+        sprintf_s(name, "ast %u functions [lex stream]", copies);
+        print_bench(name, timer.milliseconds(), src.size());
+        printf("  %-40s %10zu bytes of tokens\n", "", sizeof(LexStream));
+        ast_free(&out);
+    }
+    return true;
+}
+
+// parse only (tokens are lexed up front, untimed) so the difference is the parser reading an array of Tokens
+// vs the SoA TokenBuffer's type array.
+static bool bench_ast_token_layouts(uint32_t copies)
+{
+    std::string src = make_function_source(copies);
+    LexInput lexin = init_lex("bench_ast_token_layouts", src.data(), src.size());
+    char name[64];
+
+    LexOutput raw = {};
+    LexOutput stripped = {};
+    TokenBuffer buffer = {};
+    if (!lex(&lexin, &raw) || !lex(&lexin, &buffer, true))
+    {
+        printf("  lex failed\n");
+        debug_break();
+        return false;
+    }
+    lex_strip_comments(&raw, &stripped);
+    free(raw.tokens);
+
+    float array_ms = 1e30f;
+    float buffer_ms = 1e30f;
+    for (int run = 0; run < 3; ++run)
+    {
+        ASTOut array_out = {};
+        Timer timer;
+        timer.start();
+        bool ok = ast(stripped.tokens, stripped.num_tokens, &array_out);
+        timer.end();
+        if (timer.milliseconds() < array_ms)
+            array_ms = timer.milliseconds();
+
+        ASTOut buffer_out = {};
+        timer.start();
+        ok = ok && ast(&buffer, &buffer_out);
+        timer.end();
+        if (timer.milliseconds() < buffer_ms)
+            buffer_ms = timer.milliseconds();
+        ast_free(&array_out);
+        ast_free(&buffer_out);
+
+        if (!ok)
+        {
+            printf("  parse failed\n");
+            debug_break();
+            return false;
+        }
+    }
+
+    const uint64_t buffer_bytes = buffer.count * (sizeof(eToken) + 4 * sizeof(uint32_t))
+        + buffer.num_identifiers * sizeof(str)
+        + buffer.num_numbers * sizeof(uint64_t)
+        + buffer.num_strings * sizeof(str_slice);
+
+    sprintf_s(name, "parse %u functions [Token array]", copies);
+    print_bench(name, array_ms, src.size());
+    printf("  %-40s %10" PRIu64 " bytes of tokens\n", "", stripped.num_tokens * sizeof(Token));
+    sprintf_s(name, "parse %u functions [TokenBuffer]", copies);
+    print_bench(name, buffer_ms, src.size());
+    printf("  %-40s %10" PRIu64 " bytes of tokens\n", "", buffer_bytes);
+
+    free(stripped.tokens);
+    token_buffer_free(&buffer);
+    return true;
+}
+
+// finding every top-level item: stepping over each parameter list and body with the bracket index (see
+// TokenStream::skip_group) vs parsing all of it. The skip only reads the tokens between one body and the next.
+static bool bench_skip_function_bodies(uint32_t copies)
+{
+    std::string src = make_function_source(copies);
+    LexInput lexin = init_lex("bench_skip_function_bodies", src.data(), src.size());
+    char name[64];
+
+    Timer timer;
+    timer.start();
+    TokenBuffer buffer = {};
+    bool ok = lex(&lexin, &buffer, true);
+    timer.end();
+    if (!ok)
+    {
+        printf("  lex failed: %s\n", buffer.failure_reason);
+        debug_break();
+        token_buffer_free(&buffer);
+        return false;
+    }
+    sprintf_s(name, "lex %u functions + brackets", copies);
+    print_bench(name, timer.milliseconds(), src.size());
+
+    // int name ( ... ) { ... }
+    uint32_t found = 0;
+    timer.start();
+    TokenStream ts = token_stream(&buffer);
+    while (!ts.at_end())
+    {
+        ts.advance(2);
+        ts.skip_group();
+        if (ts.type() == eToken::open_curly)
+            ts.skip_group();
+        else
+            ts.advance();
+        ++found;
+    }
+    timer.end();
+    sprintf_s(name, "skip %u function bodies", copies);
+    print_bench(name, timer.milliseconds(), src.size());
+
+    ASTOut out = {};
+    timer.start();
+    ok = ast(&buffer, &out) && out.root->program.size == found;
+    timer.end();
+    sprintf_s(name, "parse %u function bodies", copies);
+    print_bench(name, timer.milliseconds(), src.size());
+    ast_free(&out);
+    token_buffer_free(&buffer);
+    if (!ok || found != copies)
+    {
+        printf("  skipping found %u functions, expected %u\n", found, copies);
+        debug_break();
+        return false;
+    }
+    return true;
+}
+
+// parse only, serial ast() vs ast_parallel on a growing number of threads. Every tree must have as many nodes as the
+// serial one.
+static bool bench_ast_parallel(uint32_t copies)
+{
+    std::string src = make_function_source(copies);
+    LexInput lexin = init_lex("bench_ast_parallel", src.data(), src.size());
+    char name[64];
+
+    LexOutput raw = {};
+    LexOutput stripped = {};
+    BracketIndex brackets = {};
+    if (!lex(&lexin, &raw))
+    {
+        printf("  lex failed\n");
+        debug_break();
+        return false;
+    }
+    lex_strip_comments(&raw, &stripped);
+    free(raw.tokens);
+    bool ok = lex_match_brackets(stripped.tokens, stripped.num_tokens, &brackets);
+
+    ASTOut reference = {};
+    Timer timer;
+    timer.start();
+    ok = ok && ast(stripped.tokens, stripped.num_tokens, &reference);
+    timer.end();
+    sprintf_s(name, "parse %u functions [serial]", copies);
+    print_bench(name, timer.milliseconds(), src.size());
+
+    for (uint32_t threads = 2; ok && threads <= 16; threads *= 2)
+    {
+        float best_ms = 1e30f;
+        for (int run = 0; ok && run < 3; ++run)
+        {
+            ASTOut out = {};
+            timer.start();
+            ok = ast_parallel(stripped.tokens, stripped.num_tokens, brackets.matches, threads, &out);
+            timer.end();
+            if (timer.milliseconds() < best_ms)
+                best_ms = timer.milliseconds();
+            ok = ok && out.arena.num_nodes == reference.arena.num_nodes;
+            ast_free(&out);
+        }
+
+        sprintf_s(name, "parse %u functions [%u threads]", copies, threads);
+        print_bench(name, best_ms, src.size());
+    }
+    ast_free(&reference);
+    bracket_index_free(&brackets);
+    free(stripped.tokens);
+
+    if (!ok)
+    {
+        printf("  parallel parse doesn't match serial\n");
+        debug_break();
+    }
+    printf("  %-40s %10u hardware threads\n", "", std::thread::hardware_concurrency());
+    return ok;
+}
+
+// a big file where main calls two functions: full ast() against ast_lazy plus what main reaches. Both must run to
+// the same result.
+static bool bench_ast_lazy(uint32_t copies)
+{
+    std::string src = make_function_source(copies);
+    src += "int main()\n{\n    return function_number_0(5, 7) + function_number_1(50, 7);\n}\n";
+    LexInput lexin = init_lex("bench_ast_lazy", src.data(), src.size());
+    char name[64];
+
+    LexOutput raw = {};
+    LexOutput stripped = {};
+    BracketIndex brackets = {};
+    if (!lex(&lexin, &raw))
+    {
+        printf("  lex failed\n");
+        debug_break();
+        return false;
+    }
+    lex_strip_comments(&raw, &stripped);
+    free(raw.tokens);
+    bool ok = lex_match_brackets(stripped.tokens, stripped.num_tokens, &brackets);
+
+    ASTOut full = {};
+    Timer timer;
+    timer.start();
+    ok = ok && ast(stripped.tokens, stripped.num_tokens, &full);
+    timer.end();
+    sprintf_s(name, "parse %u functions [all bodies]", copies + 1);
+    print_bench(name, timer.milliseconds(), src.size());
+
+    ASTOut lazy = {};
+    timer.start();
+    ok = ok && ast_lazy(stripped.tokens, stripped.num_tokens, brackets.matches, &lazy) && ast_materialize_reachable(&lazy);
+    timer.end();
+    sprintf_s(name, "parse %u functions [lazy, from main]", copies + 1);
+    print_bench(name, timer.milliseconds(), src.size());
+    printf("  %-40s %10" PRIu64 " bodies parsed, %" PRIu64 " skipped, %" PRIu64 " vs %" PRIu64 " nodes\n", "",
+        lazy.bodies_parsed, lazy.bodies_skipped, lazy.arena.num_nodes, full.arena.num_nodes);
+
+    int64_t full_result = 0;
+    int64_t lazy_result = 0;
+    ok = ok && lazy.bodies_parsed == 3 && interp_return_value(full.root, &full_result)
+        && interp_return_value(&lazy, &lazy_result) && full_result == lazy_result;
+    ast_free(&lazy);
+    ast_free(&full);
+    bracket_index_free(&brackets);
+    free(stripped.tokens);
+
+    if (!ok)
+    {
+        printf("  lazy parse doesn't run the same as the full one\n");
+        debug_break();
+    }
+    return ok;
+}
+
+// what one tree costs in allocations: mallocs per node (arena blocks, see ast_alloc.h), bytes handed out, what the
+// parse did to the working set, and how long throwing the whole tree away takes.
+static bool bench_ast_arena(uint32_t copies)
+{
+    std::string src = make_function_source(copies);
+    LexInput lexin = init_lex("bench_ast_arena", src.data(), src.size());
+    char name[64];
+
+    LexOutput raw = {};
+    LexOutput stripped = {};
+    if (!lex(&lexin, &raw))
+    {
+        printf("  lex failed\n");
+        debug_break();
+        return false;
+    }
+    lex_strip_comments(&raw, &stripped);
+    free(raw.tokens);
+
+    uint64_t rss_before, peak_before;
+    process_memory(&rss_before, &peak_before);
+    ASTOut out = {};
+    Timer timer;
+    timer.start();
+    bool ok = ast(stripped.tokens, stripped.num_tokens, &out);
+    timer.end();
+    uint64_t rss_after, peak_after;
+    process_memory(&rss_after, &peak_after);
+    free(stripped.tokens);
+    if (!ok)
+    {
+        printf("  parse failed\n");
+        debug_break();
+        ast_free(&out);
+        return false;
+    }
+
+    const ASTArena& arena = out.arena;
+    sprintf_s(name, "parse %u functions [arena]", copies);
+    print_bench(name, timer.milliseconds(), src.size());
+    printf("  %-40s %10" PRIu64 " nodes, %.4f mallocs per node\n", "", arena.num_nodes,
+        arena.num_nodes ? double(arena.num_blocks) / double(arena.num_nodes) : 0.0);
+    printf("  %-40s %10" PRIu64 " bytes in %" PRIu64 " blocks\n", "", arena.bytes_used, arena.num_blocks);
+    printf("  %-40s %10" PRIu64 " KB working set added, %" PRIu64 " KB peak\n", "",
+        (rss_after > rss_before ? rss_after - rss_before : 0) / 1024, peak_after / 1024);
+
+    timer.start();
+    ast_free(&out);
+    timer.end();
+    sprintf_s(name, "free %u functions' tree", copies);
+    printf("  %-40s %10.2fms\n", name, timer.milliseconds());
+    return true;
+}
+
+// copies functions each returning a terms operand expression, cycling through every binary operator so each
+// precedence level is entered and left over and over. Chains lean left as deep as they are long, so they're kept
+// short enough for the recursive passes after the parse.
+static std::string make_expression_chain_source(uint32_t copies, uint32_t terms)
+{
+    static const char* kOps[] = { " + ", " * ", " - ", " / ", " % ", " < ", " >= ", " == ", " != ", " && ", " || ", " > ", " <= " };
+    std::string src;
+    src.reserve(size_t(copies) * terms * 8);
+    char chunk[64];
+    for (uint32_t c = 0; c < copies; ++c)
+    {
+        int len = sprintf_s(chunk, "int chain_%u(int a)\n{\n    return a", c);
+        src.append(chunk, len);
+        for (uint32_t i = 1; i < terms; ++i)
+        {
+            src += kOps[i % (sizeof(kOps) / sizeof(kOps[0]))];
+            len = sprintf_s(chunk, i & 1 ? "a" : "%u", i % 1000 + 1);
+            src.append(chunk, len);
+        }
+        src += ";\n}\n";
+    }
+    return src;
+}
+
+// copies functions each returning depth nested parens, (1 + (2 * (3 - (... a ...)))), a ?: every so often
+static std::string make_nested_parens_source(uint32_t copies, uint32_t depth)
+{
+    static const char* kOps[] = { " + ", " * ", " - ", " == ", " && " };
+    std::string src;
+    char chunk[64];
+    for (uint32_t c = 0; c < copies; ++c)
+    {
+        int len = sprintf_s(chunk, "int nested_%u(int a)\n{\n    return ", c);
+        src.append(chunk, len);
+        for (uint32_t d = 0; d < depth; ++d)
+        {
+            len = d % 16 == 15 ? sprintf_s(chunk, "(a ? %u : ", d) : sprintf_s(chunk, "(%u%s", d, kOps[d % 5]);
+            src.append(chunk, len);
+        }
+        src += "a";
+        src.append(depth, ')');
+        src += ";\n}\n";
+    }
+    return src;
+}
+
+// parse only, best of 3, tokens lexed up front
+static bool bench_parse_only(const char* label, const std::string& src)
+{
+    LexInput lexin = init_lex(label, src.data(), src.size());
+    LexOutput tokens = {};
+    if (!lex(&lexin, &tokens))
+    {
+        printf("  lex failed\n");
+        debug_break();
+        return false;
+    }
+
+    float best_ms = 1e30f;
+    for (int run = 0; run < 3; ++run)
+    {
+        ASTOut out = {};
+        Timer timer;
+        timer.start();
+        bool ok = ast(tokens.tokens, tokens.num_tokens, &out);
+        timer.end();
+        ast_free(&out);
+        if (!ok)
+        {
+            printf("  parse failed\n");
+            debug_break();
+            free(tokens.tokens);
+            return false;
+        }
+        if (timer.milliseconds() < best_ms)
+            best_ms = timer.milliseconds();
+    }
+
+    print_bench(label, best_ms, src.size());
+    printf("  %-40s %10" PRIu64 " tokens, %.1fns per token\n", "", tokens.num_tokens,
+        tokens.num_tokens ? best_ms * 1e6 / double(tokens.num_tokens) : 0.0);
+    free(tokens.tokens);
+    return true;
+}
+
+// expression-heavy input for the binding power loop in ast.cpp: long flat chains, then deeply nested
+// parenthesized expressions
+static bool bench_ast_expressions(uint32_t copies, uint32_t terms, uint32_t depth)
+{
+    char name[64];
+    sprintf_s(name, "parse %u x %u term chains", copies, terms);
+    bool ok = bench_parse_only(name, make_expression_chain_source(copies, terms));
+    sprintf_s(name, "parse %u x %u deep parens", copies, depth);
+    ok = ok && bench_parse_only(name, make_nested_parens_source(copies, depth));
+    return ok;
+}
+
+// main nesting depth levels of one construct: before, the opens, something in the middle, the closes, after
+static std::string make_deep_nesting_source(uint32_t depth, const char* before, const char* open, const char* middle,
+    const char* close, const char* after)
+{
+    std::string src = "int main()\n{\n    ";
+    src += before;
+    for (uint32_t i = 0; i < depth; ++i)
+        src += open;
+    src += middle;
+    for (uint32_t i = 0; i < depth; ++i)
+        src += close;
+    src += after;
+    src += "\n    return 0;\n}\n";
+    return src;
+}
+
+// pathological nesting: at the default ast_max_depth() the parse has to fail with an error rather than take the
+// process down, with the limit raised it has to go all the way through. Either way it's only heap.
+static bool bench_ast_deep_nesting(uint32_t depth)
+{
+    struct { const char* label; std::string src; } cases[] = {
+        { "parens", make_deep_nesting_source(depth, "return ", "(", "1", ")", ";") },
+        { "ifs", make_deep_nesting_source(depth, "", "if (1) ", "return 1;", "", "") },
+        { "blocks", make_deep_nesting_source(depth, "", "{", "return 1;", "}", "") },
+    };
+
+    bool ok = true;
+    char name[64];
+    for (const auto& c : cases)
+    {
+        LexInput lexin = init_lex(c.label, c.src.data(), c.src.size());
+        LexOutput tokens = {};
+        if (!lex(&lexin, &tokens))
+        {
+            printf("  lex failed\n");
+            debug_break();
+            return false;
+        }
+
+        for (uint32_t limit : { 0u, depth * 3 })
+        {
+            ast_set_max_depth(limit);
+            ASTOut out = {};
+            Timer timer;
+            timer.start();
+            bool parsed = ast(tokens.tokens, tokens.num_tokens, &out);
+            timer.end();
+
+            sprintf_s(name, "parse %u nested %s [limit %u]", depth, c.label, ast_max_depth());
+            print_bench(name, timer.milliseconds(), c.src.size());
+            printf("  %-40s %10u frames deep, %s\n", "", out.deepest, parsed ? "parsed" : out.failure_reason);
+            ok = ok && parsed == (limit != 0) && (parsed || out.failure_reason);
+            ast_free(&out);
+        }
+        ast_set_max_depth(0);
+        free(tokens.tokens);
+    }
+
+    if (!ok)
+    {
+        printf("  deep nesting didn't stop at the limit or didn't get through without it\n");
+        debug_break();
+    }
+    return ok;
+}
+
+// one function, locals declared in blocks nested depth deep, each initialized from a local declared much further
+// out and the one just before it, so a lookup can't stop near the top of the scope
+static std::string make_many_locals_source(uint32_t locals, uint32_t depth)
+{
+    std::string src = "int main()\n{\n    int v0 = 1;\n";
+    src.reserve(size_t(locals) * 32);
+    const uint32_t per_block = locals / depth;
+    char chunk[96];
+    for (uint32_t i = 1; i < locals; ++i)
+    {
+        if (i % per_block == 0)
+            src += "{\n";
+        int len = sprintf_s(chunk, "    int v%u = v%u + v%u;\n", i, i / 7, i - 1);
+        src.append(chunk, len);
+    }
+    src += "    return v0;\n";
+    for (uint32_t i = 1; i < locals; ++i)
+    {
+        if (i % per_block == 0)
+            src += "}\n";
+    }
+    src += "}\n";
+    return src;
+}
+
+// name resolution with many declarations in scope: every use is resolved against thousands of live locals
+static bool bench_ast_many_locals(uint32_t locals, uint32_t depth)
+{
+    char name[64];
+    sprintf_s(name, "parse %u locals %u blocks deep", locals, depth);
+    return bench_parse_only(name, make_many_locals_source(locals, depth));
+}
+
+// one-line edits in the middle of a ~50k line file: incremental update vs lexing and parsing it all again
+static bool bench_incremental_edit(uint32_t lines)
+{
+    const uint32_t copies = lines / 13; // lines per function in make_function_source
+    std::string src = make_function_source(copies);
+    LexInput lexin = init_lex("bench_incremental_edit", src.data(), src.size());
+    char name[64];
+
+    LexOutput raw = {};
+    LexOutput tokens = {};
+    ASTOut tree = {};
+    bool parsed = lex(&lexin, &raw);
+    lex_strip_comments(&raw, &tokens);
+    parsed = parsed && ast(tokens.tokens, tokens.num_tokens, &tree);
+    if (!parsed)
+    {
+        printf("  initial parse failed\n");
+        debug_break();
+        return false;
+    }
+    free(raw.tokens);
+
+    // each edit changes the constant on a "return second_argument - 987654321;" line, different function each time
+    const int kEdits = 16;
+    float incremental_ms = 1e30f;
+    float full_ms = 1e30f;
+    std::string edited = src;
+    for (int e = 0; e < kEdits; ++e)
+    {
+        const char* old_source = edited.data(); // tokens point here, replace() may move the text
+        size_t at = edited.find("987654321;", edited.size() / 4 + size_t(e) * (edited.size() / (2 * kEdits)));
+        if (at == std::string::npos)
+            return false;
+        edited.replace(at, 9, "42");
+        LexInput edited_in = init_lex("bench_incremental_edit", edited.data(), edited.size());
+        SourceEdit edit = { at, at + 9, 2 };
+
+        Timer timer;
+        timer.start();
+        TokenEdit changed = {};
+        bool ok = lex_incremental(&edited_in, old_source, &edit, true, &tokens, &changed)
+            && ast_incremental(tokens.tokens, tokens.num_tokens, &changed, &tree);
+        timer.end();
+        if (timer.milliseconds() < incremental_ms)
+            incremental_ms = timer.milliseconds();
+
+        LexOutput full_raw = {};
+        LexOutput full = {};
+        ASTOut full_tree = {};
+        timer.start();
+        ok = ok && lex(&edited_in, &full_raw);
+        lex_strip_comments(&full_raw, &full);
+        ok = ok && ast(full.tokens, full.num_tokens, &full_tree);
+        timer.end();
+        if (timer.milliseconds() < full_ms)
+            full_ms = timer.milliseconds();
+
+        ok = ok && full.num_tokens == tokens.num_tokens && full_tree.root->program.size == tree.root->program.size;
+        free(full_raw.tokens);
+        free(full.tokens);
+        ast_free(&full_tree);
+        if (!ok)
+        {
+            printf("  incremental edit %d failed\n", e);
+            debug_break();
+            return false;
+        }
+    }
+
+    sprintf_s(name, "edit 1 line of %u [incremental]", lines);
+    print_bench(name, incremental_ms, src.size());
+    sprintf_s(name, "edit 1 line of %u [full re-parse]", lines);
+    print_bench(name, full_ms, src.size());
+
+    free(tokens.tokens);
+    ast_free(&tree);
+    return true;
+}
+
+// lex() vs lex_parallel at 1..16 chunks (one thread each), checking every run stitches back to the same tokens
+static bool bench_lex_parallel(uint32_t copies)
+{
+    std::string src = make_function_source(copies);
+    LexInput lexin = init_lex("bench_lex_parallel", src.data(), src.size());
+    char name[64];
+
+    LexOutput reference = {};
+    Timer timer;
+    timer.start();
+    bool ok = lex(&lexin, &reference);
+    timer.end();
+    sprintf_s(name, "lex %u functions [serial]", copies);
+    print_bench(name, timer.milliseconds(), src.size());
+
+    for (uint32_t chunks = 1; ok && chunks <= 16; chunks *= 2)
+    {
+        float best_ms = 1e30f;
+        for (int run = 0; ok && run < 3; ++run)
+        {
+            LexOutput out = {};
+            timer.start();
+            ok = lex_parallel(&lexin, &out, chunks);
+            timer.end();
+            if (timer.milliseconds() < best_ms)
+                best_ms = timer.milliseconds();
+
+            ok = ok && out.num_tokens == reference.num_tokens;
+            for (uint64_t i = 0; ok && i < out.num_tokens; ++i)
+                ok = token_equal(out.tokens[i], reference.tokens[i]);
+            free(out.tokens);
+        }
+
+        sprintf_s(name, "lex %u functions [%u chunks]", copies, chunks);
+        print_bench(name, best_ms, src.size());
+    }
+    free(reference.tokens);
+
+    if (!ok)
+    {
+        printf("  parallel lex doesn't match serial\n");
+        debug_break();
+    }
+    printf("  %-40s %10u hardware threads\n", "", std::thread::hardware_concurrency());
+    return ok;
+}
+
+// a header of count #defines in groups of four (constant, function-like, one calling another, an alias of a
+// function-like macro), then one use of each group. Preprocess only (lexing is untimed) from the lex() array,
+// then lexing and preprocessing together through a LexStream, which pulls macro arguments as it goes.
+static bool bench_preprocess_macros(uint32_t count)
+{
+    std::string src;
+    src.reserve(size_t(count) * 64);
+    char line[160];
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        int len = 0;
+        switch (i % 4)
+        {
+        case 0: len = sprintf_s(line, "#define MACRO_CONSTANT_%u %u\n", i, i); break;
+        case 1: len = sprintf_s(line, "#define MACRO_SUM_%u(a, b) ((a) + (b) + MACRO_CONSTANT_%u)\n", i, i - 1); break;
+        case 2: len = sprintf_s(line, "#define MACRO_NESTED_%u(x) MACRO_SUM_%u(x, MACRO_CONSTANT_%u)\n", i, i - 1, i - 2); break;
+        case 3: len = sprintf_s(line, "#define MACRO_ALIAS_%u MACRO_NESTED_%u\n", i, i - 1); break;
+        }
+        src.append(line, len);
+    }
+    for (uint32_t i = 3; i < count; i += 4)
+    {
+        int len = sprintf_s(line, "int use_%u = MACRO_ALIAS_%u(%u);\n", i, i, i);
+        src.append(line, len);
+    }
+
+    LexInput lexin = init_lex("bench_preprocess_macros", src.data(), src.size());
+    LexOutput raw = {};
+    if (!lex(&lexin, &raw))
+    {
+        printf("  lex failed: %s\n", raw.failure_reason);
+        debug_break();
+        return false;
+    }
+
+    char name[64];
+    LexOutput expanded = {};
+    Preprocessor pp;
+    preprocess_init(&pp);
+    Timer timer;
+    timer.start();
+    bool ok = preprocess(&pp, &lexin, &raw, &expanded);
+    timer.end();
+    preprocess_free(&pp);
+    if (!ok)
+    {
+        printf("  preprocess failed: %s\n", pp.failure_reason);
+        debug_break();
+        free(raw.tokens);
+        return false;
+    }
+    sprintf_s(name, "preprocess %u macros [token array]", count);
+    print_bench(name, timer.milliseconds(), src.size());
+    printf("  %-40s %10" PRIu64 " tokens in, %" PRIu64 " out\n", "", raw.num_tokens, expanded.num_tokens);
+
+    LexStream* stream = (LexStream*)malloc(sizeof(LexStream));
+    preprocess_init(&pp);
+    lex_stream_init(stream, &lexin, true);
+    stream->pp = &pp;
+    uint64_t streamed = 0;
+    timer.start();
+    while (next_token(stream))
+        ++streamed;
+    timer.end();
+    ok = !stream->failure_reason && streamed == expanded.num_tokens;
+    lex_stream_close(stream);
+    free(stream);
+    preprocess_free(&pp);
+    sprintf_s(name, "lex+preprocess %u macros [lex stream]", count);
+    print_bench(name, timer.milliseconds(), src.size());
+
+    free(raw.tokens);
+    free(expanded.tokens);
+    if (!ok)
+    {
+        printf("  streamed expansion doesn't match the token array\n");
+        debug_break();
+    }
+    return ok;
+}
+
+// an #if 0 around code-shaped input. Through a LexStream the group is skipped by the line-start # scanner
+// without being lexed, compared against lexing the same text. From a lex() array it's a binary search.
+static bool bench_preprocess_skip(uint32_t copies)
+{
+    std::string src = "#if 0\n";
+    src += make_function_source(copies);
+    src += "#endif\nint after_the_group;\n";
+    LexInput lexin = init_lex("bench_preprocess_skip", src.data(), src.size());
+    char name[64];
+
+    LexOutput raw = {};
+    Timer timer;
+    timer.start();
+    bool ok = lex(&lexin, &raw);
+    timer.end();
+    sprintf_s(name, "lex %u functions in #if 0", copies);
+    print_bench(name, timer.milliseconds(), src.size());
+
+    if (ok)
+    {
+        LexOutput expanded = {};
+        Preprocessor pp;
+        preprocess_init(&pp);
+        timer.start();
+        ok = preprocess(&pp, &lexin, &raw, &expanded);
+        timer.end();
+        preprocess_free(&pp);
+        ok = ok && expanded.num_tokens == 3;
+        sprintf_s(name, "skip %u functions [token array]", copies);
+        print_bench(name, timer.milliseconds(), src.size());
+        free(expanded.tokens);
+    }
+    free(raw.tokens);
+
+    if (ok)
+    {
+        LexStream* stream = (LexStream*)malloc(sizeof(LexStream));
+        Preprocessor pp;
+        preprocess_init(&pp);
+        lex_stream_init(stream, &lexin, true);
+        stream->pp = &pp;
+        uint64_t streamed = 0;
+        timer.start();
+        while (next_token(stream))
+            ++streamed;
+        timer.end();
+        ok = !stream->failure_reason && streamed == 3;
+        lex_stream_close(stream);
+        free(stream);
+        preprocess_free(&pp);
+        sprintf_s(name, "skip %u functions [lex stream]", copies);
+        print_bench(name, timer.milliseconds(), src.size());
+    }
+
+    if (!ok)
+    {
+        printf("  skipping the #if 0 group failed\n");
+        debug_break();
+    }
+    return ok;
+}
+
+struct intern_worker
+{
+    const std::string* names; // null-separated
+    const uint32_t* offsets;
+    uint32_t num_names;
+    uint32_t rounds;
+    uint32_t thread_index;
+    const char** results; // what the last round got for each shared name
+};
+
+static void intern_worker_run(intern_worker* w)
+{
+    // every round looks up the shared names again, and inserts one name only this thread uses so the shard locks see
+    // traffic too. In the first pass the first round races the other threads to insert the shared names.
+    char unique[32];
+    for (uint32_t round = 0; round < w->rounds; ++round)
+    {
+        for (uint32_t i = 0; i < w->num_names; ++i)
+            w->results[i] = strings_insert_nts(w->names->data() + w->offsets[i]).nts;
+        sprintf_s(unique, "intern_t%u_r%u", w->thread_index, round);
+        strings_insert_nts(unique);
+    }
+}
+
+// the interner from 32 threads at once, all looking up the same names, then the same work from 1 thread. Checks every
+// thread was handed the same pointer for each name, which is what lets interp/gen compare strings by address.
+static bool bench_strings_contention(uint32_t num_names, uint32_t rounds)
+{
+    static const uint32_t kThreads = 32;
+    char name[64];
+    std::string names;
+    uint32_t* offsets = (uint32_t*)malloc(num_names * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_names; ++i)
+    {
+        offsets[i] = uint32_t(names.size());
+        int len = sprintf_s(name, "contended_identifier_%u", i);
+        names.append(name, len + 1);
+    }
+
+    const char** results = (const char**)malloc(size_t(num_names) * kThreads * sizeof(const char*));
+    intern_worker workers[kThreads];
+    for (uint32_t t = 0; t < kThreads; ++t)
+    {
+        workers[t].names = &names;
+        workers[t].offsets = offsets;
+        workers[t].num_names = num_names;
+        workers[t].rounds = rounds;
+        workers[t].thread_index = t;
+        workers[t].results = results + size_t(t) * num_names;
+    }
+
+    bool ok = true;
+    Timer timer;
+    for (uint32_t num_threads = kThreads; num_threads; num_threads /= kThreads)
+    {
+        uint32_t strings_before = strings_count();
+        std::thread threads[kThreads];
+        timer.start();
+        for (uint32_t t = 0; t < num_threads; ++t)
+            threads[t] = std::thread(intern_worker_run, &workers[t]);
+        for (uint32_t t = 0; t < num_threads; ++t)
+            threads[t].join();
+        timer.end();
+
+        for (uint32_t t = 1; ok && t < num_threads; ++t)
+            for (uint32_t i = 0; ok && i < num_names; ++i)
+                ok = workers[t].results[i] == workers[0].results[i];
+
+        sprintf_s(name, "intern %u names x%u [%u threads]", num_names, rounds, num_threads);
+        print_bench(name, timer.milliseconds(), names.size() * rounds * num_threads);
+        printf("  %-40s %10u new strings\n", "", strings_count() - strings_before);
+    }
+
+    free(results);
+    free(offsets);
+    if (!ok)
+    {
+        printf("  threads interned the same name to different pointers\n");
+        debug_break();
+    }
+    return ok;
+}
+
+int run_benchmarks()
+{
+    printf("=== RUNNING BENCHMARKS\n");
+    bool ok = true;
+    ok &= bench_lex_unique_identifiers(1000 * 1000);
+    ok &= bench_lex_scan_levels(100 * 1000);
+    ok &= bench_ast_array_vs_stream(20 * 1000);
+    ok &= bench_ast_token_layouts(20 * 1000);
+    ok &= bench_ast_arena(20 * 1000);
+    ok &= bench_skip_function_bodies(100 * 1000);
+    ok &= bench_ast_parallel(100 * 1000);
+    ok &= bench_ast_lazy(100 * 1000);
+    ok &= bench_ast_expressions(2000, 500, 400);
+    ok &= bench_ast_many_locals(10 * 1000, 100);
+    ok &= bench_ast_deep_nesting(100 * 1000);
+    ok &= bench_incremental_edit(50 * 1000);
+    ok &= bench_lex_parallel(100 * 1000);
+    ok &= bench_preprocess_macros(10 * 1000);
+    ok &= bench_preprocess_skip(100 * 1000);
+    ok &= bench_strings_contention(10 * 1000, 20);
+    return ok ? 0 : 1;
+}
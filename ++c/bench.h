@@ -0,0 +1,4 @@
+#pragma once
+
+// synthetic front-end benchmarks. inputs are generated in memory so results don't depend on what's on disk.
+int run_benchmarks();
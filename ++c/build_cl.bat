@@ -1 +1 @@
-cl /Z7 main.cpp test.cpp file.cpp dir.cpp lex.cpp ast.cpp ast_alloc.cpp interp.cpp strings.cpp simplify.cpp timer.cpp test_cache.c ir.cpp gen.cpp %*
\ No newline at end of file
+cl /Z7 main.cpp test.cpp file.cpp dir.cpp lex.cpp lines.cpp preprocess.cpp scan.cpp token_cache.cpp ast.cpp ast_alloc.cpp ast_flat.cpp bench.cpp interp.cpp strings.cpp symbols.cpp simplify.cpp splice.cpp timer.cpp test_cache.c ir.cpp gen.cpp %*
\ No newline at end of file
@@ -3,13 +3,267 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32)
+#include "windows.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const size_t READ_CHUNK_SIZE = 64 * 1024;
+
+// 64-bit safe size of an open FILE*, leaves the file position at the start.
+static bool file_size_64(FILE* file, uint64_t* o_size)
+{
+#if defined(_WIN32)
+    if (0 != _fseeki64(file, 0, SEEK_END))
+        return false;
+    int64_t size = _ftelli64(file);
+#else
+    if (0 != fseeko(file, 0, SEEK_END))
+        return false;
+    int64_t size = ftello(file);
+#endif
+    rewind(file);
+    if (size < 0 || uint64_t(size) > SIZE_MAX)
+        return false;
+
+    *o_size = uint64_t(size);
+    return true;
+}
+
+#if defined(_WIN32)
+typedef HANDLE source_handle;
+
+static bool source_read(source_handle handle, char* buffer, size_t size, size_t* o_read)
+{
+    DWORD request = size > 0x40000000 ? 0x40000000 : DWORD(size); // ReadFile takes a 32-bit count
+    DWORD actually_read = 0;
+    if (!ReadFile(handle, buffer, request, &actually_read, NULL))
+    {
+        // a pipe whose writer has gone away is just end of input
+        if (GetLastError() != ERROR_BROKEN_PIPE)
+            return false;
+    }
+    *o_read = actually_read;
+    return true;
+}
+#else
+typedef int source_handle;
+
+static bool source_read(source_handle handle, char* buffer, size_t size, size_t* o_read)
+{
+    for (;;)
+    {
+        ssize_t actually_read = read(handle, buffer, size);
+        if (actually_read >= 0)
+        {
+            *o_read = size_t(actually_read);
+            return true;
+        }
+        if (errno != EINTR)
+            return false;
+    }
+}
+#endif
+
+// fallback for anything we can't map: read until end of input into a geometrically grown heap buffer.
+static bool source_read_all(const char* filename, source_handle handle, uint64_t size_hint, SourceBuffer* o_source)
+{
+    size_t capacity = size_hint > 0 && size_hint < SIZE_MAX ? size_t(size_hint) + 1 : READ_CHUNK_SIZE;
+    size_t size = 0;
+    char* buffer = (char*)malloc(capacity);
+    for (;;)
+    {
+        if (!buffer)
+        {
+            printf("out of memory reading file %s\n", filename);
+            debug_break();
+            return false;
+        }
+
+        size_t actually_read = 0;
+        if (!source_read(handle, buffer + size, capacity - size, &actually_read))
+        {
+            printf("failed to read file %s\n", filename);
+            debug_break();
+            free(buffer);
+            return false;
+        }
+        if (actually_read == 0)
+            break;
+
+        size += actually_read;
+        if (size == capacity)
+        {
+            capacity *= 2;
+            char* grown = (char*)realloc(buffer, capacity);
+            if (!grown)
+                free(buffer);
+            buffer = grown;
+        }
+    }
+
+    o_source->data = buffer;
+    o_source->size = size;
+    o_source->mapped = false;
+    return true;
+}
+
+bool file_open_source(const char* filename, SourceBuffer* o_source)
+{
+    *o_source = SourceBuffer();
+    const bool is_stdin = 0 == strcmp(filename, "-");
+
+#if defined(_WIN32)
+    HANDLE file = is_stdin
+        ? GetStdHandle(STD_INPUT_HANDLE)
+        : CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE || file == NULL)
+    {
+        printf("failed to open file %s\n", filename);
+        debug_break();
+        return false;
+    }
+
+    uint64_t size = 0;
+    LARGE_INTEGER file_size;
+    if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &file_size))
+    {
+        size = uint64_t(file_size.QuadPart);
+
+        // can't map an empty file, and a 32-bit process can't map more than its address space
+        if (size > 0 && size <= SIZE_MAX)
+        {
+            // the view keeps its own reference to the mapping, so both handles can be closed right away
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+            if (mapping)
+                CloseHandle(mapping);
+            if (view)
+            {
+                if (!is_stdin)
+                    CloseHandle(file);
+                o_source->data = (const char*)view;
+                o_source->size = size;
+                o_source->mapped = true;
+                return true;
+            }
+        }
+    }
+
+    bool ok = source_read_all(filename, file, size, o_source);
+    if (!is_stdin)
+        CloseHandle(file);
+    return ok;
+#else
+    int fd = is_stdin ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("failed to open file %s\n", filename);
+        debug_break();
+        return false;
+    }
+
+    uint64_t size = 0;
+    struct stat st;
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode))
+    {
+        size = uint64_t(st.st_size);
+
+        // can't map an empty file, and a 32-bit process can't map more than its address space
+        if (size > 0 && size <= SIZE_MAX)
+        {
+            int flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+            flags |= MAP_POPULATE; // pre-fault the whole file, the lexer is going to touch every byte anyway
+#endif
+            void* view = mmap(NULL, size_t(size), PROT_READ, flags, fd, 0);
+            if (view != MAP_FAILED)
+            {
+                madvise(view, size_t(size), MADV_SEQUENTIAL);
+                if (!is_stdin)
+                    close(fd);
+                o_source->data = (const char*)view;
+                o_source->size = size;
+                o_source->mapped = true;
+                return true;
+            }
+        }
+    }
+
+    bool ok = source_read_all(filename, fd, size, o_source);
+    if (!is_stdin)
+        close(fd);
+    return ok;
+#endif
+}
+
+void file_close_source(SourceBuffer* source)
+{
+    if (!source->data)
+        return;
+
+    if (source->mapped)
+    {
+#if defined(_WIN32)
+        UnmapViewOfFile(source->data);
+#else
+        munmap((void*)source->data, size_t(source->size));
+#endif
+    }
+    else
+    {
+        free((void*)source->data);
+    }
+    *source = SourceBuffer();
+}
+
+bool file_identity(const char* filename, FileIdentity* o_identity)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filename, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    BY_HANDLE_FILE_INFORMATION info;
+    bool ok = 0 != GetFileInformationByHandle(file, &info);
+    CloseHandle(file);
+    if (!ok)
+        return false;
+    o_identity->device = info.dwVolumeSerialNumber;
+    o_identity->file = (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    return true;
+#else
+    struct stat st;
+    if (0 != stat(filename, &st))
+        return false;
+    o_identity->device = uint64_t(st.st_dev);
+    o_identity->file = uint64_t(st.st_ino);
+    return true;
+#endif
+}
+
+bool file_make_directory(const char* path)
+{
+#if defined(_WIN32)
+    return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return 0 == mkdir(path, 0777) || errno == EEXIST;
+#endif
+}
 
 void file_dump_to_stdout(const char* filename)
 {
-    size_t size;
-    const char* data = file_read_into_memory(filename, &size);
-    assert(data);
-    fwrite(data, 1, (size_t)size, stdout);
+    SourceBuffer source;
+    if (!file_open_source(filename, &source))
+        return;
+    fwrite(source.data, 1, (size_t)source.size, stdout);
+    file_close_source(&source);
 }
 
 bool file_read_into_stretchy_memory(const char* filename, size_t* o_size, char** io_buffer, size_t* io_buffer_size)
@@ -22,9 +276,15 @@ bool file_read_into_stretchy_memory(const char* filename, size_t* o_size, char**
         return NULL;
     }
 
-    fseek(file, 0, SEEK_END);
-    uint32_t file_size = ftell(file);
-    rewind(file);
+    uint64_t file_size64;
+    if (!file_size_64(file, &file_size64))
+    {
+        printf("failed to get size of file %s\n", filename);
+        debug_break();
+        fclose(file);
+        return false;
+    }
+    size_t file_size = size_t(file_size64);
 
     char* buffer = *io_buffer;
     size_t buffer_size = *io_buffer_size;
@@ -37,7 +297,7 @@ bool file_read_into_stretchy_memory(const char* filename, size_t* o_size, char**
 
     if (file_size != actually_read)
     {
-        printf("failed to read file %s of size %" PRIu32 "\n", filename, file_size);
+        printf("failed to read file %s of size %" PRIu64 "\n", filename, file_size64);
         debug_break();
         return false;
     }
@@ -58,9 +318,15 @@ char* file_read_into_memory(const char* filename, size_t* o_size)
         return NULL;
     }
 
-    fseek(file, 0, SEEK_END);
-    uint32_t file_size = ftell(file);
-    rewind(file);
+    uint64_t file_size64;
+    if (!file_size_64(file, &file_size64))
+    {
+        printf("failed to get size of file %s\n", filename);
+        debug_break();
+        fclose(file);
+        return NULL;
+    }
+    size_t file_size = size_t(file_size64);
 
     void* memory = malloc(file_size);
     size_t actually_read = fread_s(memory, file_size, 1, file_size, file);
@@ -68,7 +334,7 @@ char* file_read_into_memory(const char* filename, size_t* o_size)
 
     if (file_size != actually_read)
     {
-        printf("failed to read file %s of size %" PRIu32 "\n", filename, file_size);
+        printf("failed to read file %s of size %" PRIu64 "\n", filename, file_size64);
         debug_break();
         free(memory);
         return NULL;
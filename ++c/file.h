@@ -1,4 +1,31 @@
 #pragma once
+#include <inttypes.h>
+#include <stddef.h>
+
+// Read-only contents of a source file. Regular files are memory-mapped so lexing is zero-copy
+// (Token.location points straight into the mapping). Pipes, stdin ("-") and anything that can't be
+// mapped are read into a heap buffer instead. Either way data stays valid until file_close_source.
+struct SourceBuffer
+{
+    const char* data;
+    uint64_t size;
+    bool mapped; // false means data was malloc'd
+};
+
+bool file_open_source(const char* filename, SourceBuffer* o_source);
+void file_close_source(SourceBuffer* source); // safe to call on a zero-initialized or already closed SourceBuffer
+
+// Which file a path refers to, so two different paths to the same file can be recognized.
+// (volume serial + file index on Windows, device + inode elsewhere)
+struct FileIdentity
+{
+    uint64_t device;
+    uint64_t file;
+};
+
+bool file_identity(const char* filename, FileIdentity* o_identity);
+
+bool file_make_directory(const char* path); // true if the directory exists afterwards, parent must exist
 
 void file_dump_to_stdout(const char* filename);
 bool file_read_into_stretchy_memory(const char* filename, size_t* o_size, char** io_buffer, size_t* io_buffer_size);
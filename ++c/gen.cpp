@@ -18,16 +18,10 @@ struct global_var
     ASTNode* node;
 };
 
-struct stack_var
-{
-    ASTNode* id;
-    char location[32]; // ex: 32(%rsp)
-};
-
 struct stack_frame
 {
-    stack_var vars[MAX_VARS_SIZE];
-    int64_t num_vars;
+    uint32_t num_slots; // see ASTNode::fdef.num_slots
+    uint32_t num_temps; // after the slots, see ASTNode::fdef.num_temps
     int64_t frame_size_in_bytes;
 };
 
@@ -117,108 +111,13 @@ stack_frame* push_stack_frame(gen_ctx* ctx)
     }
 
     stack_frame* f = &ctx->stack_frames[ctx->num_frames++];
-    f->num_vars = 0;
+    f->num_slots = 0;
+    f->num_temps = 0;
     f->frame_size_in_bytes = 0;
 
     return f;
 }
 
-void push_vars_recursive(stack_frame* frame, ASTNode* n);
-void push_vars_recursive_ASTNodeArray(stack_frame* frame, const ASTNodeArray* na)
-{
-    for (uint32_t i = 0; i < na->size; ++i)
-    {
-        ASTNode* n = na->nodes[i];
-        push_vars_recursive(frame, n);
-    }
-}
-
-void push_vars_recursive(stack_frame* frame, ASTNode* n)
-{
-    if (n == NULL)
-        return;
-
-    if (n->type == AST_var && n->var.is_variable_declaration)
-    {
-        // NOTE: there's one other place we do this. See AST_binop below.
-        assert(frame->num_vars != MAX_VARS_SIZE);
-        int64_t stack_offset = 32 + frame->num_vars * 8; // TODO: calc size of type
-        stack_var* sv = &frame->vars[frame->num_vars++];
-        sv->id = n;
-        sprintf_s(sv->location, "%" PRIi64 "(%%rsp)", stack_offset);
-        frame->frame_size_in_bytes += 8; // TODO: calc size of type
-    }
-
-    switch (n->type)
-    {
-    case AST_program:
-        debug_break(); // we shouldn't hit this case, the initial caller should be a fdef
-        return;
-    case AST_blocklist:
-        push_vars_recursive_ASTNodeArray(frame, &n->blocklist);
-        return;
-    case AST_ret:
-        push_vars_recursive(frame, n->ret.expression);
-        return;
-    case AST_var:
-        push_vars_recursive(frame, n->var.assign_expression);
-        return;
-    case AST_num:
-        return;
-    case AST_fdecl:
-        debug_break(); // we shouldn't hit this case, the initial caller should be a fdef
-        return;
-    case AST_fdef:
-        debug_break(); // we shouldn't hit this case, the initial caller should be a fdef
-        return;
-    case AST_fcall:
-        push_vars_recursive_ASTNodeArray(frame, &n->fcall.args);
-        return;
-    case AST_if:
-        push_vars_recursive(frame, n->ifdef.condition);
-        push_vars_recursive(frame, n->ifdef.if_true);
-        push_vars_recursive(frame, n->ifdef.if_false);
-        return;
-    case AST_for:
-        push_vars_recursive(frame, n->forloop.init);
-        push_vars_recursive(frame, n->forloop.condition);
-        push_vars_recursive(frame, n->forloop.update);
-        push_vars_recursive(frame, n->forloop.body);
-        return;
-    case AST_while: // fall-through
-    case AST_dowhile:
-        push_vars_recursive(frame, n->whileloop.condition);
-        push_vars_recursive(frame, n->whileloop.body);
-        return;
-    case AST_binop: // BINOP REQUIRES A TEMPORARY LOCATION FOR STORAGE OF LEFT WHILE EVALUATING RIGHT. NOTE: We are doing this so we don't touch the stack. Previous binops would push/pop. Hopefully changing to a IR w/ infinite registers would simplify all this. 
-        {
-            assert(frame->num_vars != MAX_VARS_SIZE);
-            int64_t stack_offset = 32 + frame->num_vars * 8; // TODO: calc size of type
-            stack_var* sv = &frame->vars[frame->num_vars++];
-            sv->id = n;
-            sprintf_s(sv->location, "%" PRIi64 "(%%rsp)", stack_offset);
-            frame->frame_size_in_bytes += 8; // TODO: calc size of type
-
-            push_vars_recursive(frame, n->binop.left);
-            push_vars_recursive(frame, n->binop.right);
-        }
-        return;
-    case AST_unop:
-        push_vars_recursive(frame, n->unop.on);
-        return;
-    case AST_terop:
-        push_vars_recursive(frame, n->terop.condition);
-        push_vars_recursive(frame, n->terop.if_true);
-        push_vars_recursive(frame, n->terop.if_false);
-    case AST_break: // fall-through
-    case AST_continue: // fall-through
-    case AST_empty:
-        return;
-    };
-
-    debug_break(); // new AST type?
-}
-
 enum ePopType
 {
     PT_gen_asm,
@@ -261,38 +160,47 @@ bool pop_scope(gen_ctx* ctx, stack_frame* sf, ePopType pt)
     return true;
 }
 
+// every declaration gets a slot on the stack, and so does every binop (BINOP REQUIRES A TEMPORARY LOCATION FOR STORAGE
+// OF LEFT WHILE EVALUATING RIGHT. NOTE: We are doing this so we don't touch the stack. Previous binops would push/pop.
+// Hopefully changing to a IR w/ infinite registers would simplify all this.) The parser numbered them, see
+// ASTNode::var.slot and binop.slot, so the location is just arithmetic. Temporaries go after the locals.
 bool emit_var_location(gen_ctx* ctx, const ASTNode* n)
 {
     stack_frame* frame = ctx->stack_frames + ctx->num_frames - 1;
-    for (uint32_t i = 0; i < frame->num_vars; ++i)
+
+    uint32_t slot;
+    if (n->type == AST_var)
     {
-        if (frame->vars[i].id == n)
+        if (n->var.is_global)
         {
-            fprintf(ctx->out, "%s", frame->vars[i].location);
+            // my_var_name(%rip) MORE INFO: https://stackoverflow.com/questions/56262889/why-are-global-variables-in-x86-64-accessed-relative-to-the-instruction-pointer
+            fprintf(ctx->out, "%s(%%rip)", n->var.name.nts);
             return true;
         }
+        if (n->var.slot >= frame->num_slots)
+        {
+            debug_break();
+            return false;
+        }
+        slot = n->var.slot;
     }
-
-    // not on the stack frame, check global vars
-    if (n->type != AST_var)
-    {
-        debug_break();
-        return false;
-    }
-
-    for (int64_t i = 0; i < ctx->num_global_vars; ++i)
+    else if (n->type == AST_binop)
     {
-        global_var* v = &ctx->global_vars[i];
-        if (v->node->var.name.nts == n->var.name.nts)
+        if (n->binop.slot >= frame->num_temps)
         {
-            // my_var_name(%rip) MORE INFO: https://stackoverflow.com/questions/56262889/why-are-global-variables-in-x86-64-accessed-relative-to-the-instruction-pointer
-            fprintf(ctx->out, "%s(%%rip)", n->var.name.nts);
-            return true;
+            debug_break();
+            return false;
         }
+        slot = frame->num_slots + n->binop.slot;
+    }
+    else
+    {
+        debug_break();
+        return false;
     }
 
-    debug_break();
-    return false;
+    fprintf(ctx->out, "%" PRIi64 "(%%rsp)", 32 + int64_t(slot) * 8); // TODO: calc size of type
+    return true;
 }
 
 bool copy_xxx_to_var(gen_ctx* ctx, const char* xxx, const ASTNode* n)
@@ -359,10 +267,12 @@ bool gen_asm_node(gen_ctx* ctx, const ASTNode* n)
 
     if (n->type == AST_fdef)
     {
+        assert(!n->fdef.body_pending); // no slots counted yet, see ast_materialize
         bool is_main = n->fdef.name.nts == strings_insert_nts("main").nts;
         stack_frame* func_sf = push_stack_frame(ctx);
-        push_vars_recursive_ASTNodeArray(func_sf, &n->fdef.params);
-        push_vars_recursive_ASTNodeArray(func_sf, &n->fdef.body);
+        func_sf->num_slots = n->fdef.num_slots;
+        func_sf->num_temps = n->fdef.num_temps;
+        func_sf->frame_size_in_bytes = (int64_t(n->fdef.num_slots) + n->fdef.num_temps) * 8; // TODO: calc size of type
 
         // start of function stack frame
         {
@@ -913,7 +823,7 @@ bool gen_asm(FILE* file, const ASTNode* ast_root)
     for (uint32_t i = 0; i < ast_root->program.size; ++i)
     {
         ASTNode* n = ast_root->program.nodes[i];
-        if (n->type == AST_fdef)
+        if (n->type == AST_fdef && !n->fdef.body_pending) // a pending body isn't reachable from main, see ast_lazy
         {
             fprintf(ctx->out, "  .globl %s\n", n->fdef.name.nts);
         }
@@ -965,14 +875,10 @@ bool gen_asm(FILE* file, const ASTNode* ast_root)
     for (uint32_t i = 0; i < ast_root->program.size; ++i)
     {
         ASTNode* n = ast_root->program.nodes[i];
-        if (n->type == AST_fdef)
+        if (n->type == AST_fdef && !n->fdef.body_pending)
         {
-            
             if (!gen_asm_node(ctx, n))
-            {
-                free(ctx);
                 return false;
-            }
         }
     }
     
@@ -980,6 +886,14 @@ bool gen_asm(FILE* file, const ASTNode* ast_root)
     return true;
 }
 
+bool gen_asm(FILE* file, ASTOut* ast)
+{
+    // only what main can reach gets a body, the rest of an ast_lazy tree stays unparsed and isn't emitted
+    if (!ast_materialize_reachable(ast))
+        return false;
+    return gen_asm(file, ast->root);
+}
+
 static bool emit_asm_x64(FILE* out, const IR* ir, uint64_t* io_last_rid) {
     switch (ir->type) {
     case eIR::IR_GLOBAL_FUNC:
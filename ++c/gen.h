@@ -17,4 +17,5 @@ Get program return value/errorlevel/exit status:
 */
 
 bool gen_asm(FILE* file, const ASTNode* ast_root);
+bool gen_asm(FILE* file, ASTOut* ast); // also takes a tree from ast_lazy, functions main can't reach are left out
 bool gen_asm_from_ir(FILE* out, const IR* ir, size_t ir_size);
\ No newline at end of file
@@ -1,270 +1,168 @@
 #include "interp.h"
+#include "ast_flat.h"
 #include "debug.h"
 #include "strings.h"
 
 #define RETURN_INTERP_FAILURE do{ debug_break(); return false; } while(0)
 
-struct stack_var
-{
-    // NOTE assumption here: all ids exist in the same string pool (see "strings.h") and thus we can
-    // simply store the pointer and compare on the pointer for equality.
-    const char* id;
-    int64_t value;
-};
+static const int64_t MAX_LOCALS = 1024;
+static const int64_t MAX_GLOBALS = 256;
 
 struct global_var
 {
-    const char* id; // same assumption ast stack_var here. See NOTE above.
     bool defined; // global vars may be forward-declared any number of times but they can only be defined once
     int64_t value;
 };
 
+// runs over the program flattened once up front (see ast_flat.h), a node is its index and its children follow it
 struct interp_context
 {
-    stack_var stack[256]; // uses sentinal values for stack frames
-    int64_t stack_top;
+    int64_t locals[MAX_LOCALS]; // the slots of every call in progress, see ASTNode::fdef.num_slots
+    int64_t num_locals;
+    int64_t frame; // first slot of the current call
 
     int loop_depth;
     bool return_triggered;
     bool break_triggered;
     bool continue_triggered;
 
-    ASTNodeArray global_funcs;
-    global_var global_vars[256];
-    int64_t num_global_vars;
+    const FlatAST* flat;
+    global_var global_vars[MAX_GLOBALS]; // by slot, default to zero even if they are never defined
 };
 
-bool push_frame(interp_context* ctx)
-{
-    if (ctx->stack_top == 256)
-    {
-        debug_break(); // no room
-        return false;
-    }
-
-    ctx->stack[ctx->stack_top++].id = NULL;
-    return true;
-}
-
-bool pop_frame(interp_context* ctx)
+static uint32_t sibling(const interp_context* ctx, uint32_t n)
 {
-    stack_var* iter = ctx->stack + ctx->stack_top - 1;
-    while (iter >= ctx->stack && iter->id != NULL)
-        --iter;
-
-    if (iter < ctx->stack || iter->id != NULL)
-    {
-        debug_break();
-        return false; // need to push_frame before pop_frame
-    }
-    ctx->stack_top = int(iter - ctx->stack);
-    return true;
+    return ctx->flat->nodes[n].next;
 }
 
-void declare_global_var(interp_context* ctx, const char* id)
+static bool is_placeholder(const interp_context* ctx, uint32_t n)
 {
-    // find it first, if already declared than ignore
-    for (int64_t i = 0; i < ctx->num_global_vars; ++i)
-    {
-        if (ctx->global_vars[i].id == id)
-        {
-            return;
-        }
-    }
-
-    // need room
-    if (ctx->num_global_vars >= 256)
-    {
-        debug_break();
-        return;
-    }
-
-    global_var* v = &ctx->global_vars[ctx->num_global_vars++];
-    v->id = id;
-    v->defined = false;
-    v->value = 0; // global vars default to zero even if they are never defined
+    return flat_type(ctx->flat, n) == AST_UNKNOWN;
 }
 
-void define_global_var(interp_context* ctx, const char* id, int64_t value)
+void define_global_var(interp_context* ctx, uint32_t decl, int64_t value)
 {
-    // try to find it, if it exists ensure this is the first time we are defining it
-    for (int64_t i = 0; i < ctx->num_global_vars; ++i)
+    assert(ctx->flat->nodes[decl].flags & FLAT_global);
+    const uint32_t slot = flat_name(ctx->flat, decl)->slot;
+    if (slot >= MAX_GLOBALS)
     {
-        global_var* v = &ctx->global_vars[i];
-        if (v->id != id) continue;
-        if (v->defined)
-        {
-            debug_break();
-            return;
-        }
-
-        v->defined = true;
-        v->value = value;
+        debug_break(); // need room
         return;
     }
 
-    // first time for var, make sure we have room
-    if (ctx->num_global_vars >= 256)
+    // ensure this is the first time we are defining it
+    global_var* v = &ctx->global_vars[slot];
+    if (v->defined)
     {
         debug_break();
         return;
     }
 
-    global_var* v = &ctx->global_vars[ctx->num_global_vars++];
-    v->id = id;
     v->defined = true;
     v->value = value;
 }
 
-bool push_var(interp_context* ctx, const char* id)
+// first fdef called name, by walking the top level items
+static uint32_t find_function(const interp_context* ctx, str name)
 {
-    if (ctx->stack_top >= 256)
-    {
-        debug_break();
-        return false; // no room
-    }
-
-    // ensure valid frame as been pushed
+    for (uint32_t n = 1; n < ctx->flat->num_nodes; n = sibling(ctx, n))
     {
-        stack_var* iter = ctx->stack + ctx->stack_top - 1;
-        while (iter >= ctx->stack && iter->id != NULL)
-            --iter;
-
-        if (iter < ctx->stack || iter->id != NULL)
-        {
-            debug_break(); // need to push a stack frame first!
-            return false;
-        }
+        if (flat_type(ctx->flat, n) == AST_fdef && flat_name(ctx->flat, n)->name.nts == name.nts)
+            return n;
     }
-
-    stack_var* sv = ctx->stack + ctx->stack_top;
-    sv->id = id;
-    ++ctx->stack_top;
-    return true;
+    return FLAT_NONE;
 }
 
-bool read_var(interp_context* ctx, const char* id, int64_t* out_var)
+// room for func's params and locals above the caller's, o_frame is where they start
+bool push_call(interp_context* ctx, uint32_t func, int64_t* o_frame)
 {
-    // try reading from stack first
-    for(stack_var* iter = ctx->stack + ctx->stack_top - 1;
-        iter >= ctx->stack;
-        --iter)
-    {
-        if (iter->id == id)
-        {
-            *out_var = iter->value;
-            return true;
-        }
-    }
-
-    // not found on stack so check global vars (no need to iterate backwards here, globals can't shadow themselves)
-    for (int64_t i = 0; i < ctx->num_global_vars; ++i)
+    assert(!flat_origin(ctx->flat, func)->fdef.body_pending); // no slots counted yet, see ast_materialize
+    const int64_t num_slots = flat_name(ctx->flat, func)->slot;
+    if (ctx->num_locals + num_slots > MAX_LOCALS)
     {
-        global_var* v = &ctx->global_vars[i];
-        if (v->id == id)
-        {
-            *out_var = v->value;
-            return true;
-        }
+        debug_break();
+        return false; // no room
     }
 
-    debug_break();
-    return false;
+    *o_frame = ctx->num_locals;
+    ctx->num_locals += num_slots;
+    return true;
 }
 
-bool write_var(interp_context* ctx, const char* id, int64_t value)
+int64_t* find_var(interp_context* ctx, uint32_t var)
 {
-    // try writing stack first
-    for (stack_var* iter = ctx->stack + ctx->stack_top - 1;
-        iter >= ctx->stack;
-        --iter)
-    {
-        if (iter->id == id)
-        {
-            iter->value = value;
-            return true;
-        }
-    }
-
-    // not found on stack so check global vars (no need to iterate backwards here, globals can't shadow themselves)
-    for (int64_t i = 0; i < ctx->num_global_vars; ++i)
+    const uint32_t var_slot = flat_name(ctx->flat, var)->slot;
+    if (ctx->flat->nodes[var].flags & FLAT_global)
     {
-        global_var* v = &ctx->global_vars[i];
-        if (v->id == id)
-        {
-            v->value = value;
-            return true;
-        }
+        if (var_slot >= MAX_GLOBALS)
+            return NULL;
+        return &ctx->global_vars[var_slot].value;
     }
 
-    debug_break();
-    return false;
+    const int64_t slot = ctx->frame + var_slot;
+    if (slot >= ctx->num_locals)
+        return NULL;
+    return &ctx->locals[slot];
 }
 
-bool push_func_var(interp_context* ctx, int64_t value)
+bool read_var(interp_context* ctx, uint32_t var, int64_t* out_var)
 {
-    if (ctx->stack_top >= 256)
+    const int64_t* v = find_var(ctx, var);
+    if (!v)
     {
         debug_break();
-        return false; // no room
+        return false;
     }
 
-    ctx->stack[ctx->stack_top].id = NULL;
-    ctx->stack[ctx->stack_top].value = value;
-    ++ctx->stack_top;
-
+    *out_var = *v;
     return true;
 }
 
-bool pop_func_frame(interp_context* ctx, int64_t count)
+bool write_var(interp_context* ctx, uint32_t var, int64_t value)
 {
-    if (ctx->stack_top - count < 0)
+    int64_t* v = find_var(ctx, var);
+    if (!v)
     {
         debug_break();
-        return false; // stack vars don't exist
-    }
-
-    // verify func frame
-    for (int64_t i = ctx->stack_top - count; i < ctx->stack_top; ++i)
-    {
-        if (ctx->stack[i].id != NULL)
-            return false; // all func vars should have an id of NULL. See push_func_var.
+        return false;
     }
 
-    ctx->stack_top -= count;
+    *v = value;
     return true;
 }
 
-bool interp(ASTNode* root, interp_context* ctx, int64_t* out_result)
+bool interp(uint32_t root, interp_context* ctx, int64_t* out_result)
 {
-    assert(root);
-    if (root->type == AST_empty)
+    const FlatNode* node = &ctx->flat->nodes[root];
+    const uint32_t first = root + 1; // first child, see ast_flat.h for the order by type
+    const ASTType type = ASTType(node->type);
+    if (type == AST_empty)
     {
         *out_result = 0;
         return true;
     }
-    if (root->type == AST_break)
+    if (type == AST_break)
     {
         *out_result = 0;
         ctx->break_triggered = true;
         return true;
     }
-    else if (root->type == AST_continue)
+    else if (type == AST_continue)
     {
         *out_result = 0;
         ctx->continue_triggered = true;
         return true;
     }
-    else if (root->type == AST_num)
+    else if (type == AST_num)
     {
-        *out_result = root->num.value;
+        *out_result = flat_value(ctx->flat, root);
         return true;
     }
-    else if (root->type == AST_unop)
+    else if (type == AST_unop)
     {
-        if (!interp(root->unop.on, ctx, out_result)) RETURN_INTERP_FAILURE;
+        if (!interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
 
-        switch (root->unop.op)
+        switch (node->op)
         {
         case '+': return true;
         case '-': *out_result = -*out_result; return true;
@@ -274,33 +172,35 @@ bool interp(ASTNode* root, interp_context* ctx, int64_t* out_result)
         
         RETURN_INTERP_FAILURE;
     }
-    else if (root->type == AST_binop)
+    else if (type == AST_binop)
     {
+        const uint32_t right = sibling(ctx, first);
+
         // || and && are special in C. They short-circuit evaluation.
         // * If left-side of || is true, right-side should NOT be evaluated.
         // * If left-side of && is false, right-side should NOT be evaluated.
-        if (root->binop.op == eToken::logical_or)
+        if (node->op == eToken::logical_or)
         {
-            if (!interp(root->binop.left, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (*out_result) return true;
-            if (!interp(root->binop.right, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(right, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (*out_result) *out_result = 1; // convert whatever the value of out_result is (could be -1 or whatever) to 1
             return true;
         }
-        if (root->binop.op == eToken::logical_and)
+        if (node->op == eToken::logical_and)
         {
-            if (!interp(root->binop.left, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (!*out_result) return true;
-            if (!interp(root->binop.right, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(right, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (*out_result) *out_result = 1; // convert whatever the value of out_result is (could be -1 or whatever) to 1
             return true;
         }
 
 
         int64_t lhs, rhs;
-        if (!interp(root->binop.left, ctx, &lhs) || !interp(root->binop.right, ctx, &rhs)) RETURN_INTERP_FAILURE;
+        if (!interp(first, ctx, &lhs) || !interp(right, ctx, &rhs)) RETURN_INTERP_FAILURE;
 
-        switch (root->binop.op)
+        switch (node->op)
         {
         case '%': *out_result = lhs % rhs; return true;
         case '*': *out_result = lhs * rhs; return true;
@@ -319,38 +219,29 @@ bool interp(ASTNode* root, interp_context* ctx, int64_t* out_result)
 
         RETURN_INTERP_FAILURE;
     }
-    else if (root->type == AST_if)
-    {
-        if (!interp(root->ifdef.condition, ctx, out_result)) RETURN_INTERP_FAILURE;
-        if (*out_result)
-        {
-            if (!interp(root->ifdef.if_true, ctx, out_result)) RETURN_INTERP_FAILURE;
-        }
-        else if(root->ifdef.if_false)
-        {
-            if (!interp(root->ifdef.if_false, ctx, out_result)) RETURN_INTERP_FAILURE;
-        }
-        return true;
-    }
-    else if (root->type == AST_terop)
+    else if (type == AST_if || type == AST_terop)
     {
-        if (!interp(root->terop.condition, ctx, out_result)) RETURN_INTERP_FAILURE;
+        const uint32_t if_true = sibling(ctx, first);
+        const uint32_t if_false = sibling(ctx, if_true); // a placeholder for an if without an else
+        if (!interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
         if (*out_result)
         {
-            if (!interp(root->terop.if_true, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(if_true, ctx, out_result)) RETURN_INTERP_FAILURE;
         }
-        else
+        else if (!is_placeholder(ctx, if_false))
         {
-            if (!interp(root->terop.if_false, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(if_false, ctx, out_result)) RETURN_INTERP_FAILURE;
         }
         return true;
     }
-    else if (root->type == AST_for)
+    else if (type == AST_for)
     {
-        if (!push_frame(ctx)) RETURN_INTERP_FAILURE;
+        const uint32_t condition = sibling(ctx, first);
+        const uint32_t update = sibling(ctx, condition);
+        const uint32_t body = sibling(ctx, update);
 
         // init
-        if (root->forloop.init && !interp(root->forloop.init, ctx, out_result)) RETURN_INTERP_FAILURE;
+        if (!is_placeholder(ctx, first) && !interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
 
         assert(!ctx->return_triggered);
         assert(!ctx->break_triggered);
@@ -362,31 +253,28 @@ bool interp(ASTNode* root, interp_context* ctx, int64_t* out_result)
             ctx->continue_triggered = false;
 
             // condition
-            if (root->forloop.condition)
+            if (!is_placeholder(ctx, condition))
             {
-                if (!interp(root->forloop.condition, ctx, out_result)) RETURN_INTERP_FAILURE;
+                if (!interp(condition, ctx, out_result)) RETURN_INTERP_FAILURE;
                 if (!*out_result) break;
             }
 
             // body
-            if (!interp(root->forloop.body, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(body, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (ctx->return_triggered || ctx->break_triggered)
                 break;
 
             // update
-            if (root->forloop.update && !interp(root->forloop.update, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!is_placeholder(ctx, update) && !interp(update, ctx, out_result)) RETURN_INTERP_FAILURE;
         }
         --ctx->loop_depth;
         ctx->break_triggered = false;
         ctx->continue_triggered = false;
-
-        if (!pop_frame(ctx)) RETURN_INTERP_FAILURE;
         return true;
     }
-    else if (root->type == AST_while)
+    else if (type == AST_while)
     {
-        if (!push_frame(ctx)) RETURN_INTERP_FAILURE;
-
+        const uint32_t body = sibling(ctx, first);
         assert(!ctx->return_triggered);
         assert(!ctx->break_triggered);
         assert(!ctx->continue_triggered);
@@ -397,26 +285,23 @@ bool interp(ASTNode* root, interp_context* ctx, int64_t* out_result)
             ctx->continue_triggered = false;
 
             // condition
-            if (!interp(root->whileloop.condition, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (!*out_result)
                 break;
 
             // body
-            if (!interp(root->whileloop.body, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(body, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (ctx->return_triggered || ctx->break_triggered)
                 break;
         }
         --ctx->loop_depth;
         ctx->break_triggered = false;
         ctx->continue_triggered = false;
-
-        if (!pop_frame(ctx)) RETURN_INTERP_FAILURE;
         return true;
     }
-    else if (root->type == AST_dowhile)
+    else if (type == AST_dowhile)
     {
-        if (!push_frame(ctx)) RETURN_INTERP_FAILURE;
-
+        const uint32_t body = sibling(ctx, first);
         assert(!ctx->return_triggered);
         assert(!ctx->break_triggered);
         assert(!ctx->continue_triggered);
@@ -427,57 +312,47 @@ bool interp(ASTNode* root, interp_context* ctx, int64_t* out_result)
             ctx->continue_triggered = false;
 
             // body
-            if (!interp(root->whileloop.body, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(body, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (ctx->return_triggered || ctx->break_triggered)
                 break;
 
             // condition
-            if (!interp(root->whileloop.condition, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (!*out_result)
                 break;
         }
         --ctx->loop_depth;
         ctx->break_triggered = false;
         ctx->continue_triggered = false;
-
-        if (!pop_frame(ctx)) RETURN_INTERP_FAILURE;
         return true;
     }
-    else if (root->type == AST_var)
+    else if (type == AST_var)
     {
-        if (root->var.is_variable_declaration && root->var.is_variable_assignment)
-        {
-            if (!push_var(ctx, root->var.name.nts)) RETURN_INTERP_FAILURE;
-            if (!interp(root->var.assign_expression, ctx, out_result)) RETURN_INTERP_FAILURE;
-            if (!write_var(ctx, root->var.name.nts, *out_result)) RETURN_INTERP_FAILURE;
-            return true;
-        }
-        else if(root->var.is_variable_declaration)
+        // every var carries its declaration's slot, the slot itself was reserved by push_call
+        if((node->flags & FLAT_declaration) && !(node->flags & FLAT_assignment))
         {
-            assert(!root->var.assign_expression);
-            if (!push_var(ctx, root->var.name.nts)) RETURN_INTERP_FAILURE;
+            assert(!flat_has_children(ctx->flat, root));
             return true;
         }
-        else if (root->var.is_variable_assignment)
+        else if (node->flags & FLAT_assignment)
         {
-            if (!interp(root->var.assign_expression, ctx, out_result)) RETURN_INTERP_FAILURE;
-            if (!write_var(ctx, root->var.name.nts, *out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!write_var(ctx, root, *out_result)) RETURN_INTERP_FAILURE;
             return true;
         }
-        else if (root->var.is_variable_usage)
+        else if (node->flags & FLAT_usage)
         {
-            if (!read_var(ctx, root->var.name.nts, out_result)) RETURN_INTERP_FAILURE;
+            if (!read_var(ctx, root, out_result)) RETURN_INTERP_FAILURE;
             return true;
         }
 
         RETURN_INTERP_FAILURE;
     }
-    else if (root->type == AST_blocklist)
+    else if (type == AST_blocklist)
     {
-        if (!push_frame(ctx)) RETURN_INTERP_FAILURE;
-        for (uint32_t i = 0; i < root->blocklist.size; ++i)
+        for (uint32_t i = first; i < node->next; i = sibling(ctx, i))
         {
-            if (!interp(root->blocklist.nodes[i], ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(i, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (ctx->return_triggered)
                 break;
             if (ctx->break_triggered || ctx->continue_triggered)
@@ -486,35 +361,35 @@ bool interp(ASTNode* root, interp_context* ctx, int64_t* out_result)
                 break;
             }
         }
-        if (!pop_frame(ctx)) RETURN_INTERP_FAILURE;
         return true;
     }
-    else if (root->type == AST_ret)
+    else if (type == AST_ret)
     {
-        if (root->ret.expression && !interp(root->ret.expression, ctx, out_result)) RETURN_INTERP_FAILURE;
+        if (!is_placeholder(ctx, first) && !interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
         ctx->return_triggered = true;
         return true;
     }
-    else if (root->type == AST_fdef)
+    else if (type == AST_fdef)
     {
         assert(ctx->return_triggered == false);
         assert(ctx->break_triggered == false);
         assert(ctx->continue_triggered == false);
-        if (!push_frame(ctx)) RETURN_INTERP_FAILURE;
-        for (uint32_t i = 0; i < root->fdef.body.size; ++i)
+        uint32_t body = first;
+        for (uint32_t i = 0; i < node->flags; ++i) // step over the params
+            body = sibling(ctx, body);
+        for (uint32_t i = body; i < node->next; i = sibling(ctx, i))
         {
-            if (!interp(root->fdef.body.nodes[i], ctx, out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(i, ctx, out_result)) RETURN_INTERP_FAILURE;
             if (ctx->return_triggered)
                 break;
         }
         assert(ctx->break_triggered == false);
         assert(ctx->continue_triggered == false);
-        if (!pop_frame(ctx)) RETURN_INTERP_FAILURE;
 
         if (ctx->return_triggered)
             return true;
 
-        if (root->fdef.return_type == eToken::keyword_void)
+        if (node->op == eToken::keyword_void)
         {
             // ignore out_result
             ctx->return_triggered = true;
@@ -522,7 +397,7 @@ bool interp(ASTNode* root, interp_context* ctx, int64_t* out_result)
         }
 
         // HANDLE SPECIAL CASE: C standard says if main() does not have a return than it should return 0
-        if (root->fdef.name.nts == strings_insert_nts("main").nts)
+        if (flat_name(ctx->flat, root)->name.nts == strings_insert_nts("main").nts)
         {
             // technically valid by C standard.
             *out_result = 0;
@@ -532,135 +407,87 @@ bool interp(ASTNode* root, interp_context* ctx, int64_t* out_result)
         // C standard: undefined behavior. TODO: Turn this into an error once we have error reporting.
         RETURN_INTERP_FAILURE;
     }
-    else if (root->type == AST_program)
-    {
-        // hardcoded. find main. see also gen.cpp
-        // also: populate global funcs
-        str strMain = strings_insert_nts("main");
-        ASTNode* main = NULL;
-        for (uint32_t i = 0; i < root->program.size; ++i)
-        {
-            ASTNode* n = root->program.nodes[i];
-            if (n->type == AST_fdef)
-            {
-                astn_push(&ctx->global_funcs, n);
-                if(n->fdef.name.nts == strMain.nts)
-                    main = n;
-            }
-            else if (n->type == AST_var)
-            {
-
-            }
-        }
-
-        if (!main) RETURN_INTERP_FAILURE;
-        if (!interp(main, ctx, out_result)) RETURN_INTERP_FAILURE;
-
-        // special case in standard. if main does not have a return, than it should return 0
-        if (!ctx->return_triggered)
-            *out_result = 0;
-
-        return true;
-    }
-    else if (root->type == AST_fcall)
+    else if (type == AST_fcall)
     {
-        assert(root->fcall.name.nts != strings_insert_nts("main").nts); // I'm not sure if recurisve calls to main is okay...
+        const str name = flat_name(ctx->flat, root)->name;
+        assert(name.nts != strings_insert_nts("main").nts); // I'm not sure if recurisve calls to main is okay...
 
         // special case (would normally be found when linking against stdandard library)
-        if (root->fcall.name.nts == strings_insert_nts("putchar").nts)
+        if (name.nts == strings_insert_nts("putchar").nts)
         {
-            assert(root->fcall.args.size == 1);
-            if (!interp(root->fcall.args.nodes[0], ctx, out_result)) RETURN_INTERP_FAILURE;
+            assert(flat_num_children(ctx->flat, root) == 1);
+            if (!interp(first, ctx, out_result)) RETURN_INTERP_FAILURE;
             *out_result = putchar((int)*out_result);
             return true;
         }
 
-        // find in global func list
-        ASTNode* func = NULL;
-        for (uint32_t i = 0; i < ctx->global_funcs.size; ++i)
-        {
-            ASTNode* potential = ctx->global_funcs.nodes[i];
-            assert(potential->type == AST_fdef);
-            if (potential->fdef.name.nts == root->fcall.name.nts)
-            {
-                func = ctx->global_funcs.nodes[i];
-                break;
-            }
-        }
-        if (!func) RETURN_INTERP_FAILURE;
+        const uint32_t func = find_function(ctx, name);
+        if (func == FLAT_NONE) RETURN_INTERP_FAILURE;
 
         // verify call is cool, probably should verify this somewhere else or modify the AST to have cycles...
-        if (root->fcall.args.size != func->fdef.params.size) RETURN_INTERP_FAILURE;
+        if (flat_num_children(ctx->flat, root) != ctx->flat->nodes[func].flags) RETURN_INTERP_FAILURE;
 
-        // interp each arg and push on stack (labeled as function definitions var names)
-        if (!push_frame(ctx)) RETURN_INTERP_FAILURE;
-        for (uint32_t i = 0; i < root->fcall.args.size; ++i)
+        // reserve the callee's slots before the args run, a call in an arg stacks its own above them. Each arg is
+        // evaluated in the caller's frame and lands in the param's slot in the callee's.
+        int64_t frame;
+        if (!push_call(ctx, func, &frame)) RETURN_INTERP_FAILURE;
+        for (uint32_t arg = first, param = func + 1; arg < node->next; arg = sibling(ctx, arg), param = sibling(ctx, param))
         {
-            if (!interp(root->fcall.args.nodes[i], ctx, out_result)) RETURN_INTERP_FAILURE;
-            //if (!push_func_var(ctx, *out_result)) RETURN_INTERP_FAILURE;
-            assert(func->fdef.params.nodes[i]->type == AST_var);
-            if (!push_var(ctx, func->fdef.params.nodes[i]->var.name.nts)) RETURN_INTERP_FAILURE;
-            if (!write_var(ctx, func->fdef.params.nodes[i]->var.name.nts, *out_result)) RETURN_INTERP_FAILURE;
+            if (!interp(arg, ctx, out_result)) RETURN_INTERP_FAILURE;
+            assert(flat_type(ctx->flat, param) == AST_var);
+            ctx->locals[frame + flat_name(ctx->flat, param)->slot] = *out_result;
         }
 
         // call func
+        const int64_t caller_frame = ctx->frame;
+        ctx->frame = frame;
         if (!interp(func, ctx, out_result)) RETURN_INTERP_FAILURE;
         assert(ctx->return_triggered);
         ctx->return_triggered = false;
 
-        // pop all vars we pushed on the stack for the func call
-        //if (!pop_func_frame(ctx, root->fcall.args.size)) RETURN_INTERP_FAILURE;
-        if (!pop_frame(ctx)) RETURN_INTERP_FAILURE;
+        // pop the callee's slots
+        ctx->frame = caller_frame;
+        ctx->num_locals = frame;
         return true;
     }
     
     RETURN_INTERP_FAILURE;
 }
 
-bool interp_return_value(ASTNode* root, int64_t* out_result)
+static bool interp_flat(const FlatAST* flat, int64_t* out_result)
 {
     interp_context ctx = {};
-
-    if (root->type != AST_program)
-    {
-        debug_break();
-        return false;
-    }
+    ctx.flat = flat;
 
     // initialize globals and find main
     str strMain = strings_insert_nts("main");
-    ASTNode* main = NULL;
-    for (uint32_t i = 0; i < root->program.size; ++i)
+    uint32_t main = FLAT_NONE;
+    for (uint32_t n = 1; n < flat->num_nodes; n = sibling(&ctx, n))
     {
-        ASTNode* n = root->program.nodes[i];
-        if (n->type == AST_fdef)
+        if (flat_type(flat, n) == AST_fdef)
         {
-            astn_push(&ctx.global_funcs, n);
-            if (n->fdef.name.nts == strMain.nts)
+            if (flat_name(flat, n)->name.nts == strMain.nts)
                 main = n;
         }
-        else if (n->type == AST_var)
+        else if (flat_type(flat, n) == AST_var)
         {
-            if (n->var.assign_expression)
+            if (flat_has_children(flat, n))
             {
                 int64_t v;
-                bool ok = interp(n->var.assign_expression, NULL, &v);
+                bool ok = interp(n + 1, &ctx, &v);
                 if (!ok)
                 {
                     debug_break();
                     return false;
                 }
 
-                define_global_var(&ctx, n->var.name.nts, v);
-            }
-            else
-            {
-                declare_global_var(&ctx, n->var.name.nts);
+                define_global_var(&ctx, n, v);
             }
         }
     }
 
-    if (!main) RETURN_INTERP_FAILURE;
+    if (main == FLAT_NONE) RETURN_INTERP_FAILURE;
+    if (!push_call(&ctx, main, &ctx.frame)) RETURN_INTERP_FAILURE;
     if (!interp(main, &ctx, out_result)) RETURN_INTERP_FAILURE;
 
     // special case in standard. if main does not have a return, than it should return 0
@@ -670,6 +497,32 @@ bool interp_return_value(ASTNode* root, int64_t* out_result)
     return true;
 }
 
+static bool interp_program(ASTNode* root, int64_t* out_result)
+{
+    if (root->type != AST_program)
+    {
+        debug_break();
+        return false;
+    }
+
+    FlatAST flat = {};
+    bool ok = ast_flatten(root, &flat) && interp_flat(&flat, out_result);
+    flat_free(&flat);
+    return ok;
+}
+
+bool interp_return_value(ASTNode* root, int64_t* out_result)
+{
+    return interp_program(root, out_result);
+}
+
+bool interp_return_value(ASTOut* ast, int64_t* out_result)
+{
+    // flattening needs every body main can reach, the rest of an ast_lazy tree stays unparsed
+    if (!ast_materialize_reachable(ast)) RETURN_INTERP_FAILURE;
+    return interp_program(ast->root, out_result);
+}
+
 
 #include "ir.h"
 #include <map>
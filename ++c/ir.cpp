@@ -33,13 +33,7 @@ enum eFailureReason {
     FR_TODO_HANDLE_DIFFERING_RETURN_TYPES,
 };
 
-struct TokenStream
-{
-    const Token* next;
-    const Token* end;
-};
-
-#define CHECK_OUT_OF_TOKENS if(tokens.next == tokens.end) { debug_break(); return FR_OUT_OF_TOKENS; }
+#define CHECK_OUT_OF_TOKENS if(tokens.at_end()) { debug_break(); return FR_OUT_OF_TOKENS; }
 #define RETURN_ERROR(x) {debug_break(); return x;}
 #define RETURN_TODO(x) {debug_break(); return x;}
 
@@ -86,12 +80,12 @@ static eFailureReason transform_translation_unit(TokenStream* io_tokens, ir_cont
     TokenStream tokens = *io_tokens;
     
     eFailureReason fr = FR_OKAY;
-    while (tokens.next != tokens.end)
+    while (!tokens.at_end())
     {
-        eVT vt = to_value_type(tokens.next->type);
+        eVT vt = to_value_type(tokens.type());
         if (vt != VT_UNKNOWN)
         {
-            ++tokens.next;
+            tokens.advance();
             fr = global_var_or_func(vt, &tokens, ctx);
             if (fr == FR_OKAY)
                 continue;
@@ -101,7 +95,7 @@ static eFailureReason transform_translation_unit(TokenStream* io_tokens, ir_cont
     }
     
     if (fr != FR_OKAY) return fr;
-    if (tokens.next != tokens.end) RETURN_ERROR(FR_COMPILER_ERROR_MORE_TOKENS_TO_CONSUME);
+    if (!tokens.at_end()) RETURN_ERROR(FR_COMPILER_ERROR_MORE_TOKENS_TO_CONSUME);
     return FR_OKAY;
 }
 
@@ -109,26 +103,26 @@ static eFailureReason global_var_or_func(eVT vt, TokenStream* io_tokens, ir_cont
 {
     TokenStream tokens = *io_tokens;
     CHECK_OUT_OF_TOKENS;
-    if (tokens.next->type != eToken::identifier) RETURN_ERROR(FR_SEMANTIC_ERROR_EXPECTED_IDENTIFIER);
-    const Token* id = tokens.next;
-    ++tokens.next; CHECK_OUT_OF_TOKENS;
+    if (tokens.type() != eToken::identifier) RETURN_ERROR(FR_SEMANTIC_ERROR_EXPECTED_IDENTIFIER);
+    const str id = tokens.peek().identifier;
+    tokens.advance(); CHECK_OUT_OF_TOKENS;
     // global var
-    if (tokens.next->type == eToken::semicolon) RETURN_TODO(FR_TODO_GLOBAL_VAR);
-    if (tokens.next->type == eToken::assignment) RETURN_TODO(FR_TODO_GLOBAL_VAR);
+    if (tokens.type() == eToken::semicolon) RETURN_TODO(FR_TODO_GLOBAL_VAR);
+    if (tokens.type() == eToken::assignment) RETURN_TODO(FR_TODO_GLOBAL_VAR);
     // global func def or impl
-    if (tokens.next->type != eToken::open_parens) RETURN_ERROR(FR_SEMANTIC_ERROR_FUNC_MISSING_OPEN_PARENS);
-    ++tokens.next; CHECK_OUT_OF_TOKENS;
-    if (tokens.next->type != eToken::closed_parens) RETURN_TODO(FR_TODO_FUNC_PARAMS);
-    ++tokens.next; CHECK_OUT_OF_TOKENS;
-    if (tokens.next->type != eToken::open_curly) RETURN_TODO(FR_TODO_FUNC_DEF);
-    ++tokens.next; CHECK_OUT_OF_TOKENS;
+    if (tokens.type() != eToken::open_parens) RETURN_ERROR(FR_SEMANTIC_ERROR_FUNC_MISSING_OPEN_PARENS);
+    tokens.advance(); CHECK_OUT_OF_TOKENS;
+    if (tokens.type() != eToken::closed_parens) RETURN_TODO(FR_TODO_FUNC_PARAMS);
+    tokens.advance(); CHECK_OUT_OF_TOKENS;
+    if (tokens.type() != eToken::open_curly) RETURN_TODO(FR_TODO_FUNC_DEF);
+    tokens.advance(); CHECK_OUT_OF_TOKENS;
 
     {
         size_t i = emplace_back_ir(ctx);
         IR* f = ctx->ir + i;
         f->type = IR_GLOBAL_FUNC;
         f->func.return_type = vt;
-        f->func.name = id->identifier.nts;
+        f->func.name = id.nts;
         f->func.params = NULL;
     }
     
@@ -136,13 +130,13 @@ static eFailureReason global_var_or_func(eVT vt, TokenStream* io_tokens, ir_cont
     if (fr != FR_OKAY) return fr;
 
     CHECK_OUT_OF_TOKENS;
-    if (tokens.next->type != eToken::closed_curly) RETURN_ERROR(FR_SEMANTIC_ERROR_FUNC_MISSING_CLOSED_PARENS);
-    ++tokens.next;
+    if (tokens.type() != eToken::closed_curly) RETURN_ERROR(FR_SEMANTIC_ERROR_FUNC_MISSING_CLOSED_PARENS);
+    tokens.advance();
 
     const eIR last_type = last_ir(ctx)->type;
     if (last_type != IR_RETURN && last_type != IR_RETURN_VALUE)
     {
-        if (is_str_main(id->identifier.nts)) {
+        if (is_str_main(id.nts)) {
             if (vt == VT_void) {
                 size_t i = emplace_back_ir(ctx);
                 IR* r = ctx->ir + i;
@@ -181,25 +175,25 @@ static eFailureReason func_interior(TokenStream* io_tokens, ir_context* ctx)
     TokenStream tokens = *io_tokens;
     CHECK_OUT_OF_TOKENS;
 
-    while (tokens.next != tokens.end && tokens.next->type != eToken::closed_curly)
+    while (!tokens.at_end() && tokens.type() != eToken::closed_curly)
     {
         // find expression and write to ir in reverse
         {
             // find end of expression
-            const Token* const expr_start = tokens.next;
+            const uint64_t expr_start = tokens.pos;
             
             // handle cases that can only happen at start of expression
-            switch (tokens.next->type) {
+            switch (tokens.type()) {
                 case eToken::keyword_return: 
-                    ++tokens.next;
+                    tokens.advance();
             }
 
             // handle the rest
-            while (tokens.next != tokens.end) {
-                switch (tokens.next->type) {
+            while (!tokens.at_end()) {
+                switch (tokens.type()) {
                 case eToken::constant_number: // fall-through
                 case '!': case '-': case '~': // fall-through
-                    ++tokens.next;
+                    tokens.advance();
                     continue;
                 }
                 break;
@@ -207,13 +201,13 @@ static eFailureReason func_interior(TokenStream* io_tokens, ir_context* ctx)
             CHECK_OUT_OF_TOKENS;
 
             // check that we found something
-            if (tokens.next - expr_start == 0) {
+            if (tokens.pos - expr_start == 0) {
                 RETURN_ERROR(FR_SEMANTIC_ERROR_EXPECTED_EXPRESSION);
             }
 
             // if it's just a return, handle it
-            if (tokens.next - expr_start == 1
-                && expr_start->type == eToken::keyword_return) {
+            if (tokens.pos - expr_start == 1
+                && tokens.type_at(expr_start) == eToken::keyword_return) {
                 size_t i = emplace_back_ir(ctx);
                 IR* r = ctx->ir + i;
                 r->type = IR_RETURN;
@@ -222,11 +216,12 @@ static eFailureReason func_interior(TokenStream* io_tokens, ir_context* ctx)
 
             // write expression in reverse
             uint64_t last_rid = 0;
-            for (const Token* expr_i = tokens.next - 1; expr_i >= expr_start; --expr_i)
+            for (uint64_t expr_pos = tokens.pos; expr_pos-- > expr_start;)
             {
+                const Token expr_i = tokens.at(expr_pos);
                 size_t i = emplace_back_ir(ctx);
                 IR* r = ctx->ir + i;
-                switch (expr_i->type) {
+                switch (expr_i.type) {
 
                     case eToken::keyword_return: {
                         if (last_rid == 0) {
@@ -238,7 +233,7 @@ static eFailureReason func_interior(TokenStream* io_tokens, ir_context* ctx)
 
                     case eToken::constant_number: {
                         r->type = IR_CONSTANT;
-                        r->constant.value = expr_i->number;
+                        r->constant.value = expr_i.number;
                         r->constant.rid = ++ctx->next_rid;
                         last_rid = r->constant.rid;
                     } break;
@@ -248,7 +243,7 @@ static eFailureReason func_interior(TokenStream* io_tokens, ir_context* ctx)
                             RETURN_ERROR(FR_SEMANTIC_ERROR_UNARY_OP_MISSING_TARGET);
                         }
                         r->type = IR_UNARY_OP;
-                        r->un.op = expr_i->type;
+                        r->un.op = expr_i.type;
                         r->un.rid_from = last_rid;
                         r->un.rid_to = ++ctx->next_rid;
                         last_rid = r->un.rid_to;
@@ -258,19 +253,15 @@ static eFailureReason func_interior(TokenStream* io_tokens, ir_context* ctx)
         }
 
         // after expression there should be a semicolon
-        if (tokens.next->type != eToken::semicolon) RETURN_ERROR(FR_SEMANTIC_ERROR_EXPECTED_SEMICOLON);
-        ++tokens.next;
+        if (tokens.type() != eToken::semicolon) RETURN_ERROR(FR_SEMANTIC_ERROR_EXPECTED_SEMICOLON);
+        tokens.advance();
     }
     *io_tokens = tokens;
     return eFailureReason::FR_OKAY;
 }
 
-bool ir(const Token* tokens, size_t num_tokens, IR** out, size_t* out_size)
+static bool ir(TokenStream io_tokens, IR** out, size_t* out_size)
 {
-    TokenStream io_tokens;
-    io_tokens.next = tokens;
-    io_tokens.end = tokens + num_tokens;
-
     ir_context ctx = {};
 
     eFailureReason fr = transform_translation_unit(&io_tokens, &ctx);
@@ -287,11 +278,26 @@ bool ir(const Token* tokens, size_t num_tokens, IR** out, size_t* out_size)
     return true;
 }
 
+bool ir(const Token* tokens, size_t num_tokens, IR** out, size_t* out_size)
+{
+    return ir(token_stream(tokens, num_tokens), out, out_size);
+}
+
+bool ir(const TokenBuffer* tokens, IR** out, size_t* out_size)
+{
+    return ir(token_stream(tokens), out, out_size);
+}
+
+bool ir(LexStream* tokens, IR** out, size_t* out_size)
+{
+    // see ast(LexStream*): a lex failure looks like end of input to the transform
+    bool ok = ir(token_stream(tokens), out, out_size);
+    return ok && !tokens->failure_reason && !tokens->overrun;
+}
+
 bool ir_func_interior(const struct Token* tokens, size_t num_tokens, IR** out, size_t* out_size)
 {
-    TokenStream io_tokens;
-    io_tokens.next = tokens;
-    io_tokens.end = tokens + num_tokens;
+    TokenStream io_tokens = token_stream(tokens, num_tokens);
 
     ir_context ctx = {};
 
@@ -58,5 +58,7 @@ struct IR
 };
 
 bool ir(const struct Token* tokens, size_t num_tokens, IR** out, size_t* out_size);
+bool ir(const struct TokenBuffer* tokens, IR** out, size_t* out_size);
+bool ir(struct LexStream* tokens, IR** out, size_t* out_size); // pulls tokens as it goes, check tokens->failure_reason for lex errors
 bool ir_func_interior(const struct Token* tokens, size_t num_tokens, IR** out, size_t* out_size);
 void dump_ir(FILE* out, const IR* ir, size_t ir_size);
\ No newline at end of file
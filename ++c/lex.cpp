@@ -1,38 +1,16 @@
 #include "lex.h"
 #include "debug.h"
 #include "strings.h"
+#include "scan.h"
+#include "preprocess.h"
+#include "splice.h"
 #include <string.h>//memcmp
 #include <stdlib.h>//malloc
+#include <thread>
 
-static str kMain;
-static str kStrVoid;
-static str kStrInt;
-static str kStrReturn;
-static str kStrIf;
-static str kStrElse;
-static str kStrFor;
-static str kStrWhile;
-static str kStrDo;
-static str kStrBreak;
-static str kStrContinue;
-
-void init_str_keywords()
-{
-    if (kMain.nts)
-        return; // Assume all other strings are also initilized
-
-    kMain = strings_insert_nts("main");
-    kStrVoid = strings_insert_nts("void");
-    kStrInt = strings_insert_nts("int");
-    kStrReturn = strings_insert_nts("return");
-    kStrIf = strings_insert_nts("if");
-    kStrElse = strings_insert_nts("else");
-    kStrFor = strings_insert_nts("for");
-    kStrWhile = strings_insert_nts("while");
-    kStrDo = strings_insert_nts("do");
-    kStrBreak = strings_insert_nts("break");
-    kStrContinue = strings_insert_nts("continue");
-}
+// Seeded once at program startup (dynamic initialization) rather than on every call to lex().
+// Safe regardless of init order because the string table in strings.cpp is zero-initialized.
+static const str kMain = strings_insert_nts("main");
 
 bool is_str_main(const char* str) {
     if (str == kMain.nts) return true;
@@ -47,58 +25,234 @@ bool is_str_main(const char* str) {
     return false;
 }
 
-bool is_letter_or_underscore(char c)
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CHARACTER CLASSES / OPERATORS
+// Every byte maps to a class that picks the branch in lex(). Operators then go through a tiny transition
+// table: row from the first char, column from the second, giving the two-char token (or 0 for "just the
+// first char"). All of it is built at compile time.
+enum eCharClass : uint8_t
+{
+    CHAR_INVALID,
+    CHAR_WHITESPACE,
+    CHAR_BACKSLASH,
+    CHAR_OPERATOR,
+    CHAR_DIGIT,
+    CHAR_IDENTIFIER, // letter or underscore. digits are only allowed after the first char.
+    CHAR_SINGLE_QUOTE,
+    CHAR_DOUBLE_QUOTE,
+    CHAR_HASH,
+};
+
+// not real tokens, only returned by the op_pair table.
+static constexpr uint8_t OP_PAIR_LINE_COMMENT = 0xFE;
+static constexpr uint8_t OP_PAIR_BLOCK_COMMENT = 0xFF;
+
+static constexpr char kOpPairFirst[] = " &|=!<>/"; // row index, 0 = can't start a pair
+static constexpr char kOpPairSecond[] = " &|=/*"; // col index, 0 = can't end a pair
+static constexpr int OP_PAIR_ROWS = sizeof(kOpPairFirst) - 1;
+static constexpr int OP_PAIR_COLS = sizeof(kOpPairSecond) - 1;
+
+struct op_pair_def
+{
+    char first;
+    char second;
+    uint8_t type;
+};
+
+struct lex_tables
 {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    uint8_t char_class[256];
+    uint8_t op_single[256]; // eToken for a single-char operator
+    uint8_t op_row[256];
+    uint8_t op_col[256];
+    uint8_t op_pair[OP_PAIR_ROWS][OP_PAIR_COLS];
+};
+
+static constexpr uint8_t op_pair_index(const char* chars, int count, char c)
+{
+    for (int i = 1; i < count; ++i)
+        if (chars[i] == c)
+            return uint8_t(i);
+    return 0;
 }
-bool isnumber(char c)
+
+static constexpr lex_tables make_lex_tables()
 {
-    return c >= '0' && c <= '9';
+    lex_tables t = {};
+    for (int c = '\t'; c <= '\r'; ++c) t.char_class[c] = CHAR_WHITESPACE;
+    t.char_class[' '] = CHAR_WHITESPACE;
+    t.char_class['\\'] = CHAR_BACKSLASH;
+    for (int c = '0'; c <= '9'; ++c) t.char_class[c] = CHAR_DIGIT;
+    for (int c = 'a'; c <= 'z'; ++c) t.char_class[c] = CHAR_IDENTIFIER;
+    for (int c = 'A'; c <= 'Z'; ++c) t.char_class[c] = CHAR_IDENTIFIER;
+    t.char_class['_'] = CHAR_IDENTIFIER;
+    t.char_class['\''] = CHAR_SINGLE_QUOTE;
+    t.char_class['"'] = CHAR_DOUBLE_QUOTE;
+    t.char_class['#'] = CHAR_HASH;
+
+    const char singles[] = "!%&()*+,-/:;<=>?{}~";
+    for (int i = 0; singles[i]; ++i)
+    {
+        t.char_class[(unsigned char)singles[i]] = CHAR_OPERATOR;
+        t.op_single[(unsigned char)singles[i]] = uint8_t(singles[i]); // single-char tokens are their own ascii value
+    }
+    t.char_class['|'] = CHAR_OPERATOR;
+    t.op_single['|'] = eToken::logical_or; // NOTE: lone | has always lexed as ||, bitwise or isn't supported yet
+
+    for (int c = 0; c < 256; ++c)
+    {
+        t.op_row[c] = op_pair_index(kOpPairFirst, OP_PAIR_ROWS, char(c));
+        t.op_col[c] = op_pair_index(kOpPairSecond, OP_PAIR_COLS, char(c));
+    }
+
+    const op_pair_def pairs[] = {
+        { '&', '&', eToken::logical_and },
+        { '|', '|', eToken::logical_or },
+        { '=', '=', eToken::logical_equal },
+        { '!', '=', eToken::logical_not_equal },
+        { '<', '=', eToken::less_than_or_equal },
+        { '>', '=', eToken::greater_than_or_equal },
+        { '/', '/', OP_PAIR_LINE_COMMENT },
+        { '/', '*', OP_PAIR_BLOCK_COMMENT },
+    };
+    for (const op_pair_def& p : pairs)
+        t.op_pair[t.op_row[(unsigned char)p.first]][t.op_col[(unsigned char)p.second]] = p.type;
+
+    return t;
+}
+
+static constexpr lex_tables kLexTables = make_lex_tables();
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// KEYWORDS
+// Perfect hash on length + first two chars. Only 10 keywords, so a 16 slot table with no collisions
+// (checked by the static_assert below). A hit is confirmed by comparing interned pointers.
+struct keyword_def
+{
+    const char* name;
+    int len;
+    eToken type;
+};
+
+static constexpr keyword_def kKeywords[] = {
+    { "void", 4, eToken::keyword_void },
+    { "int", 3, eToken::keyword_int },
+    { "return", 6, eToken::keyword_return },
+    { "if", 2, eToken::keyword_if },
+    { "else", 4, eToken::keyword_else },
+    { "for", 3, eToken::keyword_for },
+    { "while", 5, eToken::keyword_while },
+    { "do", 2, eToken::keyword_do },
+    { "break", 5, eToken::keyword_break },
+    { "continue", 8, eToken::keyword_continue },
+};
+static constexpr int KEYWORD_COUNT = sizeof(kKeywords) / sizeof(kKeywords[0]);
+static const int KEYWORD_MIN_LEN = 2;
+static const int KEYWORD_MAX_LEN = 8;
+static constexpr uint32_t KEYWORD_SLOTS = 16;
+
+static constexpr uint32_t keyword_hash(int len, const char* name)
+{
+    return ((uint32_t(len) << 3) + uint32_t(name[0]) + (uint32_t(name[1]) << 4)) & (KEYWORD_SLOTS - 1);
 }
-bool iswhitespace(char c)
+
+static constexpr bool keyword_hash_is_perfect()
 {
-    return (c >= '\t' && c <= '\r') || c == ' ';
+    for (int i = 0; i < KEYWORD_COUNT; ++i)
+        for (int j = i + 1; j < KEYWORD_COUNT; ++j)
+            if (keyword_hash(kKeywords[i].len, kKeywords[i].name) == keyword_hash(kKeywords[j].len, kKeywords[j].name))
+                return false;
+    return true;
 }
+static_assert(keyword_hash_is_perfect(), "keyword hash has a collision, pick new shifts in keyword_hash");
+
+struct keyword_slot
+{
+    const char* nts; // interned, NULL for empty slots
+    eToken type;
+};
+
+static const keyword_slot* make_keyword_slots()
+{
+    static keyword_slot slots[KEYWORD_SLOTS] = {};
+    for (const keyword_def& k : kKeywords)
+    {
+        keyword_slot& slot = slots[keyword_hash(k.len, k.name)];
+        slot.nts = strings_insert_nts(k.name).nts;
+        slot.type = k.type;
+    }
+    return slots;
+}
+static const keyword_slot* const kKeywordSlots = make_keyword_slots(); // see note on kMain about init order
+
+// a keyword token's identifier by type, so a TokenBuffer doesn't have to store it (see token_buffer_get)
+static_assert(int(eToken::keywords_last) - int(eToken::keywords_first) + 1 == KEYWORD_COUNT, "keyword table out of date");
+static bool is_keyword(eToken type) { return type >= eToken::keywords_first && type <= eToken::keywords_last; }
+static const str* make_keyword_ids()
+{
+    static str ids[KEYWORD_COUNT] = {};
+    for (const keyword_def& k : kKeywords)
+        ids[int(k.type) - int(eToken::keywords_first)] = strings_insert_nts(k.name);
+    return ids;
+}
+static const str* const kKeywordIds = make_keyword_ids(); // see note on kMain about init order
+
+enum eLexStep
+{
+    LEX_STEP_TOKEN,
+    LEX_STEP_END,
+    LEX_STEP_FAIL,
+};
+
+struct lex_cursor
+{
+    const char* stream; // next byte to lex
+    const char* end_stream;
+    const char* failure_location;
+    const char* failure_reason;
+    bool speculative; // failures are expected (lex_parallel guessing where a chunk starts), don't debug_break
+};
+
 Token* alloc_token(LexOutput* out)
 {
-    out->tokens = (Token*)realloc(out->tokens, (out->num_tokens + 1) * sizeof(Token));
-    assert(out->tokens);
+    // capacity is implicit: 16, then the next power of two >= num_tokens. Only grow when num_tokens hits it.
+    const uint64_t n = out->num_tokens;
+    if (n == 0 || (n >= 16 && (n & (n - 1)) == 0))
+    {
+        out->tokens = (Token*)realloc(out->tokens, (n ? n * 2 : 16) * sizeof(Token));
+        assert(out->tokens);
+    }
     return &out->tokens[out->num_tokens++];
 }
-void push_1c(LexOutput* out, eToken type, const char* start)
+static void token_1c(Token* token, eToken type, const char* start)
 {
-    Token* token = alloc_token(out);
     token->type = type;
     token->location.start = start;
     token->location.end = start + 1;
 }
-void push_2c(LexOutput* out, eToken type, const char* start)
+static void token_2c(Token* token, eToken type, const char* start)
 {
-    Token* token = alloc_token(out);
     token->type = type;
     token->location.start = start;
     token->location.end = start + 2;
 }
-void push_num(LexOutput* out, uint64_t n, const char* start, const char* end)
+static void token_num(Token* token, uint64_t n, const char* start, const char* end)
 {
-    Token* token = alloc_token(out);
     token->type = eToken::constant_number;
     token->number = n;
     token->location.start = start;
     token->location.end = end;
 }
-void push_string(LexOutput* out, const char* start, const char* end)
+static void token_string(Token* token, const char* start, const char* end)
 {
-    Token* token = alloc_token(out);
     token->type = eToken::string;
     token->location.start = start;
     token->location.end = end;
     token->str.start = start + 1; // skip starting "
     token->str.end = end - 1; // set end at ending ", end should not be read only one before it
 }
-void push_id_or_keyword(LexOutput* out, str id, const char* start, const char* end)
+static void token_id_or_keyword(Token* token, str id, const char* start, const char* end)
 {
-    Token* token = alloc_token(out);
     token->type = eToken::identifier;
     token->location.start = start;
     token->location.end = end;
@@ -109,69 +263,48 @@ void push_id_or_keyword(LexOutput* out, str id, const char* start, const char* e
     // 1>c:\users\chad\desktop\practice\write_a_c_compiler\++c\lex.cpp(58): warning C4553: '==': result of expression not used; did you intend '='?
 
     // Try to convert identifier to keyword. Keywords in C are reserved so we can do this at lex-time.
-    // TODO: verify this is still valid once we have implemented #define.
-    if (id.nts == kStrVoid.nts) token->type = eToken::keyword_void;
-    else if (id.nts == kStrInt.nts) token->type = eToken::keyword_int;
-    else if (id.nts == kStrReturn.nts) token->type = eToken::keyword_return;
-    else if (id.nts == kStrIf.nts) token->type = eToken::keyword_if;
-    else if (id.nts == kStrElse.nts) token->type = eToken::keyword_else;
-    else if (id.nts == kStrFor.nts) token->type = eToken::keyword_for;
-    else if (id.nts == kStrWhile.nts) token->type = eToken::keyword_while;
-    else if (id.nts == kStrDo.nts) token->type = eToken::keyword_do;
-    else if (id.nts == kStrBreak.nts) token->type = eToken::keyword_break;
-    else if (id.nts == kStrContinue.nts) token->type = eToken::keyword_continue;
-}
-uint64_t push_line_comment(LexOutput* out, const char* const io_stream, const char* const end_stream)
+    // #define can still name a keyword: keyword tokens keep their identifier and preprocess() looks them up too.
+    if (id.len >= KEYWORD_MIN_LEN && id.len <= KEYWORD_MAX_LEN)
+    {
+        const keyword_slot& slot = kKeywordSlots[keyword_hash(id.len, id.nts)];
+        if (slot.nts == id.nts)
+            token->type = slot.type;
+    }
+}
+static uint64_t token_line_comment(Token* token, const char* const io_stream, const char* const end_stream)
 {
     const char* stream = io_stream;
     stream += 2;
 
     while (stream != end_stream)
     {
-        while (stream != end_stream && *stream != '\n')
-            ++stream;
-
-        if (stream != end_stream)
-            ++stream; // consume '\n'
+        stream = scan_find_byte(stream, end_stream, '\n');
+        if (stream == end_stream)
+            break;
+        ++stream; // consume '\n'
 
         // backslash at end of line means we are still "logically" on the same line according to the standard
-        if (stream[-2] == '\\')
-            continue;
-        if (stream[-3] == '\\' && stream[-2] == '\r')
-            continue;
-
-        break;
+        if (!splice_before_newline(io_stream, stream - 1))
+            break;
     }
 
-    Token* token = alloc_token(out);
     token->type = eToken::comment;
     token->location.start = io_stream;
     token->location.end = stream;
 
     return stream - io_stream;
 }
-uint64_t push_multiline_comment(LexOutput* out, const char* const io_stream, const char* const end_stream)
+static uint64_t token_multiline_comment(Token* token, const char* const io_stream, const char* const end_stream)
 {
     const char* stream = io_stream;
     stream += 2;
 
-    bool found_end = false;
-    while (stream + 1 < end_stream)
-    {
-        if (stream[0] == '*' && stream[1] == '/')
-        {
-            found_end = true;
-            break;
-        }
-        ++stream;
-    }
-
-    if (!found_end)
+    stream = scan_find_comment_end(stream, end_stream);
+    if (stream == end_stream)
         return 0;
-    
+
     stream += 2; // skip past */
 
-    Token* token = alloc_token(out);
     token->type = eToken::comment;
     token->location.start = io_stream;
     token->location.end = stream;
@@ -233,13 +366,12 @@ LexInput init_lex(const char* filename, const char* filedata, uint64_t filelen)
     return LexInput{ filename, filedata, filelen };
 }
 
-bool lex(const LexInput* input, LexOutput* output)
+// Lexes exactly one token starting at cur->stream (skipping whitespace and line splices on the way),
+// or reports that the input is done or bad. Shared by lex() and LexStream.
+static eLexStep lex_step(lex_cursor* cur, Token* o_token)
 {
-    assert(output->tokens == NULL); // caller must init to 0 LexOutput
-    init_str_keywords();
-
-    const char* stream = input->stream;
-    const char* end_stream = stream + input->length;
+    const char* stream = cur->stream;
+    const char* const end_stream = cur->end_stream;
 
     // FIRST PASS: Copy and perform early Translation Phase steps (5.1.1.2 of http://www.open-std.org/jtc1/sc22/wg14/www/docs/n1256.pdf).
     //char* stream = (char*)malloc((size_t)input->length);
@@ -251,205 +383,99 @@ bool lex(const LexInput* input, LexOutput* output)
 
     while (stream < end_stream)
     {
-        // skip whitespace
-        if(iswhitespace(*stream))
+        const unsigned char c = (unsigned char)*stream;
+        switch (kLexTables.char_class[c])
         {
-            ++stream;
+        case CHAR_WHITESPACE:
+            stream = scan_whitespace_end(stream + 1, end_stream);
             continue;
-        }
 
-        // skip \newline (logically concatenates the line with the next line)
-        if (stream[0] == '\\')
-        {
+        case CHAR_BACKSLASH:
+            // skip \newline (logically concatenates the line with the next line)
             if (stream + 1 == end_stream)
             {
-                output->failure_location = stream;
-                output->failure_reason = "[lex] line concatenation with ending \\ is not allowed at end of file";
-                return false;
+                cur->failure_location = stream;
+                cur->failure_reason = "[lex] line concatenation with ending \\ is not allowed at end of file";
+                return LEX_STEP_FAIL;
             }
-
-            if (stream[1] == '\r' || stream[1] == '\n')
+            if (const uint64_t splice = splice_length(stream, end_stream))
             {
-                stream += 2;
+                stream += splice;
                 continue;
             }
-        }
+            break;
 
-        // handle two-char syntax: &&, ||, ==, !=, <=, >=
-        if (stream + 1 < end_stream)
+        case CHAR_OPERATOR:
         {
-            if (stream[0] == '&' && stream[1] == '&')
-            {
-                push_2c(output, eToken::logical_and, stream);
-                stream += 2;
-                continue;
-            }
-            if (stream[0] == '|' && stream[1] == '|')
-            {
-                push_2c(output, eToken::logical_or, stream);
-                stream += 2;
-                continue;
-            }
-            if (stream[0] == '=' && stream[1] == '=')
-            {
-                push_2c(output, eToken::logical_equal, stream);
-                stream += 2;
-                continue;
-            }
-            if (stream[0] == '!' && stream[1] == '=')
-            {
-                push_2c(output, eToken::logical_not_equal, stream);
-                stream += 2;
-                continue;
-            }
-            if (stream[0] == '<' && stream[1] == '=')
+            // two-char syntax: &&, ||, ==, !=, <=, >=, //, /*
+            // row/col 0 of the transition table are all 0, so chars that can't pair fall straight through.
+            if (stream + 1 < end_stream)
             {
-                push_2c(output, eToken::less_than_or_equal, stream);
-                stream += 2;
-                continue;
-            }
-            if (stream[0] == '>' && stream[1] == '=')
-            {
-                push_2c(output, eToken::greater_than_or_equal, stream);
-                stream += 2;
-                continue;
-            }
-            if (stream[0] == '/' && stream[1] == '/')
-            {
-                stream += push_line_comment(output, stream, end_stream);
-                continue;
-            }
-            if (stream[0] == '/' && stream[1] == '*')
-            {
-                uint64_t offset = push_multiline_comment(output, stream, end_stream);
-                if (offset == 0)
+                const uint8_t row = kLexTables.op_row[c];
+                const uint8_t col = kLexTables.op_col[(unsigned char)stream[1]];
+                const uint8_t pair = kLexTables.op_pair[row][col];
+                if (pair == OP_PAIR_LINE_COMMENT)
                 {
-                    output->failure_location = stream;
-                    output->failure_reason = "[lex] failed to find end of multi-line comment";
-                    debug_break();
-                    return false;
+                    cur->stream = stream + token_line_comment(o_token, stream, end_stream);
+                    return LEX_STEP_TOKEN;
+                }
+                if (pair == OP_PAIR_BLOCK_COMMENT)
+                {
+                    uint64_t offset = token_multiline_comment(o_token, stream, end_stream);
+                    if (offset == 0)
+                    {
+                        cur->failure_location = stream;
+                        cur->failure_reason = "[lex] failed to find end of multi-line comment";
+                        if (!cur->speculative)
+                            debug_break();
+                        return LEX_STEP_FAIL;
+                    }
+                    cur->stream = stream + offset;
+                    return LEX_STEP_TOKEN;
+                }
+                if (pair)
+                {
+                    token_2c(o_token, eToken(pair), stream);
+                    cur->stream = stream + 2;
+                    return LEX_STEP_TOKEN;
                 }
-                stream += offset;
-                continue;
             }
+
+            token_1c(o_token, eToken(kLexTables.op_single[c]), stream);
+            cur->stream = stream + 1;
+            return LEX_STEP_TOKEN;
         }
 
-        // handle one-char syntax: (){};
-        switch (*stream)
+        case CHAR_DIGIT:
         {
-        case '!':
-            push_1c(output, eToken::logical_not, stream);
-            ++stream;
-            continue;
-        //case '#':
-        //{
-        //    uint64_t offset = handle_directive(output, stream, end_stream);
-        //    if (offset == 0)
-        //    {
-        //        debug_break();
-        //        return false;
-        //    }
-        //    stream += offset;
-        //    continue;
-        //}
-        case '%':
-            push_1c(output, eToken::mod, stream);
-            ++stream;
-            continue;
-        case '&':
-            push_1c(output, eToken::bitwise_and, stream);
-            ++stream;
-            continue;
-        case '(':
-            push_1c(output, eToken::open_parens, stream);
-            ++stream;
-            continue;
-        case ')':
-            push_1c(output, eToken::closed_parens, stream);
-            ++stream;
-            continue;
-        case '*':
-            push_1c(output, eToken::star, stream);
-            ++stream;
-            continue;
-        case '+':
-            push_1c(output, eToken::plus, stream);
-            ++stream;
-            continue;
-        case ',':
-            push_1c(output, eToken::comma, stream);
-            ++stream;
-            continue;
-        case '-':
-            push_1c(output, eToken::dash, stream);
-            ++stream;
-            continue;
-        case '/':
-            push_1c(output, eToken::forward_slash, stream);
-            ++stream;
-            continue;
-        case ':':
-            push_1c(output, eToken::colon, stream);
-            ++stream;
-            continue;
-        case ';':
-            push_1c(output, eToken::semicolon, stream);
-            ++stream;
-            continue;
-        case '<':
-            push_1c(output, eToken::less_than, stream);
-            ++stream;
-            continue;
-        case '=':
-            push_1c(output, eToken::assignment, stream);
-            ++stream;
-            continue;
-        case '>':
-            push_1c(output, eToken::greater_than, stream);
-            ++stream;
-            continue;
-        case '?':
-            push_1c(output, eToken::question_mark, stream);
-            ++stream;
-            continue;
-        case '{':
-            push_1c(output, eToken::open_curly, stream);
-            ++stream;
-            continue;
-        case '|':
-            push_1c(output, eToken::logical_or, stream);
-            ++stream;
-            continue;
-        case '}':
-            push_1c(output, eToken::closed_curly, stream);
-            ++stream;
-            continue;
-        case '~':
-            push_1c(output, eToken::bitwise_not, stream);
-            ++stream;
-            continue;
+            const char* num_start = stream;
+            stream = scan_digits_end(stream + 1, end_stream);
+            token_num(o_token, scan_parse_decimal(num_start, stream), num_start, stream);
+            cur->stream = stream;
+            return LEX_STEP_TOKEN;
         }
 
-        if (isnumber(*stream))
+        case CHAR_IDENTIFIER:
         {
-            const char* num_start = stream;
-            uint64_t number = uint64_t(*stream - '0');
-            ++stream;
+            const char* start = stream;
 
-            while (stream < end_stream && isnumber(*stream))
+            // common case: no backslash-newline inside the identifier, so intern straight from the source.
+            stream = scan_identifier_end(stream + 1, end_stream);
+            if (stream == end_stream || stream[0] != '\\')
             {
-                number *= 10;
-                number += *stream - '0';
-                ++stream;
+                if (stream - start >= 256)
+                {
+                    cur->failure_location = start + 256;
+                    cur->failure_reason = "[lex] max identifier size set to 256, ran out of space.";
+                    return LEX_STEP_FAIL;
+                }
+                token_id_or_keyword(o_token, strings_insert(start, stream), start, stream);
+                cur->stream = stream;
+                return LEX_STEP_TOKEN;
             }
 
-            push_num(output, number, num_start, stream);
-            continue;
-        }
-        
-        if(is_letter_or_underscore(*stream))
-        {
-            const char* start = stream;
+            // slow path: identifier is spliced across lines, copy out the pieces.
+            stream = start;
             char id_temp[256];
             const char* const ID_MAX = id_temp + 256;
             char* id_iter = id_temp;
@@ -457,52 +483,42 @@ bool lex(const LexInput* input, LexOutput* output)
             *id_iter++ = *stream++;
             while (stream < end_stream)
             {
-                if (is_letter_or_underscore(*stream) || isnumber(*stream))
+                const uint8_t cls = kLexTables.char_class[(unsigned char)*stream];
+                if (cls == CHAR_IDENTIFIER || cls == CHAR_DIGIT)
                 {
                     *id_iter++ = *stream++;
                     if (id_iter == ID_MAX)
                     {
-                        output->failure_location = stream;
-                        output->failure_reason = "[lex] max identifier size set to 256, ran out of space.";
-                        return false;
+                        cur->failure_location = stream;
+                        cur->failure_reason = "[lex] max identifier size set to 256, ran out of space.";
+                        return LEX_STEP_FAIL;
                     }
                     continue;
                 }
 
-                if (stream[0] == '\\'
-                    && stream + 3 < end_stream
-                    && stream[1] == '\r'
-                    && stream[2] == '\n')
+                if (const uint64_t splice = splice_length(stream, end_stream))
                 {
-                    stream += 3;
+                    stream += splice;
                     continue;
                 }
 
-                if (stream[0] == '\\'
-                    && stream + 1 < end_stream
-                    && stream[1] == '\n')
-                {
-                    stream += 2;
-                    continue;
-                }
-                    
                 if(stream[0] == '\\')
                 {
-                    output->failure_location = stream;
-                    output->failure_reason = "[lex] invalid character after \\, expected \\r and/or \\n";
-                    return false;
+                    cur->failure_location = stream;
+                    cur->failure_reason = "[lex] invalid character after \\, expected \\r and/or \\n";
+                    return LEX_STEP_FAIL;
                 }
 
                 break;
             }
 
             str id = strings_insert(id_temp, id_iter);
-            push_id_or_keyword(output, id, start, stream);
-            continue;
+            token_id_or_keyword(o_token, id, start, stream);
+            cur->stream = stream;
+            return LEX_STEP_TOKEN;
         }
 
-        // single-quote strings
-        if (*stream == '\'')
+        case CHAR_SINGLE_QUOTE:
         {
             const char* token_start = stream++;
             uint64_t value = 0;
@@ -513,8 +529,8 @@ bool lex(const LexInput* input, LexOutput* output)
                 // https://en.cppreference.com/w/cpp/language/escape
                 if (*stream == '\\')
                 {
-                    ++stream;
-                    assert(stream < end_stream);
+                    if (++stream == end_stream)
+                        break; // missing end, reported below
                     switch (*stream)
                     {
                     case '\'': orvalue = 0x27; break; // single quote
@@ -529,9 +545,9 @@ bool lex(const LexInput* input, LexOutput* output)
                     case 't': orvalue = 0x09; break; // horizontal tab
                     case 'v': orvalue = 0x0b; break; // vertical tab
                     default:
-                        output->failure_location = stream;
-                        output->failure_reason = "[lex] invalid or currently unhandled escape type in single quotes.";
-                        return false;
+                        cur->failure_location = stream;
+                        cur->failure_reason = "[lex] invalid or currently unhandled escape type in single quotes.";
+                        return LEX_STEP_FAIL;
                     }
                 }
 
@@ -539,51 +555,572 @@ bool lex(const LexInput* input, LexOutput* output)
                 value |= orvalue;
                 ++stream;
             }
-            if (*stream != '\'')
+            if (stream == end_stream || *stream != '\'')
             {
-                output->failure_location = stream;
-                output->failure_reason = "[lex] missing end of single quote. max length is 8 chars.";
-                return false;
+                cur->failure_location = stream;
+                cur->failure_reason = "[lex] missing end of single quote. max length is 8 chars.";
+                return LEX_STEP_FAIL;
             }
             ++stream;
-            push_num(output, value, token_start, stream);
-            continue;
+            token_num(o_token, value, token_start, stream);
+            cur->stream = stream;
+            return LEX_STEP_TOKEN;
         }
 
-        // double-quote strings
-        if (*stream == '\"')
+        case CHAR_DOUBLE_QUOTE:
         {
             const char* string_start = stream++;
-            while (stream != end_stream && *stream != '\"')
+            for (;;)
             {
+                stream = scan_find_byte2(stream, end_stream, '\"', '\\');
+                if (stream == end_stream || *stream == '\"')
+                    break;
+
                 // handle \"
-                if (*stream == '\\' && stream + 1 < end_stream && stream[1] == '\"')
-                {
+                if (stream + 1 < end_stream && stream[1] == '\"')
                     stream += 2;
-                    continue;
-                }
-                ++stream;
+                else
+                    ++stream;
             }
-            if (*stream != '\"')
+            if (stream == end_stream)
             {
-                output->failure_location = stream;
-                output->failure_reason = "[lex] missing end of string.";
-                return false;
+                cur->failure_location = stream;
+                cur->failure_reason = "[lex] missing end of string.";
+                return LEX_STEP_FAIL;
             }
             ++stream;
-            push_string(output, string_start, stream);
+            token_string(o_token, string_start, stream);
+            cur->stream = stream;
+            return LEX_STEP_TOKEN;
+        }
+
+        case CHAR_HASH:
+        {
+            // the whole logical line is one token, preprocess() takes it apart. # can't appear anywhere
+            // else outside of a directive (stringizing only happens inside #define bodies) so there's
+            // no need to check it's first on the line.
+            const char* directive_start = stream;
+            for (;;)
+            {
+                stream = scan_find_byte(stream, end_stream, '\n');
+                if (stream == end_stream)
+                    break;
+                if (!splice_before_newline(directive_start + 1, stream))
+                    break;
+                ++stream;
+            }
+            const char* directive_end = stream;
+            if (directive_end > directive_start && directive_end[-1] == '\r')
+                --directive_end;
+            o_token->type = eToken::directive;
+            o_token->location.start = directive_start;
+            o_token->location.end = directive_end;
+            cur->stream = directive_end;
+            return LEX_STEP_TOKEN;
+        }
+        }
+
+        cur->failure_location = stream;
+        cur->failure_reason = "[lex] unsupported data in input";
+        if (!cur->speculative)
+            debug_break();
+        return LEX_STEP_FAIL;
+    }
+
+    cur->stream = stream;
+    return LEX_STEP_END;
+}
+
+bool lex(const LexInput* input, LexOutput* output)
+{
+    assert(output->tokens == NULL); // caller must init to 0 LexOutput
+
+    lex_cursor cur = {};
+    cur.stream = input->stream;
+    cur.end_stream = input->stream + input->length;
+    for (;;)
+    {
+        Token token;
+        switch (lex_step(&cur, &token))
+        {
+        case LEX_STEP_TOKEN:
+            *alloc_token(output) = token;
             continue;
+        case LEX_STEP_END:
+            return true;
+        case LEX_STEP_FAIL:
+            output->failure_location = cur.failure_location;
+            output->failure_reason = cur.failure_reason;
+            return false;
         }
+    }
+}
 
-        output->failure_location = stream;
-        output->failure_reason = "[lex] unsupported data in input";
-        debug_break();
-        return false;
+// grows a side table of a TokenBuffer to hold at least `needed` elements
+static void* grow_table(void* table, uint64_t* io_capacity, uint64_t needed, size_t element_size)
+{
+    if (needed <= *io_capacity)
+        return table;
+    uint64_t capacity = *io_capacity ? *io_capacity : 16;
+    while (capacity < needed)
+        capacity *= 2;
+    table = realloc(table, capacity * element_size);
+    assert(table);
+    *io_capacity = capacity;
+    return table;
+}
+
+// brackets still waiting for their closer, innermost last. See TokenBuffer::matches.
+struct open_bracket
+{
+    uint32_t index;
+    eToken type;
+};
+
+struct bracket_matcher
+{
+    open_bracket* open;
+    uint64_t size;
+    uint64_t capacity;
+    uint32_t failed_at; // token the failure is reported at
+    const char* failure_reason;
+};
+
+// pairs up the token at index with the innermost open bracket if it closes one. matches[index] must already be 0.
+// Returns false if it's a closer that doesn't pair, see failed_at.
+static bool bracket_step(bracket_matcher* m, uint32_t* matches, eToken type, uint32_t index)
+{
+    switch (type)
+    {
+    case eToken::open_parens:
+    case eToken::open_curly:
+        m->open = (open_bracket*)grow_table(m->open, &m->capacity, m->size + 1, sizeof(open_bracket));
+        m->open[m->size++] = { index, type };
+        return true;
+    case eToken::closed_parens:
+    case eToken::closed_curly:
+        break;
+    default:
+        return true;
     }
 
+    const eToken wanted = type == eToken::closed_parens ? eToken::open_parens : eToken::open_curly;
+    if (m->size == 0 || m->open[m->size - 1].type != wanted)
+    {
+        m->failed_at = index;
+        if (m->size == 0)
+            m->failure_reason = type == eToken::closed_parens ? "[lex] ')' without a matching '('" : "[lex] '}' without a matching '{'";
+        else
+            m->failure_reason = type == eToken::closed_parens ? "[lex] ')' where '}' was expected" : "[lex] '}' where ')' was expected";
+        return false;
+    }
+    const uint32_t opener = m->open[--m->size].index;
+    matches[opener] = index;
+    matches[index] = opener;
     return true;
 }
 
+// after the last token: everything must be closed
+static bool bracket_finish(bracket_matcher* m)
+{
+    if (m->size == 0)
+        return true;
+    m->failed_at = m->open[m->size - 1].index;
+    m->failure_reason = m->open[m->size - 1].type == eToken::open_parens ? "[lex] '(' is never closed" : "[lex] '{' is never closed";
+    return false;
+}
+
+static void token_buffer_reserve(TokenBuffer* out, uint64_t capacity)
+{
+    out->types = (eToken*)realloc(out->types, capacity * sizeof(eToken));
+    out->offsets = (uint32_t*)realloc(out->offsets, capacity * sizeof(uint32_t));
+    out->ends = (uint32_t*)realloc(out->ends, capacity * sizeof(uint32_t));
+    out->payloads = (uint32_t*)realloc(out->payloads, capacity * sizeof(uint32_t));
+    out->matches = (uint32_t*)realloc(out->matches, capacity * sizeof(uint32_t));
+    assert(out->types && out->offsets && out->ends && out->payloads && out->matches);
+    out->capacity = capacity;
+}
+
+static void token_buffer_push(TokenBuffer* out, const Token& token)
+{
+    if (out->count == out->capacity)
+        token_buffer_reserve(out, out->capacity * 2);
+
+    uint32_t payload = 0;
+    switch (token.type)
+    {
+    case eToken::identifier:
+        out->identifiers = (str*)grow_table(out->identifiers, &out->identifiers_capacity, out->num_identifiers + 1, sizeof(str));
+        payload = uint32_t(out->num_identifiers);
+        out->identifiers[out->num_identifiers++] = token.identifier;
+        break;
+    case eToken::constant_number:
+        out->numbers = (uint64_t*)grow_table(out->numbers, &out->numbers_capacity, out->num_numbers + 1, sizeof(uint64_t));
+        payload = uint32_t(out->num_numbers);
+        out->numbers[out->num_numbers++] = token.number;
+        break;
+    case eToken::string:
+        out->strings = (str_slice*)grow_table(out->strings, &out->strings_capacity, out->num_strings + 1, sizeof(str_slice));
+        payload = uint32_t(out->num_strings);
+        out->strings[out->num_strings++] = token.str;
+        break;
+    }
+
+    const uint64_t i = out->count++;
+    out->types[i] = token.type;
+    out->offsets[i] = uint32_t(token.location.start - out->source);
+    out->ends[i] = uint32_t(token.location.end - out->source);
+    out->payloads[i] = payload;
+    out->matches[i] = 0;
+}
+
+bool lex(const LexInput* input, TokenBuffer* output, bool skip_comments)
+{
+    assert(output->types == NULL); // caller must init to 0 TokenBuffer
+
+    output->source = input->stream;
+    if (input->length > UINT32_MAX)
+    {
+        output->failure_location = input->stream;
+        output->failure_reason = "[lex] file too large for 32-bit token offsets";
+        return false;
+    }
+
+    // reserve from the file size so typical code never regrows: real C averages well over 4 bytes per token
+    token_buffer_reserve(output, input->length / 4 + 16);
+
+    lex_cursor cur = {};
+    cur.stream = input->stream;
+    cur.end_stream = input->stream + input->length;
+    bracket_matcher brackets = {};
+    bool ok = true;
+    for (bool lexing = true; lexing;)
+    {
+        Token token;
+        switch (lex_step(&cur, &token))
+        {
+        case LEX_STEP_TOKEN:
+        {
+            if (skip_comments && token.type == eToken::comment)
+                continue;
+            token_buffer_push(output, token);
+            if (bracket_step(&brackets, output->matches, token.type, uint32_t(output->count - 1)))
+                continue;
+            ok = lexing = false;
+            break;
+        }
+        case LEX_STEP_END:
+            ok = bracket_finish(&brackets);
+            lexing = false;
+            break;
+        case LEX_STEP_FAIL:
+            output->failure_location = cur.failure_location;
+            output->failure_reason = cur.failure_reason;
+            free(brackets.open);
+            return false;
+        }
+    }
+
+    if (!ok)
+    {
+        output->failure_location = output->source + output->offsets[brackets.failed_at];
+        output->failure_reason = brackets.failure_reason;
+    }
+    free(brackets.open);
+    return ok;
+}
+
+void token_buffer_free(TokenBuffer* buffer)
+{
+    free(buffer->types);
+    free(buffer->offsets);
+    free(buffer->ends);
+    free(buffer->payloads);
+    free(buffer->matches);
+    free(buffer->identifiers);
+    free(buffer->numbers);
+    free(buffer->strings);
+    *buffer = TokenBuffer();
+}
+
+static const Token kEndToken = {};
+
+const Token* lex_end_token()
+{
+    return &kEndToken;
+}
+
+void lex_stream_init(LexStream* stream, const LexInput* input, bool skip_comments)
+{
+    stream->input = *input;
+    stream->cursor = input->stream;
+    stream->skip_comments = skip_comments;
+    stream->finished = false;
+    stream->failure_location = NULL;
+    stream->failure_reason = NULL;
+    stream->overrun = false;
+    stream->pp = NULL;
+    stream->pending = LexOutput();
+    stream->pending_pos = 0;
+    stream->record = NULL;
+    stream->produced = 0;
+}
+
+void lex_stream_close(LexStream* stream)
+{
+    free(stream->pending.tokens);
+    stream->pending = LexOutput();
+    stream->pending_pos = 0;
+}
+
+// jumps over an inactive #if group. The token cache wants every token of the file, so a recording stream
+// still lexes the group (just into record), and gives up on recording if that fails.
+static void stream_skip(LexStream* stream, lex_cursor* cur, const char* resume)
+{
+    if (stream->record)
+    {
+        lex_cursor skipped = {};
+        skipped.stream = cur->stream;
+        skipped.end_stream = resume;
+        skipped.speculative = true; // skipped text doesn't have to lex
+        Token token;
+        eLexStep step;
+        while ((step = lex_step(&skipped, &token)) == LEX_STEP_TOKEN)
+        {
+            if (token.type != eToken::comment)
+                *alloc_token(stream->record) = token;
+        }
+        if (step == LEX_STEP_FAIL)
+            stream->record = NULL;
+    }
+    cur->stream = resume;
+}
+
+// what preprocess_macro pulls the rest of a macro invocation through
+struct stream_pull_context
+{
+    LexStream* stream;
+    lex_cursor* cur;
+    bool failed;
+};
+
+static bool stream_pull(void* context, const char* skip_to, Token* o_token)
+{
+    stream_pull_context* pull = (stream_pull_context*)context;
+    if (skip_to)
+        stream_skip(pull->stream, pull->cur, skip_to);
+    switch (lex_step(pull->cur, o_token))
+    {
+    case LEX_STEP_TOKEN:
+        if (pull->stream->record && o_token->type != eToken::comment)
+            *alloc_token(pull->stream->record) = *o_token;
+        return true;
+    case LEX_STEP_FAIL:
+        pull->stream->failure_location = pull->cur->failure_location;
+        pull->stream->failure_reason = pull->cur->failure_reason;
+        pull->stream->finished = true; // after handing out what the macro expanded to
+        pull->failed = true;
+        return false;
+    default:
+        return false;
+    }
+}
+
+const Token* next_token(LexStream* stream)
+{
+    lex_cursor cur = {};
+    cur.stream = stream->cursor;
+    cur.end_stream = stream->input.stream + stream->input.length;
+
+    Token* token = &stream->ring[stream->produced & (LEX_STREAM_WINDOW - 1)];
+    for (;;)
+    {
+        // what the last directive expanded to comes first
+        while (stream->pending_pos < stream->pending.num_tokens)
+        {
+            *token = stream->pending.tokens[stream->pending_pos++];
+            if (stream->skip_comments && token->type == eToken::comment)
+                continue;
+            ++stream->produced;
+            return token;
+        }
+        if (stream->finished)
+            return NULL;
+
+        switch (lex_step(&cur, token))
+        {
+        case LEX_STEP_TOKEN:
+            if (stream->record && token->type != eToken::comment)
+                *alloc_token(stream->record) = *token;
+            if (stream->skip_comments && token->type == eToken::comment)
+                continue;
+            if (token->type == eToken::directive)
+            {
+                stream->cursor = cur.stream;
+                stream->pending.num_tokens = 0;
+                stream->pending_pos = 0;
+                if (!stream->pp)
+                {
+                    stream->failure_location = token->location.start;
+                    stream->failure_reason = "[lex] preprocessor directive but no preprocessor";
+                    stream->finished = true;
+                    return NULL;
+                }
+                const char* resume;
+                if (!preprocess_directive(stream->pp, &stream->input, token, &stream->pending, &resume))
+                {
+                    stream->failure_location = stream->pp->failure_location;
+                    stream->failure_reason = stream->pp->failure_reason;
+                    stream->finished = true;
+                    return NULL;
+                }
+                if (resume)
+                {
+                    stream_skip(stream, &cur, resume);
+                    stream->cursor = cur.stream;
+                }
+                continue;
+            }
+            if (stream->pp && preprocess_is_macro(stream->pp, token))
+            {
+                const Token name = *token;
+                stream->pending.num_tokens = 0;
+                stream->pending_pos = 0;
+                stream_pull_context pull = { stream, &cur, false };
+                bool ok = preprocess_macro(stream->pp, &stream->input, &name, stream_pull, &pull, &stream->pending);
+                stream->cursor = cur.stream;
+                if (!ok)
+                {
+                    if (!pull.failed)
+                    {
+                        stream->failure_location = stream->pp->failure_location;
+                        stream->failure_reason = stream->pp->failure_reason;
+                    }
+                    stream->finished = true;
+                    return NULL;
+                }
+                continue;
+            }
+            stream->cursor = cur.stream;
+            ++stream->produced;
+            return token;
+        case LEX_STEP_END:
+            stream->cursor = cur.stream;
+            stream->finished = true;
+            if (stream->pp && !preprocess_finish(stream->pp))
+            {
+                stream->failure_location = stream->pp->failure_location;
+                stream->failure_reason = stream->pp->failure_reason;
+            }
+            return NULL;
+        case LEX_STEP_FAIL:
+            stream->cursor = cur.stream;
+            stream->failure_location = cur.failure_location;
+            stream->failure_reason = cur.failure_reason;
+            stream->finished = true;
+            return NULL;
+        }
+    }
+}
+
+const Token* lex_stream_at(LexStream* stream, uint64_t index)
+{
+    while (index >= stream->produced)
+    {
+        if (!next_token(stream))
+            return &kEndToken;
+    }
+
+    if (stream->produced - index > LEX_STREAM_WINDOW)
+    {
+        // already overwritten. only an invalid program backtracks this far (the parser looks back at the start of
+        // an item that failed) so the parse fails, but whatever error the parser found is the one to report.
+        stream->overrun = true;
+        return &kEndToken;
+    }
+
+    return &stream->ring[index & (LEX_STREAM_WINDOW - 1)];
+}
+
+TokenStream token_stream(const Token* tokens, uint64_t count, const uint32_t* matches)
+{
+    TokenStream ts = {};
+    ts.tokens = tokens;
+    ts.count = count;
+    ts.matches = matches;
+    return ts;
+}
+
+Token token_buffer_get(const TokenBuffer* buffer, uint64_t index)
+{
+    if (index >= buffer->count)
+        return kEndToken;
+
+    Token token = {};
+    token.type = buffer->types[index];
+    token.location.start = buffer->source + buffer->offsets[index];
+    token.location.end = buffer->source + buffer->ends[index];
+    switch (token.type)
+    {
+    case eToken::identifier: token.identifier = buffer->identifiers[buffer->payloads[index]]; break;
+    case eToken::constant_number: token.number = buffer->numbers[buffer->payloads[index]]; break;
+    case eToken::string: token.str = buffer->strings[buffer->payloads[index]]; break;
+    default:
+        if (is_keyword(token.type))
+            token.identifier = kKeywordIds[int(token.type) - int(eToken::keywords_first)];
+        break;
+    }
+    return token;
+}
+
+TokenStream token_stream(const TokenBuffer* buffer)
+{
+    TokenStream ts = {};
+    ts.buffer = buffer;
+    ts.matches = buffer->matches;
+    return ts;
+}
+
+TokenStream token_stream(LexStream* stream)
+{
+    TokenStream ts = {};
+    ts.stream = stream;
+    return ts;
+}
+
+bool lex_match_brackets(const Token* tokens, uint64_t count, BracketIndex* output)
+{
+    assert(output->matches == NULL); // caller must init to 0 BracketIndex
+    if (count > UINT32_MAX)
+    {
+        output->failure_location = tokens[UINT32_MAX].location.start;
+        output->failure_reason = "[lex] too many tokens for 32-bit bracket matches";
+        return false;
+    }
+
+    output->matches = (uint32_t*)calloc(count ? count : 1, sizeof(uint32_t));
+    assert(output->matches);
+    bracket_matcher brackets = {};
+    bool ok = true;
+    for (uint64_t i = 0; ok && i < count; ++i)
+        ok = bracket_step(&brackets, output->matches, tokens[i].type, uint32_t(i));
+    ok = ok && bracket_finish(&brackets);
+
+    if (!ok)
+    {
+        output->failure_location = tokens[brackets.failed_at].location.start;
+        output->failure_reason = brackets.failure_reason;
+    }
+    free(brackets.open);
+    return ok;
+}
+
+void bracket_index_free(BracketIndex* index)
+{
+    free(index->matches);
+    *index = BracketIndex();
+}
+
 void lex_strip_comments(const LexOutput* input, LexOutput* output)
 {
     const Token* t = input->tokens;
@@ -602,6 +1139,320 @@ void lex_strip_comments(const LexOutput* input, LexOutput* output)
     }
 }
 
+// a token's extent can depend on this many bytes past its end (checking for a \ \r \n line splice)
+static const uint64_t LEX_LOOKAHEAD = 3;
+
+// alloc_token's implicit capacity for n tokens
+static uint64_t token_capacity(uint64_t n)
+{
+    uint64_t capacity = 16;
+    while (capacity < n)
+        capacity *= 2;
+    return capacity;
+}
+
+static void rebase_tokens(Token* token, Token* end, ptrdiff_t delta)
+{
+    for (; token != end; ++token)
+    {
+        token->location.start += delta;
+        token->location.end += delta;
+        if (token->type == eToken::string)
+        {
+            token->str.start += delta;
+            token->str.end += delta;
+        }
+    }
+}
+
+bool lex_incremental(const LexInput* input, const char* old_source, const SourceEdit* edit, bool skip_comments,
+    LexOutput* io_lex, TokenEdit* o_changed)
+{
+    assert(edit->start <= edit->end);
+    Token* tokens = io_lex->tokens;
+    const uint64_t num_tokens = io_lex->num_tokens;
+    const char* const new_source = input->stream;
+    const ptrdiff_t shift = ptrdiff_t(edit->replacement_length) - ptrdiff_t(edit->end - edit->start);
+
+    // first token that could see the edit. tokens are sorted so binary search on their ends.
+    uint64_t first = 0;
+    {
+        uint64_t hi = num_tokens;
+        while (first < hi)
+        {
+            uint64_t mid = (first + hi) / 2;
+            if (uint64_t(tokens[mid].location.end - old_source) + LEX_LOOKAHEAD <= edit->start)
+                first = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+
+    // restart where the old lexer was when it went looking for that token, the end of the one before it
+    lex_cursor cur = {};
+    cur.stream = first ? new_source + (tokens[first - 1].location.end - old_source) : new_source;
+    cur.end_stream = new_source + input->length;
+
+    // lex until a new token starts exactly where an old token past the edit did, from there on the text
+    // and so the tokens are the same. old_end walks the old tokens along with the new ones.
+    const char* const edit_end_new = new_source + edit->start + edit->replacement_length;
+    uint64_t old_end = first;
+    Token* relexed = NULL;
+    uint64_t num_relexed = 0;
+    uint64_t relexed_capacity = 0;
+    for (;;)
+    {
+        Token token;
+        eLexStep step = lex_step(&cur, &token);
+        if (step == LEX_STEP_FAIL)
+        {
+            free(relexed);
+            io_lex->failure_location = cur.failure_location;
+            io_lex->failure_reason = cur.failure_reason;
+            return false;
+        }
+        if (step == LEX_STEP_END)
+        {
+            old_end = num_tokens;
+            break;
+        }
+        if (skip_comments && token.type == eToken::comment)
+            continue;
+
+        if (token.location.start >= edit_end_new)
+        {
+            const uint64_t old_offset = uint64_t(token.location.start - new_source - shift);
+            while (old_end < num_tokens && uint64_t(tokens[old_end].location.start - old_source) < old_offset)
+                ++old_end;
+            if (old_end < num_tokens && uint64_t(tokens[old_end].location.start - old_source) == old_offset)
+                break;
+        }
+
+        if (num_relexed == relexed_capacity)
+        {
+            relexed_capacity = relexed_capacity ? relexed_capacity * 2 : 16;
+            relexed = (Token*)realloc(relexed, relexed_capacity * sizeof(Token));
+            assert(relexed);
+        }
+        relexed[num_relexed++] = token;
+    }
+
+    // splice: [0, first) rebased, relexed tokens, [old_end, num_tokens) rebased and shifted
+    const uint64_t new_count = first + num_relexed + (num_tokens - old_end);
+    if (!tokens || (new_count > num_tokens && token_capacity(new_count) != token_capacity(num_tokens)))
+        tokens = (Token*)realloc(tokens, token_capacity(new_count) * sizeof(Token));
+    memmove(tokens + first + num_relexed, tokens + old_end, (num_tokens - old_end) * sizeof(Token));
+    if (new_count < num_tokens && token_capacity(new_count) != token_capacity(num_tokens))
+        tokens = (Token*)realloc(tokens, token_capacity(new_count) * sizeof(Token));
+    assert(tokens);
+    memcpy(tokens + first, relexed, num_relexed * sizeof(Token));
+    free(relexed);
+
+    const ptrdiff_t rebase = new_source - old_source;
+    if (rebase != 0)
+        rebase_tokens(tokens, tokens + first, rebase);
+    if (rebase + shift != 0)
+        rebase_tokens(tokens + first + num_relexed, tokens + new_count, rebase + shift);
+
+    io_lex->tokens = tokens;
+    io_lex->num_tokens = new_count;
+    o_changed->first = first;
+    o_changed->old_end = old_end;
+    o_changed->new_end = first + num_relexed;
+    o_changed->rebase = rebase;
+    o_changed->rebase_tail = rebase + shift;
+    return true;
+}
+
+// appends n tokens, keeping alloc_token's implicit capacity
+static void append_tokens(LexOutput* out, const Token* tokens, uint64_t n)
+{
+    if (n == 0)
+        return;
+    const uint64_t count = out->num_tokens + n;
+    if (out->num_tokens == 0 || token_capacity(count) != token_capacity(out->num_tokens))
+    {
+        out->tokens = (Token*)realloc(out->tokens, token_capacity(count) * sizeof(Token));
+        assert(out->tokens);
+    }
+    memcpy(out->tokens + out->num_tokens, tokens, n * sizeof(Token));
+    out->num_tokens = count;
+}
+
+// One piece of lex_parallel. Lexes every token that starts in [begin, end) (the last one may run past end)
+// assuming begin is a token boundary, which is only a guess: it could be inside a comment, string or line
+// splice. Stitching checks the guess.
+struct lex_chunk
+{
+    const char* begin;
+    const char* end;
+    LexOutput out;
+    const char* next_start; // start of the first token at or after end, end of input if there's none
+    bool failed;
+    const char* failure_location;
+    const char* failure_reason;
+};
+
+static void lex_chunk_run(lex_chunk* chunk, const char* end_stream)
+{
+    lex_cursor cur = {};
+    cur.stream = chunk->begin;
+    cur.end_stream = end_stream;
+    cur.speculative = true;
+    chunk->next_start = end_stream;
+    for (;;)
+    {
+        Token token;
+        switch (lex_step(&cur, &token))
+        {
+        case LEX_STEP_TOKEN:
+            if (token.location.start >= chunk->end)
+            {
+                chunk->next_start = token.location.start;
+                return;
+            }
+            *alloc_token(&chunk->out) = token;
+            continue;
+        case LEX_STEP_END:
+            return;
+        case LEX_STEP_FAIL:
+            chunk->failed = true;
+            chunk->failure_location = cur.failure_location;
+            chunk->failure_reason = cur.failure_reason;
+            return;
+        }
+    }
+}
+
+// index of the token in [0, count) that starts at `start`, count if none
+static uint64_t find_token_start(const Token* tokens, uint64_t count, const char* start)
+{
+    uint64_t lo = 0;
+    uint64_t hi = count;
+    while (lo < hi)
+    {
+        uint64_t mid = (lo + hi) / 2;
+        if (tokens[mid].location.start < start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < count && tokens[lo].location.start == start ? lo : count;
+}
+
+bool lex_parallel(const LexInput* input, LexOutput* output, uint32_t num_chunks)
+{
+    assert(output->tokens == NULL); // caller must init to 0 LexOutput
+
+    if (num_chunks == 0)
+    {
+        uint64_t by_size = input->length / LEX_PARALLEL_MIN_CHUNK;
+        uint32_t threads = std::thread::hardware_concurrency();
+        num_chunks = by_size < threads ? uint32_t(by_size) : threads;
+    }
+    if (num_chunks <= 1)
+        return lex(input, output);
+
+    // split at line starts, chunks past the first are lexed on their own threads
+    const char* const end_stream = input->stream + input->length;
+    lex_chunk* chunks = (lex_chunk*)calloc(num_chunks, sizeof(lex_chunk));
+    assert(chunks);
+    const char* begin = input->stream;
+    for (uint32_t i = 0; i < num_chunks; ++i)
+    {
+        const char* end = input->stream + input->length * (i + 1) / num_chunks;
+        if (end < begin)
+            end = begin;
+        if (end != end_stream)
+        {
+            const char* newline = (const char*)memchr(end, '\n', size_t(end_stream - end));
+            end = newline ? newline + 1 : end_stream;
+        }
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        begin = end;
+    }
+
+    std::thread* workers = new std::thread[num_chunks - 1];
+    for (uint32_t i = 1; i < num_chunks; ++i)
+        workers[i - 1] = std::thread(lex_chunk_run, &chunks[i], end_stream);
+    lex_chunk_run(&chunks[0], end_stream);
+    for (uint32_t i = 1; i < num_chunks; ++i)
+        workers[i - 1].join();
+    delete[] workers;
+
+    // stitch. `cursor` is always somewhere the serial lexer would be between tokens. Lex one token from it
+    // for real; if a chunk has a token starting at the same byte, everything the chunk lexed from there
+    // on is what lex() would have produced. Otherwise keep the real token and try again with the next.
+    bool ok = true;
+    const char* cursor = input->stream;
+    for (uint32_t i = 0; ok && i < num_chunks; ++i)
+    {
+        lex_chunk* chunk = &chunks[i];
+        while (cursor < chunk->end)
+        {
+            lex_cursor cur = {};
+            cur.stream = cursor;
+            cur.end_stream = end_stream;
+            Token token;
+            eLexStep step = lex_step(&cur, &token);
+            if (step == LEX_STEP_FAIL)
+            {
+                output->failure_location = cur.failure_location;
+                output->failure_reason = cur.failure_reason;
+                ok = false;
+                break;
+            }
+            if (step == LEX_STEP_END)
+            {
+                cursor = end_stream;
+                break;
+            }
+            if (token.location.start >= chunk->end)
+            {
+                cursor = token.location.start; // belongs to the next chunk
+                break;
+            }
+
+            const uint64_t k = find_token_start(chunk->out.tokens, chunk->out.num_tokens, token.location.start);
+            if (k == chunk->out.num_tokens)
+            {
+                append_tokens(output, &token, 1);
+                cursor = cur.stream;
+                continue;
+            }
+
+            append_tokens(output, chunk->out.tokens + k, chunk->out.num_tokens - k);
+            if (chunk->failed)
+            {
+                output->failure_location = chunk->failure_location;
+                output->failure_reason = chunk->failure_reason;
+                ok = false;
+            }
+            cursor = chunk->next_start;
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < num_chunks; ++i)
+        free(chunks[i].out.tokens);
+    free(chunks);
+    return ok;
+}
+
+bool token_equal(const Token& a, const Token& b)
+{
+    if (a.type != b.type || a.location.start != b.location.start || a.location.end != b.location.end)
+        return false;
+    switch (a.type)
+    {
+    case eToken::identifier: return a.identifier.nts == b.identifier.nts;
+    case eToken::constant_number: return a.number == b.number;
+    case eToken::string: return a.str.start == b.str.start && a.str.end == b.str.end;
+    default: return !is_keyword(a.type) || a.identifier.nts == b.identifier.nts;
+    }
+}
+
 void dump_lex(FILE* file, const LexOutput* lex)
 {
     const Token* const token_end = lex->tokens + lex->num_tokens;
@@ -652,6 +1503,7 @@ void dump_lex(FILE* file, const LexOutput* lex)
         case eToken::keyword_break: fprintf(file, "break"); continue;
         case eToken::keyword_continue: fprintf(file, "continue"); continue;
         case eToken::comment: fprintf(file, "<comment>"); continue;
+        case eToken::directive: fprintf(file, "%.*s\n", int(token.location.end - token.location.start), token.location.start); continue;
         //case eToken::include_path: fprintf(file, "#include \"%.*s\"", (token.path.end - token.path.start), token.path.start); continue;
         }
         
@@ -59,6 +59,7 @@ enum eToken : uint8_t
     keyword_continue, keywords_last = keyword_continue,
 
     comment,
+    directive, // a whole # line (line splices included), expanded by preprocess()
     //include_path,
 };
 
@@ -101,7 +102,168 @@ struct LexOutput
     const char* failure_reason;
 };
 
+// Bump whenever lex() can produce different tokens for the same input (new token types, changed extents or
+// payloads). Anything persisted from lex() output (see token_cache.h) is keyed on it.
+static const uint32_t LEX_FORMAT_VERSION = 2;
+
 LexInput init_lex(const char* filename, const char* filedata, uint64_t filelen);
 bool lex(const LexInput* input, LexOutput* output);
+Token* alloc_token(LexOutput* out); // appends an uninitialized token
+
+// Same tokens as lex(), but the input is split at line starts into num_chunks pieces that are lexed on their
+// own threads and stitched back together. A piece that starts inside a comment, string or line splice is
+// re-lexed serially up to the point where it agrees with the real token stream again.
+// num_chunks == 0 picks one chunk per hardware thread, at most one per LEX_PARALLEL_MIN_CHUNK bytes.
+static const uint64_t LEX_PARALLEL_MIN_CHUNK = 1024 * 1024;
+bool lex_parallel(const LexInput* input, LexOutput* output, uint32_t num_chunks);
 void lex_strip_comments(const LexOutput* input, LexOutput* output);
+
+// An edit already applied to the text being lexed: bytes [start, end) of the old text were replaced by
+// replacement_length bytes.
+struct SourceEdit
+{
+    uint64_t start;
+    uint64_t end;
+    uint64_t replacement_length;
+};
+
+// Which tokens an incremental re-lex replaced: old [first, old_end) are now new [first, new_end).
+struct TokenEdit
+{
+    uint64_t first;
+    uint64_t old_end;
+    uint64_t new_end;
+    int64_t rebase; // how far source pointers of the tokens before first moved, new text - old text
+    int64_t rebase_tail; // same for the tokens from new_end on, also shifted by the edit's change in length
+};
+
+// Re-lex after a SourceEdit instead of lexing the whole file again. io_lex holds the tokens of the old text,
+// which started at old_source (only used to rebase pointers, it may already be freed); input is the new text.
+// Lexing restarts just before the first token the edit could have changed and stops as soon as a new token
+// starts where an old one did past the edit, the rest are kept and shifted. skip_comments must match how
+// io_lex was produced (lex() then lex_strip_comments() == true).
+bool lex_incremental(const LexInput* input, const char* old_source, const SourceEdit* edit, bool skip_comments,
+    LexOutput* io_lex, TokenEdit* o_changed);
+bool token_equal(const Token& a, const Token& b); // type, location and payload
 void dump_lex(FILE* file, const LexOutput* lex);
+
+// Pull-based alternative to lex(): tokens are lexed on demand into a fixed ring, so token memory is
+// O(LEX_STREAM_WINDOW) instead of O(file). The most recent LEX_STREAM_WINDOW tokens stay addressable,
+// which is how far a parser may look back (backtrack) from the furthest token it has pulled.
+static const uint64_t LEX_STREAM_WINDOW = 1024; // power of two
+
+struct LexStream
+{
+    LexInput input;
+    const char* cursor; // next byte to lex
+    bool skip_comments;
+    bool finished; // end of input or failure, nothing more will be lexed (pending is still handed out)
+    struct Preprocessor* pp; // expands directives and macros when set, otherwise a directive is a lex failure
+    LexOutput pending; // tokens the last directive or macro expanded to, handed out before lexing continues
+    uint64_t pending_pos;
+    LexOutput* record; // when set, every non-comment token of input (directives unexpanded) is appended here. Reset to NULL if an inactive #if group doesn't lex.
+
+    const char* failure_location;
+    const char* failure_reason;
+    bool overrun; // a parser reached back past the window. Only an error of its own if the parser didn't report one, see ast(LexStream*)
+
+    uint64_t produced; // tokens lexed so far. token i lives in ring[i % LEX_STREAM_WINDOW]
+    Token ring[LEX_STREAM_WINDOW];
+};
+
+void lex_stream_init(LexStream* stream, const LexInput* input, bool skip_comments);
+void lex_stream_close(LexStream* stream); // frees what a preprocessor expanded, the LexStream itself is the caller's
+const Token* next_token(LexStream* stream); // lexes the next token, NULL at end of input or on failure
+const Token* lex_stream_at(LexStream* stream, uint64_t index); // token by absolute index, lexing ahead as needed. Returns lex_end_token() past the end, on failure or if index fell out of the window (see overrun).
+const Token* lex_end_token(); // type == eToken::UNKNOWN
+
+// Structure-of-arrays token storage. The parser mostly looks at types, so those are packed one byte per
+// token in their own array; the rest of a token is a 32-bit source offset plus a 32-bit payload index into
+// per-kind side tables (identifiers, numbers, strings), with location ends off in a cold array.
+// Offsets being 32-bit limits a TokenBuffer to 4GB of source, lex() fails beyond that.
+// lex() also pairs up brackets as it goes (see matches), so it fails on unbalanced ( ) { } too.
+struct TokenBuffer
+{
+    const char* source; // offsets/ends are relative to this
+    uint64_t count;
+    uint64_t capacity;
+
+    eToken* types;
+    uint32_t* offsets; // location.start
+    uint32_t* ends; // location.end
+    uint32_t* payloads; // index into identifiers, numbers or strings depending on type, 0 otherwise (a keyword's identifier goes by its type)
+    uint32_t* matches; // for ( { ) } the index of the bracket it pairs with, 0 otherwise
+
+    str* identifiers;
+    uint64_t num_identifiers;
+    uint64_t identifiers_capacity;
+    uint64_t* numbers;
+    uint64_t num_numbers;
+    uint64_t numbers_capacity;
+    str_slice* strings;
+    uint64_t num_strings;
+    uint64_t strings_capacity;
+
+    const char* failure_location;
+    const char* failure_reason;
+};
+
+bool lex(const LexInput* input, TokenBuffer* output, bool skip_comments); // output must be zero-initialized
+void token_buffer_free(TokenBuffer* buffer);
+Token token_buffer_get(const TokenBuffer* buffer, uint64_t index); // reassembles a Token, lex_end_token() past the end
+
+// TokenBuffer::matches for a token array, for tokens that only take their final shape after preprocess() and
+// lex_strip_comments(). One pass with a stack of open brackets. Fails on the first closer that doesn't pair with
+// the innermost open bracket, or on the innermost bracket still open at the end. At most UINT32_MAX tokens.
+struct BracketIndex
+{
+    uint32_t* matches; // same as TokenBuffer::matches
+    const char* failure_location;
+    const char* failure_reason;
+};
+
+bool lex_match_brackets(const Token* tokens, uint64_t count, BracketIndex* output); // output must be zero-initialized
+void bracket_index_free(BracketIndex* index);
+
+// Parser's view of the tokens: a position plus where the tokens come from (a lex() array, a TokenBuffer or
+// a LexStream). Copying a TokenStream is how the parsers save/restore their position.
+// type() is the hot path and only touches the type array of a TokenBuffer; peek() builds a whole Token.
+// With a bracket index (always for a TokenBuffer, never for a LexStream) a ( ... ) or { ... } can be stepped over
+// in O(1) without looking at what's inside.
+struct TokenStream
+{
+    const Token* tokens; // array source
+    uint64_t count;
+    const TokenBuffer* buffer; // SoA source, used when not NULL
+    LexStream* stream; // stream source, used when not NULL
+    const uint32_t* matches; // bracket index for the source (TokenBuffer::matches, BracketIndex::matches) or NULL
+    uint64_t pos;
+
+    Token at(uint64_t index) const // absolute index, see LexStream for how far back is allowed
+    {
+        if (buffer)
+            return token_buffer_get(buffer, index);
+        if (stream)
+            return *lex_stream_at(stream, index);
+        return index < count ? tokens[index] : *lex_end_token();
+    }
+    eToken type_at(uint64_t index) const
+    {
+        if (buffer)
+            return index < buffer->count ? buffer->types[index] : eToken::UNKNOWN;
+        if (stream)
+            return lex_stream_at(stream, index)->type;
+        return index < count ? tokens[index].type : eToken::UNKNOWN;
+    }
+    Token peek(uint64_t ahead = 0) const { return at(pos + ahead); }
+    eToken type(uint64_t ahead = 0) const { return type_at(pos + ahead); }
+    bool at_end() const { return type() == eToken::UNKNOWN; }
+    bool has(uint64_t n) const { return n == 0 || type(n - 1) != eToken::UNKNOWN; } // at least n tokens left
+    void advance(uint64_t n = 1) { pos += n; }
+    uint64_t match(uint64_t ahead = 0) const { return matches[pos + ahead]; } // index of the bracket pairing with the ( { ) or } ahead, needs matches
+    void skip_group() { pos = matches[pos] + 1; } // from a ( or { to just past its closer, needs matches
+};
+
+TokenStream token_stream(const Token* tokens, uint64_t count, const uint32_t* matches = NULL); // matches from lex_match_brackets
+TokenStream token_stream(const TokenBuffer* buffer);
+TokenStream token_stream(LexStream* stream);
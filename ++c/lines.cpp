@@ -0,0 +1,75 @@
+#include "lines.h"
+#include "scan.h"
+#include "debug.h"
+#include <stdlib.h>
+
+void line_index_init(LineIndex* lines, const char* filename, const char* source, uint64_t length)
+{
+    lines->filename = filename;
+    lines->source = source;
+    lines->length = length;
+    lines->line_starts = NULL;
+    lines->num_lines = 0;
+}
+
+void line_index_free(LineIndex* lines)
+{
+    free(lines->line_starts);
+    lines->line_starts = NULL;
+    lines->num_lines = 0;
+}
+
+bool line_index_contains(const LineIndex* lines, const char* at)
+{
+    return at && at >= lines->source && uint64_t(at - lines->source) <= lines->length;
+}
+
+static void line_index_build(LineIndex* lines)
+{
+    const char* const end = lines->source + lines->length;
+    lines->num_lines = scan_count_byte(lines->source, end, '\n') + 1;
+    lines->line_starts = (uint64_t*)malloc(size_t(lines->num_lines) * sizeof(uint64_t));
+    assert(lines->line_starts);
+
+    lines->line_starts[0] = 0;
+    const char* iter = lines->source;
+    for (uint64_t i = 1; i < lines->num_lines; ++i)
+    {
+        iter = scan_find_byte(iter, end, '\n') + 1;
+        lines->line_starts[i] = uint64_t(iter - lines->source);
+    }
+}
+
+SourceLocation line_index_locate(LineIndex* lines, const char* at)
+{
+    SourceLocation where = {};
+    where.filename = lines->filename;
+    if (!line_index_contains(lines, at))
+        return where;
+    if (!lines->line_starts)
+        line_index_build(lines);
+
+    // last line starting at or before offset
+    const uint64_t offset = uint64_t(at - lines->source);
+    uint64_t lo = 0;
+    uint64_t hi = lines->num_lines;
+    while (hi - lo > 1)
+    {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (lines->line_starts[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    where.line = lo + 1;
+    where.column = offset - lines->line_starts[lo] + 1;
+    return where;
+}
+
+void print_location(FILE* file, const SourceLocation* where)
+{
+    if (where->line)
+        fprintf(file, "%s:%" PRIu64 ":%" PRIu64, where->filename, where->line, where->column);
+    else
+        fprintf(file, "%s", where->filename);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <inttypes.h>
+#include <stdio.h>
+
+// file:line:col for diagnostics. Tokens only carry pointers into their source, a LineIndex turns one back into
+// a line and column. Setting one up is free: the first lookup counts the newlines (scan_count_byte), allocates
+// exactly that many line starts and fills them in, every lookup after that is a binary search. Only failure
+// paths look anything up, so a successful compile never builds one.
+// NOTE: the lazy build isn't thread safe, locate from one thread at a time.
+
+struct SourceLocation
+{
+    const char* filename;
+    uint64_t line; // 1-based, 0 if the pointer wasn't in the file
+    uint64_t column; // 1-based, in bytes
+};
+
+struct LineIndex
+{
+    const char* filename;
+    const char* source;
+    uint64_t length;
+    uint64_t* line_starts; // offset of each line's first byte, NULL until the first lookup
+    uint64_t num_lines;
+};
+
+void line_index_init(LineIndex* lines, const char* filename, const char* source, uint64_t length);
+void line_index_free(LineIndex* lines);
+bool line_index_contains(const LineIndex* lines, const char* at); // one past the end counts, lex failures point there
+SourceLocation line_index_locate(LineIndex* lines, const char* at);
+void print_location(FILE* file, const SourceLocation* where); // "file:line:col" or just "file" if line is 0
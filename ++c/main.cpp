@@ -1,4 +1,5 @@
 #include "test.h"
+#include "bench.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -17,6 +18,12 @@ int main(int argc, char** argv)
             return run_ir_tests();
         }
 
+        // if -bench, run synthetic front-end benchmarks
+        if (0 == strcmp(argv[i], "-bench"))
+        {
+            return run_benchmarks();
+        }
+
         // if -test is specified, ignore rest of command-line
         if (0 == strcmp(argv[i], "-test"))
         {
@@ -62,7 +69,7 @@ int main(int argc, char** argv)
         return compile_file(test_file, verbose);
     }
     
-    printf("expected either '-interp' to run interpreter, '<file path to compile>', '-test' to run all tests, or '-test <number>' to run tests on a specific stage number\n");
+    printf("expected either '-interp' to run interpreter, '<file path to compile>', '-test' to run all tests, '-test <number>' to run tests on a specific stage number, or '-bench' to run benchmarks\n");
     return compile_file(NULL, true);
 }
 
@@ -71,6 +78,8 @@ int main(int argc, char** argv)
 #include "dir.h"
 #include "debug.h"
 #include "lex.h"
+#include "preprocess.h"
+#include "token_cache.h"
 #include "ir.h"
 #include "gen.h"
 struct path
@@ -121,27 +130,56 @@ static void path_init(path* p, const char* filename)
     if (!get_absolute_path(tmp, &p->exe_path))
         debug_break();
 }
+// "file:line:col: what: reason", only ever called once something has failed so the line index is built here
+static void print_failure(const LexInput& lexin, const char* at, const char* what, const char* reason)
+{
+    LineIndex lines;
+    line_index_init(&lines, lexin.filename, lexin.stream, lexin.length);
+    const SourceLocation where = preprocess_locate(&lines, at);
+    print_location(stdout, &where);
+    fprintf(stdout, ": %s: %s\n", what, reason);
+    line_index_free(&lines);
+}
+static int compile_lex_input(const char* path, const LexInput& lexin, bool verbose, Timer main_timer);
 static int compile_file(const char* path, bool verbose)
 {
-    bool verbose_print = false;
-    bool verbose_print_to_disk = false;
-    bool verbose_print_timers = false;
-
     Timer main_timer;
     main_timer.start();
 
+    // everything downstream (tokens, ir) points into the source, so it stays open until compilation is done.
+    SourceBuffer source = {};
     LexInput lexin;
     if (path)
     {
-        size_t file_length;
-        const char* file_data = file_read_into_memory(path, &file_length);
-        if (!file_data)
+        if (!file_open_source(path, &source))
         {
             // error reasons printed by function.
             return 2;
         }
-        lexin = init_lex(path, file_data, file_length);
+        lexin = init_lex(path, source.data, source.size);
+    }
+    else
+    {
+        const char* prog =
+            "int main() {\n"
+            "    return 2;\n"
+            "}\n";
+        printf("no path given so defaulting to simple program:\n%s\n", prog);
+        lexin = init_lex("ret2", prog, strlen(prog));
+    }
 
+    int result = compile_lex_input(path, lexin, verbose, main_timer);
+    file_close_source(&source);
+    return result;
+}
+static int compile_lex_input(const char* path, const LexInput& lexin, bool verbose, Timer main_timer)
+{
+    bool verbose_print = false;
+    bool verbose_print_to_disk = false;
+    bool verbose_print_timers = false;
+
+    if (path)
+    {
         if (verbose)
         {
             verbose_print = true;
@@ -155,15 +193,6 @@ static int compile_file(const char* path, bool verbose)
             fprintf(stdout, "\n===END RAW FILE===\n");
         }
     }
-    else
-    {
-        const char* prog =
-            "int main() {\n"
-            "    return 2;\n"
-            "}\n";
-        printf("no path given so defaulting to simple program:\n%s\n", prog);
-        lexin = init_lex("ret2", prog, strlen(prog));
-    }
 
     FILE* timer_log;
     if (0 != fopen_s(&timer_log, "++c.timer.log", "ab"))
@@ -175,18 +204,20 @@ static int compile_file(const char* path, bool verbose)
     struct path p;
     path_init(&p, lexin.filename);
 
-    LexOutput lexout = {};
-    if (!lex(&lexin, &lexout))
-    {
-        fprintf(stdout, "lex failure: %s\n", lexout.failure_reason);
-        dump_lex(stdout, &lexout);
-        main_timer.end();
-        fprintf(timer_log, "\n[%s] lex fail, took %.2fms\n", p.original, main_timer.milliseconds());
-        debug_break();
-        return 1;
-    }
-    else if (verbose_print)
+    // tokens are only materialized when they're going to be printed, otherwise ir() pulls them from the lexer.
+    if (verbose_print)
     {
+        LexOutput lexout = {};
+        if (!lex(&lexin, &lexout))
+        {
+            print_failure(lexin, lexout.failure_location, "lex failure", lexout.failure_reason);
+            dump_lex(stdout, &lexout);
+            main_timer.end();
+            fprintf(timer_log, "\n[%s] lex fail, took %.2fms\n", p.original, main_timer.milliseconds());
+            debug_break();
+            return 1;
+        }
+
         fprintf(stdout, "==lex success!==[");
         dump_lex(stdout, &lexout);
         fprintf(stdout, "]\n");
@@ -197,11 +228,73 @@ static int compile_file(const char* path, bool verbose)
             dump_lex(file, &lexout);
             fclose(file);
         }
+        free(lexout.tokens);
     }
 
+    // unchanged sources come straight out of the token cache, otherwise ir() pulls tokens from the lexer
+    // and they're recorded on the way for the cache.
+    Preprocessor pp;
+    preprocess_init(&pp);
     IR* ir_out = nullptr;
     size_t ir_out_size = 0;
-    if (!ir(lexout.tokens, lexout.num_tokens, &ir_out, &ir_out_size))
+    bool ir_ok = false;
+    const char* lex_failure = NULL;
+    const char* lex_failure_location = NULL;
+    LexOutput cached = {};
+    if (token_cache_load(&lexin, &cached))
+    {
+        LexOutput expanded = {};
+        LexOutput tokens = {};
+        if (preprocess(&pp, &lexin, &cached, &expanded))
+        {
+            lex_strip_comments(&expanded, &tokens); // included files still have theirs
+            BracketIndex brackets = {};
+            if (lex_match_brackets(tokens.tokens, tokens.num_tokens, &brackets))
+            {
+                ir_ok = ir(tokens.tokens, tokens.num_tokens, &ir_out, &ir_out_size);
+            }
+            else
+            {
+                lex_failure = brackets.failure_reason;
+                lex_failure_location = brackets.failure_location;
+            }
+            bracket_index_free(&brackets);
+        }
+        else
+        {
+            lex_failure = pp.failure_reason;
+            lex_failure_location = pp.failure_location;
+        }
+        free(expanded.tokens);
+        free(tokens.tokens);
+    }
+    else
+    {
+        LexStream* lexstream = (LexStream*)malloc(sizeof(LexStream)); // token ring is too big to want on the stack
+        lex_stream_init(lexstream, &lexin, true);
+        lexstream->pp = &pp;
+        lexstream->record = &cached;
+
+        ir_ok = ir(lexstream, &ir_out, &ir_out_size);
+        lex_failure = lexstream->failure_reason;
+        lex_failure_location = lexstream->failure_location;
+        if (ir_ok && lexstream->finished && !lex_failure && lexstream->record)
+            token_cache_store(&lexin, &cached);
+        lex_stream_close(lexstream);
+        free(lexstream);
+    }
+    free(cached.tokens);
+    preprocess_free(&pp);
+
+    if (lex_failure)
+    {
+        print_failure(lexin, lex_failure_location, "lex failure", lex_failure);
+        main_timer.end();
+        fprintf(timer_log, "\n[%s] lex fail, took %.2fms\n", p.original, main_timer.milliseconds());
+        debug_break();
+        return 1;
+    }
+    if (!ir_ok)
     {
         main_timer.end();
         fprintf(timer_log, "[%s] IR fail, took %.2fms\n", p.original, main_timer.milliseconds());
@@ -289,7 +382,16 @@ static int compile_file(const char* path, bool verbose)
     }
 
     main_timer.end();
-    if (verbose_print_timers) fprintf(stdout, "Total Time: %.2fms\n", main_timer.milliseconds());
+    if (verbose_print_timers)
+    {
+        const TokenCacheStats token_cache = token_cache_stats();
+        fprintf(stdout, "Token Cache: %s\n", token_cache.hits ? "hit" : token_cache.stores ? "miss, stored" : "miss");
+        const IncludeCacheStats includes = include_cache_stats();
+        if (includes.lookups)
+            fprintf(stdout, "Include Cache: %" PRIu64 " lookups, %.0f%% hits, %" PRIu64 " skipped by guard/once, %" PRIu64 " files\n",
+                includes.lookups, 100.0 * includes.hits / includes.lookups, includes.skips, includes.files);
+        fprintf(stdout, "Total Time: %.2fms\n", main_timer.milliseconds());
+    }
 
     fprintf(timer_log, "[%s] total time: %.2fms of which a system call to clang took %.2fms\n",
         p.original,
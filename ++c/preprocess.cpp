@@ -0,0 +1,1618 @@
+#include "preprocess.h"
+#include "file.h"
+#include "scan.h"
+#include "splice.h"
+#include "strings.h"
+#include "debug.h"
+#include <string.h>
+#include <stdlib.h>
+
+// see note on kMain in lex.cpp about init order
+static const str kInclude = strings_insert_nts("include");
+static const str kPragma = strings_insert_nts("pragma");
+static const str kOnce = strings_insert_nts("once");
+static const str kIfndef = strings_insert_nts("ifndef");
+static const str kDefine = strings_insert_nts("define");
+static const str kEndif = strings_insert_nts("endif");
+static const str kUndef = strings_insert_nts("undef");
+static const str kIf = strings_insert_nts("if");
+static const str kIfdef = strings_insert_nts("ifdef");
+static const str kElif = strings_insert_nts("elif");
+static const str kElse = strings_insert_nts("else");
+static const str kDefined = strings_insert_nts("defined");
+
+static const int MAX_INCLUDE_DEPTH = 64;
+static const int MAX_INCLUDE_PATH = 260;
+static const uint32_t INCLUDE_CACHE_MIN_SLOTS = 64;
+static const uint32_t MACRO_TABLE_MIN_SLOTS = 256;
+static const uint32_t MAX_MACRO_PARAMS = 127; // the standard's minimum limit
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// INCLUDE CACHE
+struct include_entry
+{
+    str path; // first path it was included by
+    FileIdentity identity;
+    SourceBuffer source;
+    LexOutput tokens; // lex() of the whole file, directives unexpanded
+    bool pragma_once;
+    str guard; // name of the classic include guard, nts == NULL if it doesn't have one
+    uint32_t included_in; // last translation unit that expanded it, for #pragma once
+    LineIndex lines; // for diagnostics, see preprocess_locate
+};
+
+// open-addressing table keyed by interned path (compared by pointer). Several paths can lead to one entry.
+struct include_slot
+{
+    const char* path;
+    include_entry* entry;
+};
+
+static include_slot* g_slots;
+static uint32_t g_slot_mask;
+static uint32_t g_slot_count;
+static include_entry** g_entries;
+static uint32_t g_num_entries;
+static IncludeCacheStats g_stats;
+static uint32_t g_translation_units;
+
+static uint32_t include_hash(const char* path)
+{
+    return uint32_t((uintptr_t(path) >> 3) * 0x9E3779B1u);
+}
+
+static include_entry* include_cache_find(const char* path)
+{
+    if (!g_slots)
+        return NULL;
+    for (uint32_t index = include_hash(path) & g_slot_mask; g_slots[index].path; index = (index + 1) & g_slot_mask)
+    {
+        if (g_slots[index].path == path)
+            return g_slots[index].entry;
+    }
+    return NULL;
+}
+
+static void include_cache_insert(const char* path, include_entry* entry)
+{
+    // keep load factor at or below 1/2, same as the string table
+    if (!g_slots || (g_slot_count + 1) * 2 > g_slot_mask + 1)
+    {
+        const uint32_t old_size = g_slots ? g_slot_mask + 1 : 0;
+        const uint32_t new_size = old_size ? old_size * 2 : INCLUDE_CACHE_MIN_SLOTS;
+        include_slot* slots = (include_slot*)calloc(new_size, sizeof(include_slot));
+        assert(slots);
+        for (uint32_t i = 0; i < old_size; ++i)
+        {
+            if (!g_slots[i].path)
+                continue;
+            uint32_t index = include_hash(g_slots[i].path) & (new_size - 1);
+            while (slots[index].path)
+                index = (index + 1) & (new_size - 1);
+            slots[index] = g_slots[i];
+        }
+        free(g_slots);
+        g_slots = slots;
+        g_slot_mask = new_size - 1;
+    }
+
+    uint32_t index = include_hash(path) & g_slot_mask;
+    while (g_slots[index].path)
+        index = (index + 1) & g_slot_mask;
+    g_slots[index].path = path;
+    g_slots[index].entry = entry;
+    ++g_slot_count;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// MACROS
+struct macro
+{
+    str name;
+    bool function_like;
+    uint32_t num_params;
+    str* params;
+    const Token* body; // replacement list, points into words
+    uint32_t body_length;
+    uint32_t* body_params; // per body token: 1 + index of the parameter it names, 0 if it isn't one
+    LexOutput words; // the lexed #define line. Its tokens point into the defining file, which outlives the macro
+};
+
+// open-addressing table keyed by interned name (compared by pointer). #undef only clears the macro, the name
+// keeps its slot so nothing ever has to be deleted from the probe sequence.
+struct macro_slot
+{
+    const char* name;
+    macro* m;
+};
+
+// names of the macros a token came out of, it can't be expanded by any of them again (the standard's
+// "painted blue"). A linked list in a per-expansion arena, index 0 is the empty set.
+struct hideset_node
+{
+    const char* name;
+    uint32_t next;
+};
+
+struct macro_table
+{
+    macro_slot* slots;
+    uint32_t slot_mask;
+    uint32_t slot_count;
+    uint32_t num_defined;
+
+    hideset_node* hidesets;
+    uint32_t num_hidesets;
+    uint32_t hidesets_capacity;
+};
+
+static uint32_t macro_hash(const char* name)
+{
+    return uint32_t((uintptr_t(name) >> 3) * 0x9E3779B1u);
+}
+
+static bool has_identifier(eToken type)
+{
+    return type == eToken::identifier || (type >= eToken::keywords_first && type <= eToken::keywords_last);
+}
+
+static macro_slot* macro_slot_find(const macro_table* table, const char* name)
+{
+    if (!table || !table->slots)
+        return NULL;
+    for (uint32_t index = macro_hash(name) & table->slot_mask; table->slots[index].name; index = (index + 1) & table->slot_mask)
+    {
+        if (table->slots[index].name == name)
+            return &table->slots[index];
+    }
+    return NULL;
+}
+
+static macro* macro_find(const macro_table* table, const char* name)
+{
+    const macro_slot* slot = macro_slot_find(table, name);
+    return slot ? slot->m : NULL;
+}
+
+static macro_slot* macro_slot_insert(macro_table* table, const char* name)
+{
+    if (macro_slot* slot = macro_slot_find(table, name))
+        return slot;
+
+    // keep load factor at or below 1/2, same as the string table
+    if (!table->slots || (table->slot_count + 1) * 2 > table->slot_mask + 1)
+    {
+        const uint32_t old_size = table->slots ? table->slot_mask + 1 : 0;
+        const uint32_t new_size = old_size ? old_size * 2 : MACRO_TABLE_MIN_SLOTS;
+        macro_slot* slots = (macro_slot*)calloc(new_size, sizeof(macro_slot));
+        assert(slots);
+        for (uint32_t i = 0; i < old_size; ++i)
+        {
+            if (!table->slots[i].name)
+                continue;
+            uint32_t index = macro_hash(table->slots[i].name) & (new_size - 1);
+            while (slots[index].name)
+                index = (index + 1) & (new_size - 1);
+            slots[index] = table->slots[i];
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->slot_mask = new_size - 1;
+    }
+
+    uint32_t index = macro_hash(name) & table->slot_mask;
+    while (table->slots[index].name)
+        index = (index + 1) & table->slot_mask;
+    table->slots[index].name = name;
+    ++table->slot_count;
+    return &table->slots[index];
+}
+
+static void macro_free(macro* m)
+{
+    if (!m)
+        return;
+    free(m->words.tokens);
+    free(m); // params and body_params share its allocation
+}
+
+static bool macro_defined(const Preprocessor* pp, str name)
+{
+    return macro_find(pp->macros, name.nts) != NULL;
+}
+
+static bool hideset_contains(const macro_table* table, uint32_t hideset, const char* name)
+{
+    for (; hideset; hideset = table->hidesets[hideset].next)
+    {
+        if (table->hidesets[hideset].name == name)
+            return true;
+    }
+    return false;
+}
+
+static uint32_t hideset_add(macro_table* table, uint32_t hideset, const char* name)
+{
+    if (hideset_contains(table, hideset, name))
+        return hideset;
+    if (table->num_hidesets == table->hidesets_capacity)
+    {
+        table->hidesets_capacity = table->hidesets_capacity ? table->hidesets_capacity * 2 : 256;
+        table->hidesets = (hideset_node*)realloc(table->hidesets, table->hidesets_capacity * sizeof(hideset_node));
+        assert(table->hidesets);
+    }
+    table->hidesets[table->num_hidesets].name = name;
+    table->hidesets[table->num_hidesets].next = hideset;
+    return table->num_hidesets++;
+}
+
+static uint32_t hideset_union(macro_table* table, uint32_t a, uint32_t b)
+{
+    for (; a; a = table->hidesets[a].next)
+        b = hideset_add(table, b, table->hidesets[a].name);
+    return b;
+}
+
+static uint32_t hideset_intersection(macro_table* table, uint32_t a, uint32_t b)
+{
+    uint32_t both = 0;
+    for (; a; a = table->hidesets[a].next)
+    {
+        if (hideset_contains(table, b, table->hidesets[a].name))
+            both = hideset_add(table, both, table->hidesets[a].name);
+    }
+    return both;
+}
+
+// true if only line splices separate the end of a from the start of b
+static bool tokens_adjacent(const Token& a, const Token& b)
+{
+    const char* at = a.location.end;
+    while (at < b.location.start)
+    {
+        const uint64_t splice = splice_length(at, b.location.start);
+        if (!splice)
+            return false;
+        at += splice;
+    }
+    return at == b.location.start;
+}
+
+static bool token_spelling_equal(const Token& a, const Token& b)
+{
+    const uint64_t length = uint64_t(a.location.end - a.location.start);
+    return a.type == b.type
+        && length == uint64_t(b.location.end - b.location.start)
+        && 0 == memcmp(a.location.start, b.location.start, size_t(length));
+}
+
+// a redefinition is only allowed if it's the same definition again
+static bool macro_equal(const macro* a, const macro* b)
+{
+    if (a->function_like != b->function_like || a->num_params != b->num_params || a->body_length != b->body_length)
+        return false;
+    for (uint32_t i = 0; i < a->num_params; ++i)
+    {
+        if (a->params[i].nts != b->params[i].nts)
+            return false;
+    }
+    for (uint32_t i = 0; i < a->body_length; ++i)
+    {
+        if (!token_spelling_equal(a->body[i], b->body[i]))
+            return false;
+    }
+    return true;
+}
+
+// #define NAME body / #define NAME(a, b) body. Takes ownership of words on success.
+static bool define_macro(Preprocessor* pp, LexOutput* words, const char** o_failure_location, const char** o_failure_reason)
+{
+    const Token* tokens = words->tokens;
+    const uint64_t count = words->num_tokens;
+    if (count < 2 || !has_identifier(tokens[1].type))
+    {
+        *o_failure_reason = "[pp] expected a macro name after #define";
+        return false;
+    }
+
+    // a ( touching the name makes it function-like, with a space before it it's the start of the body
+    const bool function_like = count > 2 && tokens[2].type == eToken::open_parens && tokens_adjacent(tokens[1], tokens[2]);
+    uint64_t first_body = 2;
+    uint32_t num_params = 0;
+    if (function_like)
+    {
+        for (first_body = 3; first_body < count && tokens[first_body].type != eToken::closed_parens; ++first_body)
+        {
+            const bool want_name = (first_body - 3) % 2 == 0;
+            if (want_name ? !has_identifier(tokens[first_body].type) : tokens[first_body].type != eToken::comma)
+                break;
+            num_params += want_name;
+        }
+        if (num_params > MAX_MACRO_PARAMS)
+        {
+            *o_failure_location = tokens[1].location.start;
+            *o_failure_reason = "[pp] too many macro parameters";
+            return false;
+        }
+        if (first_body == count || tokens[first_body].type != eToken::closed_parens || (num_params && tokens[first_body - 1].type == eToken::comma))
+        {
+            *o_failure_location = first_body < count ? tokens[first_body].location.start : tokens[1].location.start;
+            *o_failure_reason = "[pp] expected a macro parameter list";
+            return false;
+        }
+        ++first_body;
+    }
+
+    const uint32_t body_length = uint32_t(count - first_body);
+    macro* m = (macro*)malloc(sizeof(macro) + num_params * sizeof(str) + body_length * sizeof(uint32_t));
+    assert(m);
+    m->name = tokens[1].identifier;
+    m->function_like = function_like;
+    m->num_params = num_params;
+    m->params = (str*)(m + 1);
+    m->body = tokens + first_body;
+    m->body_length = body_length;
+    m->body_params = (uint32_t*)(m->params + num_params);
+    m->words = *words;
+
+    for (uint32_t i = 0; i < num_params; ++i)
+    {
+        m->params[i] = tokens[3 + i * 2].identifier;
+        for (uint32_t j = 0; j < i; ++j)
+        {
+            if (m->params[j].nts == m->params[i].nts)
+            {
+                *o_failure_location = tokens[3 + i * 2].location.start;
+                *o_failure_reason = "[pp] duplicate macro parameter";
+                free(m);
+                return false;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < body_length; ++i)
+    {
+        const Token& t = m->body[i];
+        m->body_params[i] = 0;
+        if (t.type == eToken::directive)
+        {
+            // the lexer swallows the rest of the line after a #
+            *o_failure_location = t.location.start;
+            *o_failure_reason = "[pp] # and ## aren't supported in macros yet";
+            free(m);
+            return false;
+        }
+        for (uint32_t p = 0; p < num_params && has_identifier(t.type); ++p)
+        {
+            if (m->params[p].nts == t.identifier.nts)
+                m->body_params[i] = p + 1;
+        }
+    }
+
+    if (!pp->macros)
+    {
+        pp->macros = (macro_table*)calloc(1, sizeof(macro_table));
+        assert(pp->macros);
+        hideset_add(pp->macros, 0, NULL); // reserve index 0 for the empty set
+    }
+    macro_slot* slot = macro_slot_insert(pp->macros, m->name.nts);
+    if (slot->m)
+    {
+        const bool same = macro_equal(slot->m, m);
+        free(m);
+        if (!same)
+        {
+            *o_failure_location = tokens[1].location.start;
+            *o_failure_reason = "[pp] macro redefined differently";
+            return false;
+        }
+        free(words->tokens); // keep the original, diagnostics already point at it
+    }
+    else
+    {
+        slot->m = m;
+        ++pp->macros->num_defined;
+    }
+    *words = LexOutput();
+    return true;
+}
+
+static bool undefine_macro(Preprocessor* pp, const LexOutput* words, const char** o_failure_reason)
+{
+    if (words->num_tokens != 2 || !has_identifier(words->tokens[1].type))
+    {
+        *o_failure_reason = "[pp] expected a macro name after #undef";
+        return false;
+    }
+    // undefining something that isn't defined is fine
+    if (macro_slot* slot = macro_slot_find(pp->macros, words->tokens[1].identifier.nts))
+    {
+        if (slot->m)
+            --pp->macros->num_defined;
+        macro_free(slot->m);
+        slot->m = NULL;
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// DIRECTIVES
+
+// lexes the text after the # of a directive token, comments dropped
+static bool lex_directive(const Token* directive, LexOutput* o_words, const char** o_failure_reason)
+{
+    const char* body = directive->location.start + 1;
+    LexInput in = init_lex("directive", body, uint64_t(directive->location.end - body));
+    LexOutput raw = {};
+    bool ok = lex(&in, &raw);
+    if (ok)
+        lex_strip_comments(&raw, o_words);
+    else
+        *o_failure_reason = raw.failure_reason;
+    free(raw.tokens);
+    return ok;
+}
+
+// name of the directive (include, pragma, ...), nts == NULL for the null directive or garbage
+static str directive_name(const LexOutput* words)
+{
+    if (words->num_tokens == 0)
+        return str();
+    const Token& t = words->tokens[0];
+    if (has_identifier(t.type))
+        return t.identifier; // keywords keep their identifier (#if, #else)
+    return str();
+}
+
+static bool is_directive(const include_entry* e, uint64_t index, str name, str arg)
+{
+    const Token& t = e->tokens.tokens[index];
+    if (t.type != eToken::directive)
+        return false;
+
+    LexOutput words = {};
+    const char* failure_reason = NULL;
+    bool match = lex_directive(&t, &words, &failure_reason)
+        && words.num_tokens == (arg.nts ? 2u : 1u)
+        && directive_name(&words).nts == name.nts
+        && (!arg.nts || (words.tokens[1].type == eToken::identifier && words.tokens[1].identifier.nts == arg.nts));
+    free(words.tokens);
+    return match;
+}
+
+// looks for #pragma once and the #ifndef X / #define X ... #endif pattern. The guard is only recorded if the #endif
+// matching the #ifndef is the file's last directive and nothing else (#else, #elif) sits at its level, so skipping
+// a re-include is exactly what expanding it again would do. The file is always expanded whole, guard included.
+static void include_scan(include_entry* e)
+{
+    const Token* tokens = e->tokens.tokens;
+    const uint64_t count = e->tokens.num_tokens;
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        if (is_directive(e, i, kPragma, kOnce))
+        {
+            e->pragma_once = true;
+            break;
+        }
+    }
+
+    uint64_t first = 0;
+    while (first < count && tokens[first].type == eToken::comment)
+        ++first;
+    uint64_t second = first + 1;
+    while (second < count && tokens[second].type == eToken::comment)
+        ++second;
+    uint64_t last = count;
+    while (last > 0 && tokens[last - 1].type == eToken::comment)
+        --last;
+    if (second >= count || last == 0 || --last <= second)
+        return;
+    if (tokens[first].type != eToken::directive || tokens[second].type != eToken::directive
+        || tokens[last].type != eToken::directive)
+        return;
+
+    str guard = {};
+    LexOutput words = {};
+    const char* failure_reason = NULL;
+    if (lex_directive(&tokens[first], &words, &failure_reason)
+        && words.num_tokens == 2
+        && directive_name(&words).nts == kIfndef.nts
+        && words.tokens[1].type == eToken::identifier)
+    {
+        guard = words.tokens[1].identifier;
+    }
+    free(words.tokens);
+    if (!guard.nts || !is_directive(e, second, kDefine, guard))
+        return;
+
+    // find the #endif that closes the #ifndef
+    uint32_t nesting = 1;
+    for (uint64_t i = second + 1; i <= last && nesting > 0; ++i)
+    {
+        if (tokens[i].type != eToken::directive)
+            continue;
+        words = LexOutput();
+        if (!lex_directive(&tokens[i], &words, &failure_reason))
+            return; // expanding it reports the error
+        const str name = directive_name(&words);
+        free(words.tokens);
+        if (name.nts == kIf.nts || name.nts == kIfdef.nts || name.nts == kIfndef.nts)
+            ++nesting;
+        else if (nesting == 1 && (name.nts == kElse.nts || name.nts == kElif.nts))
+            return;
+        else if (name.nts == kEndif.nts && --nesting == 0 && i != last)
+            return;
+    }
+    if (nesting == 0)
+        e->guard = guard;
+}
+
+// a file that failed to lex stays cached (and mapped) so the failure can still be located and is reported
+// again by every later include of it
+static include_entry* include_cache_hit(include_entry* e, const char** o_failure_location, const char** o_failure_reason)
+{
+    ++g_stats.hits;
+    if (!e->tokens.failure_reason)
+        return e;
+    *o_failure_location = e->tokens.failure_location;
+    *o_failure_reason = e->tokens.failure_reason;
+    return NULL;
+}
+
+static include_entry* include_cache_get(const char* path, const char** o_failure_location, const char** o_failure_reason)
+{
+    const str key = strings_insert_nts(path);
+    if (include_entry* e = include_cache_find(key.nts))
+        return include_cache_hit(e, o_failure_location, o_failure_reason);
+
+    // new path, but maybe not a new file
+    FileIdentity identity;
+    if (!file_identity(path, &identity))
+    {
+        *o_failure_reason = "[pp] can't find #include file";
+        return NULL;
+    }
+    for (uint32_t i = 0; i < g_num_entries; ++i)
+    {
+        include_entry* e = g_entries[i];
+        if (e->identity.device == identity.device && e->identity.file == identity.file)
+        {
+            include_cache_insert(key.nts, e);
+            return include_cache_hit(e, o_failure_location, o_failure_reason);
+        }
+    }
+
+    include_entry* e = (include_entry*)calloc(1, sizeof(include_entry));
+    assert(e);
+    e->path = key;
+    e->identity = identity;
+    if (!file_open_source(path, &e->source))
+    {
+        free(e);
+        *o_failure_reason = "[pp] failed to read #include file";
+        return NULL;
+    }
+    line_index_init(&e->lines, e->path.nts, e->source.data, e->source.size);
+    LexInput in = init_lex(e->path.nts, e->source.data, e->source.size);
+    if (lex(&in, &e->tokens))
+        include_scan(e);
+
+    g_entries = (include_entry**)realloc(g_entries, sizeof(include_entry*) * (g_num_entries + 1));
+    assert(g_entries);
+    g_entries[g_num_entries++] = e;
+    include_cache_insert(key.nts, e);
+    ++g_stats.files;
+    if (!e->tokens.failure_reason)
+        return e;
+    *o_failure_location = e->tokens.failure_location;
+    *o_failure_reason = e->tokens.failure_reason;
+    return NULL;
+}
+
+// "name" is relative to the directory of the file that included it
+static bool include_path(const char* includer, str_slice name, char (&o_path)[MAX_INCLUDE_PATH])
+{
+    const char* dir_end = includer;
+    for (const char* c = includer; *c; ++c)
+    {
+        if (*c == '/' || *c == '\\')
+            dir_end = c + 1;
+    }
+
+    const int name_len = int(name.end - name.start);
+    const bool absolute = name_len > 0 && (name.start[0] == '/' || name.start[0] == '\\' || (name_len > 1 && name.start[1] == ':'));
+    const int dir_len = absolute ? 0 : int(dir_end - includer);
+    if (dir_len + name_len + 1 > MAX_INCLUDE_PATH)
+        return false;
+
+    memcpy(o_path, includer, dir_len);
+    memcpy(o_path + dir_len, name.start, name_len);
+    o_path[dir_len + name_len] = 0;
+    return true;
+}
+
+struct pp_conditional
+{
+    const char* location; // the #if, #ifdef or #ifndef, for diagnostics
+    bool taken; // one of its groups was (or is being) expanded, the rest are skipped
+    bool seen_else;
+};
+
+static bool expand(Preprocessor* pp, const LexInput* input, const Token* tokens, uint64_t first, uint64_t end, LexOutput* out, int depth);
+static bool conditional_directive(Preprocessor* pp, const Token* directive, const LexOutput* words, str name,
+    uint32_t conditional_base, const char* source_end, const char** o_resume, const char** o_failure_location, const char** o_failure_reason);
+
+// *o_resume is set if the directive starts an inactive group, see conditional_directive
+static bool expand_directive(Preprocessor* pp, const LexInput* input, const Token* token, LexOutput* out, int depth,
+    uint32_t conditional_base, const char** o_resume)
+{
+    *o_resume = NULL;
+    LexOutput words = {};
+    const char* failure_reason = NULL;
+    if (!lex_directive(token, &words, &failure_reason))
+    {
+        pp->failure_location = token->location.start;
+        pp->failure_reason = failure_reason;
+        return false;
+    }
+
+    bool ok = true;
+    const char* failure_location = token->location.start;
+    const str name = directive_name(&words);
+    if (words.num_tokens == 0 || name.nts == kPragma.nts)
+    {
+        // null directive, or a pragma: #pragma once was already seen by include_scan and the rest are ignored
+    }
+    else if (name.nts == kDefine.nts)
+    {
+        ok = define_macro(pp, &words, &failure_location, &failure_reason);
+    }
+    else if (name.nts == kUndef.nts)
+    {
+        ok = undefine_macro(pp, &words, &failure_reason);
+    }
+    else if (name.nts == kIf.nts || name.nts == kIfdef.nts || name.nts == kIfndef.nts
+        || name.nts == kElif.nts || name.nts == kElse.nts || name.nts == kEndif.nts)
+    {
+        ok = conditional_directive(pp, token, &words, name, conditional_base, input->stream + input->length, o_resume,
+            &failure_location, &failure_reason);
+    }
+    else if (name.nts == kInclude.nts)
+    {
+        char path[MAX_INCLUDE_PATH];
+        if (words.num_tokens != 2 || words.tokens[1].type != eToken::string)
+        {
+            failure_reason = "[pp] expected #include \"file\"";
+            ok = false;
+        }
+        else if (!include_path(input->filename, words.tokens[1].str, path))
+        {
+            failure_reason = "[pp] #include path too long";
+            ok = false;
+        }
+        else if (depth >= MAX_INCLUDE_DEPTH)
+        {
+            failure_reason = "[pp] #include nested too deeply";
+            ok = false;
+        }
+        else
+        {
+            ++g_stats.lookups;
+            include_entry* e = include_cache_get(path, &failure_location, &failure_reason);
+            if (!e)
+                ok = false;
+            else if ((e->pragma_once && e->included_in == pp->translation_unit) || (e->guard.nts && macro_defined(pp, e->guard)))
+                ++g_stats.skips;
+            else
+            {
+                e->included_in = pp->translation_unit;
+                LexInput included = init_lex(e->path.nts, e->source.data, e->source.size);
+                ok = expand(pp, &included, e->tokens.tokens, 0, e->tokens.num_tokens, out, depth + 1);
+                failure_location = pp->failure_location;
+                failure_reason = pp->failure_reason;
+            }
+        }
+    }
+    else
+    {
+        failure_reason = "[pp] unsupported preprocessor directive";
+        ok = false;
+    }
+
+    if (!ok)
+    {
+        pp->failure_location = failure_location;
+        pp->failure_reason = failure_reason;
+    }
+    free(words.tokens);
+    return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// EXPANSION
+// Prosser's algorithm: a macro's replacement is pushed back onto the input and rescanned along with
+// whatever follows it, every token carrying the hideset of macros it came out of. Replacement tokens are
+// copies of the Tokens lexed from the #define line, so their text stays in the defining file.
+struct pp_token
+{
+    Token token;
+    uint32_t hideset;
+};
+
+struct token_list
+{
+    pp_token* tokens;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+static void list_push(token_list* list, const Token& token, uint32_t hideset)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->tokens = (pp_token*)realloc(list->tokens, list->capacity * sizeof(pp_token));
+        assert(list->tokens);
+    }
+    list->tokens[list->count].token = token;
+    list->tokens[list->count].hideset = hideset;
+    ++list->count;
+}
+
+// where an expansion reads from: tokens pushed back by earlier expansions first (last one is next), then the
+// raw tokens of a file, either an array or pulled from the lexer one at a time
+struct token_source
+{
+    token_list pushback;
+    const Token* raw;
+    uint64_t raw_pos;
+    uint64_t raw_end;
+    PreprocessPull pull;
+    void* pull_context;
+    const char* skip_to; // passed to the next pull, set after a directive that starts an inactive group
+    const LexInput* input; // file the raw tokens are from, NULL while expanding a macro argument
+    int depth;
+    uint32_t conditional_base; // conditionals open when the file started
+};
+
+// expanded tokens go to out, or to list (keeping their hidesets) while expanding a macro argument
+struct token_sink
+{
+    LexOutput* out;
+    token_list* list;
+};
+
+enum expand_step_result
+{
+    EXPAND_STEP_OK,
+    EXPAND_STEP_END,
+    EXPAND_STEP_FAIL,
+};
+
+static bool source_next(token_source* src, pp_token* o_token)
+{
+    if (src->pushback.count)
+    {
+        *o_token = src->pushback.tokens[--src->pushback.count];
+        return true;
+    }
+    o_token->hideset = 0;
+    if (src->raw_pos < src->raw_end)
+    {
+        o_token->token = src->raw[src->raw_pos++];
+        return true;
+    }
+    if (!src->pull)
+        return false;
+    const char* skip_to = src->skip_to;
+    src->skip_to = NULL;
+    return src->pull(src->pull_context, skip_to, &o_token->token);
+}
+
+static bool source_next_non_comment(token_source* src, pp_token* o_token)
+{
+    while (source_next(src, o_token))
+    {
+        if (o_token->token.type != eToken::comment)
+            return true;
+    }
+    return false;
+}
+
+static void sink_push(token_sink* sink, const pp_token& t)
+{
+    if (sink->list)
+        list_push(sink->list, t.token, t.hideset);
+    else
+        *alloc_token(sink->out) = t.token;
+}
+
+static const macro* expandable_macro(const Preprocessor* pp, const pp_token& t)
+{
+    if (!pp->macros || !pp->macros->num_defined || !has_identifier(t.token.type))
+        return NULL;
+    const macro* m = macro_find(pp->macros, t.token.identifier.nts);
+    return m && !hideset_contains(pp->macros, t.hideset, m->name.nts) ? m : NULL;
+}
+
+static expand_step_result expand_step(Preprocessor* pp, token_source* src, token_sink* sink);
+
+// fully expands an argument on its own before it's substituted, as the standard requires
+static bool expand_argument(Preprocessor* pp, const pp_token* tokens, uint32_t count, token_list* o_expanded)
+{
+    token_source src = {};
+    for (uint32_t i = count; i > 0; --i)
+        list_push(&src.pushback, tokens[i - 1].token, tokens[i - 1].hideset);
+    token_sink sink = { NULL, o_expanded };
+    expand_step_result step;
+    while ((step = expand_step(pp, &src, &sink)) == EXPAND_STEP_OK)
+        ;
+    free(src.pushback.tokens);
+    return step == EXPAND_STEP_END;
+}
+
+static bool expand_function_like(Preprocessor* pp, const macro* m, const pp_token& name, token_source* src)
+{
+    // arguments, split on commas outside of parentheses. args[arg_starts[i], arg_starts[i + 1]) is argument i.
+    token_list args = {};
+    uint32_t arg_starts[MAX_MACRO_PARAMS + 2] = {};
+    uint32_t num_args = 0;
+    bool ok = true;
+    pp_token t = {};
+    for (int parens = 0;;)
+    {
+        if (!source_next_non_comment(src, &t))
+        {
+            pp->failure_location = name.token.location.start;
+            pp->failure_reason = "[pp] unterminated macro invocation";
+            ok = false;
+            break;
+        }
+        if (t.token.type == eToken::directive)
+        {
+            pp->failure_location = t.token.location.start;
+            pp->failure_reason = "[pp] directive inside macro arguments";
+            ok = false;
+            break;
+        }
+        if (t.token.type == eToken::closed_parens && parens == 0)
+            break;
+        parens += t.token.type == eToken::open_parens;
+        parens -= t.token.type == eToken::closed_parens;
+        if (t.token.type == eToken::comma && parens == 0)
+        {
+            if (num_args == MAX_MACRO_PARAMS)
+            {
+                pp->failure_location = t.token.location.start;
+                pp->failure_reason = "[pp] too many macro arguments";
+                ok = false;
+                break;
+            }
+            arg_starts[++num_args] = args.count;
+            continue;
+        }
+        list_push(&args, t.token, t.hideset);
+    }
+    const pp_token closed_parens = t;
+    // F() is one empty argument, unless F takes none
+    if (num_args > 0 || args.count > 0 || m->num_params > 0)
+        arg_starts[++num_args] = args.count;
+    if (ok && num_args != m->num_params)
+    {
+        pp->failure_location = name.token.location.start;
+        pp->failure_reason = "[pp] wrong number of macro arguments";
+        ok = false;
+    }
+
+    token_list expanded[MAX_MACRO_PARAMS] = {};
+    bool was_expanded[MAX_MACRO_PARAMS] = {};
+    token_list replacement = {};
+    if (ok)
+    {
+        macro_table* table = pp->macros;
+        const uint32_t hideset = hideset_add(table, hideset_intersection(table, name.hideset, closed_parens.hideset), m->name.nts);
+        for (uint32_t i = 0; i < m->body_length && ok; ++i)
+        {
+            const uint32_t param = m->body_params[i];
+            if (!param)
+            {
+                list_push(&replacement, m->body[i], hideset);
+                continue;
+            }
+            const uint32_t a = param - 1;
+            if (!was_expanded[a])
+            {
+                ok = expand_argument(pp, args.tokens + arg_starts[a], arg_starts[a + 1] - arg_starts[a], &expanded[a]);
+                was_expanded[a] = true;
+            }
+            for (uint32_t j = 0; j < expanded[a].count && ok; ++j)
+                list_push(&replacement, expanded[a].tokens[j].token, hideset_union(table, expanded[a].tokens[j].hideset, hideset));
+        }
+    }
+
+    // rescanned together with the rest of the input
+    for (uint32_t i = replacement.count; i > 0 && ok; --i)
+        list_push(&src->pushback, replacement.tokens[i - 1].token, replacement.tokens[i - 1].hideset);
+
+    for (uint32_t i = 0; i < MAX_MACRO_PARAMS; ++i)
+        free(expanded[i].tokens);
+    free(replacement.tokens);
+    free(args.tokens);
+    return ok;
+}
+
+// expands or outputs one token (or directive) from src
+static expand_step_result expand_step(Preprocessor* pp, token_source* src, token_sink* sink)
+{
+    pp_token t;
+    if (!source_next(src, &t))
+        return EXPAND_STEP_END;
+
+    if (t.token.type == eToken::directive)
+    {
+        assert(src->input && !sink->list); // directives inside macro arguments are caught collecting them
+        const char* resume;
+        if (!expand_directive(pp, src->input, &t.token, sink->out, src->depth, src->conditional_base, &resume))
+            return EXPAND_STEP_FAIL;
+        if (resume && src->raw)
+        {
+            // the file was lexed up front, skip its tokens up to the directive that ends the group
+            uint64_t lo = src->raw_pos;
+            uint64_t hi = src->raw_end;
+            while (lo < hi)
+            {
+                const uint64_t mid = lo + (hi - lo) / 2;
+                if (src->raw[mid].location.start < resume)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            src->raw_pos = lo;
+        }
+        else if (resume)
+        {
+            src->skip_to = resume;
+        }
+        return EXPAND_STEP_OK;
+    }
+
+    const macro* m = expandable_macro(pp, t);
+    if (!m)
+    {
+        sink_push(sink, t);
+        return EXPAND_STEP_OK;
+    }
+
+    if (!m->function_like)
+    {
+        const uint32_t hideset = hideset_add(pp->macros, t.hideset, m->name.nts);
+        for (uint32_t i = m->body_length; i > 0; --i)
+            list_push(&src->pushback, m->body[i - 1], hideset);
+        return EXPAND_STEP_OK;
+    }
+
+    // a function-like macro's name without ( after it is just a name
+    pp_token next;
+    if (!source_next_non_comment(src, &next))
+    {
+        sink_push(sink, t);
+        return EXPAND_STEP_OK;
+    }
+    if (next.token.type != eToken::open_parens)
+    {
+        sink_push(sink, t);
+        list_push(&src->pushback, next.token, next.hideset);
+        return EXPAND_STEP_OK;
+    }
+    return expand_function_like(pp, m, t, src) ? EXPAND_STEP_OK : EXPAND_STEP_FAIL;
+}
+
+static bool expand(Preprocessor* pp, const LexInput* input, const Token* tokens, uint64_t first, uint64_t end, LexOutput* out, int depth)
+{
+    token_source src = {};
+    src.raw = tokens;
+    src.raw_pos = first;
+    src.raw_end = end;
+    src.input = input;
+    src.depth = depth;
+    src.conditional_base = pp->num_conditionals;
+    token_sink sink = { out, NULL };
+
+    expand_step_result step = EXPAND_STEP_OK;
+    while (step == EXPAND_STEP_OK)
+    {
+        // nothing is still carrying a hideset once everything pushed back has been read
+        if (!src.pushback.count && pp->macros)
+            pp->macros->num_hidesets = 1;
+
+        // plain tokens don't need the rest of the machinery
+        while (!src.pushback.count && src.raw_pos < src.raw_end)
+        {
+            const Token& t = tokens[src.raw_pos];
+            if (t.type == eToken::directive || (pp->macros && pp->macros->num_defined && has_identifier(t.type) && macro_find(pp->macros, t.identifier.nts)))
+                break;
+            *alloc_token(out) = t;
+            ++src.raw_pos;
+        }
+        step = expand_step(pp, &src, &sink);
+    }
+    free(src.pushback.tokens);
+    if (step == EXPAND_STEP_END && pp->num_conditionals > src.conditional_base)
+    {
+        pp->failure_location = pp->conditionals[src.conditional_base].location;
+        pp->failure_reason = "[pp] unterminated conditional directive";
+        return false;
+    }
+    return step == EXPAND_STEP_END;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CONDITIONALS
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\f' || c == '\v' || c == '\r';
+}
+
+static const char* skip_blanks(const char* iter, const char* end)
+{
+    for (;;)
+    {
+        if (iter != end && is_blank(*iter))
+            ++iter;
+        else if (const uint64_t splice = splice_length(iter, end))
+            iter += splice;
+        else
+            return iter;
+    }
+}
+
+// true if the /* at comment is inside a string or character constant, following quotes from from (the
+// start of its line, or the end of the last comment on it)
+static bool in_quotes(const char* from, const char* comment)
+{
+    char quote = 0;
+    for (const char* c = from; c < comment; ++c)
+    {
+        if (quote && *c == '\\')
+            ++c;
+        else if (quote && *c == quote)
+            quote = 0;
+        else if (!quote && (*c == '"' || *c == '\''))
+            quote = *c;
+    }
+    return quote != 0;
+}
+
+static const char* logical_line_end(const char* iter, const char* end)
+{
+    for (;;)
+    {
+        const char* newline = scan_find_byte(iter, end, '\n');
+        if (newline == end || !splice_before_newline(iter, newline))
+            return newline;
+        iter = newline + 1;
+    }
+}
+
+enum conditional_kind
+{
+    CONDITIONAL_NONE,
+    CONDITIONAL_IF, // #if, #ifdef, #ifndef
+    CONDITIONAL_ELSE, // #elif, #else
+    CONDITIONAL_ENDIF,
+};
+
+static conditional_kind classify_conditional(const char* name, const char* name_end)
+{
+    const size_t len = size_t(name_end - name);
+    if ((len == 2 && 0 == memcmp(name, "if", 2)) || (len == 5 && 0 == memcmp(name, "ifdef", 5)) || (len == 6 && 0 == memcmp(name, "ifndef", 6)))
+        return CONDITIONAL_IF;
+    if ((len == 4 && 0 == memcmp(name, "elif", 4)) || (len == 4 && 0 == memcmp(name, "else", 4)))
+        return CONDITIONAL_ELSE;
+    if (len == 5 && 0 == memcmp(name, "endif", 5))
+        return CONDITIONAL_ENDIF;
+    return CONDITIONAL_NONE;
+}
+
+// Skips an inactive group without lexing it. Only # and / are looked for: a # with nothing but blanks
+// before it on its line is a directive (nesting is tracked by name), a / can start a comment that has to be
+// stepped over since it can hide a #. Quotes only matter for /* and are checked on that line when one
+// turns up. Starts at the end of the directive that began the group and returns the # of the #elif, #else
+// or #endif that ends it, NULL if the file ends first.
+static const char* skip_group(const char* iter, const char* end)
+{
+    int nesting = 0;
+    const char* const begin = iter;
+    const char* quotes_from = iter; // in_quotes doesn't need to look before here
+    for (;;)
+    {
+        iter = scan_find_byte2(iter, end, '#', '/');
+        if (iter == end)
+            return NULL;
+
+        if (*iter == '/')
+        {
+            const char* at = iter++;
+            if (iter == end || (*iter != '/' && *iter != '*'))
+                continue;
+            const char* line = at;
+            while (line > begin && line[-1] != '\n')
+                --line;
+            if (in_quotes(line > quotes_from ? line : quotes_from, at))
+                continue;
+            if (*iter == '/')
+            {
+                iter = logical_line_end(iter, end);
+                continue;
+            }
+            const char* star = scan_find_comment_end(iter + 1, end);
+            if (star == end)
+                return NULL;
+            iter = quotes_from = star + 2;
+            continue;
+        }
+
+        const char* hash = iter++;
+        const char* line = hash;
+        while (line > begin && is_blank(line[-1]))
+            --line;
+        if (line == begin || line[-1] != '\n' || splice_before_newline(begin, line - 1))
+            continue; // begin is the directive's own line
+
+        const char* name = skip_blanks(iter, end);
+        switch (classify_conditional(name, scan_identifier_end(name, end)))
+        {
+        case CONDITIONAL_IF:
+            ++nesting;
+            break;
+        case CONDITIONAL_ELSE:
+            if (nesting == 0)
+                return hash;
+            break;
+        case CONDITIONAL_ENDIF:
+            if (nesting == 0)
+                return hash;
+            --nesting;
+            break;
+        case CONDITIONAL_NONE:
+            break;
+        }
+    }
+}
+
+// #if expressions, evaluated in intmax_t as the standard says (int64_t here). Every identifier left after
+// defined and macro expansion is 0. Nothing is evaluated on the side of && || ?: that doesn't count, so
+// dividing by zero there isn't an error.
+struct pp_expression
+{
+    const pp_token* at;
+    const pp_token* end;
+    const char* failure_location;
+    const char* failure_reason;
+};
+
+static eToken expression_peek(const pp_expression* e, uint32_t ahead = 0)
+{
+    return e->at + ahead < e->end ? e->at[ahead].token.type : eToken::UNKNOWN;
+}
+
+static bool expression_fail(pp_expression* e, const char* reason)
+{
+    if (!e->failure_reason)
+    {
+        e->failure_location = e->at < e->end ? e->at->token.location.start : NULL;
+        e->failure_reason = reason;
+    }
+    e->at = e->end;
+    return false;
+}
+
+enum expression_op
+{
+    OP_NONE,
+    OP_MUL, OP_DIV, OP_MOD,
+    OP_ADD, OP_SUB,
+    OP_SHL, OP_SHR,
+    OP_LT, OP_GT, OP_LE, OP_GE,
+    OP_EQ, OP_NE,
+    OP_BIT_AND,
+    OP_BIT_OR,
+    OP_AND,
+    OP_OR,
+};
+
+// the lexer has no << or >>, they're two < or > right next to each other
+static expression_op expression_binary_op(const pp_expression* e, int* o_precedence, uint32_t* o_tokens)
+{
+    *o_tokens = 1;
+    const eToken type = expression_peek(e);
+    if ((type == eToken::less_than || type == eToken::greater_than) && expression_peek(e, 1) == type && tokens_adjacent(e->at[0].token, e->at[1].token))
+    {
+        *o_tokens = 2;
+        *o_precedence = 8;
+        return type == eToken::less_than ? OP_SHL : OP_SHR;
+    }
+    switch (type)
+    {
+    case eToken::star: *o_precedence = 10; return OP_MUL;
+    case eToken::forward_slash: *o_precedence = 10; return OP_DIV;
+    case eToken::mod: *o_precedence = 10; return OP_MOD;
+    case eToken::plus: *o_precedence = 9; return OP_ADD;
+    case eToken::dash: *o_precedence = 9; return OP_SUB;
+    case eToken::less_than: *o_precedence = 7; return OP_LT;
+    case eToken::greater_than: *o_precedence = 7; return OP_GT;
+    case eToken::less_than_or_equal: *o_precedence = 7; return OP_LE;
+    case eToken::greater_than_or_equal: *o_precedence = 7; return OP_GE;
+    case eToken::logical_equal: *o_precedence = 6; return OP_EQ;
+    case eToken::logical_not_equal: *o_precedence = 6; return OP_NE;
+    case eToken::bitwise_and: *o_precedence = 5; return OP_BIT_AND;
+    case eToken::bitwise_or: *o_precedence = 3; return OP_BIT_OR;
+    case eToken::logical_and: *o_precedence = 2; return OP_AND;
+    case eToken::logical_or: *o_precedence = 1; return OP_OR;
+    default: *o_precedence = 0; return OP_NONE;
+    }
+}
+
+static int64_t evaluate_conditional(pp_expression* e, bool live);
+
+static int64_t evaluate_unary(pp_expression* e, bool live)
+{
+    const eToken type = expression_peek(e);
+    if (type == eToken::UNKNOWN)
+        return expression_fail(e, "[pp] expected a value in #if");
+    if (type == eToken::constant_number)
+        return int64_t((e->at++)->token.number);
+    if (has_identifier(type))
+    {
+        ++e->at;
+        return 0;
+    }
+
+    ++e->at;
+    switch (type)
+    {
+    case eToken::open_parens:
+    {
+        const int64_t value = evaluate_conditional(e, live);
+        if (expression_peek(e) != eToken::closed_parens)
+            return expression_fail(e, "[pp] expected ) in #if");
+        ++e->at;
+        return value;
+    }
+    case eToken::plus: return evaluate_unary(e, live);
+    case eToken::dash: return int64_t(0 - uint64_t(evaluate_unary(e, live)));
+    case eToken::logical_not: return !evaluate_unary(e, live);
+    case eToken::bitwise_not: return ~evaluate_unary(e, live);
+    default:
+        --e->at;
+        return expression_fail(e, "[pp] expected a value in #if");
+    }
+}
+
+static int64_t evaluate_binary(pp_expression* e, int min_precedence, bool live)
+{
+    int64_t lhs = evaluate_unary(e, live);
+    for (;;)
+    {
+        int precedence;
+        uint32_t op_tokens;
+        const expression_op op = expression_binary_op(e, &precedence, &op_tokens);
+        if (op == OP_NONE || precedence < min_precedence)
+            return lhs;
+        const pp_token* op_token = e->at;
+        e->at += op_tokens;
+
+        // && and || only evaluate their right side when it decides the result
+        const bool rhs_live = live && (op == OP_AND ? lhs != 0 : op == OP_OR ? lhs == 0 : true);
+        const int64_t rhs = evaluate_binary(e, precedence + 1, rhs_live);
+        const uint64_t a = uint64_t(lhs);
+        const uint64_t b = uint64_t(rhs);
+        switch (op)
+        {
+        case OP_MUL: lhs = int64_t(a * b); break;
+        case OP_DIV:
+        case OP_MOD:
+            if (rhs == 0)
+            {
+                if (live)
+                {
+                    e->at = op_token;
+                    return expression_fail(e, "[pp] division by zero in #if");
+                }
+                lhs = 0;
+            }
+            else if (rhs == -1)
+                lhs = op == OP_DIV ? int64_t(0 - a) : 0; // INT64_MIN / -1 overflows
+            else
+                lhs = op == OP_DIV ? lhs / rhs : lhs % rhs;
+            break;
+        case OP_ADD: lhs = int64_t(a + b); break;
+        case OP_SUB: lhs = int64_t(a - b); break;
+        case OP_SHL: lhs = b >= 64 ? 0 : int64_t(a << b); break;
+        case OP_SHR: lhs = b >= 64 ? (lhs < 0 ? -1 : 0) : lhs >> b; break;
+        case OP_LT: lhs = lhs < rhs; break;
+        case OP_GT: lhs = lhs > rhs; break;
+        case OP_LE: lhs = lhs <= rhs; break;
+        case OP_GE: lhs = lhs >= rhs; break;
+        case OP_EQ: lhs = lhs == rhs; break;
+        case OP_NE: lhs = lhs != rhs; break;
+        case OP_BIT_AND: lhs = int64_t(a & b); break;
+        case OP_BIT_OR: lhs = int64_t(a | b); break;
+        case OP_AND: lhs = lhs && rhs; break;
+        case OP_OR: lhs = lhs || rhs; break;
+        case OP_NONE: break;
+        }
+    }
+}
+
+static int64_t evaluate_conditional(pp_expression* e, bool live)
+{
+    const int64_t condition = evaluate_binary(e, 1, live);
+    if (expression_peek(e) != eToken::question_mark)
+        return condition;
+    ++e->at;
+    const int64_t if_true = evaluate_conditional(e, live && condition != 0);
+    if (expression_peek(e) != eToken::colon)
+        return expression_fail(e, "[pp] expected : in #if");
+    ++e->at;
+    const int64_t if_false = evaluate_conditional(e, live && condition == 0);
+    return condition ? if_true : if_false;
+}
+
+// words[1..] of an #if or #elif: defined X / defined(X) first, then macros are expanded and what's left is
+// evaluated
+static bool evaluate_if(Preprocessor* pp, const LexOutput* words, bool* o_value, const char** o_failure_location, const char** o_failure_reason)
+{
+    if (words->num_tokens < 2)
+    {
+        *o_failure_reason = "[pp] #if with no expression";
+        return false;
+    }
+
+    pp_token* tokens = (pp_token*)malloc(size_t(words->num_tokens) * sizeof(pp_token));
+    assert(tokens);
+    uint32_t count = 0;
+    bool ok = true;
+    for (uint64_t i = 1; i < words->num_tokens && ok; ++i)
+    {
+        Token t = words->tokens[i];
+        if (t.type == eToken::identifier && t.identifier.nts == kDefined.nts)
+        {
+            const bool parens = i + 1 < words->num_tokens && words->tokens[i + 1].type == eToken::open_parens;
+            const uint64_t name = i + 1 + parens;
+            ok = name < words->num_tokens && has_identifier(words->tokens[name].type)
+                && (!parens || (name + 1 < words->num_tokens && words->tokens[name + 1].type == eToken::closed_parens));
+            if (!ok)
+            {
+                *o_failure_location = t.location.start;
+                *o_failure_reason = "[pp] expected a macro name after defined";
+                break;
+            }
+            i = name + parens;
+            t.type = eToken::constant_number;
+            t.location.end = words->tokens[i].location.end;
+            t.number = macro_defined(pp, words->tokens[name].identifier);
+        }
+        tokens[count].token = t;
+        tokens[count].hideset = 0;
+        ++count;
+    }
+
+    token_list expanded = {};
+    const uint32_t hidesets = pp->macros ? pp->macros->num_hidesets : 0;
+    if (ok)
+        ok = expand_argument(pp, tokens, count, &expanded);
+    if (pp->macros)
+        pp->macros->num_hidesets = hidesets; // nothing from this expansion outlives it
+    if (!ok && pp->failure_reason)
+    {
+        *o_failure_location = pp->failure_location;
+        *o_failure_reason = pp->failure_reason;
+    }
+
+    if (ok)
+    {
+        pp_expression e = { expanded.tokens, expanded.tokens + expanded.count, NULL, NULL };
+        const int64_t value = evaluate_conditional(&e, true);
+        if (!e.failure_reason && e.at != e.end)
+            expression_fail(&e, "[pp] unexpected token in #if");
+        ok = !e.failure_reason;
+        if (ok)
+            *o_value = value != 0;
+        else
+        {
+            if (e.failure_location)
+                *o_failure_location = e.failure_location;
+            *o_failure_reason = e.failure_reason;
+        }
+    }
+    free(tokens);
+    free(expanded.tokens);
+    return ok;
+}
+
+static bool push_conditional(Preprocessor* pp, const Token* directive, bool taken)
+{
+    if (pp->num_conditionals == pp->conditionals_capacity)
+    {
+        pp->conditionals_capacity = pp->conditionals_capacity ? pp->conditionals_capacity * 2 : 16;
+        pp->conditionals = (pp_conditional*)realloc(pp->conditionals, pp->conditionals_capacity * sizeof(pp_conditional));
+        assert(pp->conditionals);
+    }
+    pp_conditional& c = pp->conditionals[pp->num_conditionals++];
+    c.location = directive->location.start;
+    c.taken = taken;
+    c.seen_else = false;
+    return taken;
+}
+
+// #if, #ifdef, #ifndef, #elif, #else and #endif. Sets *o_resume when the group that follows is inactive: it's
+// skipped by skip_group and expansion picks up again at the directive that ends it. Conditionals opened by
+// an including file (below conditional_base) can't be continued or closed from an included one.
+static bool conditional_directive(Preprocessor* pp, const Token* directive, const LexOutput* words, str name,
+    uint32_t conditional_base, const char* source_end, const char** o_resume, const char** o_failure_location, const char** o_failure_reason)
+{
+    bool active = true;
+    if (name.nts == kIf.nts || name.nts == kIfdef.nts || name.nts == kIfndef.nts)
+    {
+        if (name.nts == kIf.nts)
+        {
+            if (!evaluate_if(pp, words, &active, o_failure_location, o_failure_reason))
+                return false;
+        }
+        else if (words->num_tokens != 2 || !has_identifier(words->tokens[1].type))
+        {
+            *o_failure_reason = name.nts == kIfdef.nts ? "[pp] expected a macro name after #ifdef" : "[pp] expected a macro name after #ifndef";
+            return false;
+        }
+        else
+        {
+            active = macro_defined(pp, words->tokens[1].identifier) == (name.nts == kIfdef.nts);
+        }
+        push_conditional(pp, directive, active);
+    }
+    else
+    {
+        if (pp->num_conditionals <= conditional_base)
+        {
+            *o_failure_reason = name.nts == kEndif.nts ? "[pp] #endif without #if" : name.nts == kElse.nts ? "[pp] #else without #if" : "[pp] #elif without #if";
+            return false;
+        }
+        pp_conditional& c = pp->conditionals[pp->num_conditionals - 1];
+        if (name.nts == kEndif.nts)
+        {
+            if (words->num_tokens != 1)
+            {
+                *o_failure_reason = "[pp] unexpected tokens after #endif";
+                return false;
+            }
+            --pp->num_conditionals;
+            return true;
+        }
+        if (c.seen_else)
+        {
+            *o_failure_reason = name.nts == kElse.nts ? "[pp] #else after #else" : "[pp] #elif after #else";
+            return false;
+        }
+        if (name.nts == kElse.nts)
+        {
+            if (words->num_tokens != 1)
+            {
+                *o_failure_reason = "[pp] unexpected tokens after #else";
+                return false;
+            }
+            c.seen_else = true;
+            active = !c.taken;
+        }
+        else if (c.taken)
+        {
+            active = false; // not evaluated, an earlier group was already taken
+        }
+        else if (!evaluate_if(pp, words, &active, o_failure_location, o_failure_reason))
+        {
+            return false;
+        }
+        c.taken = c.taken || active;
+    }
+
+    if (!active)
+    {
+        *o_resume = skip_group(directive->location.end, source_end);
+        if (!*o_resume)
+        {
+            *o_failure_location = pp->conditionals[pp->num_conditionals - 1].location;
+            *o_failure_reason = "[pp] unterminated conditional directive";
+            return false;
+        }
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// PUBLIC
+
+void preprocess_init(Preprocessor* pp)
+{
+    *pp = Preprocessor();
+    pp->translation_unit = ++g_translation_units;
+}
+
+void preprocess_free(Preprocessor* pp)
+{
+    if (macro_table* table = pp->macros)
+    {
+        for (uint32_t i = 0; table->slots && i <= table->slot_mask; ++i)
+            macro_free(table->slots[i].m);
+        free(table->slots);
+        free(table->hidesets);
+        free(table);
+    }
+    pp->macros = NULL;
+    free(pp->conditionals);
+    pp->conditionals = NULL;
+    pp->num_conditionals = 0;
+    pp->conditionals_capacity = 0;
+}
+
+bool preprocess(Preprocessor* pp, const LexInput* input, const LexOutput* tokens, LexOutput* output)
+{
+    assert(output->tokens == NULL); // caller must init to 0 LexOutput
+    return expand(pp, input, tokens->tokens, 0, tokens->num_tokens, output, 0);
+}
+
+bool preprocess_directive(Preprocessor* pp, const LexInput* input, const Token* token, LexOutput* io_output, const char** o_resume)
+{
+    assert(token->type == eToken::directive);
+    return expand_directive(pp, input, token, io_output, 0, 0, o_resume);
+}
+
+bool preprocess_finish(Preprocessor* pp)
+{
+    if (!pp->num_conditionals)
+        return true;
+    pp->failure_location = pp->conditionals[0].location;
+    pp->failure_reason = "[pp] unterminated conditional directive";
+    return false;
+}
+
+bool preprocess_is_macro(const Preprocessor* pp, const Token* token)
+{
+    return pp->macros && pp->macros->num_defined && has_identifier(token->type) && macro_find(pp->macros, token->identifier.nts);
+}
+
+bool preprocess_macro(Preprocessor* pp, const LexInput* input, const Token* name, PreprocessPull pull, void* context, LexOutput* io_output)
+{
+    token_source src = {};
+    src.pull = pull;
+    src.pull_context = context;
+    src.input = input;
+    list_push(&src.pushback, *name, 0);
+    token_sink sink = { io_output, NULL };
+
+    // once the replacement has been rescanned everything after it is raw again, the caller takes it from there.
+    // A directive peeked at looking for a ( can start an inactive group, pull once more to skip it.
+    expand_step_result step = EXPAND_STEP_OK;
+    while (step == EXPAND_STEP_OK && (src.pushback.count || src.skip_to))
+        step = expand_step(pp, &src, &sink);
+    pp->macros->num_hidesets = 1;
+    free(src.pushback.tokens);
+    return step != EXPAND_STEP_FAIL;
+}
+
+SourceLocation preprocess_locate(LineIndex* file, const char* at)
+{
+    if (!line_index_contains(file, at))
+    {
+        for (uint32_t i = 0; i < g_num_entries; ++i)
+        {
+            if (line_index_contains(&g_entries[i]->lines, at))
+                return line_index_locate(&g_entries[i]->lines, at);
+        }
+    }
+    return line_index_locate(file, at);
+}
+
+IncludeCacheStats include_cache_stats()
+{
+    return g_stats;
+}
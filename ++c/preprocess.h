@@ -0,0 +1,62 @@
+#pragma once
+#include "lex.h"
+#include "lines.h"
+
+// Preprocessing on top of lex(). The lexer turns every # line into a single eToken::directive token and
+// preprocess() expands them into the token stream. Supported so far: #include "file", #pragma once (other
+// pragmas are ignored, as the standard allows), object-like and function-like #define and #undef, and
+// #if/#ifdef/#ifndef/#elif/#else/#endif.
+//
+// Included files go through a process-wide cache keyed by path, which also records each file's identity so
+// two paths to the same file share one entry. A file is read and lexed once per process; its source stays
+// mapped for the life of the process since its tokens point into it. Files with #pragma once are expanded
+// once per translation unit, files with a classic guard (#ifndef X / #define X first, #endif last) only while
+// X isn't defined. Either way including them again costs a hash lookup.
+//
+// Macros are per translation unit, in a hash table keyed by interned name. A macro keeps the tokens lexed
+// from its #define line and expanding it copies those Tokens, which still point into the defining file:
+// no text is copied or re-lexed. Rescanning follows the standard (Prosser's hidesets), so a macro is never
+// expanded again inside its own expansion. # and ## aren't supported yet.
+//
+// An inactive #if group is skipped by looking for a # at the start of each line (tracking block comments
+// and nesting), it's never lexed. From a LexStream that means the lexer jumps straight past it; tokens
+// lexed up front are skipped with a binary search for the directive that ends the group.
+
+struct Preprocessor
+{
+    uint32_t translation_unit; // for once-per-translation-unit bookkeeping in the include cache
+    struct macro_table* macros; // NULL until the first #define
+    struct pp_conditional* conditionals; // open #if groups, innermost last
+    uint32_t num_conditionals;
+    uint32_t conditionals_capacity;
+    const char* failure_location;
+    const char* failure_reason;
+};
+
+void preprocess_init(Preprocessor* pp); // once per translation unit
+void preprocess_free(Preprocessor* pp); // frees its macros and open conditionals
+bool preprocess(Preprocessor* pp, const LexInput* input, const LexOutput* tokens, LexOutput* output); // tokens from lex(input), output must be zero-initialized
+
+// For LexStream, which lexes on demand. preprocess_directive expands one directive, appending to io_output.
+// If it starts an inactive group *o_resume is where lexing picks up again (the # of the directive ending
+// the group), otherwise NULL. preprocess_finish checks nothing is left open at the end of the file.
+bool preprocess_directive(Preprocessor* pp, const LexInput* input, const Token* directive, LexOutput* io_output, const char** o_resume);
+bool preprocess_finish(Preprocessor* pp);
+
+// A macro invocation can run past the token that names it, so the rest is pulled from the lexer as needed.
+// skip_to is the same as o_resume above: when not NULL, lexing continues from there.
+typedef bool (*PreprocessPull)(void* context, const char* skip_to, Token* o_token); // next token lexed, false at end of input or on failure
+bool preprocess_is_macro(const Preprocessor* pp, const Token* token); // names a macro that's currently defined
+bool preprocess_macro(Preprocessor* pp, const LexInput* input, const Token* name, PreprocessPull pull, void* context, LexOutput* io_output); // expands the invocation starting at name, appending to io_output
+
+SourceLocation preprocess_locate(LineIndex* file, const char* at); // at can also point into anything file included
+
+struct IncludeCacheStats
+{
+    uint64_t lookups; // #include directives processed
+    uint64_t hits; // lookups that found the file already read and lexed
+    uint64_t skips; // hits that were skipped entirely by #pragma once or an include guard
+    uint64_t files; // distinct files read and lexed
+};
+
+IncludeCacheStats include_cache_stats();
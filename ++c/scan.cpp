@@ -0,0 +1,433 @@
+#include "scan.h"
+#include "debug.h"
+#include <string.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define SCAN_X64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SCAN_TARGET_AVX2
+#else
+#define SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SCALAR
+static bool is_whitespace_byte(char c) { return (c >= '\t' && c <= '\r') || c == ' '; }
+static bool is_digit_byte(char c) { return c >= '0' && c <= '9'; }
+static bool is_identifier_byte(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static const char* whitespace_end_scalar(const char* iter, const char* end)
+{
+    while (iter < end && is_whitespace_byte(*iter)) ++iter;
+    return iter;
+}
+static const char* identifier_end_scalar(const char* iter, const char* end)
+{
+    while (iter < end && is_identifier_byte(*iter)) ++iter;
+    return iter;
+}
+static const char* digits_end_scalar(const char* iter, const char* end)
+{
+    while (iter < end && is_digit_byte(*iter)) ++iter;
+    return iter;
+}
+static const char* find_byte_scalar(const char* iter, const char* end, char c)
+{
+    while (iter < end && *iter != c) ++iter;
+    return iter;
+}
+static const char* find_byte2_scalar(const char* iter, const char* end, char c0, char c1)
+{
+    while (iter < end && *iter != c0 && *iter != c1) ++iter;
+    return iter;
+}
+static const char* find_comment_end_scalar(const char* iter, const char* end)
+{
+    while (iter + 1 < end)
+    {
+        if (iter[0] == '*' && iter[1] == '/')
+            return iter;
+        ++iter;
+    }
+    return end;
+}
+static uint64_t count_byte_scalar(const char* iter, const char* end, char c)
+{
+    uint64_t count = 0;
+    while (iter < end) count += *iter++ == c;
+    return count;
+}
+
+#if SCAN_X64
+static uint32_t lowest_set_bit(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SSE2 - 16 bytes at a time. Each loop builds a mask of bytes that STOP the scan.
+
+// unsigned lo <= x <= hi using the signed compare SSE2 provides: shift the range down so lo lands on -128.
+static __m128i in_range_sse2(__m128i x, char lo, char hi)
+{
+    __m128i shifted = _mm_add_epi8(x, _mm_set1_epi8((char)(0x80 - lo)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + (hi - lo) + 1)));
+}
+
+static const char* whitespace_end_sse2(const char* iter, const char* end)
+{
+    while (end - iter >= 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)iter);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), in_range_sse2(x, '\t', '\r'));
+        uint32_t stop = ~uint32_t(_mm_movemask_epi8(ws)) & 0xFFFF;
+        if (stop)
+            return iter + lowest_set_bit(stop);
+        iter += 16;
+    }
+    return whitespace_end_scalar(iter, end);
+}
+static const char* identifier_end_sse2(const char* iter, const char* end)
+{
+    while (end - iter >= 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)iter);
+        __m128i letter = in_range_sse2(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z'); // |0x20 folds A-Z onto a-z
+        __m128i digit = in_range_sse2(x, '0', '9');
+        __m128i underscore = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+        __m128i id = _mm_or_si128(_mm_or_si128(letter, digit), underscore);
+        uint32_t stop = ~uint32_t(_mm_movemask_epi8(id)) & 0xFFFF;
+        if (stop)
+            return iter + lowest_set_bit(stop);
+        iter += 16;
+    }
+    return identifier_end_scalar(iter, end);
+}
+static const char* digits_end_sse2(const char* iter, const char* end)
+{
+    while (end - iter >= 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)iter);
+        uint32_t stop = ~uint32_t(_mm_movemask_epi8(in_range_sse2(x, '0', '9'))) & 0xFFFF;
+        if (stop)
+            return iter + lowest_set_bit(stop);
+        iter += 16;
+    }
+    return digits_end_scalar(iter, end);
+}
+static const char* find_byte_sse2(const char* iter, const char* end, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    while (end - iter >= 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)iter);
+        uint32_t found = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x, needle)));
+        if (found)
+            return iter + lowest_set_bit(found);
+        iter += 16;
+    }
+    return find_byte_scalar(iter, end, c);
+}
+static const char* find_byte2_sse2(const char* iter, const char* end, char c0, char c1)
+{
+    const __m128i n0 = _mm_set1_epi8(c0);
+    const __m128i n1 = _mm_set1_epi8(c1);
+    while (end - iter >= 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)iter);
+        uint32_t found = uint32_t(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, n0), _mm_cmpeq_epi8(x, n1))));
+        if (found)
+            return iter + lowest_set_bit(found);
+        iter += 16;
+    }
+    return find_byte2_scalar(iter, end, c0, c1);
+}
+static const char* find_comment_end_sse2(const char* iter, const char* end)
+{
+    // compare against the block and the block shifted by one so "*/" shows up as a single bit
+    while (end - iter >= 17)
+    {
+        __m128i x0 = _mm_loadu_si128((const __m128i*)iter);
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(iter + 1));
+        __m128i star = _mm_cmpeq_epi8(x0, _mm_set1_epi8('*'));
+        __m128i slash = _mm_cmpeq_epi8(x1, _mm_set1_epi8('/'));
+        uint32_t found = uint32_t(_mm_movemask_epi8(_mm_and_si128(star, slash)));
+        if (found)
+            return iter + lowest_set_bit(found);
+        iter += 16;
+    }
+    return find_comment_end_scalar(iter, end);
+}
+static uint64_t count_byte_sse2(const char* iter, const char* end, char c)
+{
+    // cmpeq is -1 per match, so subtracting it counts up in 16 byte-sized counters. Those are summed with
+    // sad every 255 blocks, before any of them can wrap.
+    const __m128i needle = _mm_set1_epi8(c);
+    uint64_t count = 0;
+    while (end - iter >= 16)
+    {
+        __m128i counters = _mm_setzero_si128();
+        for (int i = 0; i < 255 && end - iter >= 16; ++i, iter += 16)
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)iter), needle));
+        __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+        count += uint64_t(_mm_cvtsi128_si32(sums)) + uint64_t(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+    }
+    return count + count_byte_scalar(iter, end, c);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// AVX2 - same as SSE2 but 32 bytes at a time.
+SCAN_TARGET_AVX2 static __m256i in_range_avx2(__m256i x, char lo, char hi)
+{
+    __m256i shifted = _mm256_add_epi8(x, _mm256_set1_epi8((char)(0x80 - lo)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + (hi - lo) + 1)), shifted);
+}
+
+SCAN_TARGET_AVX2 static const char* whitespace_end_avx2(const char* iter, const char* end)
+{
+    while (end - iter >= 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)iter);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), in_range_avx2(x, '\t', '\r'));
+        uint32_t stop = ~uint32_t(_mm256_movemask_epi8(ws));
+        if (stop)
+            return iter + lowest_set_bit(stop);
+        iter += 32;
+    }
+    return whitespace_end_sse2(iter, end);
+}
+SCAN_TARGET_AVX2 static const char* identifier_end_avx2(const char* iter, const char* end)
+{
+    while (end - iter >= 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)iter);
+        __m256i letter = in_range_avx2(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z');
+        __m256i digit = in_range_avx2(x, '0', '9');
+        __m256i underscore = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'));
+        __m256i id = _mm256_or_si256(_mm256_or_si256(letter, digit), underscore);
+        uint32_t stop = ~uint32_t(_mm256_movemask_epi8(id));
+        if (stop)
+            return iter + lowest_set_bit(stop);
+        iter += 32;
+    }
+    return identifier_end_sse2(iter, end);
+}
+SCAN_TARGET_AVX2 static const char* digits_end_avx2(const char* iter, const char* end)
+{
+    while (end - iter >= 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)iter);
+        uint32_t stop = ~uint32_t(_mm256_movemask_epi8(in_range_avx2(x, '0', '9')));
+        if (stop)
+            return iter + lowest_set_bit(stop);
+        iter += 32;
+    }
+    return digits_end_sse2(iter, end);
+}
+SCAN_TARGET_AVX2 static const char* find_byte_avx2(const char* iter, const char* end, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    while (end - iter >= 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)iter);
+        uint32_t found = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, needle)));
+        if (found)
+            return iter + lowest_set_bit(found);
+        iter += 32;
+    }
+    return find_byte_sse2(iter, end, c);
+}
+SCAN_TARGET_AVX2 static const char* find_byte2_avx2(const char* iter, const char* end, char c0, char c1)
+{
+    const __m256i n0 = _mm256_set1_epi8(c0);
+    const __m256i n1 = _mm256_set1_epi8(c1);
+    while (end - iter >= 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)iter);
+        uint32_t found = uint32_t(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, n0), _mm256_cmpeq_epi8(x, n1))));
+        if (found)
+            return iter + lowest_set_bit(found);
+        iter += 32;
+    }
+    return find_byte2_sse2(iter, end, c0, c1);
+}
+SCAN_TARGET_AVX2 static const char* find_comment_end_avx2(const char* iter, const char* end)
+{
+    while (end - iter >= 33)
+    {
+        __m256i x0 = _mm256_loadu_si256((const __m256i*)iter);
+        __m256i x1 = _mm256_loadu_si256((const __m256i*)(iter + 1));
+        __m256i star = _mm256_cmpeq_epi8(x0, _mm256_set1_epi8('*'));
+        __m256i slash = _mm256_cmpeq_epi8(x1, _mm256_set1_epi8('/'));
+        uint32_t found = uint32_t(_mm256_movemask_epi8(_mm256_and_si256(star, slash)));
+        if (found)
+            return iter + lowest_set_bit(found);
+        iter += 32;
+    }
+    return find_comment_end_sse2(iter, end);
+}
+SCAN_TARGET_AVX2 static uint64_t count_byte_avx2(const char* iter, const char* end, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    uint64_t count = 0;
+    while (end - iter >= 32)
+    {
+        __m256i counters = _mm256_setzero_si256();
+        for (int i = 0; i < 255 && end - iter >= 32; ++i, iter += 32)
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)iter), needle));
+        uint64_t sums[4];
+        _mm256_storeu_si256((__m256i*)sums, _mm256_sad_epu8(counters, _mm256_setzero_si256()));
+        count += sums[0] + sums[1] + sums[2] + sums[3];
+    }
+    return count + count_byte_sse2(iter, end, c);
+}
+#endif // SCAN_X64
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// DISPATCH
+struct scan_kernels
+{
+    eScanLevel level;
+    const char* (*whitespace_end)(const char* iter, const char* end);
+    const char* (*identifier_end)(const char* iter, const char* end);
+    const char* (*digits_end)(const char* iter, const char* end);
+    const char* (*find_byte)(const char* iter, const char* end, char c);
+    const char* (*find_byte2)(const char* iter, const char* end, char c0, char c1);
+    const char* (*find_comment_end)(const char* iter, const char* end);
+    uint64_t (*count_byte)(const char* iter, const char* end, char c);
+};
+
+static const scan_kernels kScalarKernels = {
+    SCAN_SCALAR, whitespace_end_scalar, identifier_end_scalar, digits_end_scalar,
+    find_byte_scalar, find_byte2_scalar, find_comment_end_scalar, count_byte_scalar };
+#if SCAN_X64
+static const scan_kernels kSSE2Kernels = {
+    SCAN_SSE2, whitespace_end_sse2, identifier_end_sse2, digits_end_sse2,
+    find_byte_sse2, find_byte2_sse2, find_comment_end_sse2, count_byte_sse2 };
+static const scan_kernels kAVX2Kernels = {
+    SCAN_AVX2, whitespace_end_avx2, identifier_end_avx2, digits_end_avx2,
+    find_byte_avx2, find_byte2_avx2, find_comment_end_avx2, count_byte_avx2 };
+#endif
+
+static const scan_kernels* kernels_for_level(eScanLevel level)
+{
+    switch (level)
+    {
+    case SCAN_SCALAR: return &kScalarKernels;
+#if SCAN_X64
+    case SCAN_SSE2: return &kSSE2Kernels;
+    case SCAN_AVX2: return &kAVX2Kernels;
+#endif
+    }
+    return NULL;
+}
+
+static eScanLevel detect_best_level()
+{
+#if SCAN_X64
+#if defined(_MSC_VER)
+    // AVX2 needs both the cpu flag (leaf 7, ebx bit 5) and the OS saving ymm state (OSXSAVE + XCR0 bits 1,2)
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    if (osxsave && avx && avx2 && (_xgetbv(0) & 6) == 6)
+        return SCAN_AVX2;
+#else
+    if (__builtin_cpu_supports("avx2"))
+        return SCAN_AVX2;
+#endif
+    return SCAN_SSE2; // always available on x64
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+// Picked once at startup (dynamic initialization) so there's no per-call check.
+static const eScanLevel g_best_level = detect_best_level();
+static const scan_kernels* g_kernels = kernels_for_level(g_best_level);
+
+eScanLevel scan_best_level()
+{
+    return g_best_level;
+}
+
+eScanLevel scan_level()
+{
+    return g_kernels->level;
+}
+
+bool scan_set_level(eScanLevel level)
+{
+    if (level > g_best_level)
+        return false;
+
+    const scan_kernels* k = kernels_for_level(level);
+    if (!k)
+        return false;
+
+    g_kernels = k;
+    return true;
+}
+
+const char* scan_level_name(eScanLevel level)
+{
+    switch (level)
+    {
+    case SCAN_SCALAR: return "scalar";
+    case SCAN_SSE2: return "sse2";
+    case SCAN_AVX2: return "avx2";
+    }
+    return "???";
+}
+
+const char* scan_whitespace_end(const char* iter, const char* end) { return g_kernels->whitespace_end(iter, end); }
+const char* scan_identifier_end(const char* iter, const char* end) { return g_kernels->identifier_end(iter, end); }
+const char* scan_digits_end(const char* iter, const char* end) { return g_kernels->digits_end(iter, end); }
+const char* scan_find_byte(const char* iter, const char* end, char c) { return g_kernels->find_byte(iter, end, c); }
+const char* scan_find_byte2(const char* iter, const char* end, char c0, char c1) { return g_kernels->find_byte2(iter, end, c0, c1); }
+const char* scan_find_comment_end(const char* iter, const char* end) { return g_kernels->find_comment_end(iter, end); }
+uint64_t scan_count_byte(const char* iter, const char* end, char c) { return g_kernels->count_byte(iter, end, c); }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// DECIMAL PARSING
+static uint64_t parse_8_digits_swar(const char* digits)
+{
+    // 8 ascii digits -> 0..99999999 in three multiplies (little-endian: digits[0] is the low byte).
+    // each step merges neighbouring lanes: 1 digit -> 2 digits -> 4 digits -> 8 digits.
+    uint64_t v;
+    memcpy(&v, digits, 8);
+    v = ((v & 0x0F0F0F0F0F0F0F0Full) * 2561) >> 8;             // 2561 = 10 << 8 | 1
+    v = ((v & 0x00FF00FF00FF00FFull) * 6553601) >> 16;         // 6553601 = 100 << 16 | 1
+    return ((v & 0x0000FFFF0000FFFFull) * 42949672960001ull) >> 32; // 42949672960001 = 10000 << 32 | 1
+}
+
+uint64_t scan_parse_decimal(const char* start, const char* end)
+{
+    uint64_t value = 0;
+    while (end - start >= 8)
+    {
+        value = value * 100000000ull + parse_8_digits_swar(start);
+        start += 8;
+    }
+    while (start < end)
+    {
+        value = value * 10 + uint64_t(*start - '0');
+        ++start;
+    }
+    return value;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <inttypes.h>
+
+// Byte-scanning kernels used by the lexer. Every scan_*_end/scan_find_* function looks at [iter, end)
+// and returns a pointer to the first byte that stops the scan, or end if nothing does. Kernels never
+// read at or past end.
+//
+// The SSE2/AVX2 versions are picked at startup based on what the CPU supports. The scalar versions
+// always exist and must produce identical results (test.cpp lexes every test file at every level and
+// compares the tokens).
+
+enum eScanLevel
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+};
+
+eScanLevel scan_best_level(); // best level the cpu supports
+eScanLevel scan_level(); // level currently in use
+bool scan_set_level(eScanLevel level); // returns false (and changes nothing) if the cpu doesn't support level
+const char* scan_level_name(eScanLevel level);
+
+const char* scan_whitespace_end(const char* iter, const char* end); // skips ' ' and '\t'..'\r'
+const char* scan_identifier_end(const char* iter, const char* end); // skips [A-Za-z0-9_]
+const char* scan_digits_end(const char* iter, const char* end); // skips [0-9]
+const char* scan_find_byte(const char* iter, const char* end, char c);
+const char* scan_find_byte2(const char* iter, const char* end, char c0, char c1);
+const char* scan_find_comment_end(const char* iter, const char* end); // returns pointer to the '*' of "*/"
+uint64_t scan_count_byte(const char* iter, const char* end, char c); // number of c in [iter, end)
+
+// [start, end) must be all decimal digits. Wraps on overflow exactly like value = value * 10 + digit.
+uint64_t scan_parse_decimal(const char* start, const char* end);
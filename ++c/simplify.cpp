@@ -1,13 +1,13 @@
 #include "simplify.h"
 #include "debug.h"
 
-ASTNode* simplify(const ASTNode* root, int* reductions)
+ASTNode* simplify(ASTArena* arena, const ASTNode* root, int* reductions)
 {
     if (root->type == AST_unop && 
         root->unop.op == '-' && 
         root->unop.on->type == AST_num)
     {
-        ASTNode* n = new ASTNode();
+        ASTNode* n = ast_new(arena, ASTNode());
         n->type = AST_num;
         n->num.value = -root->unop.on->num.value;
         ++*reductions;
@@ -19,7 +19,7 @@ ASTNode* simplify(const ASTNode* root, int* reductions)
         root->binop.left->type == AST_num && 
         root->binop.right->type == AST_num)
     {
-        ASTNode* n = new ASTNode();
+        ASTNode* n = ast_new(arena, ASTNode());
         n->type = AST_num;
         n->num.value = root->binop.left->num.value + root->binop.right->num.value;
         ++*reductions;
@@ -27,41 +27,38 @@ ASTNode* simplify(const ASTNode* root, int* reductions)
     }
     
     // deep copy while simplifying...
-    ASTNode* n = new ASTNode(*root);
+    ASTNode* n = ast_new(arena, *root);
     switch (root->type)
     {
         case AST_program:
         {
-            n->program.nodes = NULL;
-            n->program.size = 0;
+            n->program = ASTNodeArray();
             for (uint32_t i = 0; i < root->program.size; ++i)
             {
-                astn_push(&n->program, simplify(root->program.nodes[i], reductions));
+                astn_push(arena, &n->program, simplify(arena, root->program.nodes[i], reductions));
             }
         } break;
         case AST_blocklist:
         {
-            n->blocklist.nodes = NULL;
-            n->blocklist.size = 0;
+            n->blocklist = ASTNodeArray();
             for (uint32_t i = 0; i < root->blocklist.size; ++i)
             {
-                astn_push(&n->blocklist, simplify(root->blocklist.nodes[i], reductions));
+                astn_push(arena, &n->blocklist, simplify(arena, root->blocklist.nodes[i], reductions));
             }
         } break;
-        case AST_ret: n->ret.expression = simplify(root->ret.expression, reductions); break;
+        case AST_ret: n->ret.expression = simplify(arena, root->ret.expression, reductions); break;
         case AST_var:
         {
             if (root->var.assign_expression)
-                n->var.assign_expression = simplify(root->var.assign_expression, reductions); break;
+                n->var.assign_expression = simplify(arena, root->var.assign_expression, reductions); break;
         } break;
         case AST_num: break;
         case AST_fdef:
         {
-            n->fdef.body.nodes = NULL;
-            n->fdef.body.size = 0;
+            n->fdef.body = ASTNodeArray();
             for (uint32_t i = 0; i < root->fdef.body.size; ++i)
             {
-                astn_push(&n->fdef.body, simplify(root->fdef.body.nodes[i], reductions));
+                astn_push(arena, &n->fdef.body, simplify(arena, root->fdef.body.nodes[i], reductions));
             }
         } break;
         case AST_fcall:debug_break();
@@ -71,7 +68,7 @@ ASTNode* simplify(const ASTNode* root, int* reductions)
         case AST_dowhile:debug_break();
         case AST_unop:
         {
-            n->unop.on = simplify(root->unop.on, reductions);
+            n->unop.on = simplify(arena, root->unop.on, reductions);
         } break;
         case AST_binop:
         case AST_terop:
@@ -1,5 +1,5 @@
 #pragma once
 #include "ast.h"
 
-ASTNode* simplify(const ASTNode* root, int* reductions);
+ASTNode* simplify(ASTArena* arena, const ASTNode* root, int* reductions); // the copy goes in arena
 void dump_simplify(FILE* out, const ASTNode* root);
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "splice.h"
+#include "scan.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* find_splice(const char* iter, const char* end)
+{
+    // backslashes are rare, so the vectorized byte search does nearly all of the work
+    for (;;)
+    {
+        iter = scan_find_byte(iter, end, '\\');
+        if (iter == end || splice_length(iter, end))
+            return iter;
+        ++iter;
+    }
+}
+
+void splice_source(const char* source, uint64_t length, SplicedSource* out)
+{
+    *out = SplicedSource();
+    const char* const end = source + length;
+    const char* splice = find_splice(source, end);
+    if (splice == end)
+    {
+        out->data = source;
+        out->length = length;
+        return;
+    }
+
+    out->buffer = (char*)malloc(size_t(length ? length : 1));
+    assert(out->buffer);
+    uint64_t marks_capacity = 0;
+    char* write = out->buffer;
+    const char* read = source;
+    while (splice != end)
+    {
+        // copy up to the splice and skip it
+        memcpy(write, read, size_t(splice - read));
+        write += splice - read;
+        read = splice + splice_length(splice, end);
+
+        if (out->num_marks == marks_capacity)
+        {
+            marks_capacity = marks_capacity ? marks_capacity * 2 : 16;
+            out->marks = (SpliceMark*)realloc(out->marks, size_t(marks_capacity) * sizeof(SpliceMark));
+            assert(out->marks);
+        }
+        out->marks[out->num_marks].spliced = uint64_t(write - out->buffer);
+        out->marks[out->num_marks].original = uint64_t(read - source);
+        ++out->num_marks;
+
+        splice = find_splice(read, end);
+    }
+    memcpy(write, read, size_t(end - read));
+    write += end - read;
+
+    out->data = out->buffer;
+    out->length = uint64_t(write - out->buffer);
+}
+
+void splice_free(SplicedSource* spliced)
+{
+    free(spliced->buffer);
+    free(spliced->marks);
+    *spliced = SplicedSource();
+}
+
+uint64_t splice_original_offset(const SplicedSource* spliced, uint64_t offset)
+{
+    // last mark at or before offset, everything between it and the next one moved by the same amount
+    uint64_t lo = 0;
+    uint64_t hi = spliced->num_marks;
+    while (lo < hi)
+    {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (spliced->marks[mid].spliced <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return offset;
+    const SpliceMark& mark = spliced->marks[lo - 1];
+    return mark.original + (offset - mark.spliced);
+}
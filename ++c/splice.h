@@ -0,0 +1,47 @@
+#pragma once
+#include <inttypes.h>
+
+// Translation phase 2: every backslash immediately followed by a newline is deleted, splicing physical lines
+// into logical lines. Only \n and \r\n line endings are recognized.
+//
+// lex() works on the physical source so tokens keep pointing into it, and uses the two helpers below wherever
+// a splice can appear. splice_source() is the whole-buffer version for tools that want logical lines up
+// front: it copies the source minus its splices and keeps a sparse remap table (one entry per splice) so
+// offsets into the result can be turned back into offsets into the original for diagnostics.
+
+// length of the splice starting at p: 2 for \ \n, 3 for \ \r \n, 0 if there isn't one
+inline uint64_t splice_length(const char* p, const char* end)
+{
+    if (end - p >= 2 && p[0] == '\\' && p[1] == '\n')
+        return 2;
+    if (end - p >= 3 && p[0] == '\\' && p[1] == '\r' && p[2] == '\n')
+        return 3;
+    return 0;
+}
+
+// true if the '\n' at newline is spliced away, i.e. preceded by \ or \ \r. Doesn't look before line_start.
+inline bool splice_before_newline(const char* line_start, const char* newline)
+{
+    if (newline - line_start >= 1 && newline[-1] == '\\')
+        return true;
+    return newline - line_start >= 2 && newline[-1] == '\r' && newline[-2] == '\\';
+}
+
+struct SpliceMark
+{
+    uint64_t spliced; // offset in the spliced text where a splice was removed
+    uint64_t original; // offset of the same byte in the original
+};
+
+struct SplicedSource
+{
+    const char* data; // logical lines. Points at the original when there was nothing to splice
+    uint64_t length;
+    char* buffer; // owned copy behind data, NULL if data is the original
+    SpliceMark* marks; // one per removed splice, in order
+    uint64_t num_marks;
+};
+
+void splice_source(const char* source, uint64_t length, SplicedSource* out);
+void splice_free(SplicedSource* spliced);
+uint64_t splice_original_offset(const SplicedSource* spliced, uint64_t offset); // O(log splices)
@@ -2,61 +2,245 @@
 #include "debug.h"
 #include <memory.h>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
 
-static char g_nts_strings[1024];
-static char* g_nts_strings_end = g_nts_strings;
-static char* g_nts_strings_cap = g_nts_strings + 1024;
-static str g_table[64];
-static str* g_table_end = g_table;
-static str* g_table_cap = g_table + 64;
+// Strings are interned into open-addressing hash tables (linear probing, power-of-two size).
+// The characters themselves live in a chain of chunks that are never moved or freed, so a str.nts
+// handed out once stays valid (and pointer-comparable) for the life of the process even as the
+// tables grow.
+//
+// The table is split into shards picked by the top bits of the hash, each with its own lock, table and
+// chunks, so threads lexing different parts of a file (see lex_parallel) rarely wait on each other.
+//
+// Lookups don't take the lock at all. A slot is filled in once and never changes after that: hash and len
+// are written first, then nts is published with a release store, so a reader that sees nts also sees the
+// rest. Growing builds a whole new table and publishes it the same way. The old table is retired rather than
+// freed since a reader may still be probing it (a lookup that misses in a stale table just falls through to
+// the locked path, which re-probes the current one). Retired tables add up to less than the live one.
+// Only a string that isn't interned yet takes the shard's lock, which in steady state is rare.
+//
+// NOTE: all state below is zero-initialized so strings_insert can be called from static initializers
+// in other translation units (see the keyword table in lex.cpp) without worrying about init order.
+// That's also why the locks are plain atomics rather than std::mutex.
 
-str strings_insert(const char* start, const char* end)
+static const size_t STRINGS_CHUNK_SIZE = 64 * 1024;
+static const uint32_t STRINGS_MIN_TABLE_SIZE = 256; // per shard
+static const uint32_t STRINGS_SHARD_BITS = 4;
+static const uint32_t STRINGS_SHARDS = 1 << STRINGS_SHARD_BITS;
+
+struct strings_chunk
 {
-    int len = int(end - start);
+    strings_chunk* prev;
+    char* end;
+    char* cap;
+};
+
+// 16 bytes so four slots share a cache line. nts == NULL means the slot is empty.
+struct strings_slot
+{
+    uint32_t hash;
+    int len;
+    std::atomic<const char*> nts; // written last, see above
+};
+
+struct strings_table
+{
+    strings_table* retired; // the table this one replaced, kept alive for readers still probing it
+    uint32_t mask; // table size - 1
+    strings_slot slots[1];
+};
+
+struct strings_shard
+{
+    std::atomic<strings_table*> table; // current table, readers load it without the lock
+    std::atomic<uint32_t> lock; // 1 while a thread is inserting into this shard
+    strings_chunk* chunk;
+    uint32_t table_count;
+};
 
-    // Search table for entry
-    str* iter = g_table;
-    while (iter < g_table_end)
+static strings_shard g_shards[STRINGS_SHARDS];
+
+static void strings_lock(strings_shard* shard)
+{
+    while (shard->lock.exchange(1, std::memory_order_acquire))
     {
-        if (iter->len != len)
+        while (shard->lock.load(std::memory_order_relaxed))
+            std::this_thread::yield();
+    }
+}
+
+static void strings_unlock(strings_shard* shard)
+{
+    shard->lock.store(0, std::memory_order_release);
+}
+
+static uint32_t strings_hash(const char* start, int len)
+{
+    // 8 bytes at a time multiply-xorshift. Doesn't need to be cryptographic, just cheap and well mixed
+    // for short identifiers.
+    const uint64_t k = 0x9E3779B97F4A7C15ull;
+    uint64_t h = uint64_t(len) * k;
+    const char* iter = start;
+    const char* end = start + len;
+    while (end - iter >= 8)
+    {
+        uint64_t w;
+        memcpy(&w, iter, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+        iter += 8;
+    }
+    if (iter < end)
+    {
+        uint64_t w = 0;
+        memcpy(&w, iter, end - iter);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    h *= k;
+    return uint32_t(h ^ (h >> 32));
+}
+
+static const char* strings_copy(strings_shard* shard, const char* start, int len)
+{
+    size_t needed = size_t(len) + 1; // +1 for null-terminator
+    if (!shard->chunk || size_t(shard->chunk->cap - shard->chunk->end) < needed)
+    {
+        size_t chunk_size = needed > STRINGS_CHUNK_SIZE ? needed : STRINGS_CHUNK_SIZE;
+        strings_chunk* c = (strings_chunk*)malloc(sizeof(strings_chunk) + chunk_size);
+        if (!c)
         {
-            ++iter;
+            debug_break();
+            return NULL;
+        }
+        c->prev = shard->chunk;
+        c->end = (char*)(c + 1);
+        c->cap = c->end + chunk_size;
+        shard->chunk = c;
+    }
+
+    char* nts = shard->chunk->end;
+    memcpy(nts, start, len);
+    nts[len] = 0;
+    shard->chunk->end += needed;
+    return nts;
+}
+
+static strings_table* strings_grow(strings_shard* shard, strings_table* old)
+{
+    uint32_t old_size = old ? old->mask + 1 : 0;
+    uint32_t new_size = old_size ? old_size * 2 : STRINGS_MIN_TABLE_SIZE;
+    if (new_size < old_size)
+    {
+        debug_break(); // 4 billion strings? Something went wrong.
+        return NULL;
+    }
+
+    strings_table* table = (strings_table*)calloc(1, sizeof(strings_table) + (new_size - 1) * sizeof(strings_slot));
+    if (!table)
+    {
+        debug_break();
+        return NULL;
+    }
+    table->retired = old;
+    table->mask = new_size - 1;
+
+    // re-seat existing entries. only the slots move, never the string data.
+    for (uint32_t i = 0; i < old_size; ++i)
+    {
+        const strings_slot* from = &old->slots[i];
+        const char* nts = from->nts.load(std::memory_order_relaxed);
+        if (!nts)
             continue;
+
+        uint32_t index = from->hash & table->mask;
+        while (table->slots[index].nts.load(std::memory_order_relaxed))
+            index = (index + 1) & table->mask;
+        strings_slot* to = &table->slots[index];
+        to->hash = from->hash;
+        to->len = from->len;
+        to->nts.store(nts, std::memory_order_relaxed);
+    }
+
+    // everything above becomes visible to a reader that loads the new table
+    shard->table.store(table, std::memory_order_release);
+    return table;
+}
+
+// probe for start..len, returns the slot holding it or the empty slot that ends its probe sequence
+static strings_slot* strings_find(strings_table* table, uint32_t hash, const char* start, int len, const char** o_nts)
+{
+    uint32_t index = hash & table->mask;
+    for (;;)
+    {
+        strings_slot* slot = &table->slots[index];
+        const char* nts = slot->nts.load(std::memory_order_acquire);
+        if (!nts)
+        {
+            *o_nts = NULL;
+            return slot;
         }
 
-        if (0 != memcmp(iter->nts, start, len))
+        if (slot->hash == hash &&
+            slot->len == len &&
+            0 == memcmp(nts, start, len))
         {
-            ++iter;
-            continue;
+            *o_nts = nts;
+            return slot;
         }
 
-        return *iter;
+        index = (index + 1) & table->mask;
     }
+}
+
+str strings_insert(const char* start, const char* end)
+{
+    int len = int(end - start);
+    uint32_t hash = strings_hash(start, len);
+    strings_shard* shard = &g_shards[hash >> (32 - STRINGS_SHARD_BITS)];
 
-    // check for room in nts buffer
-    if (g_nts_strings_end + len + 1 >= g_nts_strings_cap)
+    // lock-free lookup, almost every identifier after the first few thousand has been seen before
+    const char* nts = NULL;
+    strings_table* table = shard->table.load(std::memory_order_acquire);
+    if (table)
     {
-        debug_break();
-        return str();
+        strings_find(table, hash, start, len, &nts);
+        if (nts)
+            return str{ nts, len };
     }
 
-    // check for room in table
-    if (iter + 1 >= g_table_cap)
+    strings_lock(shard);
+
+    // keep load factor at or below 1/2 so probe sequences stay short
+    table = shard->table.load(std::memory_order_relaxed);
+    if (!table || (shard->table_count + 1) * 2 > table->mask + 1)
     {
-        debug_break();
-        return str();
+        table = strings_grow(shard, table);
+        if (!table)
+        {
+            strings_unlock(shard);
+            return str();
+        }
     }
 
-    iter->nts = g_nts_strings_end;
-    iter->len = len;
-
-    // insert
-    // NOTE: no need to null-terminate because g_table is memset to 0 by being in global namespace
-    memcpy(g_nts_strings_end, start, len);
-    g_nts_strings_end += len + 1;
-    ++g_table_end;
+    // another thread may have inserted it since the lookup above
+    strings_slot* slot = strings_find(table, hash, start, len, &nts);
+    if (!nts)
+    {
+        nts = strings_copy(shard, start, len);
+        if (nts)
+        {
+            slot->hash = hash;
+            slot->len = len;
+            slot->nts.store(nts, std::memory_order_release);
+            ++shard->table_count;
+        }
+    }
 
-    return *iter;
+    strings_unlock(shard);
+    return nts ? str{ nts, len } : str();
 }
 
 str strings_insert_nts(const char* nts)
@@ -66,3 +250,15 @@ str strings_insert_nts(const char* nts)
 
     return strings_insert(nts, end);
 }
+
+uint32_t strings_count()
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < STRINGS_SHARDS; ++i)
+    {
+        strings_lock(&g_shards[i]);
+        count += g_shards[i].table_count;
+        strings_unlock(&g_shards[i]);
+    }
+    return count;
+}
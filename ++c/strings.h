@@ -1,4 +1,5 @@
 #pragma once
+#include <inttypes.h>
 
 // users may directly compare nts pointers to see if they are equal.
 struct str
@@ -7,5 +8,6 @@ struct str
     int len;
 };
 
-str strings_insert(const char* start, const char* end);
-str strings_insert_nts(const char* nts); //nts=null-terminated string
\ No newline at end of file
+str strings_insert(const char* start, const char* end); // thread-safe, lock-free if the string is already interned
+str strings_insert_nts(const char* nts); //nts=null-terminated string
+uint32_t strings_count(); // number of unique strings interned so far
@@ -0,0 +1,119 @@
+#include "symbols.h"
+#include "debug.h"
+#include <stdlib.h>
+
+struct symbol_key
+{
+    const char* name; // NULL for an empty slot
+    uint32_t innermost; // binding index, SYMBOL_NONE once every binding of the name went out of scope
+};
+
+static uint32_t symbol_hash(const char* name, uint32_t mask)
+{
+    return uint32_t(((uint64_t(uintptr_t(name)) >> 3) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+static symbol_key* find_key(const SymbolTable* table, const char* name)
+{
+    if (!table->keys)
+        return NULL;
+    uint32_t slot = symbol_hash(name, table->keys_mask);
+    while (table->keys[slot].name)
+    {
+        if (table->keys[slot].name == name)
+            return &table->keys[slot];
+        slot = (slot + 1) & table->keys_mask;
+    }
+    return NULL;
+}
+
+static symbol_key* insert_key(SymbolTable* table, const char* name)
+{
+    if (symbol_key* key = find_key(table, name))
+        return key;
+
+    // keep the table at most half full
+    if (!table->keys || (table->num_keys + 1) * 2 > table->keys_mask + 1)
+    {
+        const uint32_t old_size = table->keys ? table->keys_mask + 1 : 0;
+        const uint32_t new_size = old_size ? old_size * 2 : 64;
+        symbol_key* keys = (symbol_key*)calloc(new_size, sizeof(symbol_key));
+        assert(keys);
+        for (uint32_t i = 0; i < old_size; ++i)
+        {
+            if (!table->keys[i].name)
+                continue;
+            uint32_t slot = symbol_hash(table->keys[i].name, new_size - 1);
+            while (keys[slot].name)
+                slot = (slot + 1) & (new_size - 1);
+            keys[slot] = table->keys[i];
+        }
+        free(table->keys);
+        table->keys = keys;
+        table->keys_mask = new_size - 1;
+    }
+
+    uint32_t slot = symbol_hash(name, table->keys_mask);
+    while (table->keys[slot].name)
+        slot = (slot + 1) & table->keys_mask;
+    table->keys[slot].name = name;
+    table->keys[slot].innermost = SYMBOL_NONE;
+    ++table->num_keys;
+    return &table->keys[slot];
+}
+
+void symbols_push_scope(SymbolTable* table)
+{
+    if (table->num_scopes == table->scopes_capacity)
+    {
+        table->scopes_capacity = table->scopes_capacity ? table->scopes_capacity * 2 : 32;
+        table->scope_starts = (uint32_t*)realloc(table->scope_starts, table->scopes_capacity * sizeof(uint32_t));
+        assert(table->scope_starts);
+    }
+    table->scope_starts[table->num_scopes++] = table->num_bindings;
+}
+
+void symbols_pop_scope(SymbolTable* table)
+{
+    assert(table->num_scopes > 0);
+    const uint32_t start = table->scope_starts[--table->num_scopes];
+    while (table->num_bindings > start)
+    {
+        const SymbolBinding& b = table->bindings[--table->num_bindings];
+        find_key(table, b.name)->innermost = b.shadowed;
+    }
+}
+
+void symbols_bind(SymbolTable* table, str name, ASTNode* decl)
+{
+    if (table->num_bindings == table->bindings_capacity)
+    {
+        table->bindings_capacity = table->bindings_capacity ? table->bindings_capacity * 2 : 64;
+        table->bindings = (SymbolBinding*)realloc(table->bindings, table->bindings_capacity * sizeof(SymbolBinding));
+        assert(table->bindings);
+    }
+
+    symbol_key* key = insert_key(table, name.nts);
+    SymbolBinding* b = &table->bindings[table->num_bindings];
+    b->name = name.nts;
+    b->decl = decl;
+    b->shadowed = key->innermost;
+    b->scope = table->num_scopes;
+    key->innermost = table->num_bindings++;
+}
+
+const SymbolBinding* symbols_find(const SymbolTable* table, str name)
+{
+    const symbol_key* key = find_key(table, name.nts);
+    if (!key || key->innermost == SYMBOL_NONE)
+        return NULL;
+    return &table->bindings[key->innermost];
+}
+
+void symbols_free(SymbolTable* table)
+{
+    free(table->keys);
+    free(table->bindings);
+    free(table->scope_starts);
+    *table = SymbolTable();
+}
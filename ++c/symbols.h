@@ -0,0 +1,41 @@
+#pragma once
+#include "strings.h"
+#include <inttypes.h>
+
+// Scoped name -> declaration table for resolving variables. Keyed by the interned name pointer (see strings.h), so
+// hashing and comparing a name never looks at its characters.
+//
+// Every bind pushes a binding that remembers the binding it shadows. The hash table only ever points at the
+// innermost binding of a name, so a lookup is one probe sequence no matter how many declarations are live, and
+// popping a scope walks back just the bindings made in it, putting each shadowed one back.
+
+static const uint32_t SYMBOL_NONE = 0xFFFFFFFF;
+
+struct SymbolBinding
+{
+    const char* name; // nts of the interned name
+    struct ASTNode* decl;
+    uint32_t shadowed; // binding of the same name this one hides, SYMBOL_NONE if none
+    uint32_t scope; // depth it was bound at, 0 is file scope
+};
+
+struct SymbolTable
+{
+    struct symbol_key* keys; // open addressing, every name ever bound keeps its key
+    uint32_t keys_mask;
+    uint32_t num_keys;
+
+    SymbolBinding* bindings; // innermost scope last
+    uint32_t num_bindings;
+    uint32_t bindings_capacity;
+
+    uint32_t* scope_starts; // num_bindings when each scope was pushed
+    uint32_t num_scopes;
+    uint32_t scopes_capacity;
+};
+
+void symbols_push_scope(SymbolTable* table);
+void symbols_pop_scope(SymbolTable* table); // drops the scope's bindings, names they shadowed are visible again
+void symbols_bind(SymbolTable* table, str name, struct ASTNode* decl); // in the innermost scope
+const SymbolBinding* symbols_find(const SymbolTable* table, str name); // innermost visible binding, NULL if none
+void symbols_free(SymbolTable* table);
@@ -1,7 +1,13 @@
 #include "test.h"
 #include "lex.h"
+#include "preprocess.h"
+#include "token_cache.h"
+#include "lines.h"
+#include "splice.h"
+#include "scan.h"
 #include "ir.h"
 #include "ast.h"
+#include "ast_flat.h"
 #include "gen.h"
 #include "simplify.h"
 #include "dir.h"
@@ -18,14 +24,24 @@
 struct perf_numbers
 {
     uint64_t total_tests = 0;
+    uint64_t tokens_parsed = 0; // tokens in every file that parsed
+    uint64_t tokens_visited = 0; // ASTOut::tokens_visited for the same files
     float test_cache_load;
     float test_cache_save;
     std::vector<float> read_file;
     std::vector<float> invalid_lex;
     std::vector<float> lex;
     std::vector<float> lex_strip;
+    std::vector<float> lex_cache;
+    std::vector<float> preprocess;
     std::vector<float> ir;
     std::vector<float> ast;
+    std::vector<float> ast_stream;
+    std::vector<float> ast_buffer;
+    std::vector<float> ast_parallel;
+    std::vector<float> ast_lazy;
+    std::vector<float> incremental;
+    std::vector<float> ast_flat;
     std::vector<float> gen_asm;
     std::vector<float> gen_asm_from_ir;
     std::vector<float> gen_exe;
@@ -52,11 +68,12 @@ struct test_iter
 {
     const char* file_path;
 
-    size_t file_length;
+    uint64_t file_length;
     const char* file_data;
 
     LexOutput lex_out;
     LexInput lex_in;
+    bool has_directives; // lex_out went through preprocess(), so not all of its tokens point into file_data
 
     IR* ir;
     size_t ir_size;
@@ -226,6 +243,558 @@ static void dump(test_config cfg, const test_iter& test)
     }
 }
 
+// lex again with every scan level the cpu supports (see scan.h) and make sure the tokens are identical.
+static bool lex_matches_all_scan_levels(const LexInput* in, const LexOutput* expected)
+{
+    const eScanLevel original = scan_level();
+    bool same = true;
+    for (int level = SCAN_SCALAR; level <= scan_best_level() && same; ++level)
+    {
+        if (level == original)
+            continue;
+
+        scan_set_level(eScanLevel(level));
+        LexOutput out = {};
+        same = lex(in, &out) && out.num_tokens == expected->num_tokens;
+        for (uint64_t i = 0; same && i < out.num_tokens; ++i)
+            same = token_equal(out.tokens[i], expected->tokens[i]);
+        free(out.tokens);
+    }
+    scan_set_level(original);
+    return same;
+}
+
+// lex_parallel with enough chunks that even the small test files get split in awkward places (inside
+// comments, strings, splices) has to stitch back to exactly what lex() produced.
+static bool lex_parallel_matches(const LexInput* in, const LexOutput* expected)
+{
+    static const uint32_t kChunkCounts[] = { 2, 3, 5, 8, 13 };
+    bool same = true;
+    for (uint32_t c = 0; same && c < sizeof(kChunkCounts) / sizeof(kChunkCounts[0]); ++c)
+    {
+        LexOutput out = {};
+        same = lex_parallel(in, &out, kChunkCounts[c]) && out.num_tokens == expected->num_tokens;
+        for (uint64_t i = 0; same && i < out.num_tokens; ++i)
+            same = token_equal(out.tokens[i], expected->tokens[i]);
+        free(out.tokens);
+    }
+    return same;
+}
+
+// line_index_locate has to agree with counting lines by hand at every token and at end of input, and the
+// newline count it's sized by has to be the same at every scan level.
+static bool lines_match_naive(const LexInput* in, const LexOutput* tokens)
+{
+    LineIndex lines;
+    line_index_init(&lines, in->filename, in->stream, in->length);
+    bool same = true;
+    uint64_t line = 1;
+    uint64_t column = 1;
+    const char* at = in->stream;
+    for (uint64_t i = 0; same && i <= tokens->num_tokens; ++i)
+    {
+        const char* target = i < tokens->num_tokens ? tokens->tokens[i].location.start : in->stream + in->length;
+        for (; at < target; ++at)
+        {
+            column = *at == '\n' ? 1 : column + 1;
+            line += *at == '\n';
+        }
+        const SourceLocation where = line_index_locate(&lines, target);
+        same = where.line == line && where.column == column;
+    }
+
+    const eScanLevel original = scan_level();
+    for (int level = SCAN_SCALAR; level <= scan_best_level() && same; ++level)
+    {
+        scan_set_level(eScanLevel(level));
+        same = scan_count_byte(in->stream, in->stream + in->length, '\n') + 1 == lines.num_lines;
+    }
+    scan_set_level(original);
+    line_index_free(&lines);
+    return same;
+}
+
+static bool is_open_bracket(eToken t) { return t == eToken::open_parens || t == eToken::open_curly; }
+static bool is_closed_bracket(eToken t) { return t == eToken::closed_parens || t == eToken::closed_curly; }
+
+// pair brackets the slow way, counting depth forward from each opener, and check lex_match_brackets agrees. It has
+// to fail exactly when something doesn't pair up, and then point at a bracket.
+static bool brackets_match_naive(const LexOutput* tokens)
+{
+    const Token* t = tokens->tokens;
+    const uint64_t n = tokens->num_tokens;
+    BracketIndex index = {};
+    const bool balanced = lex_match_brackets(t, n, &index);
+
+    bool same = true;
+    bool naive_balanced = true;
+    uint64_t paired = 0;
+    uint64_t closers = 0;
+    for (uint64_t i = 0; i < n && same; ++i)
+    {
+        if (is_closed_bracket(t[i].type))
+            ++closers;
+        if (!is_open_bracket(t[i].type))
+        {
+            same = !balanced || is_closed_bracket(t[i].type) || index.matches[i] == 0;
+            continue;
+        }
+
+        uint64_t j = i;
+        for (int64_t depth = 0; j < n; ++j)
+        {
+            depth += is_open_bracket(t[j].type) ? 1 : is_closed_bracket(t[j].type) ? -1 : 0;
+            if (depth == 0)
+                break;
+        }
+        const eToken closer = t[i].type == eToken::open_parens ? eToken::closed_parens : eToken::closed_curly;
+        if (j == n || t[j].type != closer)
+        {
+            naive_balanced = false;
+            continue;
+        }
+        ++paired;
+        same = !balanced || (index.matches[i] == j && index.matches[j] == i);
+    }
+    naive_balanced = naive_balanced && paired == closers;
+
+    same = same && balanced == naive_balanced;
+    for (uint64_t i = 0; same && !balanced && i <= n; ++i)
+    {
+        same = i < n; // failure_location has to be one of the brackets
+        if (same && t[i].location.start == index.failure_location)
+            break;
+    }
+    bracket_index_free(&index);
+    return same;
+}
+
+// lexing the output of splice_source has to give the same tokens as lexing the physical source, starting at
+// the same original offsets once mapped back through the remap table. (Token ends and string bounds can't
+// match when a splice falls inside a token, and comments/directives lose their splices.)
+static bool splice_matches_lex(const LexInput* in, const LexOutput* expected)
+{
+    SplicedSource spliced;
+    splice_source(in->stream, in->length, &spliced);
+    LexInput spliced_in = init_lex(in->filename, spliced.data, spliced.length);
+    LexOutput out = {};
+    bool same = lex(&spliced_in, &out) && out.num_tokens == expected->num_tokens;
+    for (uint64_t i = 0; same && i < out.num_tokens; ++i)
+    {
+        const Token& a = out.tokens[i];
+        const Token& b = expected->tokens[i];
+        same = a.type == b.type
+            && splice_original_offset(&spliced, uint64_t(a.location.start - spliced.data)) == uint64_t(b.location.start - in->stream);
+        if (a.type == eToken::identifier)
+            same = same && a.identifier.nts == b.identifier.nts;
+        if (a.type == eToken::constant_number)
+            same = same && a.number == b.number;
+    }
+    free(out.tokens);
+    splice_free(&spliced);
+    return same;
+}
+
+// "file:line:col: " for a failure at `at`, which can be in the test file or anything it included
+static void print_failure_location(const test_iter& test, const char* at)
+{
+    LineIndex lines;
+    line_index_init(&lines, test.file_path, test.file_data, test.file_length);
+    const SourceLocation where = preprocess_locate(&lines, at);
+    print_location(stdout, &where);
+    printf(": ");
+    line_index_free(&lines);
+}
+
+static bool ast_dumps_equal(const ASTNode* a, const ASTNode* b)
+{
+    FILE* fa;
+    FILE* fb;
+    if (0 != tmpfile_s(&fa))
+        return false;
+    if (0 != tmpfile_s(&fb))
+    {
+        fclose(fa);
+        return false;
+    }
+
+    dump_ast(fa, a, 0);
+    dump_ast(fb, b, 0);
+    rewind(fa);
+    rewind(fb);
+
+    int ca, cb;
+    do
+    {
+        ca = fgetc(fa);
+        cb = fgetc(fb);
+    } while (ca == cb && ca != EOF);
+
+    fclose(fa);
+    fclose(fb);
+    return ca == cb;
+}
+
+// dumps don't show stack slots: same shape, and the same slot for every var and binop and count for every fdef
+static bool ast_slots_equal(const ASTNode* a, const ASTNode* b)
+{
+    FlatAST fa = {};
+    FlatAST fb = {};
+    bool ok = ast_flatten(a, &fa) && ast_flatten(b, &fb) && fa.num_nodes == fb.num_nodes;
+    for (uint32_t i = 0; ok && i < fa.num_nodes; ++i)
+    {
+        const ASTType type = flat_type(&fa, i);
+        ok = type == flat_type(&fb, i);
+        if (ok && type == AST_binop)
+            ok = fa.nodes[i].aux == fb.nodes[i].aux;
+        else if (ok && (type == AST_var || type == AST_fdef))
+            ok = flat_name(&fa, i)->slot == flat_name(&fb, i)->slot;
+        if (ok && type == AST_fdef)
+            ok = flat_origin(&fa, i)->fdef.num_temps == flat_origin(&fb, i)->fdef.num_temps;
+    }
+    flat_free(&fa);
+    flat_free(&fb);
+    return ok;
+}
+
+// dumps don't show source locations either: every var's name at the same place, for trees of the same text
+static bool ast_locations_equal(const ASTNode* a, const ASTNode* b)
+{
+    FlatAST fa = {};
+    FlatAST fb = {};
+    bool ok = ast_flatten(a, &fa) && ast_flatten(b, &fb) && fa.num_nodes == fb.num_nodes;
+    for (uint32_t i = 0; ok && i < fa.num_nodes; ++i)
+    {
+        if (flat_type(&fa, i) == AST_var)
+            ok = flat_type(&fb, i) == AST_var && flat_name(&fa, i)->debug_location.start == flat_name(&fb, i)->debug_location.start
+                && flat_name(&fa, i)->debug_location.end == flat_name(&fb, i)->debug_location.end;
+    }
+    flat_free(&fa);
+    flat_free(&fb);
+    return ok;
+}
+
+// parse again pulling tokens through a LexStream (see lex.h) and make sure the tree matches the lex()-array parse.
+static bool ast_matches_streaming(const LexInput* in, const ASTNode* expected, perf_numbers* perf)
+{
+    static LexStream stream; // token ring is too big to want on the stack
+    Preprocessor pp;
+    preprocess_init(&pp);
+    lex_stream_init(&stream, in, true);
+    stream.pp = &pp;
+
+    ASTOut out = {};
+    Timer timer;
+    timer.start();
+    bool ok = ast(&stream, &out);
+    timer.end();
+    update_perf(&perf->ast_stream, timer.milliseconds());
+    lex_stream_close(&stream);
+    preprocess_free(&pp);
+
+    ok = ok && ast_dumps_equal(expected, out.root);
+    ast_free(&out);
+    return ok;
+}
+
+// an invalid function longer than the LexStream window: on failure the parser looks back at where the function
+// started, which has left the ring by then. The parse error is what has to come out, not the overrun. (Too deep a
+// nesting is the error here since it doesn't debug_break.)
+static void test_stream_error_past_window()
+{
+    std::string prog = "int main() {\n    int a = 0;\n";
+    while (prog.size() < LEX_STREAM_WINDOW * 16)
+        prog += "    a = a + 1;\n";
+    prog += "    return ";
+    for (int i = 0; i < 32; ++i)
+        prog += "(";
+    prog += "a";
+    for (int i = 0; i < 32; ++i)
+        prog += ")";
+    prog += ";\n}\n";
+
+    static LexStream stream; // token ring is too big to want on the stack
+    LexInput lexin = init_lex("stream_error_past_window", prog.data(), prog.size());
+    lex_stream_init(&stream, &lexin, true);
+
+    ast_set_max_depth(16);
+    ASTOut out = {};
+    const bool parsed = ast(&stream, &out);
+    ast_set_max_depth(0);
+    const char* parse_error = out.failure_reason ? out.failure_reason : "none";
+    const bool ok = !parsed && stream.overrun && !stream.failure_reason
+        && 0 == strcmp(parse_error, "nested too deeply, see ast_set_max_depth");
+    ast_free(&out);
+    lex_stream_close(&stream);
+
+    if (ok)
+        printf("LEX, AST[stream error past window]:OK\n");
+    else
+    {
+        debug_break();
+        printf("LEX, AST[stream error past window]:FAILED. parser: %s, lex: %s\n", parse_error,
+            stream.failure_reason ? stream.failure_reason : "none");
+    }
+}
+
+// parse again with top-level functions spread over a few threads (even for a handful of functions), the tree, the
+// item ends and the token count must come out the same as the serial parse.
+static bool ast_matches_parallel(const LexOutput* tokens, const ASTOut* expected, perf_numbers* perf)
+{
+    BracketIndex brackets = {};
+    if (!lex_match_brackets(tokens->tokens, tokens->num_tokens, &brackets))
+        return false;
+
+    ASTOut out = {};
+    Timer timer;
+    timer.start();
+    bool ok = ast_parallel(tokens->tokens, tokens->num_tokens, brackets.matches, 4, &out);
+    timer.end();
+    update_perf(&perf->ast_parallel, timer.milliseconds());
+
+    ok = ok && out.tokens_visited == expected->tokens_visited && ast_dumps_equal(expected->root, out.root)
+        && ast_slots_equal(expected->root, out.root);
+    for (uint32_t i = 0; ok && i < expected->root->program.size; ++i)
+        ok = out.item_ends[i] == expected->item_ends[i];
+    ast_free(&out);
+    bracket_index_free(&brackets);
+    return ok;
+}
+
+// globals with operators in their initializers between functions. gen only takes a number there, so none of the
+// stage tests have one, but the parallel parse has to number their temporaries the way the serial one does.
+static void test_parallel_global_slots()
+{
+    const char* prog =
+        "int a = 1 + 2 * 3;\n"
+        "int f(int x) { return x * (x - a) + 1; }\n"
+        "int b = 4 - 5 - 6;\n"
+        "int g() { return f(b) + f(a); }\n"
+        "int c = 7 * 8 + 9;\n"
+        "int main() { return g() - c; }\n";
+
+    LexInput lexin = init_lex("parallel_global_slots", prog, strlen(prog));
+    LexOutput tokens = {};
+    ASTOut expected = {};
+    bool ok = lex(&lexin, &tokens) && ast(tokens.tokens, tokens.num_tokens, &expected);
+    perf_numbers perf;
+    ok = ok && ast_matches_parallel(&tokens, &expected, &perf);
+    ast_free(&expected);
+    free(tokens.tokens);
+
+    if (ok)
+        printf("LEX, AST[parallel global slots]:OK\n");
+    else
+    {
+        debug_break();
+        printf("LEX, AST[parallel global slots]:FAILED\n");
+    }
+}
+
+// parse with every body left pending, then materialize what main reaches and after that the rest. Once nothing is
+// pending it must be the serial parse's tree, with every token visited exactly once between the two steps.
+static bool ast_matches_lazy(const LexOutput* tokens, const ASTOut* expected, perf_numbers* perf)
+{
+    BracketIndex brackets = {};
+    if (!lex_match_brackets(tokens->tokens, tokens->num_tokens, &brackets))
+        return false;
+
+    uint64_t num_functions = 0;
+    for (uint32_t i = 0; i < expected->root->program.size; ++i)
+        num_functions += expected->root->program.nodes[i]->type == AST_fdef;
+
+    ASTOut out = {};
+    Timer timer;
+    timer.start();
+    bool ok = ast_lazy(tokens->tokens, tokens->num_tokens, brackets.matches, &out) && ast_materialize_reachable(&out);
+    timer.end();
+    update_perf(&perf->ast_lazy, timer.milliseconds());
+
+    ok = ok && out.bodies_parsed + out.bodies_skipped == num_functions;
+    for (uint32_t i = 0; ok && i < out.root->program.size; ++i)
+    {
+        ASTNode* n = out.root->program.nodes[i];
+        if (n->type == AST_fdef)
+            ok = ast_materialize(&out, n);
+    }
+    ok = ok && out.bodies_skipped == 0 && out.tokens_visited == expected->tokens_visited
+        && ast_dumps_equal(expected->root, out.root);
+    ast_free(&out);
+    bracket_index_free(&brackets);
+    return ok;
+}
+
+// the deepest the parse went is all it needs: with that as the limit it gives the same tree, one frame less and it
+// fails with an error.
+static bool ast_respects_max_depth(const LexOutput* tokens, const ASTOut* expected)
+{
+    ast_set_max_depth(expected->deepest);
+    ASTOut out = {};
+    bool ok = ast(tokens->tokens, tokens->num_tokens, &out) && out.deepest == expected->deepest
+        && ast_dumps_equal(expected->root, out.root);
+    ast_free(&out);
+
+    if (ok && expected->deepest > 1)
+    {
+        ast_set_max_depth(expected->deepest - 1);
+        ok = !ast(tokens->tokens, tokens->num_tokens, &out) && out.failure && out.failure_reason;
+        ast_free(&out);
+    }
+    ast_set_max_depth(0);
+    return ok;
+}
+
+// run from an ast_lazy tree, what main can reach gets parsed first
+static bool interp_matches_lazy(const LexOutput* tokens, int64_t expected)
+{
+    BracketIndex brackets = {};
+    if (!lex_match_brackets(tokens->tokens, tokens->num_tokens, &brackets))
+        return false;
+
+    ASTOut out = {};
+    int64_t result = 0;
+    bool ok = ast_lazy(tokens->tokens, tokens->num_tokens, brackets.matches, &out) && interp_return_value(&out, &result)
+        && result == expected;
+    ast_free(&out);
+    bracket_index_free(&brackets);
+    return ok;
+}
+
+// lex into a TokenBuffer (see lex.h), check it holds the same tokens and bracket matches as the comment-stripped
+// lex() array and that parsing from it gives the same tree.
+static bool ast_matches_token_buffer(const LexInput* in, const LexOutput* stripped, const ASTNode* expected, perf_numbers* perf)
+{
+    TokenBuffer buffer = {};
+    BracketIndex brackets = {};
+    bool same = lex(in, &buffer, true) && buffer.count == stripped->num_tokens
+        && lex_match_brackets(stripped->tokens, stripped->num_tokens, &brackets);
+    for (uint64_t i = 0; same && i < buffer.count; ++i)
+        same = token_equal(stripped->tokens[i], token_buffer_get(&buffer, i)) && buffer.matches[i] == brackets.matches[i];
+    bracket_index_free(&brackets);
+
+    if (same)
+    {
+        ASTOut out = {};
+        Timer timer;
+        timer.start();
+        same = ast(&buffer, &out);
+        timer.end();
+        update_perf(&perf->ast_buffer, timer.milliseconds());
+        same = same && ast_dumps_equal(expected, out.root);
+        ast_free(&out);
+    }
+
+    token_buffer_free(&buffer);
+    return same;
+}
+
+// flatten the tree (see ast_flat.h), check every index maps back to the node it came from with the same decl, and
+// that inflating it again dumps the same.
+static bool flat_matches_tree(const ASTNode* root, perf_numbers* perf)
+{
+    FlatAST flat = {};
+    Timer timer;
+    timer.start();
+    bool ok = ast_flatten(root, &flat);
+    timer.end();
+    update_perf(&perf->ast_flat, timer.milliseconds());
+
+    ok = ok && flat.num_nodes > 0 && flat_next(&flat, 0) == flat.num_nodes;
+    uint32_t fdecl_end = 0; // only a function declaration's params are left unresolved by the parser
+    for (uint32_t i = 0; ok && i < flat.num_nodes; ++i)
+    {
+        const ASTNode* n = flat_origin(&flat, i);
+        if (!n)
+        {
+            ok = flat_type(&flat, i) == AST_UNKNOWN && !flat_has_children(&flat, i);
+            continue;
+        }
+        ok = flat_type(&flat, i) == n->type;
+        if (ok && n->type == AST_fdecl)
+            fdecl_end = flat_next(&flat, i);
+        if (ok && n->type == AST_var)
+        {
+            const uint32_t decl = flat_name(&flat, i)->decl;
+            ok = (decl == FLAT_NONE ? NULL : flat_origin(&flat, decl)) == n->var.var_decl
+                && flat_name(&flat, i)->slot == n->var.slot
+                && (decl != FLAT_NONE || i < fdecl_end);
+        }
+    }
+
+    ASTArena arena = {};
+    ok = ok && ast_dumps_equal(root, ast_inflate(&flat, &arena));
+    ast_arena_free(&arena);
+    flat_free(&flat);
+    return ok;
+}
+
+// apply an edit to a copy of the source, update tokens + AST with lex_incremental/ast_incremental and check
+// they match lexing and parsing the edited source from scratch.
+static bool incremental_matches_full(const LexInput* in, uint64_t start, uint64_t end, const char* replacement, perf_numbers* perf)
+{
+    std::string text(in->stream, size_t(in->length));
+    text.replace(size_t(start), size_t(end - start), replacement);
+    LexInput edited = init_lex(in->filename, text.data(), text.size());
+
+    LexOutput raw = {};
+    LexOutput inc = {};
+    ASTOut inc_ast = {};
+    if (!lex(in, &raw))
+        return false;
+    lex_strip_comments(&raw, &inc);
+    free(raw.tokens);
+    if (!ast(inc.tokens, inc.num_tokens, &inc_ast))
+        return false;
+
+    SourceEdit edit = { start, end, strlen(replacement) };
+    TokenEdit changed = {};
+    Timer timer;
+    timer.start();
+    bool ok = lex_incremental(&edited, in->stream, &edit, true, &inc, &changed)
+        && ast_incremental(inc.tokens, inc.num_tokens, &changed, &inc_ast);
+    timer.end();
+    update_perf(&perf->incremental, timer.milliseconds());
+
+    LexOutput full = {};
+    ASTOut full_ast = {};
+    raw = LexOutput();
+    ok = ok && lex(&edited, &raw);
+    lex_strip_comments(&raw, &full);
+    ok = ok && ast(full.tokens, full.num_tokens, &full_ast);
+
+    ok = ok && inc.num_tokens == full.num_tokens;
+    for (uint64_t i = 0; ok && i < full.num_tokens; ++i)
+        ok = token_equal(inc.tokens[i], full.tokens[i]);
+    ok = ok && ast_dumps_equal(full_ast.root, inc_ast.root) && ast_locations_equal(full_ast.root, inc_ast.root);
+
+    free(raw.tokens);
+    free(full.tokens);
+    free(inc.tokens);
+    ast_free(&full_ast);
+    ast_free(&inc_ast);
+    return ok;
+}
+
+// two edits per file: a comment pushed in front of the middle token (same program), and the last number changed.
+static bool incremental_matches_full(const LexInput* in, const LexOutput* stripped, perf_numbers* perf)
+{
+    if (stripped->num_tokens == 0)
+        return true;
+
+    const uint64_t middle = uint64_t(stripped->tokens[stripped->num_tokens / 2].location.start - in->stream);
+    if (!incremental_matches_full(in, middle, middle, "/**/ ", perf))
+        return false;
+
+    for (uint64_t i = stripped->num_tokens; i-- > 0;)
+    {
+        const Token& t = stripped->tokens[i];
+        if (t.type != eToken::constant_number)
+            continue;
+        return incremental_matches_full(in, uint64_t(t.location.start - in->stream), uint64_t(t.location.end - in->stream), "12345", perf);
+    }
+    return true;
+}
+
 static void Test(test_config cfg, perf_numbers* perf, const char* path)
 {
     DirectoryIter* dir = NULL;
@@ -235,8 +804,12 @@ static void Test(test_config cfg, perf_numbers* perf, const char* path)
     int test_fail = 0;
     bool success = true;
 
+    // the previous test's source is closed at the top of each iteration (and after the loop) because the
+    // many early-outs below all `continue` and tokens point into it until then.
+    SourceBuffer source = {};
     do
     {
+        file_close_source(&source);
         struct test_iter test = {};
 
         if (disdir(dir))
@@ -250,8 +823,7 @@ static void Test(test_config cfg, perf_numbers* perf, const char* path)
         ///// READ FILE
         Timer timer;
         timer.start();
-        test.file_data = file_read_into_memory(test.file_path, &test.file_length);
-        if (!test.file_data)
+        if (!file_open_source(test.file_path, &source))
         {
             printf("failed to read file %s\n", test.file_path);
             success = false;
@@ -260,6 +832,8 @@ static void Test(test_config cfg, perf_numbers* perf, const char* path)
         }
         timer.end();
         update_perf(&perf->read_file, timer.milliseconds());
+        test.file_data = source.data;
+        test.file_length = source.size;
 
         ///// LEX
         test.lex_in = init_lex(test.file_path, test.file_data, test.file_length);
@@ -280,25 +854,107 @@ static void Test(test_config cfg, perf_numbers* perf, const char* path)
         }
         else
         {
+            // a hit skips lexing (and the lexer consistency checks) entirely, comments are already gone
             LexOutput lexout_temp = {};
             timer.start();
-            if (!lex(&test.lex_in, &lexout_temp))
+            const bool cached = token_cache_load(&test.lex_in, &lexout_temp);
+            timer.end();
+            update_perf(&perf->lex_cache, timer.milliseconds());
+            if (!cached)
+            {
+                timer.start();
+                if (!lex(&test.lex_in, &lexout_temp))
+                {
+                    debug_break();
+                    success = false;
+                    ++test_fail;
+                    print_failure_location(test, lexout_temp.failure_location);
+                    printf("failed to lex: %s\nComparing to Clang error:\n", lexout_temp.failure_reason);
+                    char buff[256];
+                    sprintf_s(buff, "clang %s", test.file_path);
+                    system(buff);
+                    continue;
+                }
+                timer.end();
+                update_perf(&perf->lex, timer.milliseconds());
+                if (!lex_matches_all_scan_levels(&test.lex_in, &lexout_temp))
+                {
+                    debug_break();
+                    success = false;
+                    ++test_fail;
+                    printf("scan levels produced different tokens for %s\n", test.file_path);
+                    continue;
+                }
+                if (!lex_parallel_matches(&test.lex_in, &lexout_temp))
+                {
+                    debug_break();
+                    success = false;
+                    ++test_fail;
+                    printf("parallel lex produced different tokens for %s\n", test.file_path);
+                    continue;
+                }
+                if (!splice_matches_lex(&test.lex_in, &lexout_temp))
+                {
+                    debug_break();
+                    success = false;
+                    ++test_fail;
+                    printf("lexing spliced source produced different tokens for %s\n", test.file_path);
+                    continue;
+                }
+
+                timer.start();
+                token_cache_store(&test.lex_in, &lexout_temp);
+                timer.end();
+                update_perf(&perf->lex_cache, timer.milliseconds());
+            }
+
+            if (!lines_match_naive(&test.lex_in, &lexout_temp))
             {
                 debug_break();
                 success = false;
                 ++test_fail;
-                printf("failed to lex file %s\nComparing to Clang error:\n", test.file_path);
-                char buff[256];
-                sprintf_s(buff, "clang %s", test.file_path);
-                system(buff);
+                printf("line index disagrees with counting lines for %s\n", test.file_path);
                 continue;
             }
-            timer.end();
-            update_perf(&perf->lex, timer.milliseconds());
+
+            for (uint64_t i = 0; i < lexout_temp.num_tokens && !test.has_directives; ++i)
+                test.has_directives = lexout_temp.tokens[i].type == eToken::directive;
+            if (test.has_directives)
+            {
+                Preprocessor pp;
+                preprocess_init(&pp);
+                LexOutput expanded = {};
+                timer.start();
+                bool ok = preprocess(&pp, &test.lex_in, &lexout_temp, &expanded);
+                timer.end();
+                preprocess_free(&pp);
+                update_perf(&perf->preprocess, timer.milliseconds());
+                free(lexout_temp.tokens);
+                lexout_temp = expanded;
+                if (!ok)
+                {
+                    debug_break();
+                    success = false;
+                    ++test_fail;
+                    print_failure_location(test, pp.failure_location);
+                    printf("failed to preprocess: %s\n", pp.failure_reason);
+                    continue;
+                }
+            }
+
             timer.start();
             lex_strip_comments(&lexout_temp, &test.lex_out);
             timer.end();
             update_perf(&perf->lex_strip, timer.milliseconds());
+
+            if (!brackets_match_naive(&test.lex_out))
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("bracket matches disagree with counting depth for %s\n", test.file_path);
+                continue;
+            }
         }
 
         ////// IR
@@ -322,7 +978,8 @@ static void Test(test_config cfg, perf_numbers* perf, const char* path)
             timer.start();
             if (!ast(test.lex_out.tokens, test.lex_out.num_tokens, &test.ast))
             {
-                printf("failed to ast file %s\n", test.file_path);
+                print_failure_location(test, test.ast.failure_location);
+                printf("failed to ast: %s\n", test.ast.failure_reason ? test.ast.failure_reason : "no tokens");
                 success = false;
                 ++test_fail;
 
@@ -336,6 +993,76 @@ static void Test(test_config cfg, perf_numbers* perf, const char* path)
             }
             timer.end();
             update_perf(&perf->ast, timer.milliseconds());
+            perf->tokens_parsed += test.lex_out.num_tokens;
+            perf->tokens_visited += test.ast.tokens_visited;
+
+            if (test.ast.tokens_visited != test.lex_out.num_tokens)
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("parser backtracked on %s: visited %" PRIu64 " tokens for %" PRIu64 "\n",
+                    test.file_path, test.ast.tokens_visited, test.lex_out.num_tokens);
+                continue;
+            }
+
+            if (!ast_matches_streaming(&test.lex_in, test.ast.root, perf))
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("streaming parse of %s doesn't match\n", test.file_path);
+                continue;
+            }
+            if (!ast_matches_parallel(&test.lex_out, &test.ast, perf))
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("parallel parse of %s doesn't match\n", test.file_path);
+                continue;
+            }
+            if (!ast_matches_lazy(&test.lex_out, &test.ast, perf))
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("lazy parse of %s doesn't match\n", test.file_path);
+                continue;
+            }
+            if (!ast_respects_max_depth(&test.lex_out, &test.ast))
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("parse of %s doesn't stop at the depth limit\n", test.file_path);
+                continue;
+            }
+            // both of these work on offsets into / edits of the one source file
+            if (!test.has_directives && !ast_matches_token_buffer(&test.lex_in, &test.lex_out, test.ast.root, perf))
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("token buffer parse of %s doesn't match\n", test.file_path);
+                continue;
+            }
+            if (!test.has_directives && !incremental_matches_full(&test.lex_in, &test.lex_out, perf))
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("incremental update of %s doesn't match a full re-parse\n", test.file_path);
+                continue;
+            }
+            if (!flat_matches_tree(test.ast.root, perf))
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("flat AST of %s doesn't match the tree\n", test.file_path);
+                continue;
+            }
         }
 
         // Calc Ground Truth
@@ -485,12 +1212,22 @@ static void Test(test_config cfg, perf_numbers* perf, const char* path)
                 dump(temp_cfg, test);
                 debug_break();
             }
+
+            if (!interp_matches_lazy(&test.lex_out, test.interp_result))
+            {
+                debug_break();
+                success = false;
+                ++test_fail;
+                printf("Interp of the lazy parse of [%s] doesn't match.\n", test.file_path);
+            }
         }
 
         dump(cfg, test);
+        ast_free(&test.ast);
 
     } while (dnext(dir));
     dclose(&dir);
+    file_close_source(&source);
 
     // print results
     bool prior = false;
@@ -530,7 +1267,7 @@ static void test_simplify(const LexInput& lexin)
     if (!lex(&lexin, &lexout))
         return;
 
-    ASTOut ast_out;
+    ASTOut ast_out = {};
     if (!ast(lexout.tokens, lexout.num_tokens, &ast_out))
         return;
 
@@ -542,7 +1279,7 @@ static void test_simplify(const LexInput& lexin)
     while (true)
     {
         int prev_reductions = reductions;
-        simple = simplify(simple, &reductions);
+        simple = simplify(&ast_out.arena, simple, &reductions);
         assert(simple);
 
         if (prev_reductions == reductions)
@@ -634,7 +1371,7 @@ void interpreter_practice()
         printf("]==========\n");
     }
 
-    ASTOut ast_out;
+    ASTOut ast_out = {};
     if (!ast(lexout.tokens, lexout.num_tokens, &ast_out))
     {
         printf("AST FAILED!\n");
@@ -924,8 +1661,18 @@ int run_tests_on_folder(int folder_index, bool verbose)
         cleanup_artifacts(&perf.cleanup, "../stage_13_comments_and_backslash/");
         if (folder_index != 0) break; // quit if 0 or fall-through if not
     case 14:
-        //Test(TEST_LEX, &perf, "../stage_14_include/");
-        //cleanup_artifacts(&perf.cleanup, "../stage_14_include+/");
+        Test(TEST_LEX, &perf, "../stage_14_include/");
+        Test(TEST_INTERP, &perf, "../stage_14_include/");
+        Test(TEST_GEN, &perf, "../stage_14_include/");
+        cleanup_artifacts(&perf.cleanup, "../stage_14_include/");
+        if (folder_index != 0) break; // quit if 0 or fall-through if not
+    case 15:
+        Test(TEST_LEX, &perf, "../stage_15_conditionals/");
+        Test(TEST_INTERP, &perf, "../stage_15_conditionals/");
+        Test(TEST_GEN, &perf, "../stage_15_conditionals/");
+        cleanup_artifacts(&perf.cleanup, "../stage_15_conditionals/");
+        test_stream_error_past_window();
+        test_parallel_global_slots();
         break; // quit, hit our last test.
     default:
         printf("Invalid Test #. Quitting.\n");
@@ -952,8 +1699,16 @@ int run_tests_on_folder(int folder_index, bool verbose)
     tracked_total += print_perf(&perf.invalid_lex,      "  invalid_lex:    ", "\n");
     tracked_total += print_perf(&perf.lex,              "  lex:            ", "\n");
     tracked_total += print_perf(&perf.lex_strip,        "  lex_strip:      ", "\n");
+    tracked_total += print_perf(&perf.lex_cache,        "  lex_cache:      ", "\n");
+    tracked_total += print_perf(&perf.preprocess,       "  preprocess:     ", "\n");
     tracked_total += print_perf(&perf.ir,               "  ir:             ", "\n");
     tracked_total += print_perf(&perf.ast,              "  ast:            ", "\n");
+    tracked_total += print_perf(&perf.ast_stream,       "  ast_stream:     ", "\n");
+    tracked_total += print_perf(&perf.ast_buffer,       "  ast_buffer:     ", "\n");
+    tracked_total += print_perf(&perf.ast_parallel,     "  ast_parallel:   ", "\n");
+    tracked_total += print_perf(&perf.ast_lazy,         "  ast_lazy:       ", "\n");
+    tracked_total += print_perf(&perf.incremental,      "  incremental:    ", "\n");
+    tracked_total += print_perf(&perf.ast_flat,         "  ast_flat:       ", "\n");
     tracked_total += print_perf(&perf.gen_asm,          "  gen_asm:        ", "\n");
     tracked_total += print_perf(&perf.gen_asm_from_ir,  "  gen_asm_from_ir:", "\n");
     tracked_total += print_perf(&perf.gen_exe,          "  gen_exe:        ", "\n");
@@ -961,6 +1716,14 @@ int run_tests_on_folder(int folder_index, bool verbose)
     tracked_total += print_perf(&perf.ground_truth,     "  grnd_truth:     ", "\n");
     tracked_total += print_perf(&perf.interp,           "  interp:         ", "\n");
     tracked_total += print_perf(&perf.cleanup,          "  cleanup:        ", "\n");
+    printf(                                             " parser: %" PRIu64 " tokens visited for %" PRIu64 " parsed (%.2f per token)\n",
+        perf.tokens_visited, perf.tokens_parsed, perf.tokens_parsed ? double(perf.tokens_visited) / perf.tokens_parsed : 0.0);
+    const TokenCacheStats token_cache = token_cache_stats();
+    printf(                                             " token cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " stores, %.1fKB loaded\n",
+        token_cache.hits, token_cache.misses, token_cache.stores, token_cache.bytes_loaded / 1024.0);
+    const IncludeCacheStats includes = include_cache_stats();
+    printf(                                             " include cache: %" PRIu64 " lookups, %" PRIu64 " hits (%" PRIu64 " skipped by guard/once), %" PRIu64 " files\n",
+        includes.lookups, includes.hits, includes.skips, includes.files);
     printf(                                             " test cache misses: %" PRIu32 ", load: %.2fms, save: %.2fms\n", 
         get_test_cache_misses(), 
         perf.test_cache_load, 
@@ -1,5 +1,6 @@
 #include "timer.h"
 #include "windows.h"
+#include "psapi.h"
 
 void Timer::start()
 {
@@ -21,3 +22,13 @@ float Timer::milliseconds() const
     float ms = (_end - _start) * 1000.f / freq.QuadPart;
     return ms;
 }
+
+
+void process_memory(uint64_t* o_current, uint64_t* o_peak)
+{
+    PROCESS_MEMORY_COUNTERS counters = {};
+    counters.cb = sizeof(counters);
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    *o_current = counters.WorkingSetSize;
+    *o_peak = counters.PeakWorkingSetSize;
+}
\ No newline at end of file
@@ -9,4 +9,7 @@ struct Timer
     void start();
     void end();
     float milliseconds() const;
-};
\ No newline at end of file
+};
+
+// working set of the process right now and the most it has ever been, in bytes. For benchmarks.
+void process_memory(uint64_t* o_current, uint64_t* o_peak);
\ No newline at end of file
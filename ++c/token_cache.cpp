@@ -0,0 +1,366 @@
+#include "token_cache.h"
+#include "file.h"
+#include "strings.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint32_t TOKEN_CACHE_MAGIC = 0x31434F54; // "TOC1", bump the digit if the encoding below changes
+
+struct token_cache_header
+{
+    uint32_t magic;
+    uint32_t lex_version; // LEX_FORMAT_VERSION of the lexer that wrote it
+    uint64_t source_hash;
+    uint64_t source_length;
+    uint64_t num_tokens;
+    uint64_t num_identifiers;
+    uint64_t body_size; // bytes of varints following the header
+};
+
+static TokenCacheStats g_stats;
+
+TokenCacheStats token_cache_stats()
+{
+    return g_stats;
+}
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t token_cache_hash(const char* data, uint64_t length)
+{
+    // 8 bytes per multiply so hashing stays well ahead of lexing, finished with murmur3's fmix64
+    const uint64_t k1 = 0x87C37B91114253D5ull;
+    const uint64_t k2 = 0x4CF5AD432745937Full;
+    uint64_t h = length * 0x9E3779B97F4A7C15ull;
+    const char* const end8 = data + (length & ~uint64_t(7));
+    for (; data != end8; data += 8)
+    {
+        uint64_t v;
+        memcpy(&v, data, 8);
+        h = rotl64(h ^ (v * k1), 31) * k2;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data, size_t(length & 7));
+    h = rotl64(h ^ (tail * k1), 31) * k2;
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static void token_cache_path(uint64_t hash, char (*o_path)[64])
+{
+    sprintf_s(*o_path, "%s/%016" PRIx64 ".tok", TOKEN_CACHE_DIR, hash);
+}
+
+static bool has_identifier(eToken type)
+{
+    return type == eToken::identifier || (type >= eToken::keywords_first && type <= eToken::keywords_last);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ENCODE
+struct cache_writer
+{
+    uint8_t* data;
+    uint64_t size;
+    uint64_t capacity;
+};
+
+static uint8_t* writer_reserve(cache_writer* w, uint64_t bytes)
+{
+    if (w->size + bytes > w->capacity)
+    {
+        uint64_t capacity = w->capacity ? w->capacity : 4096;
+        while (capacity < w->size + bytes)
+            capacity *= 2;
+        w->data = (uint8_t*)realloc(w->data, size_t(capacity));
+        assert(w->data);
+        w->capacity = capacity;
+    }
+    return w->data + w->size;
+}
+
+static void put_byte(cache_writer* w, uint8_t b)
+{
+    *writer_reserve(w, 1) = b;
+    ++w->size;
+}
+
+static void put_varint(cache_writer* w, uint64_t v)
+{
+    uint8_t* out = writer_reserve(w, 10);
+    uint8_t* at = out;
+    while (v >= 0x80)
+    {
+        *at++ = uint8_t(v) | 0x80;
+        v >>= 7;
+    }
+    *at++ = uint8_t(v);
+    w->size += at - out;
+}
+
+// identifiers are interned, so the per-file table is keyed by pointer
+struct identifier_slot
+{
+    const char* nts;
+    uint32_t index;
+};
+
+bool token_cache_store(const LexInput* input, const LexOutput* tokens)
+{
+    uint64_t num_tokens = 0;
+    uint64_t num_named = 0;
+    for (uint64_t i = 0; i < tokens->num_tokens; ++i)
+    {
+        num_tokens += tokens->tokens[i].type != eToken::comment;
+        num_named += has_identifier(tokens->tokens[i].type);
+    }
+
+    uint64_t table_size = 16;
+    while (table_size < num_named * 2)
+        table_size *= 2;
+    identifier_slot* table = (identifier_slot*)calloc(size_t(table_size), sizeof(identifier_slot));
+    assert(table);
+
+    // identifier table first so the loader can intern it before decoding tokens
+    cache_writer names = {};
+    cache_writer body = {};
+    uint32_t num_identifiers = 0;
+    const char* prev_end = input->stream;
+    for (uint64_t i = 0; i < tokens->num_tokens; ++i)
+    {
+        const Token& t = tokens->tokens[i];
+        if (t.type == eToken::comment)
+            continue;
+
+        put_byte(&body, t.type);
+        put_varint(&body, uint64_t(t.location.start - prev_end));
+        put_varint(&body, uint64_t(t.location.end - t.location.start));
+        prev_end = t.location.end;
+
+        if (has_identifier(t.type))
+        {
+            uint64_t slot = ((uint64_t(uintptr_t(t.identifier.nts) >> 3) * 0x9E3779B97F4A7C15ull) >> 32) & (table_size - 1);
+            while (table[slot].nts && table[slot].nts != t.identifier.nts)
+                slot = (slot + 1) & (table_size - 1);
+            if (!table[slot].nts)
+            {
+                table[slot].nts = t.identifier.nts;
+                table[slot].index = num_identifiers++;
+                put_varint(&names, uint64_t(t.identifier.len));
+                memcpy(writer_reserve(&names, t.identifier.len), t.identifier.nts, t.identifier.len);
+                names.size += t.identifier.len;
+            }
+            put_varint(&body, table[slot].index);
+        }
+        else if (t.type == eToken::constant_number)
+        {
+            put_varint(&body, t.number);
+        }
+        else if (t.type == eToken::string)
+        {
+            put_varint(&body, uint64_t(t.str.start - t.location.start));
+            put_varint(&body, uint64_t(t.location.end - t.str.end));
+        }
+    }
+    free(table);
+
+    token_cache_header header = {};
+    header.magic = TOKEN_CACHE_MAGIC;
+    header.lex_version = LEX_FORMAT_VERSION;
+    header.source_hash = token_cache_hash(input->stream, input->length);
+    header.source_length = input->length;
+    header.num_tokens = num_tokens;
+    header.num_identifiers = num_identifiers;
+    header.body_size = names.size + body.size;
+
+    // written under a temporary name and renamed into place so a reader never sees half a file
+    char path[64];
+    char temp_path[72];
+    token_cache_path(header.source_hash, &path);
+    sprintf_s(temp_path, "%s.tmp", path);
+
+    bool ok = file_make_directory(TOKEN_CACHE_DIR);
+    FILE* file = NULL;
+    if (ok)
+        ok = 0 == fopen_s(&file, temp_path, "wb");
+    if (ok)
+    {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(names.data, 1, size_t(names.size), file) == names.size
+            && fwrite(body.data, 1, size_t(body.size), file) == body.size;
+        ok = 0 == fclose(file) && ok;
+        remove(path); // rename won't replace an existing file on Windows
+        ok = ok && 0 == rename(temp_path, path);
+        if (!ok)
+            remove(temp_path);
+    }
+    free(names.data);
+    free(body.data);
+
+    g_stats.stores += ok;
+    return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// DECODE
+struct cache_reader
+{
+    const uint8_t* at;
+    const uint8_t* end;
+    bool ok; // false once anything was out of bounds, every read after that returns 0
+};
+
+static uint8_t get_byte(cache_reader* r)
+{
+    if (r->at == r->end)
+    {
+        r->ok = false;
+        return 0;
+    }
+    return *r->at++;
+}
+
+static uint64_t get_varint(cache_reader* r)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        const uint8_t b = get_byte(r);
+        v |= uint64_t(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+    r->ok = false;
+    return 0;
+}
+
+static bool decode(const LexInput* input, const token_cache_header* header, cache_reader* r, LexOutput* output)
+{
+    // counts come from the file, check them against its size before allocating (an identifier is at least 2 bytes)
+    if (header->num_identifiers > uint64_t(r->end - r->at) / 2)
+        return false;
+    str* identifiers = (str*)malloc(size_t(header->num_identifiers ? header->num_identifiers : 1) * sizeof(str));
+    assert(identifiers);
+    for (uint64_t i = 0; i < header->num_identifiers && r->ok; ++i)
+    {
+        const uint64_t len = get_varint(r);
+        if (len == 0 || len > uint64_t(r->end - r->at))
+        {
+            r->ok = false;
+            break;
+        }
+        identifiers[i] = strings_insert((const char*)r->at, (const char*)r->at + len);
+        r->at += len;
+    }
+
+    // allocated up front in the same power of two alloc_token would have grown it to, so it can keep appending.
+    // Every token is at least 3 bytes.
+    if (header->num_tokens > uint64_t(r->end - r->at) / 3)
+        r->ok = false;
+    uint64_t capacity = 16;
+    while (capacity < header->num_tokens)
+        capacity *= 2;
+    output->tokens = r->ok ? (Token*)malloc(size_t(capacity) * sizeof(Token)) : NULL;
+    assert(output->tokens || !r->ok);
+
+    const char* const source_end = input->stream + input->length;
+    const char* prev_end = input->stream;
+    for (uint64_t i = 0; i < header->num_tokens && r->ok; ++i)
+    {
+        Token* t = &output->tokens[output->num_tokens++];
+        t->type = eToken(get_byte(r));
+        const uint64_t gap = get_varint(r);
+        const uint64_t len = get_varint(r);
+        if (gap > uint64_t(source_end - prev_end) || len > uint64_t(source_end - prev_end) - gap)
+        {
+            r->ok = false;
+            break;
+        }
+        t->location.start = prev_end + gap;
+        t->location.end = t->location.start + len;
+        prev_end = t->location.end;
+
+        if (has_identifier(t->type))
+        {
+            const uint64_t index = get_varint(r);
+            r->ok = r->ok && index < header->num_identifiers;
+            t->identifier = r->ok ? identifiers[index] : str();
+        }
+        else if (t->type == eToken::constant_number)
+        {
+            t->number = get_varint(r);
+        }
+        else if (t->type == eToken::string)
+        {
+            const uint64_t skip_start = get_varint(r);
+            const uint64_t skip_end = get_varint(r);
+            r->ok = r->ok && skip_start + skip_end <= len;
+            t->str.start = t->location.start + skip_start;
+            t->str.end = t->location.end - skip_end;
+        }
+    }
+    free(identifiers);
+    return r->ok && r->at == r->end;
+}
+
+bool token_cache_load(const LexInput* input, LexOutput* output)
+{
+    assert(output->tokens == NULL); // caller must init to 0 LexOutput
+
+    char path[64];
+    const uint64_t hash = token_cache_hash(input->stream, input->length);
+    token_cache_path(hash, &path);
+
+    // file_open_source complains about missing files, a miss is normal here
+    FileIdentity identity;
+    SourceBuffer cache = {};
+    if (!file_identity(path, &identity) || !file_open_source(path, &cache))
+    {
+        ++g_stats.misses;
+        return false;
+    }
+
+    token_cache_header header;
+    bool ok = cache.size >= sizeof(header);
+    if (ok)
+    {
+        memcpy(&header, cache.data, sizeof(header));
+        ok = header.magic == TOKEN_CACHE_MAGIC
+            && header.lex_version == LEX_FORMAT_VERSION
+            && header.source_hash == hash
+            && header.source_length == input->length
+            && header.body_size == cache.size - sizeof(header);
+    }
+    if (ok)
+    {
+        cache_reader r = { (const uint8_t*)cache.data + sizeof(header), (const uint8_t*)cache.data + cache.size, true };
+        ok = decode(input, &header, &r, output);
+        if (!ok)
+        {
+            free(output->tokens);
+            *output = LexOutput();
+        }
+    }
+
+    if (ok)
+    {
+        ++g_stats.hits;
+        g_stats.bytes_loaded += cache.size;
+    }
+    else
+    {
+        ++g_stats.misses;
+    }
+    file_close_source(&cache);
+    return ok;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "lex.h"
+
+// Persistent cache of lex() output so unchanged sources aren't lexed again on the next run.
+//
+// One file per source under TOKEN_CACHE_DIR, named after a 64-bit hash of the source bytes (so it doesn't
+// matter where the source lives or what it's called). The tokens stored are lex() minus comments, directives
+// left unexpanded, so the cache can be filled from either lex() or a recording LexStream. Each token is a
+// type byte plus varints: gap from the previous token's end, length, then its payload (index into a per-file
+// identifier table, number, or string bounds relative to the token). Locations are stored as offsets so a
+// cached file can be loaded against any copy of the same source bytes.
+//
+// A hit maps the cache file, checks its header (format, LEX_FORMAT_VERSION, source hash and length) and
+// decodes into a LexOutput whose tokens point into the caller's source. Anything that doesn't check out is a
+// miss and gets overwritten by the next store, which is how a lexer version bump invalidates old entries.
+
+static const char* const TOKEN_CACHE_DIR = "tokens.cache";
+
+uint64_t token_cache_hash(const char* data, uint64_t length);
+bool token_cache_load(const LexInput* input, LexOutput* output); // output must be zero-initialized
+bool token_cache_store(const LexInput* input, const LexOutput* tokens); // tokens from lex(input), comments are dropped
+
+struct TokenCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t bytes_loaded; // size of the cache files hit
+};
+
+TokenCacheStats token_cache_stats();
@@ -28,6 +28,8 @@
 #include <dir.h>
 #include <file.h>
 #include <debug.h>
+#include <splice.h>
+#include <timer.h>
 #include <vector>
 #include <string>
 #include <cstdio>
@@ -126,6 +128,9 @@ bool load_and_compact_files(const std::vector<std::string>& file_paths, std::vec
     std::vector<std::string> file_contents;
     size_t temp_buffer_size = 0;
     char* temp_buffer = nullptr;
+    double splice_ms = 0.0;
+    uint64_t splice_bytes = 0;
+    uint64_t splice_count = 0;
 
     for (size_t i = 0; i < file_paths.size(); ++i) {
 
@@ -163,46 +168,15 @@ shall end in a new-line character, which shall not be immediately preceded by a
 backslash character before any such splicing takes place. */
 
 // --> Important for #define. Can also impact comments. Low probability in src.
-        {
-            size_t buff_left = file_size - 2;
-            char* reader = (char*)memchr(temp_buffer, '\\', buff_left);
-            char* writer = reader;
-            while (reader && buff_left > 2) {
-                if (reader[1] == '\n') {
-                    reader += 1; // normally +2, but below memchr(reader+1,...)
-                    buff_left -= 2;
-                }
-                else if (reader[1] == '\r' && reader[2] == '\n') {
-                    reader += 2; // normally +3, but below memchr(reader+1,...)
-                    buff_left -= 3;
-                }
-
-                if (writer == reader) {
-                    reader = (char*)memchr(reader + 1, '\\', buff_left);
-                    buff_left = reader ? (reader - writer) : 0;
-                    writer = reader;
-                    continue;
-                }
-
-                char* pivot = reader;
-                reader = (char*)memchr(reader + 1, '\\', buff_left);
-                char* pivot_end = reader ? reader : temp_buffer + file_size;
-                size_t mm_total = (pivot_end - pivot);
-                memmove(writer, pivot, mm_total);
-                buff_left -= mm_total;
-                writer = pivot_end;
-            }
-            if (!reader) {
-                assert(writer[buff_left]);
-            }
-            assert(reader + 2 == temp_buffer + file_size);
-            assert(buff_left <= 2);
-            for (size_t i = 0; i < buff_left + 2; ++i) {
-                assert(writer[i] != '\\' && "TODO Handle edge case");
-            }
-            writer += 2;
-            file_size = (writer - temp_buffer);
-        }
+        // Shared with the lexer (see splice.h). The remap table isn't kept, nothing here reports locations yet.
+        SplicedSource spliced;
+        Timer splice_timer;
+        splice_timer.start();
+        splice_source(temp_buffer, file_size, &spliced);
+        splice_timer.end();
+        splice_ms += splice_timer.milliseconds();
+        splice_bytes += file_size;
+        splice_count += spliced.num_marks;
 
 /*
 3. The source file is decomposed into preprocessing tokens (White-space 
@@ -243,10 +217,15 @@ in its execution environment.
 */
 
         // And done!
-        file_contents.push_back(std::string(temp_buffer, file_size));
+        file_contents.push_back(std::string(spliced.data, size_t(spliced.length)));
+        splice_free(&spliced);
     }
 
     free(temp_buffer);
+
+    const double mb = splice_bytes / (1024.0 * 1024.0);
+    printf("spliced %zu files, %.2fMB, %" PRIu64 " splices in %.2fms (%.2fMB/s)\n",
+        file_paths.size(), mb, splice_count, splice_ms, splice_ms > 0.0 ? mb / (splice_ms / 1000.0) : 0.0);
     
     *o_file_contents = std::move(file_contents);
     return true;
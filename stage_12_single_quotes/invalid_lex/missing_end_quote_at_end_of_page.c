@@ -0,0 +1,46 @@
+int main()
+{
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    // the file is exactly one page long so the byte after the unterminated quote isn't mapped
+    //.........................................................................
+    return 'a
\ No newline at end of file
@@ -0,0 +1,17 @@
+#include "define.h"
+#include "define.h"
+
+#define SELF SELF
+#define THREE ADD(ONE, TWO)
+#define CALL(f, x) f(x)
+#define EMPTY
+#define SIX() TWICE(THREE)
+
+int main()
+{
+    int SELF = THREE;
+    int result = CALL(TWICE, SELF) EMPTY + SIX();
+#undef ONE
+    int ONE = 10;
+    return result + ADD(ONE, TWO);
+}
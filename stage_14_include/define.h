@@ -0,0 +1,9 @@
+#ifndef DEFINE_H
+#define DEFINE_H
+
+#define ONE 1
+#define TWO (ONE + ONE)
+#define ADD(a, b) ((a) + (b))
+#define TWICE(x) ADD(x, x)
+
+#endif
@@ -0,0 +1,7 @@
+#include "guard_then_ifdef.h"
+#include "guard_then_ifdef.h"
+
+int main()
+{
+    return BASE + EXTRA;
+}
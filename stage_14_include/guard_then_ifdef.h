@@ -0,0 +1,10 @@
+#ifndef GUARD_THEN_IFDEF_H
+#define GUARD_THEN_IFDEF_H
+
+#define BASE 3
+
+#endif
+
+#ifdef BASE
+#define EXTRA 4
+#endif
@@ -0,0 +1,7 @@
+#include "guard_with_else.h"
+#include "guard_with_else.h"
+
+int main()
+{
+    return FIRST + SECOND;
+}
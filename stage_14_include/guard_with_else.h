@@ -0,0 +1,10 @@
+#ifndef GUARD_WITH_ELSE_H
+#define GUARD_WITH_ELSE_H
+
+#define FIRST 2
+
+#else
+
+#define SECOND 5
+
+#endif
@@ -1,3 +1,3 @@
 int main(){
-    #include "6_include.txt"
+    #include "include.txt"
     }
\ No newline at end of file
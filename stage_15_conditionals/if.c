@@ -0,0 +1,30 @@
+#define VERSION 3
+#define SQUARE(x) ((x) * (x))
+
+int main()
+{
+#if VERSION >= 3 && SQUARE(VERSION) == 9
+    int a = 1;
+#else
+    int a = 100;
+#endif
+
+#if VERSION == 1
+    int b = 100;
+#elif VERSION == 2 || (VERSION < 2)
+    int b = 200;
+#elif (1 << VERSION) == 8 && 10 % VERSION == 1
+    int b = 2;
+#else
+    int b = 300;
+#endif
+
+#if UNDEFINED_NAME || 0 && 1 / 0
+    a = 1000;
+#endif
+
+#if -1 < 0 ? !0 : 1 / 0
+    b = b + 4;
+#endif
+    return a + b;
+}
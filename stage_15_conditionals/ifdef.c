@@ -0,0 +1,25 @@
+#define HAS_FEATURE
+
+int main()
+{
+    int result = 0;
+#ifdef HAS_FEATURE
+    result = result + 1;
+#  ifndef HAS_OTHER_FEATURE
+    result = result + 2;
+#    if defined(HAS_FEATURE) && !defined HAS_OTHER_FEATURE
+    result = result + 4;
+#    endif
+#  else
+    result = result + 100;
+#  endif
+#endif
+
+#undef HAS_FEATURE
+#ifdef HAS_FEATURE
+    result = result + 200;
+#elif 1
+    result = result + 8;
+#endif
+    return result;
+}
@@ -0,0 +1,19 @@
+int main()
+{
+    int result = 7;
+#if 0
+    this group is skipped, so it does not have to be C ;; {
+    #if nested groups are tracked
+    #error would fire if it was not skipped
+    #endif
+    /* a comment can hide a directive
+#endif
+    */
+    "a string can't start one /*"
+#elif 0
+    neither is this one
+#else
+    result = result * 6;
+#endif
+    return result;
+}
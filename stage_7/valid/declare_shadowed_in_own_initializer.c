@@ -0,0 +1,9 @@
+int main() {
+    int a = 5;
+    int b = 0;
+    {
+        int a = (a = 3) + 1;
+        b = a;
+    }
+    return a * 10 + b;
+}